@@ -0,0 +1,116 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+void arena_init(arena_t *a) {
+    a->head = NULL;
+    a->ptr = NULL;
+    a->end = NULL;
+    a->reserved = 0;
+}
+
+// Starting a new chunk big enough for size bytes at any alignment up to align
+static int arena_grow(arena_t *a, size_t size, size_t align) {
+    size_t need = size + align;
+    size_t usable = need > ARENA_CHUNK_SIZE ? need : ARENA_CHUNK_SIZE;
+    arena_chunk_t *c = malloc(sizeof(arena_chunk_t) + usable);
+    if (!c) return -2;
+    c->next = a->head;
+    c->size = usable;
+    a->head = c;
+    a->ptr = (char *)(c + 1);
+    a->end = a->ptr + usable;
+    a->reserved += sizeof(arena_chunk_t) + usable;
+    return 0;
+}
+
+void *arena_alloc(arena_t *a, size_t size, size_t align) {
+    uintptr_t p = ((uintptr_t)a->ptr + (align - 1)) & ~(uintptr_t)(align - 1);
+    if (!a->ptr || p + size > (uintptr_t)a->end) {
+        if (arena_grow(a, size, align) != 0) return NULL;
+        p = ((uintptr_t)a->ptr + (align - 1)) & ~(uintptr_t)(align - 1);
+    }
+    a->ptr = (char *)(p + size);
+    return (void *)p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+    size_t n = strlen(s) + 1;
+    char *p = arena_alloc(a, n, 1);
+    if (p) memcpy(p, s, n);
+    return p;
+}
+
+void arena_free(arena_t *a) {
+    arena_chunk_t *c = a->head;
+    while (c) {
+        arena_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+    arena_init(a);
+}
+
+#define STRTAB_INITIAL_CAP 64
+
+// FNV-1a, the same hash the DAG's ID index uses
+static size_t hash_str(const char *s) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+int strtab_init(strtab_t *t) {
+    t->slots = calloc(STRTAB_INITIAL_CAP, sizeof(char *));
+    if (!t->slots) return -2;
+    t->cap = STRTAB_INITIAL_CAP;
+    t->count = 0;
+    return 0;
+}
+
+// Doubling the table once it is half full
+static int strtab_grow(strtab_t *t) {
+    size_t cap = t->cap * 2;
+    char **slots = calloc(cap, sizeof(char *));
+    if (!slots) return -2;
+    for (size_t i = 0; i < t->cap; ++i) {
+        if (!t->slots[i]) continue;
+        size_t b = hash_str(t->slots[i]) & (cap - 1);
+        while (slots[b]) b = (b + 1) & (cap - 1);
+        slots[b] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->cap = cap;
+    return 0;
+}
+
+char *strtab_intern(strtab_t *t, arena_t *a, const char *s) {
+    size_t mask = t->cap - 1;
+    size_t b = hash_str(s) & mask;
+    for (; t->slots[b]; b = (b + 1) & mask) {
+        if (strcmp(t->slots[b], s) == 0) return t->slots[b];
+    }
+    if ((t->count + 1) * 2 > t->cap) {
+        if (strtab_grow(t) != 0) return NULL;
+        mask = t->cap - 1;
+        b = hash_str(s) & mask;
+        while (t->slots[b]) b = (b + 1) & mask;
+    }
+    char *copy = arena_strdup(a, s);
+    if (!copy) return NULL;
+    t->slots[b] = copy;
+    t->count++;
+    return copy;
+}
+
+void strtab_free(strtab_t *t) {
+    free(t->slots);
+    t->slots = NULL;
+    t->cap = 0;
+    t->count = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator: memory comes out of large chunks and is only ever released all at once
+// Allocations larger than a chunk get a chunk of their own
+
+#define ARENA_CHUNK_SIZE (1u << 20)
+
+typedef struct arena_chunk {
+    struct arena_chunk *next; // chunk allocated before this one
+    size_t              size; // usable bytes after the header
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *head; // chunk currently being carved up
+    char          *ptr; // next free byte in head
+    char          *end; // one past the last usable byte in head
+    size_t         reserved; // bytes obtained from malloc, headers included
+} arena_t;
+
+// Interning table: every distinct string is stored once in an arena
+typedef struct {
+    char   **slots; // open-addressing table of interned strings (NULL = empty)
+    size_t   cap; // number of slots, always a power of two
+    size_t   count;
+} strtab_t;
+
+// Sets up an empty arena; nothing is allocated until the first arena_alloc
+void arena_init(arena_t *a);
+
+// Returns size bytes aligned to align (a power of two), or NULL on memory allocation failure
+void *arena_alloc(arena_t *a, size_t size, size_t align);
+
+// Copies a NUL-terminated string into the arena; returns NULL on memory allocation failure
+char *arena_strdup(arena_t *a, const char *s);
+
+// Frees every chunk; all pointers handed out by the arena become invalid
+void arena_free(arena_t *a);
+
+// Sets up an empty table; returns 0 on success or -2 on memory allocation failure
+int strtab_init(strtab_t *t);
+
+// Returns the single arena copy of s, storing it on first use, or NULL on memory allocation failure
+// The returned string is shared and must not be modified
+char *strtab_intern(strtab_t *t, arena_t *a, const char *s);
+
+// Frees the table itself; the strings live on in the arena they were stored in
+void strtab_free(strtab_t *t);
+
+#endif
@@ -0,0 +1,378 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include "dag_manager.h"
+#include "snapshot.h"
+#include "graph_loader.h"
+
+// Benchmarks for building DAGs through the dag_manager API
+// Usage: ./bench_dag_manager [n_tasks ...]   (default: 10000 100000 1000000)
+//
+// The first table times building a graph call by call and through the bulk API, the second
+// compares task storage: malloc + strdup per task against the DAG's arena with interned
+// commands, reporting heap bytes per task and the time to create the tasks and to free the DAG.
+// The third times a pass over every task's scheduling state: through the task_t pointers,
+// as status, time and freq used to be read, against the DAG's dense per-slot arrays.
+// The fourth saves a random-parent graph to a snapshot and times loading it back
+// (from the page cache) against rebuilding it through the bulk API.
+// The fifth gives every task four random parents and reports the heap bytes per edge held by
+// the dependency lists and by the CSR copy built next to them (which adds to, rather than
+// replaces, the lists), with the time of a Kahn pass over each, the CSR's including its build.
+// The last one writes the same graph as a definition file (one add_task or add_dep line each)
+// and reports load throughput in MB/s: read line by line and added call by call, the way the
+// shell does, against graph_load_file with 1, 2 and 4 parser threads, whose parse phase
+// (mapping, splitting and converting fields, before the bulk build) is also shown on its own
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *my_strdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *p = malloc(n);
+    if (p) memcpy(p, s, n);
+    return p;
+}
+
+static task_t *make_task(const char *id) {
+    task_t *t = calloc(1, sizeof(task_t));
+    if (!t) return NULL;
+    t->id     = my_strdup(id);
+    t->cmd    = my_strdup("true");
+    t->time   = 0;
+    t->freq   = 0;
+    return t;
+}
+
+// Small deterministic generator so every run builds the same graph
+static unsigned long long lcg_next(unsigned long long *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *state >> 33;
+}
+
+// Adds n tasks, then n-1 edges that give every task a random earlier parent,
+// once call by call and once through the bulk API
+static void bench_build(size_t n) {
+    char **names = malloc(n * sizeof(char *));
+    if (!names) { fprintf(stderr, "out of memory\n"); exit(1); }
+    char buf[32];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), "task_%zu", i);
+        names[i] = my_strdup(buf);
+    }
+
+    dag_t *d = dag_init();
+    if (!d) { fprintf(stderr, "dag_init failed\n"); exit(1); }
+
+    double t0 = now_sec();
+    for (size_t i = 0; i < n; ++i) {
+        task_t *t = make_task(names[i]);
+        if (!t || dag_add_task(d, t) != 0) { fprintf(stderr, "add_task failed\n"); exit(1); }
+    }
+    double t1 = now_sec();
+
+    unsigned long long rng = 42;
+    for (size_t i = 1; i < n; ++i) {
+        size_t parent = (size_t)(lcg_next(&rng) % i);
+        if (dag_add_dep(d, names[parent], names[i]) != 0) { fprintf(stderr, "add_dep failed\n"); exit(1); }
+    }
+    double t2 = now_sec();
+
+    dag_free(d);
+
+    // Same graph through the bulk path, validated once at commit
+    d = dag_init();
+    if (!d) { fprintf(stderr, "dag_init failed\n"); exit(1); }
+    double t3 = now_sec();
+    if (dag_bulk_begin(d) != 0) { fprintf(stderr, "bulk_begin failed\n"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        task_t *t = make_task(names[i]);
+        if (!t || dag_bulk_add_task(d, t) != 0) { fprintf(stderr, "bulk_add_task failed\n"); exit(1); }
+    }
+    rng = 42;
+    for (size_t i = 1; i < n; ++i) {
+        size_t parent = (size_t)(lcg_next(&rng) % i);
+        if (dag_bulk_add_dep(d, names[parent], names[i]) != 0) { fprintf(stderr, "bulk_add_dep failed\n"); exit(1); }
+    }
+    if (dag_bulk_commit(d) != 0) { fprintf(stderr, "bulk_commit failed\n"); exit(1); }
+    double t4 = now_sec();
+    dag_free(d);
+
+    double task_rate = (double)n / (t1 - t0);
+    double dep_rate  = n > 1 ? (double)(n - 1) / (t2 - t1) : 0.0;
+    printf("%-10zu %14.0f %14.0f %10.3f %10.3f\n", n, task_rate, dep_rate, t2 - t0, t4 - t3);
+
+    for (size_t i = 0; i < n; ++i) free(names[i]);
+    free(names);
+}
+
+// Heap bytes in use, counting large blocks malloc got straight from mmap
+static size_t heap_in_use(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+// Adds n tasks whose commands come from 16 templates, stored one way or the other
+static void bench_storage(size_t n, bool arena) {
+    char name[32], cmd[64];
+    size_t before = heap_in_use();
+    dag_t *d = dag_init();
+    if (!d) { fprintf(stderr, "dag_init failed\n"); exit(1); }
+
+    double t0 = now_sec();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "task_%zu", i);
+        snprintf(cmd, sizeof(cmd), "python3 etl.py --stage %zu", i % 16);
+        task_t *t;
+        if (arena) {
+            t = dag_new_task(d, name, cmd, 0, 0);
+        } else {
+            t = calloc(1, sizeof(task_t));
+            if (t) {
+                t->id = my_strdup(name);
+                t->cmd = my_strdup(cmd);
+            }
+        }
+        if (!t || dag_add_task(d, t) != 0) { fprintf(stderr, "add_task failed\n"); exit(1); }
+    }
+    double t1 = now_sec();
+    size_t after = heap_in_use();
+    dag_free(d);
+    double t2 = now_sec();
+
+    printf("%-10zu %-8s %14.1f %10.3f %10.3f\n", n, arena ? "arena" : "malloc",
+           (double)(after - before) / (double)n, t1 - t0, t2 - t1);
+}
+
+// Nanoseconds per task for one pass, best of a few
+static void bench_scan(size_t n) {
+    dag_t *d = dag_init();
+    if (!d) { fprintf(stderr, "dag_init failed\n"); exit(1); }
+    char name[32];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "task_%zu", i);
+        task_t *t = make_task(name);
+        if (!t) { fprintf(stderr, "out of memory\n"); exit(1); }
+        t->freq = (int)(i % 7);
+        if (dag_add_task(d, t) != 0) { fprintf(stderr, "add_task failed\n"); exit(1); }
+    }
+
+    double best_ptr = 1e9, best_dense = 1e9;
+    volatile size_t sink = 0;
+    for (int rep = 0; rep < 5; ++rep) {
+        double t0 = now_sec();
+        size_t due = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const task_t *t = d->tasks[i];
+            due += t->time == 0 && t->freq > 0;
+        }
+        double t1 = now_sec();
+        size_t counts[4];
+        dag_count_status(d, counts);
+        for (size_t i = 0; i < n; ++i) due += d->time[i] == 0 && d->freq[i] > 0;
+        double t2 = now_sec();
+        sink += due + counts[PENDING];
+        if (t1 - t0 < best_ptr) best_ptr = t1 - t0;
+        if (t2 - t1 < best_dense) best_dense = t2 - t1;
+    }
+    (void)sink;
+    printf("%-10zu %14.2f %14.2f\n", n, best_ptr * 1e9 / (double)n, best_dense * 1e9 / (double)n);
+    dag_free(d);
+}
+
+static void bench_snapshot(size_t n) {
+    char path[64], name[32], parent[32], cmd[64];
+    snprintf(path, sizeof(path), "/tmp/bench_dag_snapshot_%d", (int)getpid());
+
+    double t0 = now_sec();
+    dag_t *d = dag_init();
+    if (!d || dag_bulk_begin(d) != 0) { fprintf(stderr, "dag_init failed\n"); exit(1); }
+    unsigned long long rng = 42;
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "task_%zu", i);
+        snprintf(cmd, sizeof(cmd), "python3 etl.py --stage %zu", i % 16);
+        if (dag_bulk_add_task(d, dag_new_task(d, name, cmd, 0, 0)) != 0) { fprintf(stderr, "bulk_add_task failed\n"); exit(1); }
+        if (i > 0) {
+            snprintf(parent, sizeof(parent), "task_%zu", (size_t)(lcg_next(&rng) % i));
+            if (dag_bulk_add_dep(d, parent, name) != 0) { fprintf(stderr, "bulk_add_dep failed\n"); exit(1); }
+        }
+    }
+    if (dag_bulk_commit(d) != 0) { fprintf(stderr, "bulk_commit failed\n"); exit(1); }
+    double t1 = now_sec();
+    if (dag_snapshot_save(d, path) != 0) { fprintf(stderr, "snapshot save failed\n"); exit(1); }
+    double t2 = now_sec();
+    dag_free(d);
+
+    double t3 = now_sec();
+    if (dag_snapshot_load(path, &d) != 0) { fprintf(stderr, "snapshot load failed\n"); exit(1); }
+    double t4 = now_sec();
+    dag_free(d);
+
+    FILE *f = fopen(path, "rb");
+    long size = 0;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fclose(f);
+    }
+    unlink(path);
+    printf("%-10zu %10.3f %10.3f %10.3f %12.1f\n", n, t1 - t0, t2 - t1, t4 - t3, (double)size / (double)n);
+}
+
+// Gives every task four random earlier parents, then compares the heap held by the dependency
+// lists with the CSR copy of the same edges, and times a Kahn pass over each
+static void bench_adjacency(size_t n) {
+    char name[32], parent[32];
+    dag_t *d = dag_init();
+    if (!d || dag_bulk_begin(d) != 0) { fprintf(stderr, "dag_init failed\n"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "task_%zu", i);
+        if (dag_bulk_add_task(d, dag_new_task(d, name, "true", 0, 0)) != 0) { fprintf(stderr, "bulk_add_task failed\n"); exit(1); }
+    }
+    if (dag_bulk_commit(d) != 0) { fprintf(stderr, "bulk_commit failed\n"); exit(1); }
+
+    size_t h0 = heap_in_use();
+    if (dag_bulk_begin(d) != 0) { fprintf(stderr, "bulk_begin failed\n"); exit(1); }
+    unsigned long long rng = 42;
+    for (size_t i = 1; i < n; ++i) {
+        snprintf(name, sizeof(name), "task_%zu", i);
+        for (int k = 0; k < 4; ++k) {
+            snprintf(parent, sizeof(parent), "task_%zu", (size_t)(lcg_next(&rng) % i));
+            if (dag_bulk_add_dep(d, parent, name) != 0) { fprintf(stderr, "bulk_add_dep failed\n"); exit(1); }
+        }
+    }
+    if (dag_bulk_commit(d) != 0) { fprintf(stderr, "bulk_commit failed\n"); exit(1); }
+    size_t h1 = heap_in_use();
+    dag_csr_t c;
+    if (dag_csr_build(d, &c) != 0) { fprintf(stderr, "csr_build failed\n"); exit(1); }
+    size_t h2 = heap_in_use();
+    size_t m = c.n_edges;
+    dag_csr_free(&c);
+
+    double best_list = 1e9, best_csr = 1e9;
+    for (int rep = 0; rep < 3; ++rep) {
+        size_t *order = NULL, n_order = 0;
+        double t0 = now_sec();
+        if (dag_toposort(d, &order, &n_order) != 0) { fprintf(stderr, "toposort failed\n"); exit(1); }
+        double t1 = now_sec();
+        free(order);
+        double t2 = now_sec();
+        if (dag_csr_build(d, &c) != 0 || dag_csr_toposort(&c, &order, &n_order) != 0) { fprintf(stderr, "csr toposort failed\n"); exit(1); }
+        dag_csr_free(&c);
+        double t3 = now_sec();
+        free(order);
+        if (t1 - t0 < best_list) best_list = t1 - t0;
+        if (t3 - t2 < best_csr) best_csr = t3 - t2;
+    }
+    dag_free(d);
+    printf("%-10zu %10zu %12.1f %12.1f %10.3f %10.3f\n", n, m,
+           m ? (double)(h1 - h0) / (double)m : 0.0, m ? (double)(h2 - h1) / (double)m : 0.0, best_list, best_csr);
+}
+
+// The shell's way: getline, split, then one dag_add_task or dag_add_dep per line
+static double load_line_by_line(const char *path) {
+    double t0 = now_sec();
+    FILE *f = fopen(path, "r");
+    dag_t *d = dag_init();
+    if (!f || !d) { fprintf(stderr, "line-by-line load failed\n"); exit(1); }
+    char *line = NULL, *word[5];
+    size_t cap = 0;
+    while (getline(&line, &cap, f) != -1) {
+        int n = 0;
+        for (char *p = strtok(line, " \n\""); p && n < 5; p = strtok(NULL, " \n\"")) word[n++] = p;
+        if (n == 5) dag_add_task(d, dag_new_task(d, word[1], word[2], 0, 0));
+        else if (n == 3) dag_add_dep(d, word[1], word[2]);
+    }
+    free(line);
+    fclose(f);
+    dag_free(d);
+    return now_sec() - t0;
+}
+
+static void bench_graph_file(size_t n) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bench_dag_graph_%d", (int)getpid());
+    FILE *f = fopen(path, "w");
+    if (!f) { fprintf(stderr, "could not write %s\n", path); exit(1); }
+    unsigned long long rng = 42;
+    for (size_t i = 0; i < n; ++i) {
+        fprintf(f, "add_task task_%zu \"python3 etl.py --stage %zu\" 0 0\n", i, i % 16);
+        if (i > 0) fprintf(f, "add_dep task_%zu task_%zu\n", (size_t)(lcg_next(&rng) % i), i);
+    }
+    long size = ftell(f);
+    fclose(f);
+    double mb = (double)size / (1024.0 * 1024.0);
+
+    double line_s = load_line_by_line(path);
+    printf("%-10zu %8.1f %-8s %12.1f\n", n, mb, "line", mb / line_s);
+    size_t threads[3] = { 1, 2, 4 };
+    for (size_t k = 0; k < 3; ++k) {
+        dag_t *d = dag_init();
+        graph_load_result_t res;
+        if (!d || graph_load_file(d, path, threads[k], &res) != 0) { fprintf(stderr, "graph_load_file failed\n"); exit(1); }
+        char label[8];
+        snprintf(label, sizeof(label), "-j %zu", threads[k]);
+        printf("%-10zu %8.1f %-8s %12.1f %12.1f\n", n, mb, label, mb / (res.parse_s + res.build_s), mb / res.parse_s);
+        dag_free(d);
+    }
+    unlink(path);
+}
+
+int main(int argc, char **argv) {
+    size_t defaults[] = { 10000, 100000, 1000000 };
+
+    printf("%-10s %14s %14s %10s %10s\n", "tasks", "add_task/s", "add_dep/s", "total_s", "bulk_s");
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) bench_build((size_t)strtoull(argv[i], NULL, 10));
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) bench_build(defaults[i]);
+    }
+
+    printf("\n%-10s %-8s %14s %10s %10s\n", "tasks", "storage", "bytes/task", "create_s", "free_s");
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            bench_storage((size_t)strtoull(argv[i], NULL, 10), false);
+            bench_storage((size_t)strtoull(argv[i], NULL, 10), true);
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+            bench_storage(defaults[i], false);
+            bench_storage(defaults[i], true);
+        }
+    }
+
+    printf("\n%-10s %14s %14s\n", "tasks", "task_t* ns", "dense ns");
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) bench_scan((size_t)strtoull(argv[i], NULL, 10));
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) bench_scan(defaults[i]);
+    }
+
+    printf("\n%-10s %10s %10s %10s %12s\n", "tasks", "rebuild_s", "save_s", "load_s", "bytes/task");
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) bench_snapshot((size_t)strtoull(argv[i], NULL, 10));
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) bench_snapshot(defaults[i]);
+    }
+
+    printf("\n%-10s %10s %12s %12s %10s %10s\n", "tasks", "edges", "lists B/edge", "csr B/edge", "lists_s", "csr_s");
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) bench_adjacency((size_t)strtoull(argv[i], NULL, 10));
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) bench_adjacency(defaults[i]);
+    }
+
+    printf("\n%-10s %8s %-8s %12s %12s\n", "tasks", "MB", "loader", "load MB/s", "parse MB/s");
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) bench_graph_file((size_t)strtoull(argv[i], NULL, 10));
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) bench_graph_file(defaults[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,810 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "dag_manager.h"
+#include "scheduler.h"
+#include "work_deque.h"
+#include "launcher.h"
+#include "wal.h"
+
+// Scheduler microbenchmarks
+// Usage: ./bench_scheduler [queue [n_items] | spawn [resident_mb [n_tasks]] | fn [n_tasks] | wal [n_tasks] |
+//                          sim [n_tasks] | fuse [n_tasks] | topo [n_tasks]]
+//
+// queue: ready-queue throughput with in-process work items, comparing the single
+// mutex/condvar queue the workers used to share against per-worker work-stealing deques.
+// The work is a complete binary tree where finishing item i releases items 2i+1 and 2i+2,
+// like a DAG whose tasks each fan out to two successors
+//
+// spawn: task launch rate with and without resident_mb of touched heap in the scheduler
+// process, comparing fork() + /bin/sh against posix_spawn through /bin/sh and posix_spawn
+// running the program directly. Each task is `true`, launched and waited for one at a time
+//
+// fn: end-to-end scheduler throughput on a binary-tree DAG of in-process function tasks doing
+// about a microsecond of work each, plain, with run-time statistics and with tracing (which
+// includes writing the JSON at sched_stop), next to the same tree made of `true` commands
+//
+// wal: cost of the write-ahead log at about 10k task completions/sec: independent function
+// tasks spinning for 100us each on one worker, run without a log and with one in the current
+// directory (so fdatasync hits a real disk rather than tmpfs)
+//
+// sim: simulated makespan on synthetic DAGs with known task costs, dispatching ready tasks
+// FIFO in topological order (the default) against highest upward rank first (priority mode),
+// next to the lower bound max(critical path, total work / workers). No tasks are run: an
+// event loop plays out the schedule, so the numbers only reflect the dispatch order
+//
+// fuse: independent chains of 1, 4, 16 and 64 `true` commands run plainly and with chain
+// fusion, counting the processes the scheduler started itself (a fused chain is one shell,
+// which still forks a subshell per command)
+//
+// topo: the single-threaded Kahn sort sched_start uses for most graphs against the level by
+// level sort at 1, 4, 16 and 64 threads, on a layered DAG with four edges into every task
+// below the first layer
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// A few hundred nanoseconds of work per item
+static void do_work(size_t item) {
+    volatile size_t sink = item;
+    for (int i = 0; i < 100; ++i) sink = sink * 31 + (size_t)i;
+}
+
+// ---- single shared queue, as in the old worker_loop ----
+
+typedef struct {
+    size_t         *queue;
+    size_t          q_head, q_tail, q_capacity;
+    size_t          n_items, n_done;
+    pthread_mutex_t mu;
+    pthread_cond_t  cv;
+} mutex_bench_t;
+
+static void *mutex_worker(void *arg) {
+    mutex_bench_t *b = arg;
+    while (1) {
+        pthread_mutex_lock(&b->mu);
+        while (b->q_head == b->q_tail && b->n_done < b->n_items) pthread_cond_wait(&b->cv, &b->mu);
+        if (b->q_head == b->q_tail) {
+            pthread_mutex_unlock(&b->mu);
+            break;
+        }
+        size_t item = b->queue[b->q_head];
+        b->q_head = (b->q_head + 1) % b->q_capacity;
+        pthread_mutex_unlock(&b->mu);
+
+        do_work(item);
+
+        pthread_mutex_lock(&b->mu);
+        for (size_t child = 2 * item + 1; child <= 2 * item + 2 && child < b->n_items; ++child) {
+            b->queue[b->q_tail] = child;
+            b->q_tail = (b->q_tail + 1) % b->q_capacity;
+            pthread_cond_signal(&b->cv);
+        }
+        if (++b->n_done == b->n_items) pthread_cond_broadcast(&b->cv);
+        pthread_mutex_unlock(&b->mu);
+    }
+    return NULL;
+}
+
+static double run_mutex(size_t n_workers, size_t n_items) {
+    mutex_bench_t b;
+    b.q_capacity = n_items + 1;
+    b.queue = malloc(b.q_capacity * sizeof(size_t));
+    b.q_head = 0;
+    b.q_tail = 1;
+    b.queue[0] = 0;
+    b.n_items = n_items;
+    b.n_done = 0;
+    pthread_mutex_init(&b.mu, NULL);
+    pthread_cond_init(&b.cv, NULL);
+
+    pthread_t *th = malloc(n_workers * sizeof(pthread_t));
+    double t0 = now_sec();
+    for (size_t i = 0; i < n_workers; ++i) pthread_create(&th[i], NULL, mutex_worker, &b);
+    for (size_t i = 0; i < n_workers; ++i) pthread_join(th[i], NULL);
+    double t1 = now_sec();
+
+    pthread_mutex_destroy(&b.mu);
+    pthread_cond_destroy(&b.cv);
+    free(th);
+    free(b.queue);
+    return (double)n_items / (t1 - t0);
+}
+
+// ---- per-worker deques with stealing, as in the scheduler ----
+
+typedef struct steal_bench steal_bench_t;
+
+typedef struct {
+    steal_bench_t *b;
+    size_t         id;
+    work_deque_t   deque;
+    unsigned       rng;
+} steal_worker_t;
+
+struct steal_bench {
+    steal_worker_t *w;
+    size_t          n_workers, n_items;
+    atomic_size_t   n_queued, n_done, n_sleeping;
+    pthread_mutex_t mu;
+    pthread_cond_t  cv;
+};
+
+static bool steal_find(steal_worker_t *w, size_t *out) {
+    steal_bench_t *b = w->b;
+    if (wd_pop(&w->deque, out)) return true;
+    bool contended = true;
+    while (contended && b->n_workers > 1) {
+        contended = false;
+        w->rng = w->rng * 1103515245u + 12345u;
+        size_t start = (w->rng >> 8) % b->n_workers;
+        for (size_t k = 0; k < b->n_workers; ++k) {
+            size_t v = (start + k) % b->n_workers;
+            if (v == w->id) continue;
+            int r = wd_steal(&b->w[v].deque, out);
+            if (r == 1) return true;
+            if (r < 0) contended = true;
+        }
+    }
+    return false;
+}
+
+static void *steal_worker(void *arg) {
+    steal_worker_t *w = arg;
+    steal_bench_t *b = w->b;
+    while (1) {
+        size_t item;
+        if (!steal_find(w, &item)) {
+            pthread_mutex_lock(&b->mu);
+            atomic_fetch_add(&b->n_sleeping, 1);
+            while (atomic_load(&b->n_queued) == 0 && atomic_load(&b->n_done) < b->n_items) {
+                pthread_cond_wait(&b->cv, &b->mu);
+            }
+            atomic_fetch_sub(&b->n_sleeping, 1);
+            bool finished = atomic_load(&b->n_done) == b->n_items;
+            pthread_mutex_unlock(&b->mu);
+            if (finished) break;
+            continue;
+        }
+        atomic_fetch_sub(&b->n_queued, 1);
+
+        do_work(item);
+
+        size_t released = 0;
+        for (size_t child = 2 * item + 1; child <= 2 * item + 2 && child < b->n_items; ++child) {
+            wd_push(&w->deque, child);
+            released++;
+        }
+        atomic_fetch_add(&b->n_queued, released);
+        bool finished = atomic_fetch_add(&b->n_done, 1) + 1 == b->n_items;
+        if ((released > 1 || finished) && atomic_load(&b->n_sleeping) > 0) {
+            pthread_mutex_lock(&b->mu);
+            if (finished) pthread_cond_broadcast(&b->cv);
+            else pthread_cond_signal(&b->cv);
+            pthread_mutex_unlock(&b->mu);
+        }
+    }
+    return NULL;
+}
+
+static double run_steal(size_t n_workers, size_t n_items) {
+    steal_bench_t b;
+    b.n_workers = n_workers;
+    b.n_items = n_items;
+    atomic_init(&b.n_queued, 1);
+    atomic_init(&b.n_done, 0);
+    atomic_init(&b.n_sleeping, 0);
+    pthread_mutex_init(&b.mu, NULL);
+    pthread_cond_init(&b.cv, NULL);
+    b.w = malloc(n_workers * sizeof(steal_worker_t));
+    for (size_t i = 0; i < n_workers; ++i) {
+        b.w[i].b = &b;
+        b.w[i].id = i;
+        b.w[i].rng = (unsigned)i * 2654435761u + 1;
+        wd_init(&b.w[i].deque, 64);
+    }
+    wd_push(&b.w[0].deque, 0);
+
+    pthread_t *th = malloc(n_workers * sizeof(pthread_t));
+    double t0 = now_sec();
+    for (size_t i = 0; i < n_workers; ++i) pthread_create(&th[i], NULL, steal_worker, &b.w[i]);
+    for (size_t i = 0; i < n_workers; ++i) pthread_join(th[i], NULL);
+    double t1 = now_sec();
+
+    for (size_t i = 0; i < n_workers; ++i) wd_free(&b.w[i].deque);
+    pthread_mutex_destroy(&b.mu);
+    pthread_cond_destroy(&b.cv);
+    free(th);
+    free(b.w);
+    return (double)n_items / (t1 - t0);
+}
+
+static void bench_queue(size_t n_items) {
+    size_t workers[] = { 1, 2, 4, 8, 16, 32, 64 };
+    printf("ready-queue throughput, %zu in-process items\n", n_items);
+    printf("%-8s %16s %16s %8s\n", "workers", "mutex items/s", "steal items/s", "speedup");
+    for (size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i) {
+        double m = run_mutex(workers[i], n_items);
+        double st = run_steal(workers[i], n_items);
+        printf("%-8zu %16.0f %16.0f %7.2fx\n", workers[i], m, st, st / m);
+    }
+}
+
+// ---- task launch latency ----
+
+static double run_launches(launch_mode_t mode, bool direct, size_t n_tasks) {
+    launcher_t l;
+    if (launcher_init(&l, mode, direct) != 0) return 0;
+    double t0 = now_sec();
+    for (size_t i = 0; i < n_tasks; ++i) {
+        pid_t pid;
+        if (launcher_spawn(&l, "true", &pid) == 0) launcher_wait(pid);
+    }
+    double t1 = now_sec();
+    launcher_destroy(&l);
+    return (double)n_tasks / (t1 - t0);
+}
+
+static void bench_spawn(size_t resident_mb, size_t n_tasks) {
+    printf("task launch rate, %zu sequential `true` tasks\n", n_tasks);
+    printf("%-12s %14s %14s %14s\n", "resident", "fork+sh/s", "spawn+sh/s", "spawn/s");
+    size_t sizes[] = { 0, resident_mb };
+    for (size_t i = 0; i < 2; ++i) {
+        if (i == 1 && resident_mb == 0) break;
+        // Touch every page so the child's page tables really have to be copied by fork()
+        char *heap = NULL;
+        if (sizes[i] > 0) {
+            heap = malloc(sizes[i] << 20);
+            if (!heap) {
+                fprintf(stderr, "could not allocate %zu MB\n", sizes[i]);
+                return;
+            }
+            memset(heap, 1, sizes[i] << 20);
+        }
+        double f = run_launches(LAUNCH_FORK, false, n_tasks);
+        double sh = run_launches(LAUNCH_SPAWN, false, n_tasks);
+        double d = run_launches(LAUNCH_SPAWN, true, n_tasks);
+        char label[32];
+        snprintf(label, sizeof(label), "%zu MB", sizes[i]);
+        printf("%-12s %14.0f %14.0f %14.0f\n", label, f, sh, d);
+        free(heap);
+    }
+}
+
+// ---- in-process function tasks through the real scheduler ----
+
+static int micro_fn(void *arg) {
+    volatile size_t sink = (size_t)arg;
+    for (int i = 0; i < 300; ++i) sink = sink * 31 + (size_t)i;
+    return 0;
+}
+
+static char *dup_str(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *p = malloc(n);
+    if (p) memcpy(p, s, n);
+    return p;
+}
+
+// Task i depends on (i-1)/2, built through the bulk API
+static dag_t *build_tree(size_t n_tasks, bool fn) {
+    dag_t *d = dag_init();
+    char id[24], from[24];
+    dag_bulk_begin(d);
+    for (size_t i = 0; i < n_tasks; ++i) {
+        snprintf(id, sizeof(id), "N%zu", i);
+        task_t *t;
+        if (fn) {
+            t = dag_new_fn_task(id, micro_fn, (void *)i);
+        } else {
+            t = calloc(1, sizeof(task_t));
+            t->id = dup_str(id);
+            t->cmd = dup_str("true");
+        }
+        dag_bulk_add_task(d, t);
+        if (i > 0) {
+            snprintf(from, sizeof(from), "N%zu", (i - 1) / 2);
+            dag_bulk_add_dep(d, from, id);
+        }
+    }
+    if (dag_bulk_commit(d) != 0) {
+        dag_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+#define BENCH_LOG_DIR "bench_scheduler.logs"
+
+// Removes the logs a captured run of d left behind
+static void remove_logs(const dag_t *d) {
+    char path[96];
+    for (size_t i = 0; i < d->n_tasks; ++i) {
+        snprintf(path, sizeof(path), BENCH_LOG_DIR "/%s.log", d->tasks[i]->id);
+        unlink(path);
+    }
+    rmdir(BENCH_LOG_DIR);
+}
+
+static double run_tree(dag_t *d, size_t n_workers, bool stats, bool trace, bool logs) {
+    for (size_t i = 0; i < d->n_tasks; ++i) dag_set_status(d, i, PENDING);
+    scheduler_t *s = sched_init(d, n_workers);
+    if (!s) return 0;
+    sched_stats_t st;
+    if (stats) {
+        if (stats_init(&st, d->n_tasks, n_workers) != 0) {
+            free(s);
+            return 0;
+        }
+        s->stats = &st;
+    }
+    // Big enough rings that nothing is overwritten; the file goes to /dev/null
+    sched_trace_t tr;
+    if (trace) {
+        if (trace_init(&tr, "/dev/null", n_workers, 2 * d->n_tasks) != 0) {
+            if (stats) stats_free(&st);
+            free(s);
+            return 0;
+        }
+        s->trace = &tr;
+    }
+    sched_capture_t cap;
+    if (logs) {
+        if (capture_init(&cap, BENCH_LOG_DIR, d, d->n_tasks) != 0) {
+            if (stats) stats_free(&st);
+            if (trace) trace_free(&tr);
+            free(s);
+            return 0;
+        }
+        s->capture = &cap;
+    }
+    double t0 = now_sec();
+    if (sched_start(s) != 0) {
+        if (stats) stats_free(&st);
+        if (trace) trace_free(&tr);
+        if (logs) capture_free(&cap);
+        free(s);
+        return 0;
+    }
+    sched_stop(s);
+    double t1 = now_sec();
+    free(s);
+    if (stats) stats_free(&st);
+    if (trace) trace_free(&tr);
+    if (logs) {
+        capture_free(&cap);
+        remove_logs(d);
+    }
+    return (double)d->n_tasks / (t1 - t0);
+}
+
+static void bench_fn(size_t n_tasks) {
+    size_t n_cmds = n_tasks < 2000 ? n_tasks : 2000;
+    dag_t *fd = build_tree(n_tasks, true);
+    dag_t *cd = build_tree(n_cmds, false);
+    if (!fd || !cd) {
+        fprintf(stderr, "could not build the benchmark DAGs\n");
+        if (fd) dag_free(fd);
+        if (cd) dag_free(cd);
+        return;
+    }
+    printf("scheduler throughput, %zu function tasks vs %zu command tasks\n", n_tasks, n_cmds);
+    printf("%-8s %16s %16s %16s %16s %16s\n", "workers", "fn tasks/s", "fn+stats tasks/s", "fn+trace tasks/s", "cmd tasks/s",
+           "cmd+logs tasks/s");
+    size_t workers[] = { 1, 2, 4, 8 };
+    for (size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i) {
+        double f = run_tree(fd, workers[i], false, false, false);
+        double fs = run_tree(fd, workers[i], true, false, false);
+        double ft = run_tree(fd, workers[i], false, true, false);
+        double c = run_tree(cd, workers[i], false, false, false);
+        double cl = run_tree(cd, workers[i], false, false, true);
+        printf("%-8zu %16.0f %16.0f %16.0f %16.0f %16.0f\n", workers[i], f, fs, ft, c, cl);
+    }
+    dag_free(fd);
+    dag_free(cd);
+}
+
+// ---- write-ahead log overhead ----
+
+static int spin_fn(void *arg) {
+    (void)arg;
+    double end = now_sec() + 100e-6;
+    while (now_sec() < end) {}
+    return 0;
+}
+
+static double run_spin(dag_t *d, wal_t *w) {
+    dag_reset_status(d);
+    scheduler_t *s = sched_init(d, 1);
+    if (!s) return 0;
+    s->wal = w;
+    double t0 = now_sec();
+    if (w) wal_mark_run(w);
+    if (sched_start(s) != 0) {
+        free(s);
+        return 0;
+    }
+    sched_stop(s);
+    if (w) wal_flush(w);
+    double t1 = now_sec();
+    free(s);
+    return t1 - t0;
+}
+
+static void bench_wal(size_t n_tasks) {
+    dag_t *d = dag_init();
+    char id[24];
+    dag_bulk_begin(d);
+    for (size_t i = 0; i < n_tasks; ++i) {
+        snprintf(id, sizeof(id), "S%zu", i);
+        dag_bulk_add_task(d, dag_new_fn_task(id, spin_fn, NULL));
+    }
+    if (dag_bulk_commit(d) != 0) {
+        fprintf(stderr, "could not build the benchmark DAG\n");
+        dag_free(d);
+        return;
+    }
+    const char *path = "bench_scheduler.wal";
+    unlink(path);
+    wal_t w;
+    if (wal_open(&w, path, d) != 0) {
+        fprintf(stderr, "could not open %s\n", path);
+        dag_free(d);
+        return;
+    }
+
+    double base = run_spin(d, NULL);
+    double logged = run_spin(d, &w);
+    printf("write-ahead log overhead, %zu tasks of 100us on 1 worker\n", n_tasks);
+    printf("%-10s %10s %12s\n", "", "seconds", "tasks/s");
+    printf("%-10s %10.3f %12.0f\n", "no log", base, (double)n_tasks / base);
+    printf("%-10s %10.3f %12.0f\n", "log", logged, (double)n_tasks / logged);
+    printf("overhead %.1f%%, %llu records in %llu syncs\n", (logged / base - 1) * 100,
+           (unsigned long long)w.durable, (unsigned long long)w.n_syncs);
+    wal_close(&w);
+    unlink(path);
+    dag_free(d);
+}
+
+// ---- critical-path simulation ----
+
+typedef struct {
+    double key;
+    size_t idx;
+} sim_item_t;
+
+typedef struct {
+    sim_item_t *items;
+    size_t      n;
+} sim_heap_t;
+
+static bool sim_less(sim_item_t a, sim_item_t b) {
+    return a.key < b.key || (a.key == b.key && a.idx < b.idx);
+}
+
+static void sim_push(sim_heap_t *h, double key, size_t idx) {
+    size_t i = h->n++;
+    sim_item_t it = { key, idx };
+    while (i > 0 && sim_less(it, h->items[(i - 1) / 2])) {
+        h->items[i] = h->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h->items[i] = it;
+}
+
+static sim_item_t sim_pop(sim_heap_t *h) {
+    sim_item_t top = h->items[0], last = h->items[--h->n];
+    size_t i = 0;
+    while (2 * i + 1 < h->n) {
+        size_t c = 2 * i + 1;
+        if (c + 1 < h->n && sim_less(h->items[c + 1], h->items[c])) c++;
+        if (!sim_less(h->items[c], last)) break;
+        h->items[i] = h->items[c];
+        i = c;
+    }
+    if (h->n > 0) h->items[i] = last;
+    return top;
+}
+
+// Plays out a schedule on p workers; ready tasks leave in release order (FIFO) or
+// by highest rank, and the time the last task finishes is returned
+static double simulate(const dag_csr_t *c, const size_t *order, const double *cost,
+                       const double *rank, size_t p, bool by_rank) {
+    size_t n = c->n;
+    uint32_t *remaining = malloc(n * sizeof(uint32_t));
+    sim_heap_t ready = { malloc(n * sizeof(sim_item_t)), 0 };
+    sim_heap_t running = { malloc(n * sizeof(sim_item_t)), 0 };
+    double seq = 0, now = 0;
+    for (size_t i = 0; i < n; ++i) remaining[i] = c->roff[i + 1] - c->roff[i];
+    for (size_t i = 0; i < n; ++i) {
+        size_t u = order[i];
+        if (remaining[u] == 0) sim_push(&ready, by_rank ? -rank[u] : seq++, u);
+    }
+    while (ready.n > 0 || running.n > 0) {
+        while (ready.n > 0 && running.n < p) {
+            size_t u = sim_pop(&ready).idx;
+            sim_push(&running, now + cost[u], u);
+        }
+        sim_item_t done = sim_pop(&running);
+        now = done.key;
+        for (uint32_t k = c->off[done.idx]; k < c->off[done.idx + 1]; ++k) {
+            size_t v = c->adj[k];
+            if (--remaining[v] == 0) sim_push(&ready, by_rank ? -rank[v] : seq++, v);
+        }
+    }
+    free(remaining);
+    free(ready.items);
+    free(running.items);
+    return now;
+}
+
+static double sim_uniform(unsigned long long *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double)(*state >> 11) / 9007199254740992.0;
+}
+
+// skewed:  cheap independent tasks added ahead of one long chain worth a tenth of the work
+// layered: 20 layers, each task depending on up to 3 tasks of the layer above, costs
+//          spread over two orders of magnitude
+// chains:  independent chains whose lengths fall off like 1/k, one cost unit per task
+static dag_t *build_sim_dag(const char *kind, size_t n) {
+    dag_t *d = dag_init();
+    char id[32], from[32];
+    unsigned long long rng = 99;
+    dag_bulk_begin(d);
+    size_t chain = n / 10;
+    size_t width = n / 20 > 0 ? n / 20 : 1;
+    size_t n_chains = 16, next_chain = 0, chain_left = 0;
+    double harmonic = 0;
+    for (size_t k = 1; k <= n_chains; ++k) harmonic += 1.0 / (double)k;
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(id, sizeof(id), "T%zu", i);
+        dag_bulk_add_task(d, dag_new_fn_task(id, micro_fn, NULL));
+        if (strcmp(kind, "skewed") == 0) {
+            size_t first = n - chain;
+            d->cost[i] = i < first ? (double)chain / (double)(first > 0 ? first : 1) : 1.0;
+            if (i > first) {
+                snprintf(from, sizeof(from), "T%zu", i - 1);
+                dag_bulk_add_dep(d, from, id);
+            }
+        } else if (strcmp(kind, "layered") == 0) {
+            d->cost[i] = 0.1 + 10.0 * sim_uniform(&rng) * sim_uniform(&rng);
+            if (i >= width) {
+                size_t layer_start = (i / width - 1) * width;
+                for (int e = 0; e < 3; ++e) {
+                    snprintf(from, sizeof(from), "T%zu", layer_start + (size_t)(sim_uniform(&rng) * (double)width));
+                    dag_bulk_add_dep(d, from, id);
+                }
+            }
+        } else {
+            d->cost[i] = 1.0;
+            if (chain_left == 0 && next_chain < n_chains) {
+                next_chain++;
+                chain_left = (size_t)((double)n / harmonic / (double)next_chain);
+            } else if (chain_left > 0) {
+                snprintf(from, sizeof(from), "T%zu", i - 1);
+                dag_bulk_add_dep(d, from, id);
+            }
+            if (chain_left > 0) chain_left--;
+        }
+    }
+    if (dag_bulk_commit(d) != 0) {
+        dag_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+static void bench_sim(size_t n_tasks) {
+    const char *kinds[] = { "skewed", "layered", "chains" };
+    size_t workers[] = { 4, 16, 64 };
+    printf("simulated makespan, %zu tasks, FIFO vs upward-rank priority\n", n_tasks);
+    printf("%-8s %-8s %12s %12s %12s %8s\n", "dag", "workers", "fifo", "rank", "bound", "gain");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+        dag_t *d = build_sim_dag(kinds[k], n_tasks);
+        dag_csr_t c;
+        size_t *order, n_order;
+        if (!d || dag_csr_build(d, &c) != 0 || dag_csr_toposort(&c, &order, &n_order) != 0) {
+            fprintf(stderr, "could not build the %s DAG\n", kinds[k]);
+            exit(1);
+        }
+        double *rank = malloc(c.n * sizeof(double));
+        dag_csr_upward_rank(&c, order, d->cost, rank);
+        double total = 0, critical = 0;
+        for (size_t i = 0; i < c.n; ++i) {
+            total += d->cost[i];
+            if (rank[i] > critical) critical = rank[i];
+        }
+        for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+            double fifo = simulate(&c, order, d->cost, rank, workers[w], false);
+            double ranked = simulate(&c, order, d->cost, rank, workers[w], true);
+            double bound = total / (double)workers[w] > critical ? total / (double)workers[w] : critical;
+            printf("%-8s %-8zu %12.1f %12.1f %12.1f %7.1f%%\n", kinds[k], workers[w], fifo, ranked, bound,
+                   (1 - ranked / fifo) * 100);
+        }
+        free(rank);
+        free(order);
+        dag_csr_free(&c);
+        dag_free(d);
+    }
+}
+
+// Independent chains of len `true` commands each
+static dag_t *build_chains(size_t n_tasks, size_t len) {
+    dag_t *d = dag_init();
+    char id[24], from[24];
+    dag_bulk_begin(d);
+    for (size_t i = 0; i < n_tasks; ++i) {
+        snprintf(id, sizeof(id), "N%zu", i);
+        task_t *t = calloc(1, sizeof(task_t));
+        t->id = dup_str(id);
+        t->cmd = dup_str("true");
+        dag_bulk_add_task(d, t);
+        if (i % len != 0) {
+            snprintf(from, sizeof(from), "N%zu", i - 1);
+            dag_bulk_add_dep(d, from, id);
+        }
+    }
+    if (dag_bulk_commit(d) != 0) {
+        dag_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+static double run_chains(dag_t *d, size_t n_workers, bool fuse, uint64_t *n_spawns) {
+    dag_reset_status(d);
+    scheduler_t *s = sched_init(d, n_workers);
+    if (!s) return 0;
+    s->fuse = fuse;
+    double t0 = now_sec();
+    if (sched_start(s) != 0) {
+        free(s);
+        return 0;
+    }
+    sched_stop(s);
+    double t1 = now_sec();
+    *n_spawns = atomic_load(&s->n_spawns);
+    free(s);
+    return (double)d->n_tasks / (t1 - t0);
+}
+
+static void bench_fuse(size_t n_tasks) {
+    printf("chain fusion, %zu `true` tasks in chains on 4 workers\n", n_tasks);
+    printf("%-8s %14s %10s %14s %10s %8s\n", "chain", "plain tasks/s", "launches", "fused tasks/s", "launches", "speedup");
+    size_t lens[] = { 1, 4, 16, 64 };
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+        dag_t *d = build_chains(n_tasks, lens[i]);
+        if (!d) {
+            fprintf(stderr, "could not build the benchmark DAG\n");
+            return;
+        }
+        uint64_t plain_spawns, fused_spawns;
+        double plain = run_chains(d, 4, false, &plain_spawns);
+        double fused = run_chains(d, 4, true, &fused_spawns);
+        printf("%-8zu %14.0f %10llu %14.0f %10llu %7.2fx\n", lens[i], plain, (unsigned long long)plain_spawns, fused,
+               (unsigned long long)fused_spawns, fused / plain);
+        dag_free(d);
+    }
+}
+
+// Layers of n / 50 tasks, each task depending on 4 random tasks of the layer above, built
+// straight into a CSR since going through task IDs would take longer than the sorts
+static void build_layered_csr(dag_csr_t *c, size_t n) {
+    size_t width = n / 50 > 0 ? n / 50 : 1;
+    size_t m = n > width ? (n - width) * 4 : 0;
+    uint32_t *mem = calloc(2 * (n + 1) + 2 * m, sizeof(uint32_t));
+    uint32_t *from = malloc((m > 0 ? m : 1) * sizeof(uint32_t));
+    uint32_t *fill = calloc(n > 0 ? n : 1, sizeof(uint32_t));
+    if (!mem || !from || !fill) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    c->n = (uint32_t)n;
+    c->n_edges = (uint32_t)m;
+    c->off = mem;
+    c->roff = mem + (n + 1);
+    c->adj = mem + 2 * (n + 1);
+    c->radj = mem + 2 * (n + 1) + m;
+    unsigned long long rng = 42;
+    for (size_t v = width, e = 0; v < n; ++v) {
+        size_t layer_start = (v / width - 1) * width;
+        c->roff[v + 1] = 4;
+        for (int k = 0; k < 4; ++k, ++e) {
+            from[e] = (uint32_t)(layer_start + (size_t)(sim_uniform(&rng) * (double)width));
+            c->off[from[e] + 1]++;
+        }
+    }
+    for (size_t v = 0; v < n; ++v) {
+        c->off[v + 1] += c->off[v];
+        c->roff[v + 1] += c->roff[v];
+    }
+    for (size_t v = width, e = 0; v < n; ++v) {
+        for (int k = 0; k < 4; ++k, ++e) {
+            c->radj[c->roff[v] + k] = from[e];
+            c->adj[c->off[from[e]] + fill[from[e]]++] = (uint32_t)v;
+        }
+    }
+    free(fill);
+    free(from);
+}
+
+static void bench_topo(size_t n_tasks) {
+    dag_csr_t c;
+    build_layered_csr(&c, n_tasks);
+    printf("topological sort, %zu tasks and %u edges in 50 layers\n", n_tasks, c.n_edges);
+    printf("%-8s %12s %16s %8s\n", "threads", "seconds", "edges/s", "speedup");
+
+    // Best of three, so page faults on the first pass don't count
+    double serial = 1e9;
+    for (int rep = 0; rep < 3; ++rep) {
+        size_t *order, n_order;
+        double t0 = now_sec();
+        if (dag_csr_toposort(&c, &order, &n_order) != 0) exit(1);
+        double t = now_sec() - t0;
+        if (t < serial) serial = t;
+        free(order);
+    }
+    printf("%-8s %12.4f %16.0f %8s\n", "kahn", serial, c.n_edges / serial, "1.00x");
+
+    size_t threads[] = { 1, 4, 16, 64 };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        double best = 1e9;
+        for (int rep = 0; rep < 3; ++rep) {
+            dag_levels_t lv;
+            double t0 = now_sec();
+            if (dag_csr_levels(&c, threads[i], &lv) != 0) exit(1);
+            double t = now_sec() - t0;
+            if (t < best) best = t;
+            dag_levels_free(&lv);
+        }
+        printf("%-8zu %12.4f %16.0f %7.2fx\n", threads[i], best, c.n_edges / best, serial / best);
+    }
+    dag_csr_free(&c);
+}
+
+int main(int argc, char **argv) {
+    const char *which = argc > 1 ? argv[1] : "all";
+    bool all = strcmp(which, "all") == 0;
+
+    if (all || strcmp(which, "queue") == 0) {
+        size_t n_items = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 1000000;
+        bench_queue(n_items);
+    }
+    if (all || strcmp(which, "spawn") == 0) {
+        size_t resident_mb = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 1024;
+        size_t n_tasks = argc > 3 ? (size_t)strtoull(argv[3], NULL, 10) : 2000;
+        bench_spawn(resident_mb, n_tasks);
+    }
+    if (all || strcmp(which, "fn") == 0) {
+        size_t n_tasks = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 100000;
+        bench_fn(n_tasks);
+    }
+    if (all || strcmp(which, "wal") == 0) {
+        size_t n_tasks = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 20000;
+        bench_wal(n_tasks);
+    }
+    if (all || strcmp(which, "sim") == 0) {
+        size_t n_tasks = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 10000;
+        bench_sim(n_tasks);
+    }
+    if (all || strcmp(which, "fuse") == 0) {
+        size_t n_tasks = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 2048;
+        bench_fuse(n_tasks);
+    }
+    if (all || strcmp(which, "topo") == 0) {
+        size_t n_tasks = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 2000000;
+        bench_topo(n_tasks);
+    }
+    return 0;
+}
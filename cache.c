@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static uint64_t fnv(uint64_t h, const void *p, size_t n) {
+    const unsigned char *b = p;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Spreads a key over all 64 bits before predecessor keys are summed (splitmix64 finalizer)
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static int add_entry(sched_cache_t *c, const char *id, uint64_t key) {
+    if (c->n_entries == c->entries_cap) {
+        size_t cap = c->entries_cap ? c->entries_cap * 2 : 64;
+        cache_entry_t *e = realloc(c->entries, cap * sizeof(cache_entry_t));
+        if (!e) return -2;
+        c->entries = e;
+        c->entries_cap = cap;
+    }
+    char *copy = strdup(id);
+    if (!copy) return -2;
+    c->entries[c->n_entries++] = (cache_entry_t){ copy, key };
+    return 0;
+}
+
+// Parses "<hex key> <id>"; returns false if the line isn't one
+static bool parse_entry(char *line, uint64_t *key, char **id) {
+    char *endp;
+    errno = 0;
+    unsigned long long k = strtoull(line, &endp, 16);
+    if (errno || endp == line || *endp != ' ' || !endp[1] || k == 0) return false;
+    *key = k;
+    *id = endp + 1;
+    return true;
+}
+
+int cache_open(sched_cache_t *c, const char *path) {
+    memset(c, 0, sizeof(*c));
+    atomic_init(&c->hits, 0);
+    c->path = strdup(path);
+    if (!c->path) return -2;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (errno == ENOENT) return 0;
+        free(c->path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int err = 0;
+    // An empty file, as a crash during the first save could leave, is an empty cache
+    bool first = true;
+    while ((len = getline(&line, &cap, f)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (first) {
+            first = false;
+            if (strcmp(line, CACHE_MAGIC) != 0) {
+                err = -4;
+                break;
+            }
+            continue;
+        }
+        uint64_t key;
+        char *id;
+        if (!parse_entry(line, &key, &id)) {
+            err = -4;
+            break;
+        }
+        err = add_entry(c, id, key);
+        if (err) break;
+    }
+    if (!err && ferror(f)) err = -1;
+    free(line);
+    fclose(f);
+    if (err) cache_free(c);
+    return err;
+}
+
+void cache_free(sched_cache_t *c) {
+    for (size_t i = 0; i < c->n_entries; ++i) free(c->entries[i].id);
+    free(c->entries);
+    free(c->path);
+    free(c->key);
+    free(c->done);
+    free(c->entry);
+    free(c->usable);
+    memset(c, 0, sizeof(*c));
+}
+
+int cache_prepare(sched_cache_t *c, dag_t *d) {
+    size_t n = d->n_tasks ? d->n_tasks : 1;
+    uint64_t *key = realloc(c->key, n * sizeof(uint64_t));
+    if (key) c->key = key;
+    uint64_t *done = realloc(c->done, n * sizeof(uint64_t));
+    if (done) c->done = done;
+    size_t *entry = realloc(c->entry, n * sizeof(size_t));
+    if (entry) c->entry = entry;
+    bool *usable = realloc(c->usable, n * sizeof(bool));
+    if (usable) c->usable = usable;
+    if (!key || !done || !entry || !usable) return -2;
+
+    for (size_t i = 0; i < d->n_tasks; ++i) {
+        c->key[i] = c->done[i] = 0;
+        c->entry[i] = SIZE_MAX;
+        c->usable[i] = false;
+    }
+    for (size_t e = 0; e < c->n_entries; ++e) {
+        int i = dag_find_index(d, c->entries[e].id);
+        if (i < 0) continue;
+        c->done[i] = c->entries[e].key;
+        c->entry[i] = e;
+    }
+    c->dag = d;
+    c->n_tasks = d->n_tasks;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    c->nonce = mix((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec) | 1;
+    atomic_store_explicit(&c->hits, 0, memory_order_relaxed);
+    c->err = 0;
+    return 0;
+}
+
+bool cache_check(sched_cache_t *c, const dag_csr_t *csr, size_t idx) {
+    // Later runs of a periodic task keep the key of its first
+    if (c->key[idx] != 0) return false;
+    const dag_t *d = c->dag;
+    const task_t *t = d->tasks[idx];
+    const dag_inputs_t *in = d->inputs[idx];
+    bool usable = t->kind == TASK_CMD && d->freq[idx] == 0 && in != NULL;
+
+    uint64_t h = 1469598103934665603ULL;
+    const char *what = t->kind == TASK_CMD ? t->cmd : t->id;
+    h = fnv(h, what, strlen(what) + 1);
+    for (uint32_t k = 0; in && k < in->n; ++k) {
+        struct stat st;
+        h = fnv(h, in->path[k], strlen(in->path[k]) + 1);
+        if (stat(in->path[k], &st) != 0) {
+            usable = false;
+            h = fnv(h, &c->nonce, sizeof(c->nonce));
+            continue;
+        }
+        uint64_t meta[4] = { (uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec, (uint64_t)st.st_ino };
+        h = fnv(h, meta, sizeof(meta));
+    }
+    // Summed so the order edges were added in doesn't matter; a predecessor completed by an
+    // earlier, interrupted run has no key and forces a rerun
+    uint64_t preds = 0;
+    for (uint32_t k = csr->roff[idx]; k < csr->roff[idx + 1]; ++k) {
+        uint64_t pk = c->key[csr->radj[k]];
+        preds += mix(pk ? pk : c->nonce);
+    }
+    h = fnv(h, &preds, sizeof(preds));
+    if (h == 0) h = 1;
+
+    c->key[idx] = h;
+    c->usable[idx] = usable;
+    if (usable && c->done[idx] == h) {
+        atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+        return true;
+    }
+    // The task runs now; if it fails its outputs may be half written
+    c->done[idx] = 0;
+    return false;
+}
+
+void cache_finished(sched_cache_t *c, size_t idx) {
+    if (c->usable[idx]) c->done[idx] = c->key[idx];
+}
+
+int cache_save(sched_cache_t *c) {
+    for (size_t i = 0; i < c->n_tasks; ++i) {
+        if (c->entry[i] != SIZE_MAX) {
+            c->entries[c->entry[i]].key = c->done[i];
+        } else if (c->done[i] != 0) {
+            if (add_entry(c, c->dag->tasks[i]->id, c->done[i]) != 0) return -2;
+            c->entry[i] = c->n_entries - 1;
+        }
+    }
+
+    // Written next to the target and renamed over it, so a crash never leaves half a cache
+    size_t plen = strlen(c->path);
+    char *tmp = malloc(plen + 5);
+    if (!tmp) return -2;
+    memcpy(tmp, c->path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        free(tmp);
+        return -1;
+    }
+    int err = fprintf(f, "%s\n", CACHE_MAGIC) < 0 ? -1 : 0;
+    for (size_t e = 0; e < c->n_entries && !err; ++e) {
+        if (c->entries[e].key == 0) continue;
+        if (fprintf(f, "%016llx %s\n", (unsigned long long)c->entries[e].key, c->entries[e].id) < 0) err = -1;
+    }
+    if (!err && (fflush(f) != 0 || fsync(fileno(f)) != 0)) err = -1;
+    if (fclose(f) != 0 && !err) err = -1;
+    if (!err && rename(tmp, c->path) != 0) err = -1;
+    if (err) unlink(tmp);
+    free(tmp);
+    return err;
+}
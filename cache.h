@@ -0,0 +1,72 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "dag_manager.h"
+
+// Result cache: skips tasks whose inputs haven't changed since they last succeeded
+//
+// When a task is dispatched its key is computed from its command, the size, mtime and
+// inode of every input file it declares and the keys of its predecessors, so a change
+// anywhere upstream changes every key below it. A task whose key matches the one its
+// last successful run had is marked COMPLETED without being started, the way make
+// skips up-to-date targets
+// Only one-shot command tasks that declare inputs are ever skipped; the others always run
+// and their keys only feed their successors'. A task with an input that doesn't exist
+// runs, and its successors run too
+//
+// The file keeps one line per task, "<key in hex> <id>", after a "GTCACHE 1" line, and is
+// rewritten through a temporary file when a run's scheduler stops
+
+#define CACHE_MAGIC "GTCACHE 1"
+
+typedef struct {
+    char    *id;
+    uint64_t key; // of the task's last successful run, 0 once it ran again without succeeding
+} cache_entry_t;
+
+typedef struct {
+    char          *path;
+    cache_entry_t *entries; // everything the file holds, plus tasks that succeeded since
+    size_t         n_entries, entries_cap;
+
+    // State of the current run, set up by cache_prepare; each slot is written only by the
+    // thread dispatching (then finishing) that task
+    dag_t         *dag;
+    size_t         n_tasks;
+    uint64_t      *key; // key of each task this run, 0 until it is first dispatched
+    uint64_t      *done; // key of each task's last successful run, 0 if none or if it ran since
+    size_t        *entry; // entry of each task, SIZE_MAX if it has none yet
+    bool          *usable; // the task can be skipped next time if this run succeeds
+    uint64_t       nonce; // stands in for keys that can't be known, so they never match
+    atomic_uint_least64_t hits; // tasks skipped this run
+    int            err; // result of writing the file, set by sched_stop
+} sched_cache_t;
+
+// Reads the cache at path; a file that doesn't exist yet counts as an empty cache
+// Returns 0 on success, -1 if the file can't be read, -2 on memory allocation failure,
+// -4 if it is not a cache file
+int cache_open(sched_cache_t *c, const char *path);
+
+void cache_free(sched_cache_t *c);
+
+// Matches the cache's entries to the tasks of d for a run; called by sched_start
+// Returns 0 on success or -2 on memory allocation failure
+int cache_prepare(sched_cache_t *c, dag_t *d);
+
+// Computes the key of task idx, whose predecessors have all completed
+// Returns true if the task is up to date and can be skipped; otherwise its last
+// successful run is forgotten until this one succeeds
+bool cache_check(sched_cache_t *c, const dag_csr_t *csr, size_t idx);
+
+// Records that task idx succeeded this run
+void cache_finished(sched_cache_t *c, size_t idx);
+
+// Writes the keys of every task that last succeeded to the file; call once the run is over
+// Returns 0 on success, -1 on I/O error, -2 on memory allocation failure
+int cache_save(sched_cache_t *c);
+
+#endif
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "capture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+// Splices done for one stream before the I/O thread moves on to the others
+#define CAPTURE_ROUNDS 16
+
+int capture_init(sched_capture_t *c, const char *dir, const dag_t *d, size_t n_tasks) {
+    memset(c, 0, sizeof(*c));
+    c->epfd = c->evfd = -1;
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+    c->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (c->dirfd < 0) return -1;
+    c->dir = strdup(dir);
+    c->tasks = malloc((n_tasks ? n_tasks : 1) * sizeof(capture_task_t));
+    if (!c->dir || !c->tasks || pthread_mutex_init(&c->mu, NULL) != 0) {
+        free(c->dir);
+        free(c->tasks);
+        close(c->dirfd);
+        return -2;
+    }
+    for (size_t i = 0; i < n_tasks; ++i) c->tasks[i] = (capture_task_t){ .fd = -1 };
+    c->dag = d;
+    c->n_tasks = n_tasks;
+    atomic_init(&c->bytes, 0);
+    return 0;
+}
+
+void capture_free(sched_capture_t *c) {
+    for (size_t i = 0; i < c->n_tasks; ++i) free(c->tasks[i].tail);
+    free(c->tasks);
+    free(c->dir);
+    close(c->dirfd);
+    pthread_mutex_destroy(&c->mu);
+    memset(c, 0, sizeof(*c));
+}
+
+// Opens <id>.log, truncating it the first time in this run; on failure output is dropped
+static void open_log(sched_capture_t *c, capture_task_t *t, size_t idx) {
+    char name[NAME_MAX + 1];
+    const char *id = c->dag->tasks[idx]->id;
+    size_t len = strlen(id);
+    if (len + 4 > NAME_MAX) {
+        c->err = -1;
+        return;
+    }
+    // IDs are free-form, but a log must stay inside the directory
+    for (size_t i = 0; i < len; ++i) name[i] = id[i] == '/' ? '_' : id[i];
+    memcpy(name + len, ".log", 5);
+    t->fd = openat(c->dirfd, name, O_RDWR | O_CREAT | O_CLOEXEC | (t->opened ? 0 : O_TRUNC), 0666);
+    if (t->fd < 0) {
+        c->err = -1;
+        return;
+    }
+    if (!t->opened) t->size = 0;
+    t->opened = true;
+}
+
+// Moves what is in st's pipe to the log, through user space only where splice isn't
+// supported (or the log can't be written, in which case the output is dropped)
+// Returns the bytes taken from the pipe, 0 at end of file, -1 with errno set otherwise
+static ssize_t move_out(sched_capture_t *c, capture_task_t *t, int fd) {
+    if (t->fd >= 0) {
+        loff_t off = (loff_t)t->size;
+        ssize_t r = splice(fd, NULL, t->fd, &off, CAPTURE_SPLICE_MAX, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (r >= 0) {
+            t->size += (uint64_t)r;
+            return r;
+        }
+        if (errno == EAGAIN || errno == EINTR) return -1;
+    }
+    char buf[65536];
+    ssize_t r = read(fd, buf, sizeof(buf));
+    if (r <= 0) return r;
+    if (t->fd >= 0) {
+        for (ssize_t done = 0; done < r;) {
+            ssize_t w = pwrite(t->fd, buf + done, (size_t)(r - done), (off_t)t->size);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                c->err = -1;
+                return r;
+            }
+            done += w;
+            t->size += (uint64_t)w;
+        }
+    }
+    return r;
+}
+
+// The child is gone: keeps the end of its log in memory, then closes everything
+static void finish_stream(sched_capture_t *c, capture_stream_t *st) {
+    capture_task_t *t = &c->tasks[st->task];
+    if (t->fd >= 0) {
+        char buf[CAPTURE_TAIL_BYTES];
+        size_t want = t->size < CAPTURE_TAIL_BYTES ? (size_t)t->size : CAPTURE_TAIL_BYTES;
+        ssize_t got = pread(t->fd, buf, want, (off_t)(t->size - want));
+        char *tail = t->tail ? t->tail : malloc(CAPTURE_TAIL_BYTES);
+        pthread_mutex_lock(&c->mu);
+        if (tail && got >= 0) {
+            memcpy(tail, buf, (size_t)got);
+            t->tail = tail;
+            t->tail_len = (size_t)got;
+        }
+        pthread_mutex_unlock(&c->mu);
+        close(t->fd);
+        t->fd = -1;
+    }
+    // Deregistered explicitly: a child being spawned right now may hold a copy of the fd
+    epoll_ctl(c->epfd, EPOLL_CTL_DEL, st->fd, NULL);
+    close(st->fd);
+    pthread_mutex_lock(&c->mu);
+    if (st->prev) st->prev->next = st->next;
+    else c->streams = st->next;
+    if (st->next) st->next->prev = st->prev;
+    pthread_mutex_unlock(&c->mu);
+    free(st);
+}
+
+// Returns true once the stream is finished and freed
+static bool drain(sched_capture_t *c, capture_stream_t *st) {
+    capture_task_t *t = &c->tasks[st->task];
+    // Done here rather than at launch, which costs the workers nothing
+    if (!st->nonblock) {
+        int fl = fcntl(st->fd, F_GETFL);
+        if (fl >= 0) fcntl(st->fd, F_SETFL, fl | O_NONBLOCK);
+        st->nonblock = true;
+    }
+    if (t->fd < 0) open_log(c, t, st->task);
+    for (int k = 0; k < CAPTURE_ROUNDS; ++k) {
+        ssize_t r = move_out(c, t, st->fd);
+        if (r > 0) {
+            atomic_fetch_add_explicit(&c->bytes, (uint64_t)r, memory_order_relaxed);
+            continue;
+        }
+        // Nothing left for now
+        if (r < 0 && (errno == EAGAIN || errno == EINTR)) return false;
+        finish_stream(c, st);
+        return true;
+    }
+    return false;
+}
+
+// I/O thread: drains pipes as they become readable; once told to finish, makes one more
+// pass without waiting and leaves the streams it didn't get to to capture_stop
+static void *capture_loop(void *arg) {
+    sched_capture_t *c = arg;
+    struct epoll_event ev[64];
+    bool finishing = false;
+    while (1) {
+        int n = epoll_wait(c->epfd, ev, 64, finishing ? 0 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        bool last = finishing;
+        for (int i = 0; i < n; ++i) {
+            if (!ev[i].data.ptr) finishing = true;
+            else drain(c, ev[i].data.ptr);
+        }
+        if (last) break;
+    }
+    return NULL;
+}
+
+int capture_start(sched_capture_t *c) {
+    c->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (c->epfd < 0) return -1;
+    c->evfd = eventfd(0, EFD_CLOEXEC);
+    if (c->evfd < 0) goto fail_ep;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->evfd, &ev) != 0) goto fail_ev;
+    if (pthread_create(&c->thread, NULL, capture_loop, c) != 0) goto fail_ev;
+    c->running = true;
+    return 0;
+
+fail_ev:
+    close(c->evfd);
+    c->evfd = -1;
+fail_ep:
+    close(c->epfd);
+    c->epfd = -1;
+    return -1;
+}
+
+void capture_stop(sched_capture_t *c) {
+    if (!c->running) return;
+    uint64_t one = 1;
+    while (write(c->evfd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    pthread_join(c->thread, NULL);
+    c->running = false;
+    // Each remaining stream is read until it is empty, which takes the rest of an exited
+    // child's output; one still open after that is held by a process the task left behind
+    while (c->streams) {
+        capture_stream_t *st = c->streams;
+        if (!drain(c, st)) finish_stream(c, st);
+    }
+    close(c->evfd);
+    close(c->epfd);
+    c->evfd = c->epfd = -1;
+}
+
+capture_stream_t *capture_open(sched_capture_t *c, size_t idx, int *out_fd) {
+    if (idx >= c->n_tasks) return NULL;
+    capture_stream_t *st = malloc(sizeof(capture_stream_t));
+    if (!st) return NULL;
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) != 0) {
+        free(st);
+        return NULL;
+    }
+    st->fd = p[0];
+    st->task = idx;
+    st->nonblock = false;
+    *out_fd = p[1];
+    return st;
+}
+
+void capture_launched(sched_capture_t *c, capture_stream_t *st, int out_fd, bool started) {
+    close(out_fd);
+    if (started) {
+        // Listed first: the I/O thread may finish the stream as soon as it is in the epoll set
+        pthread_mutex_lock(&c->mu);
+        st->prev = NULL;
+        st->next = c->streams;
+        if (c->streams) c->streams->prev = st;
+        c->streams = st;
+        pthread_mutex_unlock(&c->mu);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = st };
+        if (epoll_ctl(c->epfd, EPOLL_CTL_ADD, st->fd, &ev) == 0) return;
+        pthread_mutex_lock(&c->mu);
+        if (st->prev) st->prev->next = st->next;
+        else c->streams = st->next;
+        if (st->next) st->next->prev = st->prev;
+        pthread_mutex_unlock(&c->mu);
+    }
+    close(st->fd);
+    free(st);
+}
+
+size_t capture_tail(sched_capture_t *c, size_t idx, char *buf) {
+    if (idx >= c->n_tasks) return 0;
+    pthread_mutex_lock(&c->mu);
+    size_t n = c->tasks[idx].tail_len;
+    if (n) memcpy(buf, c->tasks[idx].tail, n);
+    pthread_mutex_unlock(&c->mu);
+    return n;
+}
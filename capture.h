@@ -0,0 +1,82 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "dag_manager.h"
+
+// Captured output of task commands, one log file per task
+//
+// Every child's stdout and stderr go to a pipe of its own instead of the scheduler's
+// terminal. One I/O thread waits on all the pipes in an epoll set and moves what shows
+// up into <dir>/<id>.log with splice(), so the bytes go from the pipe to the page cache
+// without passing through user space. When a child's pipe closes, the last
+// CAPTURE_TAIL_BYTES of its log are kept in memory for 'show tail'
+//
+// Launching only adds a pipe2() and an epoll_ctl() next to the spawn itself; log files
+// are opened by the I/O thread when output first arrives, truncated once per run and
+// closed again whenever no child is writing to them
+
+#define CAPTURE_TAIL_BYTES 4096 // output kept in memory per task
+#define CAPTURE_SPLICE_MAX (1u << 20) // most bytes moved by one splice() call
+
+// A running child's pipe; lives from the spawn until the I/O thread sees it close
+typedef struct capture_stream {
+    int                    fd; // read end
+    size_t                 task; // slot in the DAG
+    bool                   nonblock; // set by the I/O thread the first time it reads
+    struct capture_stream *prev, *next; // in the capture's list of open streams
+} capture_stream_t;
+
+typedef struct {
+    int      fd; // log file, open only while a stream of the task is being drained
+    bool     opened; // the log file was created (and truncated) in this run
+    uint64_t size; // bytes in the log file
+    char    *tail; // last output, CAPTURE_TAIL_BYTES allocated on first use
+    size_t   tail_len;
+} capture_task_t;
+
+typedef struct {
+    char            *dir;
+    int              dirfd;
+    const dag_t     *dag; // names the log files
+    size_t           n_tasks;
+    capture_task_t  *tasks; // owned by the I/O thread, except tail under mu
+    int              epfd; // epoll set of every open stream plus evfd
+    int              evfd; // eventfd that tells the I/O thread to finish
+    pthread_t        thread;
+    bool             running; // the I/O thread was started
+    pthread_mutex_t  mu; // guards streams and every tail
+    capture_stream_t *streams;
+    atomic_uint_least64_t bytes; // captured so far
+    int              err; // 0, or -1 once some output could not be written to its log
+} sched_capture_t;
+
+// Sets up capture of up to n_tasks tasks of d into dir, creating the directory if needed
+// Returns 0 on success, -1 if dir can't be created or opened, -2 on memory allocation failure
+int capture_init(sched_capture_t *c, const char *dir, const dag_t *d, size_t n_tasks);
+
+// Starts the I/O thread; returns 0 on success or -1
+int capture_start(sched_capture_t *c);
+
+// Drains whatever the children have written, stops the I/O thread and closes every pipe;
+// a pipe still held open by a child's own background process is cut off here
+void capture_stop(sched_capture_t *c);
+
+// Releases everything, the tails included; the I/O thread must be stopped
+void capture_free(sched_capture_t *c);
+
+// Makes a pipe for the child about to run task idx and stores its write end in out_fd,
+// which the child's stdout and stderr are pointed at
+// Returns the stream to hand to capture_launched, or NULL (output is then not captured)
+capture_stream_t *capture_open(sched_capture_t *c, size_t idx, int *out_fd);
+
+// Closes the parent's write end and, if the child started, hands the stream to the I/O thread
+void capture_launched(sched_capture_t *c, capture_stream_t *st, int out_fd, bool started);
+
+// Copies task idx's last output (up to CAPTURE_TAIL_BYTES) into buf and returns its length
+size_t capture_tail(sched_capture_t *c, size_t idx, char *buf);
+
+#endif
@@ -1,11 +1,84 @@
+#define _DEFAULT_SOURCE
 #include "dag_manager.h"
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
-static int ensure_capacity(dag_t *d) {
-    if (d->n_tasks < d->capacity) return 0;
-    size_t new_cap = d->capacity * 2;
-    
+// FNV-1a hash of a task ID, used to pick its bucket in the index
+static size_t hash_id(const char *id) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)id; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+// Placing a task slot into the index using linear probing
+static void index_insert(size_t *index, size_t index_cap, const char *id, size_t slot) {
+    size_t mask = index_cap - 1;
+    size_t b = hash_id(id) & mask;
+    while (index[b] != 0) b = (b + 1) & mask;
+    index[b] = slot + 1;
+}
+
+// Rebuilding the index for the first n_indexed tasks
+static int rebuild_index(dag_t *d, size_t index_cap, size_t n_indexed) {
+    size_t *new_index = calloc(index_cap, sizeof(size_t));
+    if (!new_index) return -2;
+    for (size_t i = 0; i < n_indexed; ++i) {
+        index_insert(new_index, index_cap, d->tasks[i]->id, i);
+    }
+    free(d->index);
+    d->index = new_index;
+    d->index_cap = index_cap;
+    return 0;
+}
+
+// Dependency lists hold a power-of-two number of slots, so a list only
+// needs to grow when its count goes past the next power of two
+static size_t deps_slots(size_t n) {
+    size_t cap = 1;
+    while (cap < n) cap <<= 1;
+    return n == 0 ? 0 : cap;
+}
+
+// Whether a dependency list lives in the shared block filled by dag_snapshot_load
+static bool in_deps_block(const dag_t *d, const size_t *row) {
+    uintptr_t p = (uintptr_t)row, lo = (uintptr_t)d->deps_block;
+    return d->deps_block && p >= lo && p < lo + d->deps_block_len * sizeof(size_t);
+}
+
+// Making sure task u has room for new_count dependencies
+static int deps_reserve(dag_t *d, size_t u, size_t new_count) {
+    size_t need = deps_slots(new_count);
+    if (in_deps_block(d, d->deps[u])) {
+        // Rows in the shared block are packed exactly, so the first addition moves the row out
+        size_t *new_arr = malloc(need * sizeof(size_t));
+        if (!new_arr) return -2;
+        memcpy(new_arr, d->deps[u], d->n_deps[u] * sizeof(size_t));
+        d->deps[u] = new_arr;
+        return 0;
+    }
+    if (need <= deps_slots(d->n_deps[u])) return 0;
+    size_t *new_arr = realloc(d->deps[u], need * sizeof(size_t));
+    if (!new_arr) return -2;
+    d->deps[u] = new_arr;
+    return 0;
+}
+
+// Growing one of the per-task size_t arrays to new_cap entries
+static int grow_slots(size_t **arr, size_t new_cap) {
+    size_t *p = realloc(*arr, new_cap * sizeof(size_t));
+    if (!p) return -2;
+    *arr = p;
+    return 0;
+}
+
+// Growing every per-task array to new_cap slots
+static int grow_to(dag_t *d, size_t new_cap) {
     task_t **new_tasks = realloc(d->tasks, new_cap * sizeof(task_t*));
     if (!new_tasks) return -2;
     d->tasks = new_tasks;
@@ -14,18 +87,67 @@ static int ensure_capacity(dag_t *d) {
     if (!new_deps) return -2;
     d->deps = new_deps;
 
-    size_t *new_n_deps = realloc(d->n_deps, new_cap * sizeof(size_t));
-    if (!new_n_deps) return -2;
-    d->n_deps = new_n_deps;
+    if (grow_slots(&d->n_deps, new_cap) != 0) return -2;
+    if (grow_slots(&d->topo_pos, new_cap) != 0) return -2;
+    if (grow_slots(&d->topo_node, new_cap) != 0) return -2;
+    if (grow_slots(&d->mark, new_cap) != 0) return -2;
+    if (grow_slots(&d->stack, new_cap) != 0) return -2;
+    atomic_uchar *new_status = realloc(d->status, new_cap * sizeof(atomic_uchar));
+    if (!new_status) return -2;
+    d->status = new_status;
+    time_t *new_time = realloc(d->time, new_cap * sizeof(time_t));
+    if (!new_time) return -2;
+    d->time = new_time;
+    int *new_freq = realloc(d->freq, new_cap * sizeof(int));
+    if (!new_freq) return -2;
+    d->freq = new_freq;
+    double *new_cost = realloc(d->cost, new_cap * sizeof(double));
+    if (!new_cost) return -2;
+    d->cost = new_cost;
+    dag_needs_t **new_needs = realloc(d->needs, new_cap * sizeof(dag_needs_t *));
+    if (!new_needs) return -2;
+    d->needs = new_needs;
+    dag_inputs_t **new_inputs = realloc(d->inputs, new_cap * sizeof(dag_inputs_t *));
+    if (!new_inputs) return -2;
+    d->inputs = new_inputs;
 
     for (size_t i = d->capacity; i < new_cap; ++i) {
         d->deps[i] = NULL;
         d->n_deps[i] = 0;
+        d->mark[i] = 0;
     }
+
+    // Rehashing every task so the index stays at most half full
+    // (tasks of an uncommitted bulk build are indexed by the commit)
+    size_t n_indexed = d->bulk ? d->bulk->base : d->n_tasks;
+    if (rebuild_index(d, new_cap * 2, n_indexed) != 0) return -2;
     d->capacity = new_cap;
     return 0;
 }
 
+static int ensure_capacity(dag_t *d) {
+    if (d->n_tasks < d->capacity) return 0;
+    return grow_to(d, d->capacity * 2);
+}
+
+int dag_reserve(dag_t *d, size_t n) {
+    if (!d) return -2;
+    size_t new_cap = d->capacity;
+    while (new_cap < n) new_cap *= 2;
+    if (new_cap == d->capacity) return 0;
+    return grow_to(d, new_cap);
+}
+
+// Filling in the dense scheduling state of a task that is taking slot i
+static void set_hot_state(dag_t *d, size_t i, const task_t *t) {
+    atomic_init(&d->status[i], (unsigned char)PENDING);
+    d->time[i] = t->time;
+    d->freq[i] = t->freq;
+    d->cost[i] = 0;
+    d->needs[i] = NULL;
+    d->inputs[i] = NULL;
+}
+
 // An empty DAG has been created and initialized
 dag_t *dag_init(void) {
     dag_t *d = malloc(sizeof(dag_t));
@@ -34,15 +156,66 @@ dag_t *dag_init(void) {
     d->tasks = malloc(DAG_INITIAL_CAPACITY * sizeof(task_t*));
     d->deps  = malloc(DAG_INITIAL_CAPACITY * sizeof(size_t*));
     d->n_deps = calloc(DAG_INITIAL_CAPACITY, sizeof(size_t));
-    if (!d->tasks || !d->deps || !d->n_deps) {
+    d->index = calloc(DAG_INITIAL_CAPACITY * 2, sizeof(size_t));
+    d->topo_pos  = malloc(DAG_INITIAL_CAPACITY * sizeof(size_t));
+    d->topo_node = malloc(DAG_INITIAL_CAPACITY * sizeof(size_t));
+    d->mark  = calloc(DAG_INITIAL_CAPACITY, sizeof(size_t));
+    d->stack = malloc(DAG_INITIAL_CAPACITY * sizeof(size_t));
+    d->status = malloc(DAG_INITIAL_CAPACITY * sizeof(atomic_uchar));
+    d->time = malloc(DAG_INITIAL_CAPACITY * sizeof(time_t));
+    d->freq = malloc(DAG_INITIAL_CAPACITY * sizeof(int));
+    d->cost = malloc(DAG_INITIAL_CAPACITY * sizeof(double));
+    d->needs = malloc(DAG_INITIAL_CAPACITY * sizeof(dag_needs_t *));
+    d->inputs = malloc(DAG_INITIAL_CAPACITY * sizeof(dag_inputs_t *));
+    if (!d->tasks || !d->deps || !d->n_deps || !d->index ||
+        !d->topo_pos || !d->topo_node || !d->mark || !d->stack ||
+        !d->status || !d->time || !d->freq || !d->cost || !d->needs || !d->inputs) {
+        free(d->tasks);
+        free(d->deps);
+        free(d->n_deps);
+        free(d->index);
+        free(d->topo_pos);
+        free(d->topo_node);
+        free(d->mark);
+        free(d->stack);
+        free(d->status);
+        free(d->time);
+        free(d->freq);
+        free(d->cost);
+        free(d->needs);
+        free(d->inputs);
+        free(d);
+        return NULL;
+    }
+    if (strtab_init(&d->strings) != 0) {
         free(d->tasks);
         free(d->deps);
         free(d->n_deps);
+        free(d->index);
+        free(d->topo_pos);
+        free(d->topo_node);
+        free(d->mark);
+        free(d->stack);
+        free(d->status);
+        free(d->time);
+        free(d->freq);
+        free(d->cost);
+        free(d->needs);
+        free(d->inputs);
         free(d);
         return NULL;
     }
+    arena_init(&d->arena);
+    d->deps_block = NULL;
+    d->deps_block_len = 0;
+    d->snapshot = NULL;
+    d->snapshot_len = 0;
+    d->n_pools = 0;
+    d->mark_epoch = 0;
+    d->bulk = NULL;
     d->n_tasks = 0;
     d->capacity = DAG_INITIAL_CAPACITY;
+    d->index_cap = DAG_INITIAL_CAPACITY * 2;
     for (size_t i = 0; i < d->capacity; ++i) d->deps[i] = NULL;
     return d;
 }
@@ -50,8 +223,10 @@ dag_t *dag_init(void) {
 // Looking for the index of a task by its ID string
 int dag_find_index(dag_t *d, const char *id) {
     if (!d || !id) return -1;
-    for (size_t i = 0; i < d->n_tasks; ++i) {
-        if (strcmp(d->tasks[i]->id, id) == 0) return (int)i;
+    size_t mask = d->index_cap - 1;
+    for (size_t b = hash_id(id) & mask; d->index[b] != 0; b = (b + 1) & mask) {
+        size_t slot = d->index[b] - 1;
+        if (strcmp(d->tasks[slot]->id, id) == 0) return (int)slot;
     }
     return -1;
 }
@@ -69,10 +244,219 @@ int dag_add_task(dag_t *d, task_t *t) {
     d->tasks[d->n_tasks] = t;
     d->deps[d->n_tasks]  = NULL;
     d->n_deps[d->n_tasks] = 0;
+    set_hot_state(d, d->n_tasks, t);
+    index_insert(d->index, d->index_cap, t->id, d->n_tasks);
+    // New tasks have no edges yet, so they can go at the end of the order
+    d->topo_pos[d->n_tasks]  = d->n_tasks;
+    d->topo_node[d->n_tasks] = d->n_tasks;
     d->n_tasks++;
     return 0;
 }
 
+void dag_reset_status(dag_t *d) {
+    if (!d) return;
+    for (size_t i = 0; i < d->n_tasks; ++i) dag_set_status(d, i, PENDING);
+}
+
+int dag_mark_downstream(dag_t *d, size_t i, bool *mark, size_t *n_marked) {
+    if (!d || i >= d->n_tasks || d->bulk) return -1;
+    // Depth-first over the successor lists, with the cycle check's scratch stack
+    size_t n = 0, top = 0;
+    if (!mark[i]) {
+        mark[i] = true;
+        n++;
+        d->stack[top++] = i;
+    }
+    while (top > 0) {
+        size_t u = d->stack[--top];
+        for (size_t k = 0; k < d->n_deps[u]; ++k) {
+            size_t v = d->deps[u][k];
+            if (mark[v]) continue;
+            mark[v] = true;
+            n++;
+            d->stack[top++] = v;
+        }
+    }
+    if (n_marked) *n_marked = n;
+    return 0;
+}
+
+void dag_count_status(const dag_t *d, size_t counts[4]) {
+    counts[PENDING] = counts[RUNNING] = counts[COMPLETED] = counts[FAILED] = 0;
+    if (!d) return;
+    for (size_t i = 0; i < d->n_tasks; ++i) {
+        counts[atomic_load_explicit(&d->status[i], memory_order_relaxed)]++;
+    }
+}
+
+int dag_find_pool(const dag_t *d, const char *name) {
+    if (!d || !name) return -1;
+    for (size_t p = 0; p < d->n_pools; ++p) {
+        if (strcmp(d->pool_name[p], name) == 0) return (int)p;
+    }
+    return -1;
+}
+
+int dag_set_pool(dag_t *d, const char *name, uint64_t capacity) {
+    if (!d || !name) return -2;
+    if (capacity == 0) return -1;
+    int p = dag_find_pool(d, name);
+    if (p < 0) {
+        if (d->n_pools == DAG_MAX_POOLS) return -3;
+        char *copy = arena_strdup(&d->arena, name);
+        if (!copy) return -2;
+        p = (int)d->n_pools++;
+        d->pool_name[p] = copy;
+    }
+    d->pool_cap[p] = capacity;
+    return p;
+}
+
+bool dag_parse_amount(const char *s, uint64_t *out) {
+    if (*s < '0' || *s > '9') return false;
+    uint64_t v = 0;
+    for (; *s >= '0' && *s <= '9'; ++s) {
+        if (v > (UINT64_MAX - 9) / 10) return false;
+        v = v * 10 + (uint64_t)(*s - '0');
+    }
+    unsigned shift = 0;
+    switch (*s) {
+      case '\0': break;
+      case 'K': shift = 10; break;
+      case 'M': shift = 20; break;
+      case 'G': shift = 30; break;
+      case 'T': shift = 40; break;
+      default: return false;
+    }
+    if (shift && *++s) return false;
+    if (v == 0 || v > (UINT64_MAX >> shift)) return false;
+    *out = v << shift;
+    return true;
+}
+
+int dag_parse_need(dag_t *d, const char *spec, dag_need_t *out) {
+    const char *eq = strchr(spec, '=');
+    if (!eq || eq == spec || eq - spec >= 64) return -1;
+    char name[64];
+    memcpy(name, spec, (size_t)(eq - spec));
+    name[eq - spec] = '\0';
+    uint64_t amount;
+    if (!dag_parse_amount(eq + 1, &amount)) return -1;
+
+    int p = dag_find_pool(d, name);
+    if (p < 0) {
+        // The two pools every machine has default to what this one has
+        long v = -1;
+        if (strcmp(name, "cpu") == 0) {
+            v = sysconf(_SC_NPROCESSORS_ONLN);
+        } else if (strcmp(name, "mem") == 0) {
+            long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+            if (pages > 0 && page > 0) v = pages * page;
+        }
+        if (v <= 0) return -3;
+        p = dag_set_pool(d, name, (uint64_t)v);
+        if (p < 0) return p == -2 ? -2 : -3;
+    }
+    out->pool = (uint32_t)p;
+    out->amount = amount;
+    return 0;
+}
+
+int dag_set_needs(dag_t *d, size_t i, const dag_need_t *needs, size_t n) {
+    if (!d || i >= d->n_tasks) return -1;
+    uint32_t seen = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (needs[k].pool >= d->n_pools || (seen >> needs[k].pool & 1) || needs[k].amount == 0) return -1;
+        seen |= 1u << needs[k].pool;
+    }
+    if (n == 0) {
+        d->needs[i] = NULL;
+        return 0;
+    }
+    dag_needs_t *r = arena_alloc(&d->arena, sizeof(dag_needs_t) + n * sizeof(dag_need_t), _Alignof(dag_needs_t));
+    if (!r) return -2;
+    r->n = (uint32_t)n;
+    memcpy(r->need, needs, n * sizeof(dag_need_t));
+    d->needs[i] = r;
+    return 0;
+}
+
+int dag_set_inputs(dag_t *d, size_t i, const char *const *paths, size_t n) {
+    if (!d || i >= d->n_tasks || n > UINT32_MAX) return -1;
+    for (size_t k = 0; k < n; ++k) {
+        if (!paths[k] || !paths[k][0]) return -1;
+    }
+    if (n == 0) {
+        d->inputs[i] = NULL;
+        return 0;
+    }
+    dag_inputs_t *in = arena_alloc(&d->arena, sizeof(dag_inputs_t) + n * sizeof(char *), _Alignof(dag_inputs_t));
+    if (!in) return -2;
+    for (size_t k = 0; k < n; ++k) {
+        in->path[k] = strtab_intern(&d->strings, &d->arena, paths[k]);
+        if (!in->path[k]) return -2;
+    }
+    in->n = (uint32_t)n;
+    d->inputs[i] = in;
+    return 0;
+}
+
+// Tasks from dag_new_task go away with the arena, everything else is freed piecemeal
+static void free_task(task_t *t) {
+    if (t->in_arena) return;
+    free(t->id);
+    free(t->cmd);
+    free(t);
+}
+
+task_t *dag_new_task(dag_t *d, const char *id, const char *cmd, time_t time, int freq) {
+    if (!d || !id || !cmd) return NULL;
+    task_t *t = arena_alloc(&d->arena, sizeof(task_t), _Alignof(task_t));
+    if (!t) return NULL;
+    t->id = arena_strdup(&d->arena, id);
+    t->cmd = strtab_intern(&d->strings, &d->arena, cmd);
+    if (!t->id || !t->cmd) return NULL;
+    t->kind     = TASK_CMD;
+    t->fn       = NULL;
+    t->arg      = NULL;
+    t->time     = time;
+    t->freq     = freq;
+    t->in_arena = true;
+    return t;
+}
+
+task_t *dag_new_fn_task(const char *id, task_fn_t fn, void *arg) {
+    task_t *t = malloc(sizeof(task_t));
+    if (!t) return NULL;
+    size_t len = strlen(id) + 1;
+    t->id = malloc(len);
+    if (!t->id) {
+        free(t);
+        return NULL;
+    }
+    memcpy(t->id, id, len);
+    t->kind   = TASK_FN;
+    t->cmd    = NULL;
+    t->fn     = fn;
+    t->arg    = arg;
+    t->time   = 0;
+    t->freq   = 0;
+    t->in_arena = false;
+    return t;
+}
+
+int dag_add_fn_task(dag_t *d, const char *id, task_fn_t fn, void *arg) {
+    if (!d || !id || !fn) return -2;
+    task_t *t = dag_new_fn_task(id, fn, arg);
+    if (!t) return -2;
+    int r = dag_add_task(d, t);
+    if (r != 0) {
+        free(t->id);
+        free(t);
+    }
+    return r;
+}
+
 // Using depth-first search, helper function is used to check for cycles
 static bool dfs_cycle(dag_t *d, size_t u, int *colors) {
     colors[u] = 1; // GRAY: Node has been marked as "visiting"
@@ -101,6 +485,42 @@ bool dag_detect_cycle(dag_t *d) {
     return has_cycle;
 }
 
+// Making room for edge from -> to in the topological order, where "to" currently sits before "from"
+// Only tasks positioned between the two are looked at: everything reachable from "to" inside
+// that window moves right after "from", keeping its relative order
+// Returns 0 on success or -1 if "from" is reachable from "to" (the edge would close a cycle)
+static int reorder_for_edge(dag_t *d, size_t from, size_t to) {
+    size_t lb = d->topo_pos[to], ub = d->topo_pos[from];
+    size_t epoch = ++d->mark_epoch;
+
+    // Forward search from "to", never leaving the window [lb, ub]
+    size_t top = 0;
+    d->stack[top++] = to;
+    d->mark[to] = epoch;
+    while (top > 0) {
+        size_t u = d->stack[--top];
+        for (size_t k = 0; k < d->n_deps[u]; ++k) {
+            size_t v = d->deps[u][k];
+            if (v == from) return -1;
+            if (d->topo_pos[v] < ub && d->mark[v] != epoch) {
+                d->mark[v] = epoch;
+                d->stack[top++] = v;
+            }
+        }
+    }
+
+    // Unreached tasks stay first, reached ones are shifted after them
+    size_t write = lb, n_moved = 0;
+    for (size_t p = lb; p <= ub; ++p) {
+        size_t w = d->topo_node[p];
+        if (d->mark[w] == epoch) d->stack[n_moved++] = w;
+        else d->topo_node[write++] = w;
+    }
+    for (size_t k = 0; k < n_moved; ++k) d->topo_node[write++] = d->stack[k];
+    for (size_t p = lb; p <= ub; ++p) d->topo_pos[d->topo_node[p]] = p;
+    return 0;
+}
+
 // Adding a dependency task "from" must happen before task "to"
 int dag_add_dep(dag_t *d, const char *from, const char *to) {
     int i = dag_find_index(d, from);
@@ -111,23 +531,197 @@ int dag_add_dep(dag_t *d, const char *from, const char *to) {
     for (size_t k = 0; k < d->n_deps[i]; ++k) {
         if (d->deps[i][k] == (size_t)j) return -2;
     }
-    // Adding new dependency
-    size_t new_count = d->n_deps[i] + 1;
-    size_t *new_arr = realloc(d->deps[i], new_count * sizeof(size_t));
-    if (!new_arr) return -1;
-    d->deps[i] = new_arr;
-    d->deps[i][d->n_deps[i]] = (size_t)j;
-    d->n_deps[i] = new_count;
-
-    // Checking for cycles after adding
-    if (dag_detect_cycle(d)) {
-        // undoing the addition
-        d->n_deps[i]--;
+
+    // Checking for cycles before anything is changed, so there is nothing to undo
+    if (i == j) return -3;
+    if (d->topo_pos[i] > d->topo_pos[j] && reorder_for_edge(d, (size_t)i, (size_t)j) != 0) {
         return -3;
     }
+
+    // Adding new dependency
+    if (deps_reserve(d, (size_t)i, d->n_deps[i] + 1) != 0) return -1;
+    d->deps[i][d->n_deps[i]++] = (size_t)j;
+    return 0;
+}
+
+int dag_bulk_begin(dag_t *d) {
+    if (!d) return -2;
+    if (d->bulk) return -1;
+    d->bulk = calloc(1, sizeof(dag_bulk_t));
+    if (!d->bulk) return -2;
+    d->bulk->base = d->n_tasks;
     return 0;
 }
 
+int dag_bulk_add_task(dag_t *d, task_t *t) {
+    if (!d || !t) return -2;
+    if (!d->bulk) return -1;
+    int cap_res = ensure_capacity(d);
+    if (cap_res != 0) return cap_res;
+    d->tasks[d->n_tasks] = t;
+    d->deps[d->n_tasks]  = NULL;
+    d->n_deps[d->n_tasks] = 0;
+    set_hot_state(d, d->n_tasks, t);
+    d->n_tasks++;
+    return 0;
+}
+
+// Copying an ID into the bulk name buffer, returning its offset through out_off
+static int bulk_push_name(dag_bulk_t *b, const char *id, size_t *out_off) {
+    size_t len = strlen(id) + 1;
+    if (b->names_len + len > b->names_cap) {
+        size_t new_cap = b->names_cap ? b->names_cap : 256;
+        while (new_cap < b->names_len + len) new_cap *= 2;
+        char *p = realloc(b->names, new_cap);
+        if (!p) return -2;
+        b->names = p;
+        b->names_cap = new_cap;
+    }
+    memcpy(b->names + b->names_len, id, len);
+    *out_off = b->names_len;
+    b->names_len += len;
+    return 0;
+}
+
+int dag_bulk_add_dep(dag_t *d, const char *from, const char *to) {
+    if (!d || !from || !to) return -2;
+    if (!d->bulk) return -1;
+    dag_bulk_t *b = d->bulk;
+    if (b->n_edges == b->edges_cap) {
+        size_t new_cap = b->edges_cap ? b->edges_cap * 2 : 64;
+        size_t *p = realloc(b->edges, new_cap * 2 * sizeof(size_t));
+        if (!p) return -2;
+        b->edges = p;
+        b->edges_cap = new_cap;
+    }
+    size_t off_from, off_to;
+    if (bulk_push_name(b, from, &off_from) != 0) return -2;
+    if (bulk_push_name(b, to, &off_to) != 0) return -2;
+    b->edges[2 * b->n_edges]     = off_from;
+    b->edges[2 * b->n_edges + 1] = off_to;
+    b->n_edges++;
+    return 0;
+}
+
+// Ordering resolved edges by source, then target, so repeats end up next to each other
+static int cmp_edge(const void *a, const void *b) {
+    const size_t *x = a, *y = b;
+    if (x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+    if (x[1] != y[1]) return x[1] < y[1] ? -1 : 1;
+    return 0;
+}
+
+static void bulk_release(dag_t *d) {
+    free(d->bulk->names);
+    free(d->bulk->edges);
+    free(d->bulk);
+    d->bulk = NULL;
+}
+
+// Putting the DAG back the way it was at dag_bulk_begin
+// old_counts holds the dependency count of every pre-existing task at begin, or NULL if
+// none of them has been touched yet
+static int bulk_rollback(dag_t *d, const size_t *old_counts, int err) {
+    size_t base = d->bulk->base;
+    for (size_t i = base; i < d->n_tasks; ++i) {
+        free_task(d->tasks[i]);
+        if (!in_deps_block(d, d->deps[i])) free(d->deps[i]);
+        d->deps[i] = NULL;
+        d->n_deps[i] = 0;
+    }
+    if (old_counts) {
+        for (size_t i = 0; i < base; ++i) d->n_deps[i] = old_counts[i];
+    }
+    d->n_tasks = base;
+    // Entries of the new tasks can't be removed one by one from a probing table,
+    // so the index is refilled in place with the tasks that remain
+    memset(d->index, 0, d->index_cap * sizeof(size_t));
+    for (size_t i = 0; i < base; ++i) index_insert(d->index, d->index_cap, d->tasks[i]->id, i);
+    bulk_release(d);
+    return err;
+}
+
+int dag_bulk_commit(dag_t *d) {
+    if (!d || !d->bulk) return -1;
+    dag_bulk_t *b = d->bulk;
+    size_t base = b->base;
+
+    // One pass over the new IDs, catching duplicates as they are indexed
+    for (size_t i = base; i < d->n_tasks; ++i) {
+        if (dag_find_index(d, d->tasks[i]->id) >= 0) return bulk_rollback(d, NULL, -4);
+        index_insert(d->index, d->index_cap, d->tasks[i]->id, i);
+    }
+
+    // Resolving edge endpoints in place, then sorting so repeated edges can be dropped
+    size_t *e = b->edges;
+    for (size_t k = 0; k < b->n_edges; ++k) {
+        int from = dag_find_index(d, b->names + e[2 * k]);
+        int to   = dag_find_index(d, b->names + e[2 * k + 1]);
+        if (from < 0 || to < 0) return bulk_rollback(d, NULL, -1);
+        if (from == to) return bulk_rollback(d, NULL, -3);
+        e[2 * k]     = (size_t)from;
+        e[2 * k + 1] = (size_t)to;
+    }
+    if (b->n_edges > 1) qsort(e, b->n_edges, 2 * sizeof(size_t), cmp_edge);
+
+    size_t *old_counts = malloc((base > 0 ? base : 1) * sizeof(size_t));
+    if (!old_counts) return bulk_rollback(d, NULL, -2);
+    memcpy(old_counts, d->n_deps, base * sizeof(size_t));
+
+    // Appending each source's edges with a single reservation per task
+    for (size_t k = 0; k < b->n_edges; ) {
+        size_t u = e[2 * k];
+        size_t end = k;
+        while (end < b->n_edges && e[2 * end] == u) end++;
+        if (deps_reserve(d, u, d->n_deps[u] + (end - k)) != 0) {
+            int r = bulk_rollback(d, old_counts, -2);
+            free(old_counts);
+            return r;
+        }
+        size_t existing = d->n_deps[u];
+        for (size_t m = k; m < end; ++m) {
+            size_t v = e[2 * m + 1];
+            if (m > k && v == e[2 * (m - 1) + 1]) continue;
+            bool dup = false;
+            for (size_t q = 0; q < existing && !dup; ++q) dup = d->deps[u][q] == v;
+            if (!dup) d->deps[u][d->n_deps[u]++] = v;
+        }
+        k = end;
+    }
+
+    // A single Kahn pass over the whole graph catches any cycle; it runs over a CSR copy
+    // of the edges, falling back to the dependency lists when indices don't fit 32 bits
+    size_t *order = NULL, n_order = 0;
+    dag_csr_t c;
+    int r = dag_csr_build(d, &c);
+    if (r == 0) {
+        r = dag_csr_toposort(&c, &order, &n_order);
+        dag_csr_free(&c);
+    } else if (r == -1) {
+        r = dag_toposort(d, &order, &n_order);
+    }
+    if (r != 0) {
+        r = bulk_rollback(d, old_counts, r == -1 ? -3 : -2);
+        free(old_counts);
+        return r;
+    }
+    free(old_counts);
+
+    // The Kahn order becomes the maintained topological order
+    for (size_t p = 0; p < n_order; ++p) {
+        d->topo_node[p] = order[p];
+        d->topo_pos[order[p]] = p;
+    }
+    free(order);
+    bulk_release(d);
+    return 0;
+}
+
+void dag_bulk_abort(dag_t *d) {
+    if (!d || !d->bulk) return;
+    bulk_rollback(d, NULL, 0);
+}
+
 // Performing Topological sort using Kahn's algorithm
 int dag_toposort(dag_t *d, size_t **out_order, size_t *out_n) {
     if (!d || !out_order || !out_n) return -2;
@@ -172,17 +766,359 @@ int dag_toposort(dag_t *d, size_t **out_order, size_t *out_n) {
     return 0;
 }
 
+// Building the forward and reverse CSR arrays in one allocation
+int dag_csr_build(dag_t *d, dag_csr_t *out) {
+    if (!d || !out) return -2;
+    size_t n = d->n_tasks, m = 0;
+    for (size_t u = 0; u < n; ++u) m += d->n_deps[u];
+    if (n >= UINT32_MAX || m >= UINT32_MAX) return -1;
+
+    uint32_t *mem = malloc((2 * (n + 1) + 2 * m) * sizeof(uint32_t));
+    if (!mem) return -2;
+    out->n = (uint32_t)n;
+    out->n_edges = (uint32_t)m;
+    out->off  = mem;
+    out->roff = mem + (n + 1);
+    out->adj  = mem + 2 * (n + 1);
+    out->radj = mem + 2 * (n + 1) + m;
+
+    // Forward rows are the dependency lists laid out back to back;
+    // counting in-degrees along the way for the reverse rows
+    memset(out->roff, 0, (n + 1) * sizeof(uint32_t));
+    uint32_t pos = 0;
+    for (size_t u = 0; u < n; ++u) {
+        out->off[u] = pos;
+        for (size_t k = 0; k < d->n_deps[u]; ++k) {
+            size_t v = d->deps[u][k];
+            out->adj[pos++] = (uint32_t)v;
+            out->roff[v + 1]++;
+        }
+    }
+    out->off[n] = pos;
+
+    // Prefix sums give the start of every reverse row, then each edge is placed
+    // using roff[v] as a cursor and the starts are shifted back afterwards
+    for (size_t v = 0; v < n; ++v) out->roff[v + 1] += out->roff[v];
+    for (size_t u = 0; u < n; ++u) {
+        for (uint32_t k = out->off[u]; k < out->off[u + 1]; ++k) {
+            out->radj[out->roff[out->adj[k]]++] = (uint32_t)u;
+        }
+    }
+    for (size_t v = n; v > 0; --v) out->roff[v] = out->roff[v - 1];
+    out->roff[0] = 0;
+    return 0;
+}
+
+// Kahn's algorithm over the CSR; the output array doubles as the work queue
+int dag_csr_toposort(const dag_csr_t *c, size_t **out_order, size_t *out_n) {
+    if (!c || !out_order || !out_n) return -2;
+    size_t n = c->n;
+    *out_n = n;
+    *out_order = malloc((n > 0 ? n : 1) * sizeof(size_t));
+    uint32_t *indegree = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    if (!*out_order || !indegree) {
+        free(*out_order);
+        free(indegree);
+        *out_order = NULL;
+        return -2;
+    }
+
+    size_t *order = *out_order;
+    size_t qt = 0;
+    for (size_t v = 0; v < n; ++v) {
+        indegree[v] = c->roff[v + 1] - c->roff[v];
+        if (indegree[v] == 0) order[qt++] = v;
+    }
+    for (size_t qh = 0; qh < qt; ++qh) {
+        size_t u = order[qh];
+        for (uint32_t k = c->off[u]; k < c->off[u + 1]; ++k) {
+            if (--indegree[c->adj[k]] == 0) order[qt++] = c->adj[k];
+        }
+    }
+    free(indegree);
+
+    // A cycle must exist, if we didn't process all tasks
+    if (qt < n) {
+        free(*out_order);
+        *out_order = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void dag_csr_upward_rank(const dag_csr_t *c, const size_t *order, const double *cost, double *rank) {
+    double known = 0;
+    size_t n_known = 0;
+    for (size_t i = 0; i < c->n; ++i) {
+        if (cost[i] > 0) {
+            known += cost[i];
+            n_known++;
+        }
+    }
+    double guess = n_known > 0 ? known / (double)n_known : 1.0;
+
+    // Successors come later in the order, so walking it backwards finds their ranks done
+    for (size_t p = c->n; p-- > 0; ) {
+        size_t u = order[p];
+        double longest = 0;
+        for (uint32_t k = c->off[u]; k < c->off[u + 1]; ++k) {
+            if (rank[c->adj[k]] > longest) longest = rank[c->adj[k]];
+        }
+        rank[u] = (cost[u] > 0 ? cost[u] : guess) + longest;
+    }
+}
+
+size_t dag_csr_chains(const dag_csr_t *c, const bool *fusable, uint32_t *next) {
+    size_t n_links = 0;
+    for (size_t u = 0; u < c->n; ++u) {
+        next[u] = UINT32_MAX;
+        if (!fusable[u] || c->off[u + 1] - c->off[u] != 1) continue;
+        uint32_t v = c->adj[c->off[u]];
+        if (!fusable[v] || c->roff[v + 1] - c->roff[v] != 1) continue;
+        next[u] = v;
+        n_links++;
+    }
+    return n_links;
+}
+
+#define LEVELS_MAX_THREADS 64
+#define LEVELS_PAR_MIN     4096 // narrower levels are expanded by one thread, and smaller graphs sorted by one
+
+typedef struct levels_job levels_job_t;
+
+typedef struct {
+    levels_job_t *job;
+    size_t        tid;
+    uint32_t     *buf; // tasks this thread freed for the next level
+    size_t        n_buf, cap;
+    pthread_t     thread;
+} levels_part_t;
+
+struct levels_job {
+    const dag_csr_t   *c;
+    dag_levels_t      *out;
+    _Atomic uint32_t  *indeg;
+    size_t             n_threads; // final once go is set
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond;
+    bool               go;
+    pthread_barrier_t  barrier;
+    size_t             lo, hi, lvl; // where a one-thread stretch left the frontier
+    atomic_bool        oom;
+    levels_part_t      part[LEVELS_MAX_THREADS];
+};
+
+static void levels_push(levels_part_t *p, uint32_t v) {
+    if (p->n_buf == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 1024;
+        uint32_t *b = realloc(p->buf, cap * sizeof(uint32_t));
+        if (!b) {
+            atomic_store(&p->job->oom, true);
+            return;
+        }
+        p->buf = b;
+        p->cap = cap;
+    }
+    p->buf[p->n_buf++] = v;
+}
+
+static void levels_sync(levels_job_t *j) {
+    if (j->n_threads > 1) pthread_barrier_wait(&j->barrier);
+}
+
+// Expands levels from order[lo] .. order[hi-1] on the calling thread while the other threads
+// wait, until the frontier is wide enough to split again or nothing is left
+static void levels_serial(levels_job_t *j, size_t *lo, size_t *hi, size_t *lvl) {
+    const dag_csr_t *c = j->c;
+    dag_levels_t *out = j->out;
+    while (*hi > *lo && (j->n_threads == 1 || *hi - *lo < LEVELS_PAR_MIN)) {
+        size_t tail = *hi;
+        for (size_t q = *lo; q < *hi; ++q) {
+            size_t u = out->order[q];
+            for (uint32_t k = c->off[u]; k < c->off[u + 1]; ++k) {
+                uint32_t v = c->adj[k];
+                // Nobody else is touching the counts, so no locked instruction is needed
+                uint32_t left = atomic_load_explicit(&j->indeg[v], memory_order_relaxed) - 1;
+                atomic_store_explicit(&j->indeg[v], left, memory_order_relaxed);
+                if (left == 0) {
+                    out->order[tail++] = v;
+                    out->level[v] = (uint32_t)*lvl;
+                }
+            }
+        }
+        *lo = *hi;
+        *hi = tail;
+        if (tail > *lo) out->start[++*lvl] = tail;
+    }
+}
+
+static void *levels_worker(void *arg) {
+    levels_part_t *p = arg;
+    levels_job_t *j = p->job;
+    const dag_csr_t *c = j->c;
+    dag_levels_t *out = j->out;
+    if (p->tid > 0) {
+        pthread_mutex_lock(&j->lock);
+        while (!j->go) pthread_cond_wait(&j->cond, &j->lock);
+        pthread_mutex_unlock(&j->lock);
+    }
+    size_t n_threads = j->n_threads, n = c->n;
+
+    // In-degrees come straight from the reverse rows; the roots found are the first level
+    for (size_t v = n * p->tid / n_threads; v < n * (p->tid + 1) / n_threads; ++v) {
+        uint32_t deg = c->roff[v + 1] - c->roff[v];
+        atomic_init(&j->indeg[v], deg);
+        if (deg == 0) levels_push(p, (uint32_t)v);
+    }
+
+    // Every thread tracks the frontier itself: they all see the same counts
+    size_t lo = 0, hi = 0, lvl = 0;
+    for (;;) {
+        levels_sync(j);
+        // Each thread copies what it freed behind the frontier, after the lower threads' finds
+        size_t at = hi, total = 0;
+        for (size_t t = 0; t < n_threads; ++t) {
+            if (t == p->tid) at = hi + total;
+            total += j->part[t].n_buf;
+        }
+        for (size_t k = 0; k < p->n_buf; ++k) {
+            out->order[at + k] = p->buf[k];
+            out->level[p->buf[k]] = (uint32_t)lvl;
+        }
+        if (total == 0 || atomic_load(&j->oom)) break;
+        lo = hi;
+        hi += total;
+        lvl++;
+        if (p->tid == 0) out->start[lvl] = hi;
+        // The counts have been read by everyone before any buffer is refilled
+        levels_sync(j);
+        p->n_buf = 0;
+
+        if (n_threads == 1 || hi - lo < LEVELS_PAR_MIN) {
+            if (p->tid == 0) {
+                levels_serial(j, &lo, &hi, &lvl);
+                j->lo = lo;
+                j->hi = hi;
+                j->lvl = lvl;
+            }
+            levels_sync(j);
+            lo = j->lo;
+            hi = j->hi;
+            lvl = j->lvl;
+            if (lo == hi) break;
+        }
+
+        size_t width = hi - lo;
+        for (size_t q = lo + width * p->tid / n_threads; q < lo + width * (p->tid + 1) / n_threads; ++q) {
+            size_t u = out->order[q];
+            for (uint32_t k = c->off[u]; k < c->off[u + 1]; ++k) {
+                uint32_t v = c->adj[k];
+                if (atomic_fetch_sub_explicit(&j->indeg[v], 1, memory_order_relaxed) == 1) levels_push(p, v);
+            }
+        }
+    }
+    if (p->tid == 0) out->n_levels = lvl;
+    return NULL;
+}
+
+int dag_csr_levels(const dag_csr_t *c, size_t n_threads, dag_levels_t *out) {
+    if (!c || !out) return -2;
+    memset(out, 0, sizeof(*out));
+    size_t n = c->n;
+    levels_job_t *j = calloc(1, sizeof(levels_job_t));
+    out->order = malloc((n > 0 ? n : 1) * sizeof(size_t));
+    out->start = malloc((n + 1) * sizeof(size_t));
+    out->level = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    _Atomic uint32_t *indeg = malloc((n > 0 ? n : 1) * sizeof(*indeg));
+    if (!j || !out->order || !out->start || !out->level || !indeg) {
+        free(j);
+        free(indeg);
+        dag_levels_free(out);
+        return -2;
+    }
+    out->start[0] = 0;
+    j->c = c;
+    j->out = out;
+    j->indeg = indeg;
+    atomic_init(&j->oom, false);
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->cond, NULL);
+
+    size_t want = n_threads > 0 ? n_threads : 1;
+    if (want > LEVELS_MAX_THREADS) want = LEVELS_MAX_THREADS;
+    if (want > n / LEVELS_PAR_MIN) want = n / LEVELS_PAR_MIN > 0 ? n / LEVELS_PAR_MIN : 1;
+    for (size_t t = 0; t < want; ++t) {
+        j->part[t].job = j;
+        j->part[t].tid = t;
+    }
+    // The calling thread is thread 0; the barrier is sized to however many could be started
+    size_t started = 1;
+    for (; started < want; ++started) {
+        if (pthread_create(&j->part[started].thread, NULL, levels_worker, &j->part[started]) != 0) break;
+    }
+    pthread_mutex_lock(&j->lock);
+    j->n_threads = started;
+    if (started > 1) pthread_barrier_init(&j->barrier, NULL, (unsigned)started);
+    j->go = true;
+    pthread_cond_broadcast(&j->cond);
+    pthread_mutex_unlock(&j->lock);
+    levels_worker(&j->part[0]);
+    for (size_t t = 1; t < started; ++t) pthread_join(j->part[t].thread, NULL);
+
+    int r = 0;
+    if (atomic_load(&j->oom)) r = -2;
+    // A cycle must exist, if we didn't reach all tasks
+    else if (out->start[out->n_levels] < n) r = -1;
+    if (started > 1) pthread_barrier_destroy(&j->barrier);
+    pthread_cond_destroy(&j->cond);
+    pthread_mutex_destroy(&j->lock);
+    for (size_t t = 0; t < started; ++t) free(j->part[t].buf);
+    free(j);
+    free(indeg);
+    if (r != 0) dag_levels_free(out);
+    return r;
+}
+
+void dag_levels_free(dag_levels_t *l) {
+    if (!l) return;
+    free(l->order);
+    free(l->start);
+    free(l->level);
+    memset(l, 0, sizeof(*l));
+}
+
+void dag_csr_free(dag_csr_t *c) {
+    if (!c) return;
+    free(c->off);
+    c->off = c->adj = c->roff = c->radj = NULL;
+    c->n = c->n_edges = 0;
+}
+
 // Freeing all memory associated with the DAG
 void dag_free(dag_t *d) {
     if (!d) return;
+    dag_bulk_abort(d);
     for (size_t i = 0; i < d->n_tasks; ++i) {
-        free(d->tasks[i]->id);
-        free(d->tasks[i]->cmd);
-        free(d->tasks[i]);
-        free(d->deps[i]);
+        free_task(d->tasks[i]);
+        if (!in_deps_block(d, d->deps[i])) free(d->deps[i]);
     }
+    free(d->deps_block);
+    if (d->snapshot) munmap(d->snapshot, d->snapshot_len);
     free(d->tasks);
     free(d->deps);
     free(d->n_deps);
+    free(d->index);
+    free(d->topo_pos);
+    free(d->topo_node);
+    free(d->mark);
+    free(d->stack);
+    free(d->status);
+    free(d->time);
+    free(d->freq);
+    free(d->cost);
+    free(d->needs);
+    free(d->inputs);
+    strtab_free(&d->strings);
+    arena_free(&d->arena);
     free(d);
 }
\ No newline at end of file
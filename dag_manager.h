@@ -3,23 +3,70 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
+#include <stdatomic.h>
+#include "arena.h"
 
 //Starting Size for the task list
 #define DAG_INITIAL_CAPACITY 16
 
+// Most resource pools one DAG can define
+#define DAG_MAX_POOLS 16
+
 // Different Task status enumeration
 typedef enum { PENDING, RUNNING, COMPLETED, FAILED } task_status_t;
 
+// What running a task means: a shell command in a child process, or a C function
+// called directly on the worker thread
+typedef enum { TASK_CMD, TASK_FN } task_kind_t;
+
+// Callback of a TASK_FN task; returns 0 on success, like a command's exit status
+typedef int (*task_fn_t)(void *arg);
+
 // It Represents a single task that can be scheduled and executed
+// Only the task's description lives here; once it is in a DAG, its scheduling state
+// (status, time, freq) is kept in the DAG's dense per-slot arrays
 typedef struct {
     char          *id; // unique name for the task
-    char          *cmd; // shell command this task will run
-    time_t         time; // when this task should run (in seconds)
-    int            freq; // how often it should repeat
-    task_status_t  status; // what is happening with this task right now
+    task_kind_t    kind; // TASK_CMD unless the task was created as a function task
+    char          *cmd; // shell command this task will run, NULL for TASK_FN
+    task_fn_t      fn; // function a TASK_FN task calls
+    void          *arg; // user data passed to fn, not owned by the task
+    time_t         time; // when this task should run (in seconds), copied into the DAG when added
+    int            freq; // how often it should repeat, copied into the DAG when added
+    bool           in_arena; // made by dag_new_task: lives in its DAG's arena and is never freed on its own
 } task_t;
 
+// Tokens of one resource pool that a task holds while it runs
+typedef struct {
+    uint32_t pool; // index into the DAG's pools
+    uint64_t amount;
+} dag_need_t;
+
+// Everything one task holds while it runs, each pool at most once; lives in the DAG's arena
+typedef struct {
+    uint32_t   n;
+    dag_need_t need[];
+} dag_needs_t;
+
+// Files a task reads, which the result cache hashes into the task's key; lives in the DAG's arena
+typedef struct {
+    uint32_t    n;
+    const char *path[];
+} dag_inputs_t;
+
+// Tasks and edges collected between dag_bulk_begin and dag_bulk_commit
+typedef struct {
+    size_t         base; // n_tasks when the bulk build started
+    char          *names; // endpoint IDs of pending edges, stored back to back with NUL terminators
+    size_t         names_len;
+    size_t         names_cap;
+    size_t        *edges; // pairs of offsets into names: from, to
+    size_t         n_edges;
+    size_t         edges_cap;
+} dag_bulk_t;
+
 // Directed Acyclic Graph structure to represents tasks and dependencies
 typedef struct {
     task_t       **tasks; // dynamic list of pointers to tasks
@@ -27,8 +74,60 @@ typedef struct {
     size_t         capacity; // Total space currently allocated for task 
     size_t       **deps;
     size_t        *n_deps;
+    atomic_uchar  *status; // task_status_t of each task, read and written through dag_status / dag_set_status
+    time_t        *time; // declared start delay of each task in seconds
+    int           *freq; // declared repeat period of each task in seconds, 0 for one-shot
+    double        *cost; // expected run time of each task in seconds, declared or learned from runs, 0 if unknown
+    dag_needs_t  **needs; // resources each task holds while it runs, NULL for none
+    dag_inputs_t **inputs; // files each task reads, NULL for none
+    char          *pool_name[DAG_MAX_POOLS]; // resource pools tasks can draw tokens from, e.g. mem or db
+    uint64_t       pool_cap[DAG_MAX_POOLS]; // tokens in each pool
+    size_t         n_pools;
+    size_t        *index; // open-addressing hash table of task slot + 1 keyed by ID (0 = empty)
+    size_t         index_cap; // number of buckets in index, always a power of two
+    size_t        *topo_pos; // position of each task in a topological order kept up to date by dag_add_dep
+    size_t        *topo_node; // inverse of topo_pos: which task sits at each position
+    size_t        *mark; // visit stamps used by the incremental cycle check
+    size_t         mark_epoch; // stamp value of the current search
+    size_t        *stack; // scratch space for the incremental cycle check
+    dag_bulk_t    *bulk; // non-NULL while a bulk build is in progress
+    arena_t        arena; // storage of tasks made by dag_new_task, released in one go by dag_free
+    strtab_t       strings; // interned commands of those tasks, so identical commands are stored once
+    size_t        *deps_block; // dependency lists of a loaded snapshot, packed back to back; rows move out on growth
+    size_t         deps_block_len; // entries in deps_block
+    void          *snapshot; // read-only mapping of the snapshot file this DAG was loaded from, or NULL
+    size_t         snapshot_len;
 } dag_t;
 
+// Frozen compressed sparse row (CSR) copy of the DAG's edges for read-only traversal
+// All four arrays share a single allocation and task indices are stored in 32 bits
+typedef struct {
+    uint32_t       n; // number of tasks
+    uint32_t       n_edges;
+    uint32_t      *off; // successors of u are adj[off[u]] .. adj[off[u+1]-1]
+    uint32_t      *adj;
+    uint32_t      *roff; // predecessors of v are radj[roff[v]] .. radj[roff[v+1]-1]
+    uint32_t      *radj;
+} dag_csr_t;
+
+// Tasks grouped by depth, as computed by dag_csr_levels; a level's tasks only depend on tasks
+// of earlier levels, so its width is how many tasks could be running at once
+typedef struct {
+    size_t        *order; // every task, level by level: a topological order
+    size_t        *start; // level l is order[start[l]] .. order[start[l+1]-1]
+    uint32_t      *level; // level of each task: 0 without predecessors, else one past its deepest predecessor's
+    size_t         n_levels;
+} dag_levels_t;
+
+// Status of the task at slot i; safe to call while the scheduler is running
+static inline task_status_t dag_status(const dag_t *d, size_t i) {
+    return (task_status_t)atomic_load_explicit(&d->status[i], memory_order_acquire);
+}
+
+static inline void dag_set_status(dag_t *d, size_t i, task_status_t st) {
+    atomic_store_explicit(&d->status[i], (unsigned char)st, memory_order_release);
+}
+
 // Create an new empty DAG; 
 //returns NULL if something went wrong with memory allocation
 dag_t *dag_init(void);
@@ -37,7 +136,68 @@ dag_t *dag_init(void);
 // Returns 0 if added successfully, -1 if a task with same ID already exist, -2 on if memory allocation failure
 int dag_add_task(dag_t *d, task_t *t);
 
-// Look up the position of a task by its ID
+// Makes room for n tasks in total without further reallocation
+// Returns 0 on success or -2 on memory allocation failure
+int dag_reserve(dag_t *d, size_t n);
+
+// Allocates a PENDING TASK_CMD task in the DAG's arena, ready for dag_add_task or dag_bulk_add_task
+// The ID is copied and the command interned, so tasks running the same command share one copy
+// The DAG owns the task either way: if adding it fails, it is simply dropped and its
+// memory comes back at dag_free
+// Returns NULL on memory allocation failure
+task_t *dag_new_task(dag_t *d, const char *id, const char *cmd, time_t time, int freq);
+
+// Allocates a PENDING TASK_FN task with time and freq 0, ready for dag_add_task or dag_bulk_add_task
+// Returns NULL on memory allocation failure
+task_t *dag_new_fn_task(const char *id, task_fn_t fn, void *arg);
+
+// Adds a task that runs fn(arg) on a worker thread instead of a shell command
+// Returns the same codes as dag_add_task; nothing is kept on failure
+int dag_add_fn_task(dag_t *d, const char *id, task_fn_t fn, void *arg);
+
+// Defines resource pool name holding capacity tokens, or changes the capacity of an existing one
+// Returns the pool's index, -1 if capacity is 0, -2 on memory allocation failure,
+// -3 if DAG_MAX_POOLS pools already exist
+int dag_set_pool(dag_t *d, const char *name, uint64_t capacity);
+
+// Index of the pool called name, or -1 if there is none
+int dag_find_pool(const dag_t *d, const char *name);
+
+// Parses a need such as "mem=4G", "cpu=2" or "db=1" into its pool and amount
+// Amounts are whole numbers with an optional K, M, G or T suffix (powers of 1024);
+// naming the pools cpu or mem before they are defined defines them with this machine's
+// online CPUs and physical memory in bytes
+// Returns 0 on success, -1 if the syntax or amount is invalid, -2 on memory allocation failure,
+// -3 if the pool doesn't exist
+int dag_parse_need(dag_t *d, const char *spec, dag_need_t *out);
+
+// Parses a positive amount with an optional K, M, G or T suffix; returns false if it isn't one
+bool dag_parse_amount(const char *s, uint64_t *out);
+
+// Sets the n resources task i holds while it runs, replacing what it held before (n = 0 for none)
+// A task needing more of a pool than it holds waits until the pool is entirely free, then runs alone in it
+// Returns 0 on success, -1 if a pool index is invalid or repeated or an amount is 0,
+// -2 on memory allocation failure
+int dag_set_needs(dag_t *d, size_t i, const dag_need_t *needs, size_t n);
+
+// Sets the n files task i reads, replacing those it had before (n = 0 for none)
+// Paths are interned in the DAG's arena, so files many tasks read are stored once
+// Returns 0 on success, -1 if i is out of range or a path is empty, -2 on memory allocation failure
+int dag_set_inputs(dag_t *d, size_t i, const char *const *paths, size_t n);
+
+// Sets every task back to PENDING, e.g. before running the whole DAG again
+void dag_reset_status(dag_t *d);
+
+// Marks task i and every task that transitively depends on it in mark, which has an entry
+// per task; tasks already marked are not walked again, so marks from earlier calls add up
+// Stores the number of newly marked tasks in n_marked if it is not NULL
+// Returns 0 on success, or -1 if i is out of range or a bulk build is in progress
+int dag_mark_downstream(dag_t *d, size_t i, bool *mark, size_t *n_marked);
+
+// Counts tasks per status in one pass over the status array; counts is indexed by task_status_t
+void dag_count_status(const dag_t *d, size_t counts[4]);
+
+// Look up the position of a task by its ID in O(1) through the hash index
 // Returns >=0 index if found, or -1 if no such task exists
 int dag_find_index(dag_t *d, const char *id);
 
@@ -48,8 +208,40 @@ int dag_find_index(dag_t *d, const char *id);
 // -1 if one or both task ID's not found,
 // -2 if the dependency already exists,
 // -3 if the dependency would create a cycle
+// The cycle check only searches tasks between "to" and "from" in the maintained topological order,
+// so adding an edge that already agrees with that order costs O(1)
 int dag_add_dep(dag_t *d, const char *from, const char *to);
 
+// Bulk construction, for loading a whole graph at once:
+// dag_bulk_begin, then any number of dag_bulk_add_task / dag_bulk_add_dep, then dag_bulk_commit
+// Nothing is validated until the commit, which checks all new IDs for duplicates in one pass,
+// resolves and sorts the edges (silently dropping repeated ones) and runs a single Kahn pass for cycles
+// dag_add_task and dag_add_dep must not be called while a bulk build is in progress
+// The DAG owns a task once dag_bulk_add_task returns 0; tasks and edges added during a failed
+// or aborted bulk build are freed and the DAG is left exactly as it was at dag_bulk_begin
+// Returns 0 on success, -1 if a bulk build is already in progress, -2 on memory allocation failure
+int dag_bulk_begin(dag_t *d);
+
+// Appends a task without checking its ID
+// Returns 0 on success, -1 if no bulk build is in progress, -2 on memory allocation failure
+int dag_bulk_add_task(dag_t *d, task_t *t);
+
+// Records a dependency by task IDs; the IDs are copied and resolved at commit
+// Returns 0 on success, -1 if no bulk build is in progress, -2 on memory allocation failure
+int dag_bulk_add_dep(dag_t *d, const char *from, const char *to);
+
+// Validates and applies everything added since dag_bulk_begin
+// Returns
+// 0 if the graph was committed,
+// -1 if an edge names an unknown task ID (or no bulk build is in progress),
+// -2 on memory allocation failure,
+// -3 if the edges would create a cycle,
+// -4 if a new task ID is duplicated
+int dag_bulk_commit(dag_t *d);
+
+// Throws away everything added since dag_bulk_begin
+void dag_bulk_abort(dag_t *d);
+
 // Check DAG for cycles; returns true if cycle exists, otherwise false
 bool dag_detect_cycle(dag_t *d);
 
@@ -63,6 +255,37 @@ bool dag_detect_cycle(dag_t *d);
 // -2 if memory allocation failed
 int dag_toposort(dag_t *d, size_t **out_order, size_t *out_n);
 
+// Build the CSR form of the DAG's current edges into out
+// Later changes to the DAG are not reflected, the CSR has to be rebuilt
+// Returns 0 on success, -1 if the DAG is too large for 32-bit indices, -2 on memory allocation failure
+int dag_csr_build(dag_t *d, dag_csr_t *out);
+
+// Topological ordering over a CSR, same outputs and return codes as dag_toposort
+int dag_csr_toposort(const dag_csr_t *c, size_t **out_order, size_t *out_n);
+
+// Topological ordering by levels over a CSR, using up to n_threads threads (0 or 1 sorts on the
+// calling thread, as do graphs too small to split). In-degrees are counted over ranges of tasks
+// and each level is expanded over ranges of the one before it, every thread collecting the
+// tasks it frees in its own buffer; levels too narrow to split are expanded by one thread
+// Returns 0 on success, -1 if the DAG contains a cycle, -2 on memory allocation failure
+int dag_csr_levels(const dag_csr_t *c, size_t n_threads, dag_levels_t *out);
+
+// Release the arrays of levels computed by dag_csr_levels
+void dag_levels_free(dag_levels_t *l);
+
+// Links the tasks of linear chains: next[u] = v when v is u's only successor, u is v's only
+// predecessor and both are marked in fusable, UINT32_MAX otherwise; next must have room for c->n entries
+// Returns the number of links made
+size_t dag_csr_chains(const dag_csr_t *c, const bool *fusable, uint32_t *next);
+
+// Upward rank of every task: its own cost plus the most expensive path from it to a sink
+// order must be a topological order of all c->n tasks; cost[i] <= 0 counts as the
+// mean of the known costs (1 if none is known); rank must have room for c->n entries
+void dag_csr_upward_rank(const dag_csr_t *c, const size_t *order, const double *cost, double *rank);
+
+// Release the arrays of a CSR built by dag_csr_build
+void dag_csr_free(dag_csr_t *c);
+
 // Freeing all the memory associated with the DAG, includes tasks and dependencies
 void dag_free(dag_t *d);
 
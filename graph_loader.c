@@ -0,0 +1,383 @@
+#define _DEFAULT_SOURCE
+#include "graph_loader.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Ranges smaller than this aren't worth a thread of their own
+#define LOAD_MIN_CHUNK (1u << 20)
+#define LOAD_MAX_THREADS 64
+#define LOAD_MAX_FIELDS 64
+
+typedef struct {
+    char  *id;
+    char  *cmd;
+    time_t time;
+    int    freq;
+    double cost;
+    size_t need; // first of its pool=amount fields in the chunk's needs
+    size_t n_needs;
+    size_t input; // first of its in=path fields in the chunk's inputs
+    size_t n_inputs;
+} load_task_t;
+
+typedef struct {
+    char *from;
+    char *to;
+} load_dep_t;
+
+typedef struct {
+    char    *name;
+    uint64_t cap;
+} load_pool_t;
+
+// One line range and what was parsed out of it; strings point into the mapped file
+typedef struct {
+    char        *start;
+    char        *end; // just past the range's last '\n', or the end of the file
+    load_task_t *tasks;
+    size_t       n_tasks, tasks_cap;
+    load_dep_t  *deps;
+    size_t       n_deps, deps_cap;
+    char       **needs; // pool=amount fields of add_task lines, resolved once every pool is known
+    size_t       n_needs, needs_cap;
+    const char **inputs; // paths of in=path fields of add_task lines
+    size_t       n_inputs, inputs_cap;
+    load_pool_t *pools;
+    size_t       n_pools, pools_cap;
+    size_t       lines; // lines read, up to and including a line with an error
+    const char  *err; // first error in the range, NULL if none
+    int          code; // -2 or -3 alongside err
+} load_chunk_t;
+
+// Splits a line into fields like the shell's tokenizer: on whitespace, with "..." kept
+// together; every field is NUL-terminated in place
+// Returns the number of fields, or -1 if there are more than max
+static int split_fields(char *p, char **out, int max) {
+    int n = 0;
+    while (1) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        if (!*p) return n;
+        if (n == max) return -1;
+        if (*p == '"') {
+            out[n++] = ++p;
+            while (*p && *p != '"') p++;
+        } else {
+            out[n++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        }
+        if (!*p) return n;
+        *p++ = '\0';
+    }
+}
+
+// Parses a non-negative decimal no larger than max; returns false on anything else
+static bool parse_uint(const char *s, unsigned long long max, unsigned long long *out) {
+    if (!*s) return false;
+    unsigned long long v = 0;
+    for (; *s; ++s) {
+        if (*s < '0' || *s > '9') return false;
+        v = v * 10 + (unsigned long long)(*s - '0');
+        if (v > max) return false;
+    }
+    *out = v;
+    return true;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int chunk_fail(load_chunk_t *c, int code, const char *msg) {
+    c->code = code;
+    c->err = msg;
+    return -1;
+}
+
+// Grows *arr (of elem-sized items, *cap of them) so one more fits; returns false when out of memory
+static bool ensure_room(void **arr, size_t *cap, size_t n, size_t elem) {
+    if (n < *cap) return true;
+    size_t new_cap = *cap ? *cap * 2 : 1024;
+    void *p = realloc(*arr, new_cap * elem);
+    if (!p) return false;
+    *arr = p;
+    *cap = new_cap;
+    return true;
+}
+
+static int parse_line(load_chunk_t *c, char *line) {
+    while (*line == ' ' || *line == '\t' || *line == '\r') line++;
+    if (!*line || *line == '#') return 0;
+    char *f[LOAD_MAX_FIELDS];
+    int n = split_fields(line, f, LOAD_MAX_FIELDS);
+    if (n < 0) return chunk_fail(c, -3, "Too many fields");
+
+    if (strcmp(f[0], "add_task") == 0) {
+        if (n < 5) return chunk_fail(c, -3, "Usage: add_task <id> \"<cmd>\" <time> <freq> [est_secs] [pool=amount ...] [in=path ...]");
+        unsigned long long tv, fv;
+        if (!parse_uint(f[3], LONG_MAX, &tv)) return chunk_fail(c, -3, "Invalid time");
+        if (!parse_uint(f[4], INT_MAX, &fv)) return chunk_fail(c, -3, "Invalid freq");
+        double cost = 0;
+        int k = 5;
+        if (n > k && !strchr(f[k], '=')) {
+            char *endp;
+            cost = strtod(f[k++], &endp);
+            if (*endp || !(cost >= 0 && cost < 1e12)) return chunk_fail(c, -3, "Invalid estimate");
+        }
+        // Only the syntax of needs is checked here, pools may be defined further down
+        size_t first_need = c->n_needs, first_input = c->n_inputs;
+        for (; k < n; ++k) {
+            if (strncmp(f[k], "in=", 3) == 0) {
+                if (!f[k][3]) return chunk_fail(c, -3, "Invalid input, expected in=path");
+                if (!ensure_room((void **)&c->inputs, &c->inputs_cap, c->n_inputs, sizeof(char *))) return chunk_fail(c, -2, "Out of memory");
+                c->inputs[c->n_inputs++] = f[k] + 3;
+                continue;
+            }
+            char *eq = strchr(f[k], '=');
+            uint64_t amount;
+            if (!eq || eq == f[k] || !dag_parse_amount(eq + 1, &amount)) return chunk_fail(c, -3, "Invalid need, expected pool=amount");
+            if (!ensure_room((void **)&c->needs, &c->needs_cap, c->n_needs, sizeof(char *))) return chunk_fail(c, -2, "Out of memory");
+            c->needs[c->n_needs++] = f[k];
+        }
+        // More needs than there can be pools means one is named twice, and wouldn't fit feed_needs' array
+        if (c->n_needs - first_need > DAG_MAX_POOLS) return chunk_fail(c, -3, "Too many needs");
+        if (!ensure_room((void **)&c->tasks, &c->tasks_cap, c->n_tasks, sizeof(load_task_t))) return chunk_fail(c, -2, "Out of memory");
+        c->tasks[c->n_tasks++] = (load_task_t){ f[1], f[2], (time_t)tv, (int)fv, cost, first_need, c->n_needs - first_need,
+                                                first_input, c->n_inputs - first_input };
+    } else if (strcmp(f[0], "add_dep") == 0) {
+        if (n != 3) return chunk_fail(c, -3, "Usage: add_dep <from> <to>");
+        if (!ensure_room((void **)&c->deps, &c->deps_cap, c->n_deps, sizeof(load_dep_t))) return chunk_fail(c, -2, "Out of memory");
+        c->deps[c->n_deps++] = (load_dep_t){ f[1], f[2] };
+    } else if (strcmp(f[0], "pool") == 0) {
+        uint64_t cap;
+        if (n != 3) return chunk_fail(c, -3, "Usage: pool <name> <capacity>");
+        if (strchr(f[1], '=') || strcmp(f[1], "in") == 0 || !dag_parse_amount(f[2], &cap)) return chunk_fail(c, -3, "Invalid pool");
+        if (!ensure_room((void **)&c->pools, &c->pools_cap, c->n_pools, sizeof(load_pool_t))) return chunk_fail(c, -2, "Out of memory");
+        c->pools[c->n_pools++] = (load_pool_t){ f[1], cap };
+    } else {
+        return chunk_fail(c, -3, "Unknown command (only add_task, add_dep and pool are allowed)");
+    }
+    return 0;
+}
+
+// Parses one range, stopping at its first bad line
+static void *parse_chunk(void *arg) {
+    load_chunk_t *c = arg;
+    char *p = c->start;
+    while (p < c->end) {
+        char *nl = memchr(p, '\n', (size_t)(c->end - p));
+        char *eol = nl ? nl : c->end;
+        *eol = '\0'; // the byte after the file is ours too, see map_file
+        c->lines++;
+        if (parse_line(c, p) != 0) break;
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+// Maps the file privately with one writable byte past its end, so every line,
+// the last one included, can be cut up in place
+static char *map_file(const char *path, size_t *len, size_t *map_len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *map_len = (size / page + 1) * page;
+    char *base = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (size > 0 && mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, *map_len);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+    *len = size;
+    return base;
+}
+
+// Cuts buf into n ranges that start at line boundaries; returns how many are non-empty
+static size_t split_chunks(char *buf, size_t len, size_t n, load_chunk_t *chunks) {
+    size_t k = 0;
+    char *p = buf, *end = buf + len;
+    for (size_t i = 0; i < n && p < end; ++i) {
+        char *stop = i + 1 == n ? end : buf + len / n * (i + 1);
+        if (stop < p) stop = p;
+        char *nl = stop < end ? memchr(stop, '\n', (size_t)(end - stop)) : NULL;
+        stop = nl ? nl + 1 : end;
+        memset(&chunks[k], 0, sizeof(load_chunk_t));
+        chunks[k].start = p;
+        chunks[k].end = stop;
+        k++;
+        p = stop;
+    }
+    return k;
+}
+
+// Puts the DAG's pools back the way they were before a failed load; names that were
+// added stay in the arena
+static void restore_pools(dag_t *d, size_t n_pools, const uint64_t *cap) {
+    d->n_pools = n_pools;
+    memcpy(d->pool_cap, cap, sizeof(d->pool_cap));
+}
+
+// Resolves the needs of task slot i, which was just added, from its pool=amount fields
+// Returns 0, -2 on memory allocation failure or -4 if a pool doesn't exist
+static int feed_needs(dag_t *d, size_t i, const load_chunk_t *c, const load_task_t *lt, graph_load_result_t *res) {
+    dag_need_t needs[DAG_MAX_POOLS];
+    for (size_t k = 0; k < lt->n_needs; ++k) {
+        int r = dag_parse_need(d, c->needs[lt->need + k], &needs[k]);
+        if (r == -2) return -2;
+        if (r != 0) {
+            res->msg = "A task needs an unknown resource pool";
+            return -4;
+        }
+    }
+    int r = dag_set_needs(d, i, needs, lt->n_needs);
+    if (r == -1) res->msg = "A task names the same pool twice";
+    return r == -1 ? -4 : r;
+}
+
+// Feeds every parsed range into one bulk build, in file order
+static int feed_dag(dag_t *d, load_chunk_t *chunks, size_t n, graph_load_result_t *res) {
+    size_t n_tasks = 0;
+    for (size_t i = 0; i < n; ++i) n_tasks += chunks[i].n_tasks;
+    if (dag_reserve(d, d->n_tasks + n_tasks) != 0 || dag_bulk_begin(d) != 0) {
+        res->msg = "Out of memory";
+        return -2;
+    }
+
+    // Pools may be defined after the tasks that need them, so they all go in first
+    size_t old_pools = d->n_pools;
+    uint64_t old_cap[DAG_MAX_POOLS];
+    memcpy(old_cap, d->pool_cap, sizeof(old_cap));
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = 0; k < chunks[i].n_pools; ++k) {
+            int r = dag_set_pool(d, chunks[i].pools[k].name, chunks[i].pools[k].cap);
+            if (r == -2) goto oom;
+            if (r < 0) {
+                dag_bulk_abort(d);
+                restore_pools(d, old_pools, old_cap);
+                res->msg = "Too many resource pools";
+                return -4;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        const load_chunk_t *c = &chunks[i];
+        for (size_t k = 0; k < c->n_tasks; ++k) {
+            const load_task_t *lt = &c->tasks[k];
+            task_t *t = dag_new_task(d, lt->id, lt->cmd, lt->time, lt->freq);
+            if (!t || dag_bulk_add_task(d, t) != 0) goto oom;
+            d->cost[d->n_tasks - 1] = lt->cost;
+            if (lt->n_inputs > 0 && dag_set_inputs(d, d->n_tasks - 1, c->inputs + lt->input, lt->n_inputs) != 0) goto oom;
+            if (lt->n_needs > 0) {
+                int r = feed_needs(d, d->n_tasks - 1, c, lt, res);
+                if (r == -2) goto oom;
+                if (r != 0) {
+                    dag_bulk_abort(d);
+                    restore_pools(d, old_pools, old_cap);
+                    res->n_tasks = res->n_deps = 0;
+                    return r;
+                }
+            }
+        }
+        for (size_t k = 0; k < c->n_deps; ++k) {
+            if (dag_bulk_add_dep(d, c->deps[k].from, c->deps[k].to) != 0) goto oom;
+        }
+        res->n_tasks += c->n_tasks;
+        res->n_deps += c->n_deps;
+    }
+
+    int r = dag_bulk_commit(d);
+    if (r == 0) return 0;
+    restore_pools(d, old_pools, old_cap);
+    res->n_tasks = res->n_deps = 0;
+    switch (r) {
+      case -1: res->msg = "A dependency names an unknown task ID"; return -4;
+      case -3: res->msg = "The dependencies would create a cycle"; return -4;
+      case -4: res->msg = "Task ID defined more than once"; return -4;
+      default: res->msg = "Out of memory"; return -2;
+    }
+
+oom:
+    dag_bulk_abort(d);
+    restore_pools(d, old_pools, old_cap);
+    res->n_tasks = res->n_deps = 0;
+    res->msg = "Out of memory";
+    return -2;
+}
+
+int graph_load_file(dag_t *d, const char *path, size_t n_threads, graph_load_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    double t0 = now_sec();
+    size_t len, map_len;
+    char *buf = map_file(path, &len, &map_len);
+    if (!buf) {
+        res->msg = "Failed to open graph file";
+        return -1;
+    }
+
+    // Every thread gets at least LOAD_MIN_CHUNK bytes
+    size_t n = n_threads > 0 ? n_threads : 1;
+    if (n > LOAD_MAX_THREADS) n = LOAD_MAX_THREADS;
+    if (n > len / LOAD_MIN_CHUNK) n = len / LOAD_MIN_CHUNK > 0 ? len / LOAD_MIN_CHUNK : 1;
+    load_chunk_t chunks[LOAD_MAX_THREADS];
+    pthread_t threads[LOAD_MAX_THREADS];
+    n = split_chunks(buf, len, n, chunks);
+
+    // The calling thread takes the first range itself
+    size_t started = 1;
+    for (; started < n; ++started) {
+        if (pthread_create(&threads[started], NULL, parse_chunk, &chunks[started]) != 0) break;
+    }
+    parse_chunk(&chunks[0]);
+    for (size_t i = 1; i < started; ++i) pthread_join(threads[i], NULL);
+    // Ranges a thread couldn't be started for are parsed here
+    for (size_t i = started; i < n; ++i) parse_chunk(&chunks[i]);
+
+    int r = 0;
+    size_t line = 0;
+    for (size_t i = 0; i < n; ++i) {
+        line += chunks[i].lines;
+        if (chunks[i].err) {
+            r = chunks[i].code;
+            res->msg = chunks[i].err;
+            if (r == -3) res->line = line;
+            break;
+        }
+    }
+    double t1 = now_sec();
+    res->parse_s = t1 - t0;
+    if (r == 0) {
+        r = feed_dag(d, chunks, n, res);
+        res->build_s = now_sec() - t1;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        free(chunks[i].tasks);
+        free(chunks[i].deps);
+        free(chunks[i].needs);
+        free(chunks[i].inputs);
+        free(chunks[i].pools);
+    }
+    munmap(buf, map_len);
+    return r;
+}
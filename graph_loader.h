@@ -0,0 +1,36 @@
+#ifndef GRAPH_LOADER_H
+#define GRAPH_LOADER_H
+
+#include <stddef.h>
+#include "dag_manager.h"
+
+// Batch loading of graph definition files, as used by `task_scheduler -f <file>`
+//
+// A file holds the shell's add_task, add_dep and pool commands, one per line, with the same
+// syntax; blank lines and lines starting with '#' are skipped:
+//   add_task <id> "<cmd>" <time> <freq> [est_secs] [pool=amount ...] [in=path ...]
+//   add_dep <from> <to>
+//   pool <name> <capacity>
+// Pools can be defined anywhere in the file, before or after the tasks that need them
+// The file is mapped and parsed in place in one pass, optionally split into line ranges
+// parsed by several threads, and everything goes into the DAG through one bulk build,
+// so the graph is only validated once, at the end
+
+typedef struct {
+    size_t      n_tasks; // tasks and dependencies read from the file
+    size_t      n_deps;
+    size_t      line; // 1-based line of a syntax error, 0 otherwise
+    const char *msg; // what went wrong, NULL on success
+    double      parse_s; // wall time spent mapping and parsing the file
+    double      build_s; // wall time spent adding everything to the DAG and validating it
+} graph_load_result_t;
+
+// Adds every task and dependency defined in the file at path to d, parsing with up to
+// n_threads threads (0 or 1 parses on the calling thread)
+// On failure d is left as it was and res->msg says why
+// Returns 0 on success, -1 if the file can't be opened or mapped, -2 on memory allocation failure,
+// -3 on a syntax error (res->line says where), -4 if the graph is invalid
+// (duplicate ID, dependency on an unknown task, a cycle, or a need from an unknown pool)
+int graph_load_file(dag_t *d, const char *path, size_t n_threads, graph_load_result_t *res);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include "launcher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#define DIRECT_MAX_ARGS 64
+#define DIRECT_MAX_LEN  1024
+
+// Run by launcher_spawn_chain with the commands as its arguments; fd 3 is the status pipe
+// Each command's subshell first drops the arguments and the loop's variables, so it sees the
+// same state `sh -c cmd` would give it
+#define CHAIN_SCRIPT \
+    "for c in \"$@\"; do (eval \"set --; unset c s\n$c\") 3>&-; s=$?; echo $s >&3; [ $s -eq 0 ] || exit $s; done"
+
+// Words the shell treats specially when they come first
+static const char *const shell_words[] = {
+    "cd", "exit", "export", "set", "unset", "source", ".", "eval", "exec", "alias",
+    "unalias", "ulimit", "umask", "read", "wait", "trap", "shift", "return", "break",
+    "continue", "readonly", "times", "type", "command", "hash", "local", "getopts",
+    ":", "!", "{", "}", "if", "then", "else", "elif", "fi", "for", "while", "until",
+    "do", "done", "case", "esac", "function", "select", NULL
+};
+
+int launcher_init(launcher_t *l, launch_mode_t mode, bool direct_exec) {
+    l->mode = mode;
+    l->direct_exec = direct_exec;
+    if (posix_spawnattr_init(&l->attr) != 0) return -1;
+
+    // Children start with no blocked signals and default dispositions, whatever the
+    // worker thread or the shell's handlers had
+    sigset_t none, defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGCHLD);
+    if (posix_spawnattr_setsigmask(&l->attr, &none) != 0 ||
+        posix_spawnattr_setsigdefault(&l->attr, &defaults) != 0 ||
+        posix_spawnattr_setflags(&l->attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF) != 0) {
+        posix_spawnattr_destroy(&l->attr);
+        return -1;
+    }
+    return 0;
+}
+
+void launcher_destroy(launcher_t *l) {
+    posix_spawnattr_destroy(&l->attr);
+}
+
+bool launcher_split_argv(const char *cmd, char *buf, size_t buf_len, char **argv, size_t max_args) {
+    size_t len = strlen(cmd);
+    if (len + 1 > buf_len) return false;
+    if (strpbrk(cmd, "|&;<>()$`\\\"'*?[]\n")) return false;
+    memcpy(buf, cmd, len + 1);
+
+    size_t n = 0;
+    char *p = buf;
+    while (*p) {
+        while (*p == ' ' || *p == '\t') *p++ = '\0';
+        if (!*p) break;
+        if (n == max_args) return false;
+        // Comments and tilde expansion only apply at the start of a word
+        if (*p == '#' || *p == '~') return false;
+        argv[n++] = p;
+        while (*p && *p != ' ' && *p != '\t') p++;
+    }
+    argv[n] = NULL;
+    if (n == 0) return false;
+
+    if (strchr(argv[0], '=')) return false;
+    for (size_t i = 0; shell_words[i]; ++i) {
+        if (strcmp(argv[0], shell_words[i]) == 0) return false;
+    }
+    return true;
+}
+
+int launcher_spawn(launcher_t *l, const char *cmd, pid_t *out_pid) {
+    return launcher_spawn_to(l, cmd, -1, out_pid);
+}
+
+int launcher_spawn_to(launcher_t *l, const char *cmd, int out_fd, pid_t *out_pid) {
+    if (l->mode == LAUNCH_FORK) {
+        pid_t pid = fork();
+        if (pid < 0) return -1;
+        if (pid == 0) {
+            if (out_fd >= 0 && (dup2(out_fd, STDOUT_FILENO) < 0 || dup2(out_fd, STDERR_FILENO) < 0)) _exit(127);
+            execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+            _exit(127);
+        }
+        *out_pid = pid;
+        return 0;
+    }
+
+    // Redirections are applied in the child, between clone and exec
+    posix_spawn_file_actions_t fa, *pfa = NULL;
+    if (out_fd >= 0) {
+        if (posix_spawn_file_actions_init(&fa) != 0) return -1;
+        pfa = &fa;
+        if (posix_spawn_file_actions_adddup2(pfa, out_fd, STDOUT_FILENO) != 0 ||
+            posix_spawn_file_actions_adddup2(pfa, out_fd, STDERR_FILENO) != 0) {
+            posix_spawn_file_actions_destroy(pfa);
+            return -1;
+        }
+    }
+
+    char buf[DIRECT_MAX_LEN];
+    char *argv[DIRECT_MAX_ARGS + 1];
+    int r;
+    if (l->direct_exec && launcher_split_argv(cmd, buf, sizeof(buf), argv, DIRECT_MAX_ARGS)) {
+        r = posix_spawnp(out_pid, argv[0], pfa, &l->attr, argv, environ);
+        if (pfa) posix_spawn_file_actions_destroy(pfa);
+        // Same status the shell reports for a missing command
+        if (r == ENOENT || r == EACCES || r == ENOEXEC) return 127;
+    } else {
+        char *sh_argv[] = { "sh", "-c", (char *)cmd, NULL };
+        r = posix_spawn(out_pid, "/bin/sh", pfa, &l->attr, sh_argv, environ);
+        if (pfa) posix_spawn_file_actions_destroy(pfa);
+    }
+    return r == 0 ? 0 : -1;
+}
+
+int launcher_spawn_chain(launcher_t *l, const char *const *cmds, size_t n, pid_t *out_pid, int *out_status_fd) {
+    // Both ends are close-on-exec, so children other workers start meanwhile don't hold the
+    // pipe open; the shell gets its own copy of the write end as fd 3
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) != 0) return -1;
+    int wfd = p[1];
+    if (wfd <= 3) {
+        wfd = fcntl(p[1], F_DUPFD_CLOEXEC, 4);
+        if (wfd < 0) goto fail;
+    }
+    char **argv = malloc((n + 5) * sizeof(char *));
+    if (!argv) goto fail;
+    argv[0] = "sh";
+    argv[1] = "-c";
+    argv[2] = CHAIN_SCRIPT;
+    argv[3] = "sh";
+    for (size_t i = 0; i < n; ++i) argv[4 + i] = (char *)cmds[i];
+    argv[4 + n] = NULL;
+
+    int r = -1;
+    if (l->mode == LAUNCH_FORK) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (dup2(wfd, 3) < 0) _exit(127);
+            execv("/bin/sh", argv);
+            _exit(127);
+        }
+        if (pid > 0) {
+            *out_pid = pid;
+            r = 0;
+        }
+    } else {
+        posix_spawn_file_actions_t fa;
+        if (posix_spawn_file_actions_init(&fa) == 0) {
+            if (posix_spawn_file_actions_adddup2(&fa, wfd, 3) == 0) {
+                r = posix_spawn(out_pid, "/bin/sh", &fa, &l->attr, argv, environ) == 0 ? 0 : -1;
+            }
+            posix_spawn_file_actions_destroy(&fa);
+        }
+    }
+    free(argv);
+    if (wfd != p[1]) close(wfd);
+    close(p[1]);
+    if (r != 0) {
+        close(p[0]);
+        return -1;
+    }
+    *out_status_fd = p[0];
+    return 0;
+
+fail:
+    close(p[0]);
+    close(p[1]);
+    return -1;
+}
+
+int launcher_wait(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return -1;
+}
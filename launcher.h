@@ -0,0 +1,53 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stdbool.h>
+#include <spawn.h>
+#include <sys/types.h>
+
+// Starts task commands as child processes
+// LAUNCH_SPAWN uses posix_spawn, which glibc implements with clone(CLONE_VM|CLONE_VFORK),
+// so launch cost does not grow with the scheduler's resident memory the way fork() does
+// LAUNCH_FORK is the classic fork() + exec of /bin/sh
+
+typedef enum { LAUNCH_SPAWN, LAUNCH_FORK } launch_mode_t;
+
+typedef struct {
+    launch_mode_t     mode;
+    bool              direct_exec; // skip /bin/sh when the command has no shell syntax
+    posix_spawnattr_t attr; // built once and reused for every spawn
+} launcher_t;
+
+// Sets up a launcher; spawned children get an empty signal mask and default signal handling
+// Returns 0 on success or -1 if the spawn attributes could not be created
+int launcher_init(launcher_t *l, launch_mode_t mode, bool direct_exec);
+
+// Releases the spawn attributes
+void launcher_destroy(launcher_t *l);
+
+// Starts cmd in a child process and stores its pid in out_pid
+// Returns 0 on success, 127 if the program could not be found, -1 on any other failure
+int launcher_spawn(launcher_t *l, const char *cmd, pid_t *out_pid);
+
+// Like launcher_spawn, but the child's stdout and stderr both go to out_fd (-1 to inherit them)
+int launcher_spawn_to(launcher_t *l, const char *cmd, int out_fd, pid_t *out_pid);
+
+// Runs cmds one after another in a single /bin/sh, each in a subshell of its own so none can
+// change the shell the others run in, stopping after the first that fails
+// The exit status of every command that ran is written as a decimal line to a pipe the
+// commands themselves can't see; its read end is stored in out_status_fd for the caller to
+// read and close. The shell exits with the failed command's status, 0 if none failed
+// Returns 0 on success or -1 on failure
+int launcher_spawn_chain(launcher_t *l, const char *const *cmds, size_t n, pid_t *out_pid, int *out_status_fd);
+
+// Waits for a child started by launcher_spawn
+// Returns its exit status, or -1 if it was killed by a signal or could not be waited for
+int launcher_wait(pid_t pid);
+
+// Splits cmd into argv in place of a shell when that is safe: no quoting, expansions,
+// redirections, control operators, assignments or shell builtins/keywords
+// buf receives the words, argv at most max_args entries plus the NULL terminator
+// Returns true if cmd can be executed directly
+bool launcher_split_argv(const char *cmd, char *buf, size_t buf_len, char **argv, size_t max_args);
+
+#endif
@@ -7,6 +7,7 @@
 #include "dag_manager.h"
 #include "scheduler.h"
 #include "shell_interface.h"
+#include "graph_loader.h"
 
 volatile sig_atomic_t stop_flag = 0;
 
@@ -26,16 +27,58 @@ void install_signal_handlers(void) {
     sigaction(SIGTERM, &sa, NULL);
 }
 
-int main(void) {
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f <graph file> [-j <parse threads>]]\n", prog);
+}
+
+// Loads a graph definition file without echoing every command, like the shell would
+static int load_graph(dag_t *d, const char *path, size_t n_threads) {
+    graph_load_result_t res;
+    int r = graph_load_file(d, path, n_threads, &res);
+    if (r != 0) {
+        if (res.line > 0) fprintf(stderr, "[error] %s:%zu: %s\n", path, res.line, res.msg);
+        else fprintf(stderr, "[error] %s: %s\n", path, res.msg);
+        return -1;
+    }
+    printf("Loaded %zu tasks and %zu dependencies from '%s' in %.3f s.\n", res.n_tasks, res.n_deps, path,
+           res.parse_s + res.build_s);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *graph_file = NULL;
+    size_t parse_threads = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            graph_file = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char *endp;
+            long n = strtol(argv[++i], &endp, 10);
+            if (*endp || n <= 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            parse_threads = (size_t)n;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     dag_t *d = dag_init();
     if (!d) {
         fprintf(stderr, "Error: Failed to initialize DAG\n");
         return EXIT_FAILURE;
     }
+    // The graph comes from the file; commands such as run still come from stdin
+    if (graph_file && load_graph(d, graph_file, parse_threads) != 0) {
+        dag_free(d);
+        return EXIT_FAILURE;
+    }
 
     scheduler_t *sched = NULL;
     install_signal_handlers();
-    shell_loop(d, &sched);
+    shell_loop(&d, &sched);
 
     if (sched) {
         sched_stop(sched);
@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define RELAXED memory_order_relaxed
+
+static void gauge(FILE *out, const char *name, const char *help, double v) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n", name, help, name, name, v);
+}
+
+static void counter(FILE *out, const char *name, const char *help, uint64_t v) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)v);
+}
+
+void metrics_render(FILE *out, const scheduler_t *s, uint64_t n_scrapes) {
+    counter(out, "graphtasker_scrapes_total", "Metrics scrapes served.", n_scrapes);
+    gauge(out, "graphtasker_scheduler_up", "Whether a scheduler is attached.", s != NULL);
+    if (!s) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double uptime = (double)(now.tv_sec - s->start_time.tv_sec) + (double)(now.tv_nsec - s->start_time.tv_nsec) / 1e9;
+    gauge(out, "graphtasker_uptime_seconds", "Seconds since the scheduler started.", uptime);
+    gauge(out, "graphtasker_tasks", "Tasks in the running DAG.", (double)s->csr.n);
+    gauge(out, "graphtasker_queue_depth", "Ready tasks waiting for a worker.", (double)atomic_load_explicit(&s->n_queued, RELAXED));
+    gauge(out, "graphtasker_tasks_running", "Tasks started and not finished yet.", (double)atomic_load_explicit(&s->n_active, RELAXED));
+    gauge(out, "graphtasker_children_running", "Child processes supervised by the reactor in async mode.",
+          (double)atomic_load_explicit(&s->n_running, RELAXED));
+    gauge(out, "graphtasker_tasks_waiting_resources", "Ready tasks set aside until their resource pools free up.",
+          (double)atomic_load_explicit(&s->n_blocked, RELAXED));
+
+    // Every thread's counters are summed here, off the hot path
+    uint64_t started = 0, completed = 0, failed = 0, busy = 0;
+    for (size_t i = 0; i <= s->n_workers; ++i) {
+        const sched_counters_t *c = &s->counters[i];
+        started += atomic_load_explicit(&c->started, RELAXED);
+        completed += atomic_load_explicit(&c->completed, RELAXED);
+        failed += atomic_load_explicit(&c->failed, RELAXED);
+        busy += atomic_load_explicit(&c->busy_ns, RELAXED);
+    }
+    counter(out, "graphtasker_tasks_started_total", "Task runs started.", started);
+    counter(out, "graphtasker_tasks_completed_total", "Task runs that succeeded.", completed);
+    counter(out, "graphtasker_tasks_failed_total", "Task runs that failed.", failed);
+    if (s->cache) {
+        counter(out, "graphtasker_tasks_cached_total", "Tasks skipped because the result cache found them up to date.",
+                atomic_load_explicit(&s->cache->hits, RELAXED));
+    }
+
+    gauge(out, "graphtasker_workers", "Worker threads.", (double)s->n_workers);
+    gauge(out, "graphtasker_workers_idle", "Workers parked waiting for work.", (double)atomic_load_explicit(&s->n_sleeping, RELAXED));
+    fprintf(out, "# HELP graphtasker_worker_busy_seconds_total Time each worker spent starting and running tasks.\n"
+                 "# TYPE graphtasker_worker_busy_seconds_total counter\n");
+    for (size_t i = 0; i < s->n_workers; ++i) {
+        fprintf(out, "graphtasker_worker_busy_seconds_total{worker=\"%zu\"} %.9f\n", i,
+                (double)atomic_load_explicit(&s->counters[i].busy_ns, RELAXED) / 1e9);
+    }
+    double util = uptime > 0 ? (double)busy / 1e9 / (uptime * (double)s->n_workers) : 0;
+    gauge(out, "graphtasker_worker_utilization", "Share of worker time spent on tasks since the scheduler started.",
+          util < 1 ? util : 1);
+
+    fprintf(out, "# HELP graphtasker_spawn_seconds Time spent starting task processes.\n"
+                 "# TYPE graphtasker_spawn_seconds summary\n"
+                 "graphtasker_spawn_seconds_sum %.9f\ngraphtasker_spawn_seconds_count %llu\n",
+            (double)atomic_load_explicit(&s->spawn_ns, RELAXED) / 1e9,
+            (unsigned long long)atomic_load_explicit(&s->n_spawns, RELAXED));
+}
+
+// Sends all of buf, giving up if the client goes away
+static void send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+// Reads what the client sends within METRICS_READ_TIMEOUT_MS, up to the end of an HTTP
+// request header; returns true if it was an HTTP request
+static bool read_request(int fd) {
+    char req[4096];
+    size_t len = 0;
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    while (len < sizeof(req) - 1 && poll(&p, 1, METRICS_READ_TIMEOUT_MS) > 0) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+    return len >= 4 && memcmp(req, "GET ", 4) == 0;
+}
+
+static void serve_client(metrics_server_t *m, int fd) {
+    bool http = read_request(fd);
+    char *body = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&body, &len);
+    if (!out) return;
+    uint64_t n = atomic_fetch_add_explicit(&m->n_scrapes, 1, RELAXED) + 1;
+    pthread_mutex_lock(&m->mu);
+    metrics_render(out, m->sched, n);
+    pthread_mutex_unlock(&m->mu);
+    if (fclose(out) != 0) {
+        free(body);
+        return;
+    }
+    if (http) {
+        char head[160];
+        int h = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                             "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+        send_all(fd, head, (size_t)h);
+    }
+    send_all(fd, body, len);
+    free(body);
+}
+
+// Server thread: answers one client at a time until evfd fires
+static void *server_loop(void *arg) {
+    metrics_server_t *m = arg;
+    struct pollfd p[2] = { { .fd = m->fd, .events = POLLIN }, { .fd = m->evfd, .events = POLLIN } };
+    while (1) {
+        if (poll(p, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (p[1].revents) break;
+        if (!(p[0].revents & POLLIN)) continue;
+        int fd = accept4(m->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        serve_client(m, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(metrics_server_t *m, const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+    m->sched = NULL;
+    atomic_init(&m->n_scrapes, 0);
+    m->path = strdup(path);
+    if (!m->path) return -2;
+
+    // Only a socket file is replaced, never some other file given by mistake
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    m->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m->fd < 0) goto fail_path;
+    if (bind(m->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(m->fd, 16) != 0) goto fail_fd;
+    m->evfd = eventfd(0, EFD_CLOEXEC);
+    if (m->evfd < 0) goto fail_bound;
+    if (pthread_mutex_init(&m->mu, NULL) != 0) goto fail_evfd;
+    if (pthread_create(&m->thread, NULL, server_loop, m) != 0) goto fail_mutex;
+    return 0;
+
+fail_mutex:
+    pthread_mutex_destroy(&m->mu);
+fail_evfd:
+    close(m->evfd);
+fail_bound:
+    unlink(path);
+fail_fd:
+    close(m->fd);
+fail_path:
+    free(m->path);
+    return -1;
+}
+
+void metrics_attach(metrics_server_t *m, scheduler_t *s) {
+    pthread_mutex_lock(&m->mu);
+    m->sched = s;
+    pthread_mutex_unlock(&m->mu);
+}
+
+void metrics_stop(metrics_server_t *m) {
+    uint64_t one = 1;
+    while (write(m->evfd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    pthread_join(m->thread, NULL);
+    pthread_mutex_destroy(&m->mu);
+    close(m->evfd);
+    close(m->fd);
+    unlink(m->path);
+    free(m->path);
+}
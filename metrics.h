@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "scheduler.h"
+
+// Live scheduler metrics in the Prometheus text format, served on a Unix domain socket
+//
+// A scrape only reads counters and gauges the scheduler keeps with atomics anyway (queue
+// depth, running tasks, per-thread start/completion/failure/busy counters, spawn time),
+// so it never takes mu_queue or touches the task arrays and can't stall a worker.
+// Clients may send an HTTP request (curl --unix-socket) and get an HTTP response, or send
+// nothing (nc -U) and get the bare metrics
+//
+// The server outlives schedulers: the shell attaches each run's scheduler and detaches it
+// before stopping it. Counters restart from zero with every run, which Prometheus treats
+// as a counter reset
+
+#define METRICS_READ_TIMEOUT_MS 100 // how long a client gets to send its request
+
+typedef struct {
+    int             fd; // listening socket
+    int             evfd; // eventfd that tells the server thread to exit
+    char           *path;
+    pthread_t       thread;
+    pthread_mutex_t mu; // guards sched; held by scrapes and by metrics_attach, never by workers
+    scheduler_t    *sched;
+    atomic_uint_least64_t n_scrapes;
+} metrics_server_t;
+
+// Listens on a Unix socket at path, replacing a stale socket file left there, and starts
+// the thread serving it
+// Returns 0 on success, -1 if the socket can't be set up, -2 on memory allocation failure
+int metrics_start(metrics_server_t *m, const char *path);
+
+// Makes scrapes report s, or only the server's own metrics when s is NULL
+// s must be started, and detached before it is stopped
+void metrics_attach(metrics_server_t *m, scheduler_t *s);
+
+// Stops the server thread, closes the socket and removes its file
+void metrics_stop(metrics_server_t *m);
+
+// Writes the metrics of s (NULL for none) to out in the Prometheus text format
+void metrics_render(FILE *out, const scheduler_t *s, uint64_t n_scrapes);
+
+#endif
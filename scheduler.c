@@ -1,10 +1,25 @@
 // scheduler.c
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 #include "scheduler.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <sys/wait.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// epoll data of the reactor's wakeup eventfd; children use their task index
+#define REACTOR_WAKE UINT64_MAX
+
+// Graphs with at least this many edges are sorted on several threads by sched_start
+#define SCHED_PAR_TOPO_EDGES (1u << 20)
 
 scheduler_t *sched_init(dag_t *dag, size_t n_workers) {
     if (!dag || n_workers == 0) return NULL;
@@ -12,6 +27,7 @@ scheduler_t *sched_init(dag_t *dag, size_t n_workers) {
     if (!s) return NULL;
 
     s->dag = dag;
+    memset(&s->csr, 0, sizeof(s->csr));
     s->order = NULL;
     s->n_order = 0;
     s->n_workers = n_workers;
@@ -20,24 +36,123 @@ scheduler_t *sched_init(dag_t *dag, size_t n_workers) {
     s->workers = malloc(n_workers * sizeof(pthread_t));
     if (!s->workers) goto fail_s;
 
+    // Every worker gets its own deque of ready tasks
+    s->wctx = malloc(n_workers * sizeof(sched_worker_t));
+    if (!s->wctx) goto fail_workers;
+    size_t n_deques = 0;
+    for (; n_deques < n_workers; ++n_deques) {
+        sched_worker_t *w = &s->wctx[n_deques];
+        w->s = s;
+        w->id = n_deques;
+        w->rng = (unsigned)n_deques * 2654435761u + 1;
+        if (wd_init(&w->deque, 64) != 0) goto fail_deques;
+    }
+
     // Task queue has been setted up
     //Size is one more than the umber of tasks to distinguish full from empty
     s->q_capacity = (dag->n_tasks > 0 ? dag->n_tasks + 1 : 1);
     s->queue = malloc(s->q_capacity * sizeof(size_t));
-    if (!s->queue) goto fail_workers;
+    if (!s->queue) goto fail_deques;
     s->q_head = 0;
     s->q_tail = 0;
+    atomic_init(&s->n_injected, 0);
+
+    // One remaining-predecessor counter per task, filled in by sched_start
+    s->remaining = malloc((dag->n_tasks > 0 ? dag->n_tasks : 1) * sizeof(atomic_size_t));
+    if (!s->remaining) goto fail_queue;
+    atomic_init(&s->n_queued, 0);
+    atomic_init(&s->n_active, 0);
+    atomic_init(&s->n_sleeping, 0);
+
+    // Due times and the timer wheel, one timer slot per task
+    size_t n_slots = dag->n_tasks > 0 ? dag->n_tasks : 1;
+    s->due = malloc(n_slots * sizeof(uint64_t));
+    s->expired = malloc(n_slots * sizeof(size_t));
+    s->children = malloc(n_slots * sizeof(sched_child_t));
+    s->rank = malloc(n_slots * sizeof(double));
+    s->started = malloc(n_slots * sizeof(uint64_t));
+    s->ready_at = malloc(n_slots * sizeof(uint64_t));
+    s->released = malloc(n_slots * sizeof(bool));
+    s->counters = aligned_alloc(64, (n_workers + 1) * sizeof(sched_counters_t));
+    if (!s->due || !s->expired || !s->children || !s->rank || !s->started || !s->ready_at || !s->released || !s->counters) goto fail_due;
+    memset(s->counters, 0, (n_workers + 1) * sizeof(sched_counters_t));
+    atomic_init(&s->n_spawns, 0);
+    atomic_init(&s->spawn_ns, 0);
+    if (tw_init(&s->wheel, dag->n_tasks, 0) != 0) goto fail_due;
+    s->n_expired = 0;
+    s->timer_stop = false;
 
-    s->stop = false;
-    if (pthread_mutex_init(&s->mu_queue, NULL) != 0) goto fail_queue;
+    atomic_init(&s->stop, false);
+    if (pthread_mutex_init(&s->mu_queue, NULL) != 0) goto fail_wheel;
     if (pthread_cond_init(&s->cv_queue, NULL) != 0) goto fail_mutex;
+    if (pthread_mutex_init(&s->mu_timer, NULL) != 0) goto fail_cond;
+
+    // The timer thread sleeps until absolute CLOCK_MONOTONIC deadlines
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0) goto fail_mutex_timer;
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int cv_res = pthread_cond_init(&s->cv_timer, &attr);
+    pthread_condattr_destroy(&attr);
+    if (cv_res != 0) goto fail_mutex_timer;
+
+    // Tasks are started with posix_spawn and skip /bin/sh when they can;
+    // callers may change launcher.mode or launcher.direct_exec before sched_start
+    if (launcher_init(&s->launcher, LAUNCH_SPAWN, true) != 0) goto fail_cond_timer;
+
+    s->async = false;
+    s->max_running = 0;
+    atomic_init(&s->n_running, 0);
+    s->epfd = -1;
+    s->evfd = -1;
+    s->priority = false;
+    s->wal = NULL;
+    s->stats = NULL;
+    s->trace = NULL;
+    s->capture = NULL;
+    s->cache = NULL;
+    s->only = NULL;
+    s->fuse = false;
+    s->chain_next = NULL;
+    s->n_chains = s->n_chained = 0;
+    s->track_ready = false;
+    s->needs = NULL;
+    s->res_held = NULL;
+    s->blocked = NULL;
+    atomic_init(&s->n_blocked, 0);
+    if (pthread_cond_init(&s->cv_slots, NULL) != 0) goto fail_launcher;
+    if (pthread_mutex_init(&s->mu_res, NULL) != 0) goto fail_slots;
 
     return s;
 
+fail_slots:
+    pthread_cond_destroy(&s->cv_slots);
+fail_launcher:
+    launcher_destroy(&s->launcher);
+fail_cond_timer:
+    pthread_cond_destroy(&s->cv_timer);
+fail_mutex_timer:
+    pthread_mutex_destroy(&s->mu_timer);
+fail_cond:
+    pthread_cond_destroy(&s->cv_queue);
 fail_mutex:
     pthread_mutex_destroy(&s->mu_queue);
+fail_wheel:
+    tw_free(&s->wheel);
+fail_due:
+    free(s->due);
+    free(s->expired);
+    free(s->children);
+    free(s->rank);
+    free(s->started);
+    free(s->ready_at);
+    free(s->released);
+    free(s->counters);
+    free(s->remaining);
 fail_queue:
     free(s->queue);
+fail_deques:
+    for (size_t i = 0; i < n_deques; ++i) wd_free(&s->wctx[i].deque);
+    free(s->wctx);
 fail_workers:
     free(s->workers);
 fail_s:
@@ -45,31 +160,574 @@ fail_s:
     return NULL;
 }
 
+// Heap order in priority mode: higher rank first, then lower slot
+static bool ranks_before(const scheduler_t *s, size_t a, size_t b) {
+    return s->rank[a] > s->rank[b] || (s->rank[a] == s->rank[b] && a < b);
+}
+
+static void heap_push(scheduler_t *s, size_t idx) {
+    size_t i = s->q_tail++;
+    while (i > 0 && ranks_before(s, idx, s->queue[(i - 1) / 2])) {
+        s->queue[i] = s->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->queue[i] = idx;
+}
+
+static size_t heap_pop(scheduler_t *s) {
+    size_t top = s->queue[0];
+    size_t last = s->queue[--s->q_tail];
+    size_t n = s->q_tail, i = 0;
+    while (2 * i + 1 < n) {
+        size_t c = 2 * i + 1;
+        if (c + 1 < n && ranks_before(s, s->queue[c + 1], s->queue[c])) c++;
+        if (!ranks_before(s, s->queue[c], last)) break;
+        s->queue[i] = s->queue[c];
+        i = c;
+    }
+    if (n > 0) s->queue[i] = last;
+    return top;
+}
+
+// Adds a task index to the back of the injection queue, or to the heap in priority mode;
+// caller holds mu_queue and wakes parked workers once done pushing
+static void queue_push(scheduler_t *s, size_t idx) {
+    if (s->priority) {
+        heap_push(s, idx);
+    } else {
+        s->queue[s->q_tail] = idx;
+        s->q_tail = (s->q_tail + 1) % s->q_capacity;
+    }
+    atomic_fetch_add(&s->n_injected, 1);
+    atomic_fetch_add(&s->n_queued, 1);
+}
+
+// Wakes parked workers after n tasks were queued; caller holds mu_queue
+static void wake_parked(scheduler_t *s, size_t n) {
+    if (n == 0 || atomic_load(&s->n_sleeping) == 0) return;
+    if (n > 1) pthread_cond_broadcast(&s->cv_queue);
+    else pthread_cond_signal(&s->cv_queue);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Counters have a single writer, so a plain read-modify-write keeps readers lock-free
+// without a locked instruction on the hot path
+static void count(atomic_uint_least64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// Starts task idx's command, with its output going to the task's log when capturing,
+// adding how long that took to the spawn counters
+static int spawn_timed(scheduler_t *s, size_t idx, pid_t *pid) {
+    uint64_t t0 = now_ns();
+    const char *cmd = s->dag->tasks[idx]->cmd;
+    int r, out;
+    capture_stream_t *st = s->capture ? capture_open(s->capture, idx, &out) : NULL;
+    if (st) {
+        r = launcher_spawn_to(&s->launcher, cmd, out, pid);
+        capture_launched(s->capture, st, out, r == 0);
+    } else {
+        r = launcher_spawn(&s->launcher, cmd, pid);
+    }
+    atomic_fetch_add_explicit(&s->spawn_ns, now_ns() - t0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->n_spawns, 1, memory_order_relaxed);
+    return r;
+}
+
+// Ticks elapsed since sched_start
+static uint64_t current_tick(scheduler_t *s) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (int64_t)(now.tv_sec - s->start_time.tv_sec) * 1000 +
+                 (now.tv_nsec - s->start_time.tv_nsec) / 1000000;
+    return ms > 0 ? (uint64_t)ms / SCHED_TICK_MS : 0;
+}
+
+// Queues a task whose predecessors are done if it is due, otherwise arms its timer
+// Worker w gets it on its own deque; with w == NULL, or in priority mode, it goes to
+// the injection queue
+// Returns 1 if the task was queued and 0 if it was armed
+static int make_ready(scheduler_t *s, sched_worker_t *w, size_t idx) {
+    if (s->due[idx] <= current_tick(s)) {
+        if (s->track_ready) s->ready_at[idx] = now_ns();
+        if (w && !s->priority && wd_push(&w->deque, idx) == 0) {
+            atomic_fetch_add(&s->n_queued, 1);
+        } else {
+            pthread_mutex_lock(&s->mu_queue);
+            queue_push(s, idx);
+            wake_parked(s, 1);
+            pthread_mutex_unlock(&s->mu_queue);
+        }
+        return 1;
+    }
+    pthread_mutex_lock(&s->mu_timer);
+    bool wake = s->due[idx] < tw_next_tick(&s->wheel);
+    tw_schedule(&s->wheel, idx, s->due[idx]);
+    if (wake) pthread_cond_signal(&s->cv_timer);
+    pthread_mutex_unlock(&s->mu_timer);
+    return 0;
+}
+
+static void collect_expired(void *ctx, size_t id) {
+    scheduler_t *s = (scheduler_t *)ctx;
+    s->expired[s->n_expired++] = id;
+}
+
+// Timer thread: sleeps until the wheel's next deadline, then moves every task that
+// came due into the queue
+static void *timer_loop(void *arg) {
+    scheduler_t *s = (scheduler_t *)arg;
+    pthread_mutex_lock(&s->mu_timer);
+    while (!s->timer_stop) {
+        s->n_expired = 0;
+        tw_advance(&s->wheel, current_tick(s), collect_expired, s);
+        if (s->n_expired > 0) {
+            // mu_queue is never taken while mu_timer is held
+            size_t n = s->n_expired;
+            pthread_mutex_unlock(&s->mu_timer);
+            if (s->track_ready) {
+                uint64_t now = now_ns();
+                for (size_t i = 0; i < n; ++i) s->ready_at[s->expired[i]] = now;
+            }
+            pthread_mutex_lock(&s->mu_queue);
+            for (size_t i = 0; i < n; ++i) queue_push(s, s->expired[i]);
+            wake_parked(s, n);
+            pthread_mutex_unlock(&s->mu_queue);
+            pthread_mutex_lock(&s->mu_timer);
+            continue;
+        }
+
+        uint64_t next = tw_next_tick(&s->wheel);
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&s->cv_timer, &s->mu_timer);
+        } else {
+            uint64_t ms = next * SCHED_TICK_MS;
+            struct timespec deadline = s->start_time;
+            deadline.tv_sec  += (time_t)(ms / 1000);
+            deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&s->cv_timer, &s->mu_timer, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&s->mu_timer);
+    return NULL;
+}
+
+static void stop_timer_thread(scheduler_t *s) {
+    pthread_mutex_lock(&s->mu_timer);
+    s->timer_stop = true;
+    pthread_cond_signal(&s->cv_timer);
+    pthread_mutex_unlock(&s->mu_timer);
+    pthread_join(s->timer_thread, NULL);
+}
+
+// Tokens task idx takes from its pool for need n; more than the pool holds means all of it
+static uint64_t need_amount(const scheduler_t *s, const dag_need_t *n) {
+    return n->amount < s->res_cap[n->pool] ? n->amount : s->res_cap[n->pool];
+}
+
+// Takes every resource task idx needs if all of them are free; caller holds mu_res
+static bool try_acquire(scheduler_t *s, size_t idx) {
+    const dag_needs_t *r = s->needs[idx];
+    for (uint32_t k = 0; k < r->n; ++k) {
+        if (s->res_avail[r->need[k].pool] < need_amount(s, &r->need[k])) return false;
+    }
+    for (uint32_t k = 0; k < r->n; ++k) s->res_avail[r->need[k].pool] -= need_amount(s, &r->need[k]);
+    s->res_held[idx] = true;
+    return true;
+}
+
+// Admits task idx that a worker just took from the queue, unless it already was
+// (a task queued by release_resources holds its resources already)
+// Returns false after setting it aside until running tasks free enough; it then no
+// longer counts as active, but whoever holds its resources still does
+static bool claim_resources(scheduler_t *s, size_t idx) {
+    pthread_mutex_lock(&s->mu_res);
+    bool ok = s->res_held[idx] || try_acquire(s, idx);
+    if (!ok) {
+        size_t n = atomic_load_explicit(&s->n_blocked, memory_order_relaxed);
+        s->blocked[n] = idx;
+        atomic_store_explicit(&s->n_blocked, n + 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&s->mu_res);
+    if (!ok) atomic_fetch_sub(&s->n_active, 1);
+    return ok;
+}
+
+// Gives back what task idx held and queues the set-aside tasks that fit now, oldest first
+static void release_resources(scheduler_t *s, size_t idx) {
+    const dag_needs_t *r = s->needs[idx];
+    pthread_mutex_lock(&s->mu_res);
+    s->res_held[idx] = false;
+    for (uint32_t k = 0; k < r->n; ++k) s->res_avail[r->need[k].pool] += need_amount(s, &r->need[k]);
+    // Queued while mu_res is still held, before this task stops counting as active,
+    // so they are never out of sight of parking workers
+    size_t n = atomic_load_explicit(&s->n_blocked, memory_order_relaxed);
+    size_t kept = 0, admitted = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t b = s->blocked[i];
+        if (!try_acquire(s, b)) {
+            s->blocked[kept++] = b;
+            continue;
+        }
+        if (admitted++ == 0) pthread_mutex_lock(&s->mu_queue);
+        queue_push(s, b);
+    }
+    atomic_store_explicit(&s->n_blocked, kept, memory_order_relaxed);
+    if (admitted > 0) {
+        wake_parked(s, admitted);
+        pthread_mutex_unlock(&s->mu_queue);
+    }
+    pthread_mutex_unlock(&s->mu_res);
+}
+
+// Sets the final status of task idx and releases what it unblocks
+// Worker w keeps released successors on its own deque; the reactor passes NULL and
+// they go to the injection queue
+static void settle_task(scheduler_t *s, sched_worker_t *w, size_t idx, task_status_t st) {
+    dag_t *d = s->dag;
+    dag_set_status(d, idx, st);
+    if (s->wal) wal_log(s->wal, idx, st);
+
+    size_t released = 0;
+    // A periodic task releases its successors once, on its first successful run; later runs
+    // would release them early when they wait on other tasks too
+    if (st == COMPLETED && !s->released[idx]) {
+        s->released[idx] = true;
+        // Release every successor that was only waiting on this task
+        const dag_csr_t *c = &s->csr;
+        for (uint32_t k = c->off[idx]; k < c->off[idx + 1]; ++k) {
+            size_t v = c->adj[k];
+            if (atomic_fetch_sub_explicit(&s->remaining[v], 1, memory_order_acq_rel) == 1) {
+                released += make_ready(s, w, v);
+            }
+        }
+    }
+
+    // If task should repeat periodically, schedule it again
+    if (d->freq[idx] > 0 && !atomic_load(&s->stop)) {
+        s->due[idx] += (uint64_t)d->freq[idx] * SCHED_TICKS_PER_SEC;
+        released += make_ready(s, w, idx);
+    }
+
+    // A worker takes one released task itself, parked peers are woken for the rest
+    // (the injection queue already woke one per task); the last task to finish after
+    // a stop wakes everyone so they can exit
+    size_t still_active = atomic_fetch_sub(&s->n_active, 1) - 1;
+    bool finishing = still_active == 0 && atomic_load(&s->stop);
+    if (((w && released > 1) || finishing) && atomic_load(&s->n_sleeping) > 0) {
+        pthread_mutex_lock(&s->mu_queue);
+        if (finishing) pthread_cond_broadcast(&s->cv_queue);
+        else wake_parked(s, released - 1);
+        pthread_mutex_unlock(&s->mu_queue);
+    }
+}
+
+// Records how task idx ended, gives back what it held and settles it
+static void complete_task(scheduler_t *s, sched_worker_t *w, size_t idx, int code) {
+    dag_t *d = s->dag;
+    uint64_t end = now_ns();
+    size_t t = w ? w->id : s->n_workers;
+    count(code == 0 ? &s->counters[t].completed : &s->counters[t].failed, 1);
+    if (s->stats) stats_task_finished(s->stats, t, idx, end, end - s->started[idx], code != 0);
+    if (s->trace) trace_record(s->trace, t, TRACE_END, idx, end, (uint64_t)(int64_t)code);
+    // Failed runs often stop early, so only successful ones teach us how long a task takes
+    if (code == 0) {
+        double took = (double)(end - s->started[idx]) / 1e9;
+        d->cost[idx] = d->cost[idx] > 0 ? d->cost[idx] + (took - d->cost[idx]) / 4 : took;
+        if (s->cache) cache_finished(s->cache, idx);
+    }
+    if (s->needs && s->needs[idx]) release_resources(s, idx);
+    settle_task(s, w, idx, code == 0 ? COMPLETED : FAILED);
+}
+
+// Waits until fewer than max_running children are running, then claims a slot
+static void acquire_slot(scheduler_t *s) {
+    if (s->max_running == 0) {
+        atomic_fetch_add(&s->n_running, 1);
+        return;
+    }
+    pthread_mutex_lock(&s->mu_queue);
+    while (atomic_load(&s->n_running) >= s->max_running) pthread_cond_wait(&s->cv_slots, &s->mu_queue);
+    atomic_fetch_add(&s->n_running, 1);
+    pthread_mutex_unlock(&s->mu_queue);
+}
+
+static void release_slot(scheduler_t *s) {
+    atomic_fetch_sub(&s->n_running, 1);
+    if (s->max_running == 0) return;
+    pthread_mutex_lock(&s->mu_queue);
+    pthread_cond_signal(&s->cv_slots);
+    pthread_mutex_unlock(&s->mu_queue);
+}
+
+static int open_pidfd(pid_t pid) {
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+// Starts task idx and hands its child to the reactor
+// Returns true if the reactor will complete the task, or false with its exit code in code
+// when it could not be handed over (spawn failed, or no pidfd so it was waited for here)
+static bool launch_async(scheduler_t *s, size_t idx, int *code) {
+    acquire_slot(s);
+    sched_child_t *c = &s->children[idx];
+    int r = spawn_timed(s, idx, &c->pid);
+    if (r != 0) {
+        release_slot(s);
+        *code = r;
+        return false;
+    }
+
+    c->pidfd = open_pidfd(c->pid);
+    if (c->pidfd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = idx };
+        if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, c->pidfd, &ev) == 0) return true;
+        close(c->pidfd);
+    }
+    *code = launcher_wait(c->pid);
+    release_slot(s);
+    return false;
+}
+
+// Reactor thread: reaps children as their pidfds become readable and completes their tasks
+static void *reactor_loop(void *arg) {
+    scheduler_t *s = (scheduler_t *)arg;
+    struct epoll_event ev[64];
+    while (1) {
+        int n = epoll_wait(s->epfd, ev, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            // Only sent by sched_stop once every child has been reaped
+            if (ev[i].data.u64 == REACTOR_WAKE) return NULL;
+            size_t idx = (size_t)ev[i].data.u64;
+            sched_child_t *c = &s->children[idx];
+            // Deregistered explicitly: a child another thread is spawning right now may
+            // hold a copy of the pidfd until it execs, which would keep it in the set
+            epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->pidfd, NULL);
+            close(c->pidfd);
+            int code = launcher_wait(c->pid);
+            release_slot(s);
+            complete_task(s, NULL, idx, code);
+        }
+    }
+    return NULL;
+}
+
+// Sets up the epoll set and starts the reactor; returns 0, or -1 after undoing everything
+static int start_reactor(scheduler_t *s) {
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0) return -1;
+    s->evfd = eventfd(0, EFD_CLOEXEC);
+    if (s->evfd < 0) goto fail_ep;
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = REACTOR_WAKE };
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->evfd, &ev) != 0) goto fail_ev;
+    if (pthread_create(&s->reactor_thread, NULL, reactor_loop, s) != 0) goto fail_ev;
+    return 0;
+
+fail_ev:
+    close(s->evfd);
+    s->evfd = -1;
+fail_ep:
+    close(s->epfd);
+    s->epfd = -1;
+    return -1;
+}
+
+static void stop_reactor(scheduler_t *s) {
+    if (s->epfd < 0) return;
+    uint64_t one = 1;
+    while (write(s->evfd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    pthread_join(s->reactor_thread, NULL);
+    close(s->evfd);
+    close(s->epfd);
+    s->evfd = -1;
+    s->epfd = -1;
+}
+
+// A finished one-off task from an earlier, interrupted run; periodic tasks always run again
+static bool already_done(const dag_t *d, size_t idx) {
+    return d->freq[idx] == 0 && dag_status(d, idx) == COMPLETED;
+}
+
+static bool will_run(const scheduler_t *s, size_t idx) {
+    return !already_done(s->dag, idx) && (!s->only || s->only[idx]);
+}
+
+// Links the chains fused tasks run in; the tasks after a chain's head wait for one more
+// predecessor, so only run_chain ever starts them
+static int find_chains(scheduler_t *s) {
+    const dag_t *d = s->dag;
+    const dag_csr_t *c = &s->csr;
+    bool *fusable = malloc((c->n > 0 ? c->n : 1) * sizeof(bool));
+    free(s->chain_next);
+    s->chain_next = malloc((c->n > 0 ? c->n : 1) * sizeof(uint32_t));
+    if (!fusable || !s->chain_next) {
+        free(fusable);
+        free(s->chain_next);
+        s->chain_next = NULL;
+        return -1;
+    }
+    for (size_t i = 0; i < c->n; ++i) {
+        fusable[i] = d->tasks[i]->kind == TASK_CMD && d->freq[i] == 0 && d->time[i] == 0 && will_run(s, i) &&
+                     !d->needs[i] && !d->inputs[i];
+    }
+    dag_csr_chains(c, fusable, s->chain_next);
+
+    // Heads are found before any chain is cut, as cutting makes new ones
+    for (size_t i = 0; i < c->n; ++i) {
+        bool linked_to = c->roff[i + 1] - c->roff[i] == 1 && s->chain_next[c->radj[c->roff[i]]] == i;
+        fusable[i] = s->chain_next[i] != UINT32_MAX && !linked_to;
+    }
+    // Chains that grow too long are cut into several
+    s->n_chains = s->n_chained = 0;
+    for (size_t i = 0; i < c->n; ++i) {
+        if (!fusable[i]) continue;
+        size_t len = 1;
+        for (size_t u = i; s->chain_next[u] != UINT32_MAX; ) {
+            size_t v = s->chain_next[u];
+            if (len == SCHED_CHAIN_MAX) {
+                s->chain_next[u] = UINT32_MAX;
+                s->n_chains++;
+                s->n_chained += len;
+                len = 0;
+            } else {
+                atomic_fetch_add_explicit(&s->remaining[v], 1, memory_order_relaxed);
+            }
+            len++;
+            u = v;
+        }
+        if (len > 1) {
+            s->n_chains++;
+            s->n_chained += len;
+        }
+    }
+    free(fusable);
+    return 0;
+}
+
 int sched_start(scheduler_t *s) {
     if (!s) return -1;
+    // The queue and counters were sized for the tasks present at sched_init
+    if (s->dag->n_tasks >= s->q_capacity && s->dag->n_tasks > 0) return -1;
+    if (s->stats && (s->stats->n_tasks < s->dag->n_tasks || s->stats->n_threads < s->n_workers + 1)) return -1;
+    if (s->trace && s->trace->n_rings < s->n_workers + 1) return -1;
+    if (s->capture && s->capture->n_tasks < s->dag->n_tasks) return -1;
+    if (s->cache && cache_prepare(s->cache, s->dag) != 0) return -1;
+    s->track_ready = s->stats || s->trace;
+
+    // Pools are only looked at for tasks that need something, and not at all when none does
+    const dag_t *d = s->dag;
+    bool any_needs = false;
+    for (size_t i = 0; i < d->n_tasks && !any_needs; ++i) any_needs = d->needs[i] != NULL;
+    if (any_needs) {
+        size_t n_slots = d->n_tasks;
+        s->needs = malloc(n_slots * sizeof(dag_needs_t *));
+        s->res_held = calloc(n_slots, sizeof(bool));
+        s->blocked = malloc(n_slots * sizeof(size_t));
+        if (!s->needs || !s->res_held || !s->blocked) {
+            free(s->needs);
+            free(s->res_held);
+            free(s->blocked);
+            s->needs = NULL;
+            s->res_held = NULL;
+            s->blocked = NULL;
+            return -1;
+        }
+        memcpy(s->needs, d->needs, n_slots * sizeof(dag_needs_t *));
+        for (size_t p = 0; p < d->n_pools; ++p) s->res_cap[p] = s->res_avail[p] = d->pool_cap[p];
+    }
 
-    // Generate a topological order for the tasks
+    // Freeze the edges once, then generate a topological order for the tasks
+    dag_csr_free(&s->csr);
+    if (dag_csr_build(s->dag, &s->csr) != 0) return -1;
     if (s->order) free(s->order);
-    if (dag_toposort(s->dag, &s->order, &s->n_order) != 0) {
+    s->order = NULL;
+    if (s->csr.n_edges >= SCHED_PAR_TOPO_EDGES) {
+        // Big graphs are sorted level by level on a thread per worker, up to one per CPU
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t n_threads = n_cpus > 0 && (size_t)n_cpus < s->n_workers ? (size_t)n_cpus : s->n_workers;
+        dag_levels_t lv;
+        if (dag_csr_levels(&s->csr, n_threads, &lv) != 0) return -1;
+        s->order = lv.order;
+        s->n_order = s->csr.n;
+        lv.order = NULL;
+        dag_levels_free(&lv);
+    } else if (dag_csr_toposort(&s->csr, &s->order, &s->n_order) != 0) {
         s->order = NULL;
         return -1;
     }
 
-    // Load the queue the tasks in the sorted order
+    // Each task waits for its predecessors that still have to run; one that isn't going
+    // to run waits for one more, so completing its predecessors never releases it
+    const dag_csr_t *c = &s->csr;
+    for (size_t i = 0; i < c->n; ++i) {
+        size_t waiting = !will_run(s, i);
+        for (uint32_t k = c->roff[i]; k < c->roff[i + 1]; ++k) waiting += !already_done(s->dag, c->radj[k]);
+        atomic_init(&s->remaining[i], waiting);
+        s->released[i] = false;
+    }
+
+    if (s->fuse && !s->capture && find_chains(s) != 0) return -1;
+
+    // Tasks heading the most expensive remaining paths go first in priority mode
+    if (s->priority) dag_csr_upward_rank(c, s->order, s->dag->cost, s->rank);
+
+    // Tick 0 is now; every task is first due at its declared time
+    // Async mode needs pidfds; without them workers wait on their children as usual
+    if (s->async) {
+        int probe = open_pidfd(getpid());
+        if (probe < 0) s->async = false;
+        else close(probe);
+    }
+    if (s->async && start_reactor(s) != 0) return -1;
+    if (s->capture && capture_start(s->capture) != 0) {
+        stop_reactor(s);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &s->start_time);
+    if (s->stats) s->stats->start_ns = now_ns();
+    if (s->trace) s->trace->start_ns = now_ns();
+    for (size_t i = 0; i < c->n; ++i) {
+        time_t t = s->dag->time[i];
+        s->due[i] = t > 0 ? (uint64_t)t * SCHED_TICKS_PER_SEC : 0;
+    }
+    if (pthread_create(&s->timer_thread, NULL, timer_loop, s) != 0) {
+        stop_reactor(s);
+        if (s->capture) capture_stop(s->capture);
+        return -1;
+    }
+
+    // Only tasks with no pending predecessors are ready right away, the rest get
+    // released by worker_loop as their predecessors complete
     for (size_t i = 0; i < s->n_order; ++i) {
-        s->queue[s->q_tail] = s->order[i];
-        s->q_tail = (s->q_tail + 1) % s->q_capacity;
+        size_t idx = s->order[i];
+        if (atomic_load_explicit(&s->remaining[idx], memory_order_relaxed) == 0) make_ready(s, NULL, idx);
     }
 
     // Start each worker thread
     for (size_t i = 0; i < s->n_workers; ++i) {
-        if (pthread_create(&s->workers[i], NULL, worker_loop, s) != 0) {
+        if (pthread_create(&s->workers[i], NULL, worker_loop, &s->wctx[i]) != 0) {
             // If a thread fails to start, will stop all previously created threads 
             pthread_mutex_lock(&s->mu_queue);
-            s->stop = true;
+            atomic_store(&s->stop, true);
             pthread_cond_broadcast(&s->cv_queue);
             pthread_mutex_unlock(&s->mu_queue);
+            stop_timer_thread(s);
             for (size_t j = 0; j < i; ++j) pthread_join(s->workers[j], NULL);
+            stop_reactor(s);
+            if (s->capture) capture_stop(s->capture);
             return -1;
         }
     }
@@ -81,71 +739,229 @@ void sched_stop(scheduler_t *s) {
 
     // Tell all threads to stop
     pthread_mutex_lock(&s->mu_queue);
-    s->stop = true;
+    atomic_store(&s->stop, true);
     pthread_cond_broadcast(&s->cv_queue);
     pthread_mutex_unlock(&s->mu_queue);
 
+    // No more timers will fire; whatever is still waiting in the wheel is dropped
+    stop_timer_thread(s);
+
     // Waiting for each thread to finish
     for (size_t i = 0; i < s->n_workers; ++i) {
         pthread_join(s->workers[i], NULL);
     }
+    // Workers only exit once no task is active, so every child has been reaped
+    stop_reactor(s);
+    if (s->capture) capture_stop(s->capture);
+    // Nothing records anymore, so the rings can be read
+    if (s->trace) s->trace->err = trace_write(s->trace, s->dag);
+    if (s->cache) s->cache->err = cache_save(s->cache);
 
     pthread_mutex_destroy(&s->mu_queue);
     pthread_cond_destroy(&s->cv_queue);
+    pthread_mutex_destroy(&s->mu_timer);
+    pthread_cond_destroy(&s->cv_timer);
+    pthread_cond_destroy(&s->cv_slots);
+    pthread_mutex_destroy(&s->mu_res);
+    launcher_destroy(&s->launcher);
+    tw_free(&s->wheel);
+    free(s->due);
+    free(s->expired);
+    free(s->children);
+    free(s->rank);
+    free(s->started);
+    free(s->ready_at);
+    free(s->released);
+    free(s->counters);
+    free(s->needs);
+    free(s->res_held);
+    free(s->blocked);
+    for (size_t i = 0; i < s->n_workers; ++i) wd_free(&s->wctx[i].deque);
+    free(s->wctx);
     free(s->workers);
     free(s->queue);
+    free(s->remaining);
     free(s->order);
+    free(s->chain_next);
+    dag_csr_free(&s->csr);
 }
 
-void *worker_loop(void *arg) {
-    scheduler_t *s = (scheduler_t *)arg;
-    while (1) {
+// Takes a ready task for worker w: its own deque first, then the injection queue,
+// then a steal from a peer starting at a random one
+// Returns true and stores the task in out if one was found
+static bool find_work(sched_worker_t *w, size_t *out) {
+    scheduler_t *s = w->s;
+    bool found = wd_pop(&w->deque, out);
+
+    if (!found && atomic_load(&s->n_injected) > 0) {
         pthread_mutex_lock(&s->mu_queue);
-        // Wait until there is a task in the queue or stop signal
-        while (s->q_head == s->q_tail && !s->stop) {
-            pthread_cond_wait(&s->cv_queue, &s->mu_queue);
-        }
-        // Exist if there is nothing to do and we are stopping
-        if (s->stop && s->q_head == s->q_tail) {
-            pthread_mutex_unlock(&s->mu_queue);
-            break;
+        if (s->q_head != s->q_tail) {
+            if (s->priority) {
+                *out = heap_pop(s);
+            } else {
+                *out = s->queue[s->q_head];
+                s->q_head = (s->q_head + 1) % s->q_capacity;
+            }
+            atomic_fetch_sub(&s->n_injected, 1);
+            found = true;
         }
-        // A task will be removed from the queue
-        size_t idx = s->queue[s->q_head];
-        s->q_head = (s->q_head + 1) % s->q_capacity;
         pthread_mutex_unlock(&s->mu_queue);
+    }
 
-        int code = execute_task(s, idx);
-        if (code == 0) {
-            s->dag->tasks[idx]->status = COMPLETED;
-        } else {
-            s->dag->tasks[idx]->status = FAILED;
+    // A lost race means the victim still had work, so that round is worth repeating
+    bool contended = true;
+    while (!found && contended && s->n_workers > 1) {
+        contended = false;
+        w->rng = w->rng * 1103515245u + 12345u;
+        size_t start = (w->rng >> 8) % s->n_workers;
+        for (size_t k = 0; k < s->n_workers && !found; ++k) {
+            size_t v = (start + k) % s->n_workers;
+            if (v == w->id) continue;
+            int r = wd_steal(&s->wctx[v].deque, out);
+            if (r == 1) found = true;
+            else if (r < 0) contended = true;
         }
+    }
 
-        // If task should repeat periodically, schedule it again
-        if (s->dag->tasks[idx]->freq > 0) {
-            s->dag->tasks[idx]->time += s->dag->tasks[idx]->freq;
-            pthread_mutex_lock(&s->mu_queue);
-            s->queue[s->q_tail] = idx;
-            s->q_tail = (s->q_tail + 1) % s->q_capacity;
-            pthread_cond_signal(&s->cv_queue);
-            pthread_mutex_unlock(&s->mu_queue);
+    if (found) {
+        // Counted as active before it stops counting as queued, so nobody sees both at zero
+        atomic_fetch_add(&s->n_active, 1);
+        atomic_fetch_sub(&s->n_queued, 1);
+    }
+    return found;
+}
+
+// Parks worker until work is queued anywhere or the scheduler is done
+// Returns false when the worker should exit
+static bool park(scheduler_t *s) {
+    pthread_mutex_lock(&s->mu_queue);
+    atomic_fetch_add(&s->n_sleeping, 1);
+    // n_queued is read after n_sleeping is raised, and pushers raise n_queued before
+    // checking n_sleeping, so one side always sees the other
+    while (atomic_load(&s->n_queued) == 0 &&
+           !(atomic_load(&s->stop) && atomic_load(&s->n_active) == 0)) {
+        pthread_cond_wait(&s->cv_queue, &s->mu_queue);
+    }
+    atomic_fetch_sub(&s->n_sleeping, 1);
+    bool keep_going = atomic_load(&s->n_queued) > 0 || atomic_load(&s->n_active) > 0;
+    pthread_mutex_unlock(&s->mu_queue);
+    return keep_going;
+}
+
+// Marks task idx as running on worker w and records its start; returns the start time
+static uint64_t begin_task(scheduler_t *s, sched_worker_t *w, size_t idx) {
+    uint64_t t0 = now_ns();
+    s->started[idx] = t0;
+    count(&s->counters[w->id].started, 1);
+    if (s->track_ready) {
+        uint64_t wait = t0 > s->ready_at[idx] ? t0 - s->ready_at[idx] : 0;
+        if (s->stats) stats_task_started(s->stats, w->id, idx, t0, wait);
+        if (s->trace) trace_record(s->trace, w->id, TRACE_BEGIN, idx, t0, wait);
+    }
+    dag_set_status(s->dag, idx, RUNNING);
+    if (s->wal) wal_log(s->wal, idx, RUNNING);
+    return t0;
+}
+
+// Runs the chain headed by task idx, already begun, in one shell and completes each of its
+// tasks as the shell reports the exit status, beginning the next one; a task the shell
+// never reported on (it was killed, say) ends with the shell's own status
+static void run_chain(scheduler_t *s, sched_worker_t *w, size_t idx) {
+    const char *cmds[SCHED_CHAIN_MAX];
+    size_t task[SCHED_CHAIN_MAX], n = 0;
+    for (size_t v = idx; n < SCHED_CHAIN_MAX; v = s->chain_next[v]) {
+        task[n] = v;
+        cmds[n++] = s->dag->tasks[v]->cmd;
+        if (s->chain_next[v] == UINT32_MAX) break;
+    }
+
+    if (s->async) acquire_slot(s);
+    uint64_t t0 = now_ns();
+    pid_t pid;
+    int status_fd;
+    int r = launcher_spawn_chain(&s->launcher, cmds, n, &pid, &status_fd);
+    atomic_fetch_add_explicit(&s->spawn_ns, now_ns() - t0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->n_spawns, 1, memory_order_relaxed);
+    if (r != 0) {
+        if (s->async) release_slot(s);
+        complete_task(s, w, idx, r);
+        return;
+    }
+
+    char buf[64];
+    size_t len = 0, k = 0;
+    bool failed = false;
+    while (!failed && k < n) {
+        ssize_t got = read(status_fd, buf + len, sizeof(buf) - 1 - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        len += (size_t)got;
+        char *nl;
+        while (!failed && k < n && (nl = memchr(buf, '\n', len)) != NULL) {
+            *nl = '\0';
+            int code = atoi(buf);
+            len -= (size_t)(nl + 1 - buf);
+            memmove(buf, nl + 1, len);
+            complete_task(s, w, task[k], code);
+            if (code != 0) {
+                failed = true;
+            } else if (++k < n) {
+                // Counted as active like a task taken from a queue, which its predecessor just released
+                atomic_fetch_add(&s->n_active, 1);
+                if (s->track_ready) s->ready_at[task[k]] = now_ns();
+                if (s->cache) cache_check(s->cache, &s->csr, task[k]);
+                begin_task(s, w, task[k]);
+            }
         }
     }
+    close(status_fd);
+    int code = launcher_wait(pid);
+    if (s->async) release_slot(s);
+    if (!failed && k < n) complete_task(s, w, task[k], code != 0 ? code : -1);
+}
+
+void *worker_loop(void *arg) {
+    sched_worker_t *w = (sched_worker_t *)arg;
+    scheduler_t *s = w->s;
+    dag_t *d = s->dag;
+    while (1) {
+        size_t idx;
+        if (!find_work(w, &idx)) {
+            // Exist if there is nothing to do and we are stopping
+            if (!park(s)) break;
+            continue;
+        }
+        // Up-to-date tasks finish here, before they would take any resources
+        if (s->cache && cache_check(s->cache, &s->csr, idx)) {
+            settle_task(s, w, idx, COMPLETED);
+            continue;
+        }
+        if (s->needs && s->needs[idx] && !claim_resources(s, idx)) continue;
+        uint64_t t0 = begin_task(s, w, idx);
+
+        // Function tasks and chains always run right here; only single commands go to the reactor
+        int code;
+        bool handed_off = false;
+        if (s->chain_next && s->chain_next[idx] != UINT32_MAX) {
+            run_chain(s, w, idx);
+            handed_off = true;
+        } else if (s->async && d->tasks[idx]->kind == TASK_CMD) {
+            handed_off = launch_async(s, idx, &code);
+        } else {
+            code = execute_task(s, idx);
+        }
+        if (!handed_off) complete_task(s, w, idx, code);
+        count(&s->counters[w->id].busy_ns, now_ns() - t0);
+    }
     return NULL;
 }
 
 int execute_task(scheduler_t *s, size_t idx) {
     if (!s || idx >= s->dag->n_tasks) return -1;
     task_t *t = s->dag->tasks[idx];
-    pid_t pid = fork();
-    if (pid < 0) return -1;
-    if (pid == 0) {
-        execl("/bin/sh", "sh", "-c", t->cmd, (char *)NULL);
-        _exit(127);
-    }
-    int status;
-    if (waitpid(pid, &status, 0) < 0) return -1;
-    if (WIFEXITED(status)) return WEXITSTATUS(status);
-    return -1;
+    if (t->kind == TASK_FN) return t->fn(t->arg);
+    pid_t pid;
+    int r = spawn_timed(s, idx, &pid);
+    if (r != 0) return r;
+    return launcher_wait(pid);
 }
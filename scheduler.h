@@ -4,65 +4,231 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 #include "dag_manager.h"
+#include "timer_wheel.h"
+#include "work_deque.h"
+#include "launcher.h"
+#include "wal.h"
+#include "stats.h"
+#include "trace.h"
+#include "capture.h"
+#include "cache.h"
+
+// Resolution of the scheduler's clock; task time and freq are whole seconds
+#define SCHED_TICK_MS 10
+#define SCHED_TICKS_PER_SEC (1000 / SCHED_TICK_MS)
+
+// Most tasks fused into one shell, which also keeps its argument list well within ARG_MAX
+#define SCHED_CHAIN_MAX 64
 
 // Scheduler is responsible for managing multiple worker threads to execute tasks from DAG concurrently and efficiently 
 
+struct scheduler;
+
+// State owned by one worker thread
+typedef struct {
+    struct scheduler *s;
+    size_t          id; // position of this worker in the scheduler's arrays
+    work_deque_t    deque; // Ready tasks this worker released; peers steal from the other end
+    unsigned        rng; // picks where to start looking for a victim when stealing
+} sched_worker_t;
+
+// Hot-path counters of one thread, each written only by that thread with relaxed atomics
+// and summed by readers such as the metrics endpoint; one cache line per thread
 typedef struct {
+    atomic_uint_least64_t started; // tasks this worker started
+    atomic_uint_least64_t completed; // tasks this thread finished successfully
+    atomic_uint_least64_t failed;
+    atomic_uint_least64_t busy_ns; // time this worker spent starting and running tasks
+    char                  pad[32];
+} sched_counters_t;
+
+// A task's child process while the reactor supervises it
+typedef struct {
+    pid_t pid;
+    int   pidfd; // registered with the reactor's epoll set
+} sched_child_t;
+
+typedef struct scheduler {
     dag_t          *dag; // DAG holds all the tasks
+    dag_csr_t       csr; // Frozen copy of the DAG's edges built by sched_start, used for all traversal
     size_t         *order; // It stores the order of tasks
     size_t          n_order;
 
     pthread_t      *workers; // Array to store thread ID's of all workers
+    sched_worker_t *wctx; // Per-worker state, one entry per thread
     size_t          n_workers;
 
-    size_t         *queue; // Circular queue to hold task indices ready to run
+    // Circular injection queue for tasks made ready outside the workers (sched_start, timer thread)
+    // In priority mode it holds every ready task instead, as a max-heap on rank in queue[0..q_tail)
+    size_t         *queue;
     size_t          q_head; // index of next task to take from the queue
     size_t          q_tail; // index where the next task will be added
     size_t          q_capacity; // Total capacity of the queue
+    atomic_size_t   n_injected; // Tasks in the injection queue, so workers can skip the lock when empty
+
+    atomic_size_t  *remaining; // Per-task count of predecessors that have not completed yet
+    bool           *released; // Whether each task has released its successors; only its own runs touch it
+    atomic_size_t   n_queued; // Ready tasks in the injection queue and all worker deques
+    atomic_size_t   n_active; // Tasks currently being executed by workers
+    atomic_size_t   n_sleeping; // Workers parked on cv_queue
+
+    pthread_mutex_t mu_queue; // Guards the injection queue and parking
+    pthread_cond_t  cv_queue; // Parked workers wait here until work shows up or the scheduler stops
+
+    atomic_bool     stop; // Set to true when threads should stop running
+
+    uint64_t       *due; // Tick each task is next due at, counted from start_time
+    struct timespec start_time; // CLOCK_MONOTONIC time of sched_start, which is tick 0
+    timer_wheel_t   wheel; // Tasks whose predecessors are done but that are not due yet
+    size_t         *expired; // Tasks the timer thread took out of the wheel on its last pass
+    size_t          n_expired;
+    pthread_t       timer_thread; // Single thread that moves due tasks into the queue
+    pthread_mutex_t mu_timer; // Guards wheel, expired and timer_stop; never held while taking mu_queue
+    pthread_cond_t  cv_timer; // Wakes the timer thread when a timer is armed or on stop
+    bool            timer_stop;
+
+    launcher_t      launcher; // How execute_task starts task commands
+
+    // Async mode: workers start children and move on, one reactor thread reaps them
+    bool            async; // Set before sched_start; falls back to waiting in workers without pidfd support
+    size_t          max_running; // Cap on children running at once in async mode, 0 for no cap
+    atomic_size_t   n_running; // Children started and not reaped yet
+    pthread_cond_t  cv_slots; // Workers wait here, under mu_queue, while max_running children run
+    sched_child_t  *children; // Child of each task that is running in async mode
+    int             epfd; // epoll set of running children's pidfds plus evfd, -1 when not in use
+    int             evfd; // eventfd that tells the reactor to exit
+    pthread_t       reactor_thread;
+
+    bool            priority; // Set before sched_start to dispatch ready tasks by rank instead of FIFO / work stealing
+    double         *rank; // Upward rank of each task (expected time from its start to the end of the DAG)
+    uint64_t       *started; // CLOCK_MONOTONIC ns each running task started at, to learn its cost
+    uint64_t       *ready_at; // CLOCK_MONOTONIC ns each task was last queued at, kept while track_ready
+    bool            track_ready; // stats or trace is set, so queue waits are measured
+
+    // Resource pools: a task with needs only starts once it can take all of them at once
+    dag_needs_t   **needs; // Copy of the DAG's needs made by sched_start, NULL when no task has any
+    uint64_t        res_cap[DAG_MAX_POOLS]; // Tokens of each pool, from the DAG
+    uint64_t        res_avail[DAG_MAX_POOLS]; // Tokens not held by a running task
+    bool           *res_held; // Whether each task holds its resources, i.e. was admitted to run
+    size_t         *blocked; // Tasks taken from the queue while their resources were held, in that order
+    atomic_size_t   n_blocked;
+    pthread_mutex_t mu_res; // Guards res_avail, res_held and blocked; may be held while taking mu_queue
+
+    sched_counters_t *counters; // One per worker, then one for the reactor
+    atomic_uint_least64_t n_spawns; // Child processes started, and the total time spent starting them
+    atomic_uint_least64_t spawn_ns;
 
-    pthread_mutex_t mu_queue; // Mutex to guard access to the queue and control flags
-    pthread_cond_t  cv_queue; // Consitional variables to signal changes in the queue
+    wal_t          *wal; // Every status transition is logged here when set before sched_start, NULL for none
+    sched_stats_t  *stats; // Run times and queue waits are recorded here when set before sched_start, NULL for none
+    sched_trace_t  *trace; // Timeline recorded when set before sched_start and written to its file by sched_stop
+    sched_capture_t *capture; // Task commands' output goes to log files when set before sched_start, NULL to inherit ours
+    sched_cache_t  *cache; // Up-to-date tasks are skipped when set before sched_start, NULL to run everything
+    const bool     *only; // Set before sched_start to run only the tasks marked true, NULL for all; read by sched_start alone
 
-    bool            stop; // Set to true when threads should stop running
+    // Chain fusion: a linear chain of plain command tasks runs in one shell, dispatched once
+    bool            fuse; // Set before sched_start to fuse chains
+    uint32_t       *chain_next; // Next task of the chain each task runs in, UINT32_MAX at its end; NULL unless fuse
+    size_t          n_chains; // Chains found by sched_start, and the tasks in them
+    size_t          n_chained;
 } scheduler_t;
 
 /*
 With the given DAG and number of worker threads, it creates and set up scheduler
 It only initializes internal structure - it doesn't start the threads yet
+Tasks run in sync mode, each worker waiting on its own child; set async and
+max_running before sched_start to have a reactor thread supervise children instead
 Returns a pointer to the scheduler on success, or NULL if memory allocation fails
  */
 scheduler_t *sched_init(dag_t *dag, size_t n_workers);
 
 /*
 By launching all the worker threads, will start the scheduler
+Non-periodic tasks that are already COMPLETED (e.g. after wal_replay) are not run again
+and count as satisfied predecessors; reset statuses to PENDING for a full run
+With only set, tasks not marked in it are not run either; successors of those that are
+not COMPLETED stay PENDING, as if they had failed
+Only tasks without pending predecessors are queued at start; every other task is released
+once all of its predecessors have completed successfully, onto the deque of the
+worker that completed the last one; a periodic predecessor counts once, on its first
+successful run
+In priority mode every ready task goes to one shared heap and the one with the highest
+upward rank - its expected run time plus the most expensive path below it, from the
+DAG's cost estimates - is dispatched first, so long chains start early
+A released task whose time (seconds after sched_start) has not come yet waits in the
+timer wheel until the timer thread moves it into the queue
 Each thread runs the worker_loop() to pick and execute tasks
 Returns 0 if everything starts correctly
+In async mode a reactor thread watches every running child through a pidfd in one
+epoll set and completes the task when it exits, so workers only launch children and
+up to max_running of them can run at once regardless of n_workers
 If any thread fails to start, it will stop all others, cleans up and return -1
+Tasks that need resources from the DAG's pools only start once all of them are free;
+a task asking for more than a pool's capacity waits for the whole pool instead
+With stats set, it must have been set up by stats_init for at least the DAG's tasks and
+n_workers; the start of the run is time 0 for the task timestamps it records
+Likewise trace must have been set up by trace_init for at least n_workers
+With capture set (see capture_init, for at least the DAG's tasks), its I/O thread is started
+and every command's stdout and stderr go to the task's log file instead of ours
+With cache set (see cache_open), its entries are matched to the DAG's tasks; it must stay
+open until sched_stop
+With fuse set, command tasks that run once, at time 0, with no needs or inputs and
+whose only successor has them as its only predecessor are linked into chains of up to
+SCHED_CHAIN_MAX tasks (none while capture is set, as each task's output needs its own log);
+a worker that takes a chain's head runs the whole chain in one shell, each command in a
+subshell, and completes every task in turn as the shell reports its exit status, so
+statuses, exit codes and run times stay per task. A failed task stops the chain and the
+tasks after it stay PENDING, as they would without fusion
  */
 int sched_start(scheduler_t *s);
 
 /*
 Stops the scheduler by signaling all worker threads to finish their work and exit
+Workers keep draining until the queue is empty and no running task can release more work,
+which in async mode includes waiting for the reactor to reap every child
+Tasks still waiting for their time, and further runs of periodic tasks, are dropped
+With capture set, output still in the children's pipes is written to the logs
+With trace set, the recorded timeline is then written to its file and trace->err says
+how that went (see trace_write); likewise the cache is saved and cache->err set
 Broadcast a stop signal, wait for all threads to complete and then cleans up all thread related resources like mutexex, condition variables, queues etc
  */
 void sched_stop(scheduler_t *s);
 
 /*
 This is the main logic function that each worker thread runs:
-waits until there is task available or until a stop signal is received
-picks a task from the queue and executes it using execute_task()
-Updates the task status depending on whether it ran successfully
-If the task is recurring one, it re-adds to the queue.
-This function is passed to pthread_create when starting threads
+takes a task from its own deque, else from the injection queue, else steals from a peer;
+when there is nothing anywhere it parks until there is task available or until a stop signal is received
+a task whose resources are held by running tasks is set aside (still PENDING) and the worker
+moves on to the next ready task; it is queued again as soon as a finishing task frees enough
+With cache set, a task the cache finds up to date is marked COMPLETED without running
+and releases its successors as if it had run
+executes the task using execute_task(), or in async mode starts it and leaves the rest
+to the reactor, which performs the same completion steps below
+Updates the task status depending on whether it ran successfully, gives back the resources
+it held, and after a success
+folds the observed run time into the task's cost estimate in the DAG
+With stats set, how long the task waited in the queue and how long it ran are recorded
+Starts, completions, failures and time spent on tasks always go to the thread's counters
+With trace set, a begin record (with the queue wait) and an end record (with the exit
+code) go to the ring of the thread that started or finished the task
+On success, successors whose last pending predecessor was this task are queued;
+a failed task leaves its successors PENDING
+If the task is recurring one, it is armed again freq seconds after its previous due time
+(or queued right away if that time has already passed), unless the scheduler is stopping
+This function is passed to pthread_create when starting threads, with its sched_worker_t as argument
  */
 void *worker_loop(void *arg);
 
 /*
 Run the command for specific task in the DAG
+A TASK_FN task instead calls its function on the calling thread and returns what it returned
 It:
-forks a new process
-execute the shell command using /bin/sh
+starts a new process through the scheduler's launcher (posix_spawn by default, or fork)
+execute the shell command using /bin/sh, or exec the program directly when the
+command has no shell syntax and direct_exec is enabled
 waits for the task to complete
 returns the exit status from the command (0 = success, non-zero = failure)
  */
@@ -1,13 +1,36 @@
 // shell_interface.c
 #define _POSIX_C_SOURCE 200809L
 #include "shell_interface.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "stats.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
+#include "cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>    // strdup, strcmp, strcspn
 #include <ctype.h>     // isspace
+#include <unistd.h>    // sysconf
 
 #define MAX_TOKENS 16
 
+// Metrics endpoint started by 'metrics <socket>', shared by every run until exit
+static metrics_server_t *metrics;
+
+// Output capture of the last run, kept for 'show tail' until the next run or load
+static sched_capture_t *capture;
+
+// Result cache opened by 'cache <file>', used by every run until it is closed
+static sched_cache_t *cache;
+
+// Set by 'fuse on': later runs start linear chains of commands in one shell each
+static bool fuse_chains;
+
+// Set by 'priority on': later runs dispatch ready tasks by upward rank instead of FIFO
+static bool priority_dispatch;
+
 static const char *status_str(task_status_t s) {
     switch (s) {
       case PENDING:   return "PENDING";
@@ -26,11 +49,32 @@ static void print_error(const char *msg) {
 static void print_help(void) {
     printf(
         "Available commands:\n"
-        "  add_task <id> \"<cmd>\" <time> <freq>  - Add a new task\n"
+        "  add_task <id> \"<cmd>\" <time> <freq> [est_secs] [pool=amount ...] [in=path ...]\n"
+        "                                        - Add a new task, optionally with its expected run time,\n"
+        "                                          resources it holds while running (e.g. mem=4G cpu=2)\n"
+        "                                          and files it reads (for the result cache)\n"
+        "  pool <name> <capacity>                - Define a resource pool, or change its capacity\n"
         "  add_dep <from> <to>                   - Add a dependency\n"
         "  show tasks                            - List tasks\n"
         "  show deps                             - List dependencies\n"
-        "  run [n_workers]                       - Start scheduler\n"
+        "  show stats                            - Run time percentiles of the last run\n"
+        "  show pools                            - List resource pools and what tasks need\n"
+        "  show levels                           - Tasks per level of the graph (how many could run at once)\n"
+        "  show tail <id>                        - Last output of a task (needs 'logs')\n"
+        "  run [n_workers] [max_running]         - Start scheduler (async if max_running given)\n"
+        "  save <file>                           - Write the DAG to a binary snapshot\n"
+        "  load <file>                           - Replace the DAG with a saved snapshot\n"
+        "  wal <file>                            - Log task status changes to a write-ahead log\n"
+        "  metrics <socket>                      - Serve live Prometheus metrics on a Unix socket\n"
+        "  trace [file]                          - Record a timeline of later runs (no file: stop)\n"
+        "  logs [dir]                            - Capture task output to <dir>/<id>.log (no dir: stop)\n"
+        "  cache [file]                          - Skip tasks whose inputs haven't changed (no file: stop)\n"
+        "  fuse on|off                           - Run linear chains of commands in one shell each\n"
+        "  priority on|off                       - Start ready tasks on the longest remaining paths first\n"
+        "  resume [n_workers] [max_running]      - Run only tasks the log doesn't show completed\n"
+        "  rerun <id> [--downstream] [n_workers] [max_running]\n"
+        "                                        - Run a task again with what it still blocks below it\n"
+        "                                          (--downstream: everything below it), keeping the rest\n"
         "  help                                  - Show this help\n"
         "  exit                                  - Quit\n"
     );
@@ -58,10 +102,10 @@ static int tokenize_line(char *line, char **out) {
     return n;
 }
 
-// add_task <id> "<cmd>" <time> <freq>
+// add_task <id> "<cmd>" <time> <freq> [est_secs] [pool=amount ...] [in=path ...]
 static void handle_add_task(char **argv, int argc, dag_t *d) {
-    if (argc != 5) {
-        print_error("Usage: add_task <id> \"<cmd>\" <time> <freq>");
+    if (argc < 5) {
+        print_error("Usage: add_task <id> \"<cmd>\" <time> <freq> [est_secs] [pool=amount ...] [in=path ...]");
         return;
     }
     char *id = argv[1], *cmd = argv[2], *t_s = argv[3], *f_s = argv[4];
@@ -74,24 +118,121 @@ static void handle_add_task(char **argv, int argc, dag_t *d) {
     if (*endp || fl < 0) { print_error("Invalid freq"); return; }
     int freq = (int)fl;
 
-    task_t *t = malloc(sizeof(*t));
+    // Expected run time, used to rank tasks until runs have been observed
+    double est = 0;
+    int a = 5;
+    if (argc > a && !strchr(argv[a], '=')) {
+        est = strtod(argv[a++], &endp);
+        if (*endp || !(est >= 0 && est < 1e12)) { print_error("Invalid estimate"); return; }
+    }
+
+    // What the task holds while it runs, and the files it reads
+    dag_need_t needs[MAX_TOKENS];
+    const char *inputs[MAX_TOKENS];
+    size_t n_needs = 0, n_inputs = 0;
+    for (; a < argc; ++a) {
+        if (strncmp(argv[a], "in=", 3) == 0) {
+            if (!argv[a][3]) { print_error("Invalid input, expected in=path"); return; }
+            inputs[n_inputs++] = argv[a] + 3;
+            continue;
+        }
+        int r = dag_parse_need(d, argv[a], &needs[n_needs]);
+        if (r == -3) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Unknown resource pool in '%s' (define it with 'pool')", argv[a]);
+            print_error(msg);
+            return;
+        }
+        if (r != 0) { print_error(r == -2 ? "Out of memory" : "Invalid need, expected pool=amount"); return; }
+        for (size_t k = 0; k < n_needs; ++k) {
+            if (needs[k].pool == needs[n_needs].pool) { print_error("Pool named twice"); return; }
+        }
+        n_needs++;
+    }
+
+    // Checked up front so a rejected task doesn't take up room in the DAG's arena
+    if (dag_find_index(d, id) >= 0) { print_error("Task ID already exists"); return; }
+    task_t *t = dag_new_task(d, id, cmd, tval, freq);
     if (!t) { print_error("Out of memory"); return; }
-    t->id = strdup(id);
-    t->cmd = strdup(cmd);
-    t->time = tval;
-    t->freq = freq;
-    t->status = PENDING;
 
     int r = dag_add_task(d, t);
     if (r == 0) {
+        d->cost[d->n_tasks - 1] = est;
+        if (dag_set_needs(d, d->n_tasks - 1, needs, n_needs) != 0) print_error("Out of memory, task added without its resources");
+        if (dag_set_inputs(d, d->n_tasks - 1, inputs, n_inputs) != 0) print_error("Out of memory, task added without its inputs");
         printf("Task '%s' added.\n", id);
     } else {
-        free(t->id); free(t->cmd); free(t);
         if (r == -1) print_error("Task ID already exists");
         else          print_error("Failed to add task");
     }
 }
 
+// pool <name> <capacity>
+static void handle_pool(char **argv, int argc, dag_t *d) {
+    if (argc != 3) {
+        print_error("Usage: pool <name> <capacity>");
+        return;
+    }
+    uint64_t cap;
+    // in=path names a task's input, so no pool can be called that
+    if (argv[1][0] == '\0' || strchr(argv[1], '=') || strcmp(argv[1], "in") == 0 || !dag_parse_amount(argv[2], &cap)) {
+        print_error("Invalid pool");
+        return;
+    }
+    int r = dag_set_pool(d, argv[1], cap);
+    if (r >= 0) printf("Pool '%s' holds %llu.\n", argv[1], (unsigned long long)cap);
+    else if (r == -3) print_error("Too many pools");
+    else print_error("Out of memory");
+}
+
+// Lists every pool with the tasks drawing from it
+static void show_pools(const dag_t *d) {
+    if (d->n_pools == 0) {
+        printf("No pools.\n");
+        return;
+    }
+    for (size_t p = 0; p < d->n_pools; ++p) {
+        printf("%s: capacity=%llu\n", d->pool_name[p], (unsigned long long)d->pool_cap[p]);
+        for (size_t i = 0; i < d->n_tasks; ++i) {
+            const dag_needs_t *r = d->needs[i];
+            for (uint32_t k = 0; r && k < r->n; ++k) {
+                if (r->need[k].pool == p) printf("  %s: %llu\n", d->tasks[i]->id, (unsigned long long)r->need[k].amount);
+            }
+        }
+    }
+}
+
+// Width of every level of the graph: how many tasks could run at once at each depth
+static void show_levels(dag_t *d) {
+    if (d->n_tasks == 0) {
+        printf("No tasks.\n");
+        return;
+    }
+    dag_csr_t c;
+    dag_levels_t lv;
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (dag_csr_build(d, &c) != 0) {
+        print_error("Graph too large for 32-bit indices or out of memory");
+        return;
+    }
+    int r = dag_csr_levels(&c, n_cpus > 0 ? (size_t)n_cpus : 1, &lv);
+    dag_csr_free(&c);
+    if (r != 0) {
+        print_error("Out of memory");
+        return;
+    }
+    size_t widest = 0;
+    for (size_t l = 0; l < lv.n_levels; ++l) {
+        size_t width = lv.start[l + 1] - lv.start[l];
+        if (width > lv.start[widest + 1] - lv.start[widest]) widest = l;
+        printf("Level %zu: %zu task%s\n", l, width, width == 1 ? "" : "s");
+    }
+    size_t most = lv.start[widest + 1] - lv.start[widest];
+    printf("%zu level%s, the widest is level %zu with %zu task%s.\n", lv.n_levels, lv.n_levels == 1 ? "" : "s",
+           widest, most, most == 1 ? "" : "s");
+    dag_levels_free(&lv);
+}
+
 // add_dep <from> <to>
 static void handle_add_dep(char **argv, int argc, dag_t *d) {
     if (argc != 3) {
@@ -112,10 +253,97 @@ static void handle_add_dep(char **argv, int argc, dag_t *d) {
     }
 }
 
-// show tasks | show deps
-static void handle_show(char **argv, int argc, dag_t *d) {
+// Formats a duration in ns with a unit that keeps it short
+static const char *fmt_ns(char *buf, size_t len, uint64_t ns) {
+    if (ns < 1000) snprintf(buf, len, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(buf, len, "%.1fus", (double)ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, len, "%.2fms", (double)ns / 1e6);
+    else snprintf(buf, len, "%.3fs", (double)ns / 1e9);
+    return buf;
+}
+
+static void print_percentiles(const char *label, const hist_view_t *v) {
+    char p50[32], p99[32], max[32];
+    printf("%s p50=%s p99=%s max=%s\n", label, fmt_ns(p50, sizeof(p50), hist_view_percentile(v, 0.50)),
+           fmt_ns(p99, sizeof(p99), hist_view_percentile(v, 0.99)), fmt_ns(max, sizeof(max), v->max));
+}
+
+// Percentiles of the whole run, then of every task that ran, with when it last ran
+// (seconds after run) and its learned run time estimate
+static void show_stats(const dag_t *d, const sched_stats_t *st) {
+    if (!st) {
+        printf("No run yet.\n");
+        return;
+    }
+    hist_view_t *v = malloc(sizeof(hist_view_t));
+    if (!v) { print_error("Out of memory"); return; }
+    stats_run_view(st, 0, v);
+    if (v->total == 0) {
+        printf("No task has finished yet.\n");
+        free(v);
+        return;
+    }
+    // Tasks added since the run started have no statistics
+    size_t n = st->n_tasks < d->n_tasks ? st->n_tasks : d->n_tasks;
+    uint64_t failed = 0, span = 0;
+    for (size_t i = 0; i < n; ++i) {
+        failed += atomic_load_explicit(&st->tasks[i].failed, memory_order_relaxed);
+        uint64_t end = atomic_load_explicit(&st->tasks[i].last_end, memory_order_relaxed);
+        if (end > span) span = end;
+    }
+    printf("Run: %llu task runs finished (%llu failed) within %.3f s\n", (unsigned long long)v->total,
+           (unsigned long long)failed, (double)span / 1e9);
+    print_percentiles("  run time:  ", v);
+    stats_run_view(st, 1, v);
+    print_percentiles("  queue wait:", v);
+
+    for (size_t i = 0; i < n; ++i) {
+        const task_stats_t *ts = &st->tasks[i];
+        uint64_t runs = atomic_load_explicit(&ts->runs, memory_order_acquire);
+        if (runs == 0) continue;
+        stats_task_view(st, i, v);
+        char p50[32], p99[32], max[32], wait[32];
+        uint64_t wait_ns = atomic_load_explicit(&ts->wait_ns, memory_order_relaxed);
+        printf("[%zu] %s: runs=%llu failed=%llu p50=%s p99=%s max=%s wait=%s start=%.3f end=%.3f est=%.3f\n",
+               i, d->tasks[i]->id, (unsigned long long)runs,
+               (unsigned long long)atomic_load_explicit(&ts->failed, memory_order_relaxed),
+               fmt_ns(p50, sizeof(p50), hist_view_percentile(v, 0.50)), fmt_ns(p99, sizeof(p99), hist_view_percentile(v, 0.99)),
+               fmt_ns(max, sizeof(max), v->max), fmt_ns(wait, sizeof(wait), wait_ns / runs),
+               (double)(atomic_load_explicit(&ts->last_start, memory_order_relaxed) - 1) / 1e9,
+               (double)(atomic_load_explicit(&ts->last_end, memory_order_relaxed) - 1) / 1e9, d->cost[i]);
+    }
+    free(v);
+}
+
+// Prints the end of what task id wrote in the last run
+static void show_tail(dag_t *d, const char *id) {
+    int idx = dag_find_index(d, id);
+    if (idx < 0) {
+        print_error("Unknown task ID");
+        return;
+    }
+    if (!capture) {
+        print_error("No output captured (use 'logs <dir>' before running)");
+        return;
+    }
+    char buf[CAPTURE_TAIL_BYTES];
+    size_t n = capture_tail(capture, (size_t)idx, buf);
+    if (n == 0) {
+        printf("No output from '%s'.\n", id);
+        return;
+    }
+    fwrite(buf, 1, n, stdout);
+    if (buf[n - 1] != '\n') putchar('\n');
+}
+
+// show tasks | show deps | show stats | show pools | show levels | show tail <id>
+static void handle_show(char **argv, int argc, dag_t *d, const sched_stats_t *st) {
+    if (argc == 3 && strcmp(argv[1], "tail") == 0) {
+        show_tail(d, argv[2]);
+        return;
+    }
     if (argc != 2) {
-        print_error("Usage: show tasks|deps");
+        print_error("Usage: show tasks|deps|stats|pools|levels, or show tail <id>");
         return;
     }
     if (strcmp(argv[1], "tasks") == 0) {
@@ -125,8 +353,12 @@ static void handle_show(char **argv, int argc, dag_t *d) {
         }
         for (size_t i = 0; i < d->n_tasks; ++i) {
             task_t *t = d->tasks[i];
-            printf("[%zu] %s: time=%ld freq=%d status=%s\n", i, t->id, (long)t->time, t->freq, status_str(t->status));
+            printf("[%zu] %s: time=%ld freq=%d status=%s\n", i, t->id, (long)d->time[i], d->freq[i], status_str(dag_status(d, i)));
         }
+        size_t counts[4];
+        dag_count_status(d, counts);
+        printf("%zu tasks: %zu pending, %zu running, %zu completed, %zu failed\n", d->n_tasks,
+               counts[PENDING], counts[RUNNING], counts[COMPLETED], counts[FAILED]);
     } else if (strcmp(argv[1], "deps") == 0) {
         if (d->n_tasks == 0) {
             printf("No dependencies.\n");
@@ -146,46 +378,421 @@ static void handle_show(char **argv, int argc, dag_t *d) {
             }
             printf("\n");
         }
+    } else if (strcmp(argv[1], "stats") == 0) {
+        show_stats(d, st);
+    } else if (strcmp(argv[1], "pools") == 0) {
+        show_pools(d);
+    } else if (strcmp(argv[1], "levels") == 0) {
+        show_levels(d);
     } else {
         print_error("Unknown show option");
     }
 }
 
-// run [n_workers]
-static void handle_run(char **argv, int argc, scheduler_t **ps, dag_t *d) {
-    if (d->n_tasks == 0) {
-        print_error("No tasks to run.");
-        return;
-    }
-    size_t n_workers = 4;
-    if (argc == 2) {
-        char *endp;
-        long nw = strtol(argv[1], &endp, 10);
-        if (*endp || nw <= 0) { print_error("Invalid worker count"); return; }
-        n_workers = (size_t)nw;
-    } else if (argc > 2) {
-        print_error("Usage: run [n_workers]");
-        return;
-    }
+static void free_trace(sched_trace_t *t) {
+    if (!t) return;
+    trace_free(t);
+    free(t);
+}
 
+// A run's trace is written out once its scheduler stops
+static void stop_scheduler(scheduler_t **ps) {
     if (*ps) {
+        if (metrics) metrics_attach(metrics, NULL);
         sched_stop(*ps);
+        if (capture && capture->err) print_error("Some task output could not be written to its log");
+        if ((*ps)->cache) {
+            if ((*ps)->cache->err) print_error("Failed to write result cache");
+            else printf("Result cache: %llu of %zu tasks were up to date.\n",
+                        (unsigned long long)atomic_load_explicit(&(*ps)->cache->hits, memory_order_relaxed), (*ps)->dag->n_tasks);
+        }
+        sched_trace_t *t = (*ps)->trace;
+        if (t) {
+            if (t->err == 0) printf("Wrote trace of the last run to '%s'.\n", t->path);
+            else print_error("Failed to write trace");
+            free_trace(t);
+        }
         free(*ps);
         *ps = NULL;
     }
+}
+
+// Statistics belong to one run and are only dropped once its scheduler is stopped
+static void free_stats(sched_stats_t **pst, scheduler_t **ps) {
+    if (!*pst) return;
+    stop_scheduler(ps);
+    stats_free(*pst);
+    free(*pst);
+    *pst = NULL;
+}
+
+// Captured output refers to the DAG's slots, so it goes away with the run that made it
+static void free_capture(scheduler_t **ps) {
+    if (!capture) return;
+    stop_scheduler(ps);
+    capture_free(capture);
+    free(capture);
+    capture = NULL;
+}
+
+// Reads the optional [n_workers] [max_running] arguments; reports and returns false if one is bad
+static bool parse_workers(char **argv, int argc, size_t *n_workers, size_t *max_running) {
+    *n_workers = 4;
+    *max_running = 0;
+    char *endp;
+    if (argc >= 1) {
+        long nw = strtol(argv[0], &endp, 10);
+        if (*endp || nw <= 0) { print_error("Invalid worker count"); return false; }
+        *n_workers = (size_t)nw;
+    }
+    // A running-children cap switches to async mode, where it can exceed n_workers
+    if (argc >= 2) {
+        long mr = strtol(argv[1], &endp, 10);
+        if (*endp || mr <= 0) { print_error("Invalid max_running"); return false; }
+        *max_running = (size_t)mr;
+    }
+    return true;
+}
+
+// Stops the last run and drops what belongs to it, before statuses are set up for the next
+static void end_run(scheduler_t **ps, sched_stats_t **pst) {
+    stop_scheduler(ps);
+    free_stats(pst, ps);
+    free_capture(ps);
+}
+
+// Starts a scheduler over d's current statuses with everything the shell has turned on;
+// with only set, just the tasks marked in it run
+static void start_run(scheduler_t **ps, dag_t *d, wal_t *wal, sched_stats_t **pst, const char *trace_path,
+                      const char *log_dir, size_t n_workers, size_t max_running, const bool *only) {
     scheduler_t *s = sched_init(d, n_workers);
+    if (s && max_running > 0) {
+        s->async = true;
+        s->max_running = max_running;
+    }
+    if (s) {
+        s->priority = priority_dispatch;
+        s->wal = wal;
+        s->cache = cache;
+        s->only = only;
+        s->fuse = fuse_chains;
+        sched_stats_t *st = malloc(sizeof(sched_stats_t));
+        if (st && stats_init(st, d->n_tasks, n_workers) == 0) {
+            s->stats = *pst = st;
+        } else {
+            free(st);
+        }
+        if (trace_path) {
+            sched_trace_t *t = malloc(sizeof(sched_trace_t));
+            if (t && trace_init(t, trace_path, n_workers, 0) == 0) {
+                s->trace = t;
+            } else {
+                free(t);
+                print_error("Out of memory, running without a trace");
+            }
+        }
+        if (log_dir) {
+            sched_capture_t *c = malloc(sizeof(sched_capture_t));
+            int r = c ? capture_init(c, log_dir, d, d->n_tasks) : -2;
+            if (r == 0) {
+                s->capture = capture = c;
+            } else {
+                free(c);
+                print_error(r == -1 ? "Can't use the log directory, output not captured" : "Out of memory, output not captured");
+            }
+        }
+    }
     if (!s || sched_start(s) != 0) {
         print_error("Failed to start scheduler");
+        if (s) free_trace(s->trace);
         free(s);
+        free_stats(pst, ps);
+        free_capture(ps);
     } else {
         *ps = s;
-        printf("Scheduler started with %zu workers.\n", n_workers);
+        if (metrics) metrics_attach(metrics, s);
+        if (s->async) printf("Scheduler started with %zu workers, up to %zu tasks running.\n", n_workers, max_running);
+        else printf("Scheduler started with %zu workers.\n", n_workers);
+        if (s->n_chains > 0) {
+            printf("Fused %zu tasks into %zu chain%s.\n", s->n_chained, s->n_chains, s->n_chains == 1 ? "" : "s");
+        }
+    }
+}
+
+// run [n_workers] [max_running] | resume [n_workers] [max_running]
+// run starts every task over; resume first replays the write-ahead log so tasks that
+// completed before a crash are skipped
+static void handle_run(char **argv, int argc, scheduler_t **ps, dag_t *d, wal_t *wal, sched_stats_t **pst,
+                       const char *trace_path, const char *log_dir, bool resume) {
+    if (d->n_tasks == 0) {
+        print_error("No tasks to run.");
+        return;
+    }
+    if (resume && !wal) {
+        print_error("No write-ahead log open (use 'wal <file>' first)");
+        return;
+    }
+    if (argc > 3) {
+        print_error(resume ? "Usage: resume [n_workers] [max_running]" : "Usage: run [n_workers] [max_running]");
+        return;
+    }
+    size_t n_workers, max_running;
+    if (!parse_workers(argv + 1, argc - 1, &n_workers, &max_running)) return;
+
+    end_run(ps, pst);
+    if (resume) {
+        size_t done;
+        int r = wal_replay(wal, d, &done);
+        if (r != 0) {
+            if (r == -4) print_error("Tasks were added since the log was opened");
+            else if (r == -2) print_error("Out of memory");
+            else print_error("Failed to read write-ahead log");
+            return;
+        }
+        printf("Resuming: %zu of %zu tasks already completed.\n", done, d->n_tasks);
+    } else {
+        dag_reset_status(d);
+        if (wal) wal_mark_run(wal);
+    }
+    start_run(ps, d, wal, pst, trace_path, log_dir, n_workers, max_running, NULL);
+}
+
+// rerun <id> [--downstream] [n_workers] [max_running]
+// Runs the task again along with the tasks below it that haven't completed (all of them
+// with --downstream); every other task keeps its status and is left alone
+static void handle_rerun(char **argv, int argc, scheduler_t **ps, dag_t *d, wal_t *wal, sched_stats_t **pst,
+                         const char *trace_path, const char *log_dir) {
+    int a = 2;
+    bool downstream = argc > a && strcmp(argv[a], "--downstream") == 0;
+    if (downstream) a++;
+    if (argc < 2 || argc - a > 2) {
+        print_error("Usage: rerun <id> [--downstream] [n_workers] [max_running]");
+        return;
+    }
+    int idx = dag_find_index(d, argv[1]);
+    if (idx < 0) {
+        print_error("Unknown task ID");
+        return;
+    }
+    size_t n_workers, max_running;
+    if (!parse_workers(argv + a, argc - a, &n_workers, &max_running)) return;
+
+    // Statuses only settle once the last run has stopped
+    end_run(ps, pst);
+    bool *dirty = calloc(d->n_tasks, sizeof(bool));
+    if (!dirty) { print_error("Out of memory"); return; }
+    dag_mark_downstream(d, (size_t)idx, dirty, NULL);
+    size_t n_dirty = 0;
+    for (size_t i = 0; i < d->n_tasks; ++i) {
+        if (dirty[i] && !downstream && i != (size_t)idx && dag_status(d, i) == COMPLETED) dirty[i] = false;
+        if (!dirty[i]) continue;
+        n_dirty++;
+        dag_set_status(d, i, PENDING);
+        // Logged so a crash during the rerun doesn't resume with these as completed
+        if (wal) wal_log(wal, i, PENDING);
+    }
+    printf("Rerunning %zu of %zu tasks.\n", n_dirty, d->n_tasks);
+    start_run(ps, d, wal, pst, trace_path, log_dir, n_workers, max_running, dirty);
+    free(dirty);
+}
+
+// The log is tied to the DAG it was opened for, and the scheduler may still be writing to it
+static void close_wal(wal_t **pw, scheduler_t **ps) {
+    if (!*pw) return;
+    stop_scheduler(ps);
+    if (wal_close(*pw) != 0) print_error("Write-ahead log had I/O errors");
+    free(*pw);
+    *pw = NULL;
+}
+
+// wal <file>
+static void handle_wal(char **argv, int argc, dag_t *d, wal_t **pw, scheduler_t **ps) {
+    if (argc != 2) {
+        print_error("Usage: wal <file>");
+        return;
+    }
+    close_wal(pw, ps);
+    wal_t *w = malloc(sizeof(wal_t));
+    if (!w) { print_error("Out of memory"); return; }
+    int r = wal_open(w, argv[1], d);
+    if (r != 0) {
+        if (r == -4) print_error("Not a write-ahead log for this DAG");
+        else if (r == -2) print_error("Out of memory");
+        else print_error("Failed to open write-ahead log");
+        free(w);
+        return;
+    }
+    *pw = w;
+    printf("Logging task status to '%s'.\n", argv[1]);
+}
+
+static void stop_metrics(void) {
+    if (!metrics) return;
+    metrics_stop(metrics);
+    free(metrics);
+    metrics = NULL;
+}
+
+// metrics <socket>
+static void handle_metrics(char **argv, int argc, scheduler_t *s) {
+    if (argc != 2) {
+        print_error("Usage: metrics <socket>");
+        return;
+    }
+    stop_metrics();
+    metrics_server_t *m = malloc(sizeof(metrics_server_t));
+    if (!m) { print_error("Out of memory"); return; }
+    int r = metrics_start(m, argv[1]);
+    if (r != 0) {
+        print_error(r == -2 ? "Out of memory" : "Failed to listen on metrics socket");
+        free(m);
+        return;
+    }
+    metrics = m;
+    if (s) metrics_attach(m, s);
+    printf("Serving metrics on '%s'.\n", argv[1]);
+}
+
+// trace [file]
+// Only takes effect from the next run on
+static void handle_trace(char **argv, int argc, char **ppath) {
+    if (argc > 2) {
+        print_error("Usage: trace [file]");
+        return;
+    }
+    free(*ppath);
+    *ppath = NULL;
+    if (argc == 1) {
+        printf("Tracing off.\n");
+        return;
+    }
+    *ppath = strdup(argv[1]);
+    if (!*ppath) { print_error("Out of memory"); return; }
+    printf("Tracing runs to '%s'.\n", argv[1]);
+}
+
+// logs [dir]
+// Only takes effect from the next run on
+static void handle_logs(char **argv, int argc, char **pdir) {
+    if (argc > 2) {
+        print_error("Usage: logs [dir]");
+        return;
+    }
+    free(*pdir);
+    *pdir = NULL;
+    if (argc == 1) {
+        printf("Output capture off.\n");
+        return;
+    }
+    *pdir = strdup(argv[1]);
+    if (!*pdir) { print_error("Out of memory"); return; }
+    printf("Capturing task output in '%s'.\n", argv[1]);
+}
+
+// fuse on|off
+static void handle_fuse(char **argv, int argc) {
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        print_error("Usage: fuse on|off");
+        return;
+    }
+    fuse_chains = strcmp(argv[1], "on") == 0;
+    printf(fuse_chains ? "Fusing linear chains of commands.\n" : "Chain fusion off.\n");
+}
+
+// priority on|off
+static void handle_priority(char **argv, int argc) {
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        print_error("Usage: priority on|off");
+        return;
+    }
+    priority_dispatch = strcmp(argv[1], "on") == 0;
+    printf(priority_dispatch ? "Dispatching ready tasks by upward rank.\n" : "Dispatching ready tasks in FIFO order.\n");
+}
+
+// The cache is in use by the scheduler until it stops
+static void close_cache(scheduler_t **ps) {
+    if (!cache) return;
+    stop_scheduler(ps);
+    cache_free(cache);
+    free(cache);
+    cache = NULL;
+}
+
+// cache [file]
+// Only takes effect from the next run on
+static void handle_cache(char **argv, int argc, scheduler_t **ps) {
+    if (argc > 2) {
+        print_error("Usage: cache [file]");
+        return;
+    }
+    close_cache(ps);
+    if (argc == 1) {
+        printf("Result cache off.\n");
+        return;
+    }
+    sched_cache_t *c = malloc(sizeof(sched_cache_t));
+    if (!c) { print_error("Out of memory"); return; }
+    int r = cache_open(c, argv[1]);
+    if (r != 0) {
+        if (r == -4) print_error("Not a result cache");
+        else if (r == -2) print_error("Out of memory");
+        else print_error("Failed to read result cache");
+        free(c);
+        return;
+    }
+    cache = c;
+    printf("Caching task results in '%s' (%zu known).\n", argv[1], c->n_entries);
+}
+
+// save <file>
+static void handle_save(char **argv, int argc, dag_t *d) {
+    if (argc != 2) {
+        print_error("Usage: save <file>");
+        return;
+    }
+    int r = dag_snapshot_save(d, argv[1]);
+    if (r == 0) {
+        printf("Saved %zu tasks to '%s'.\n", d->n_tasks, argv[1]);
+    } else if (r == -3) {
+        print_error("This DAG can't be saved");
+    } else if (r == -2) {
+        print_error("Out of memory");
+    } else {
+        print_error("Failed to write snapshot");
+    }
+}
+
+// load <file>
+static void handle_load(char **argv, int argc, dag_t **pd, scheduler_t **ps, wal_t **pw, sched_stats_t **pst) {
+    if (argc != 2) {
+        print_error("Usage: load <file>");
+        return;
+    }
+    dag_t *loaded;
+    int r = dag_snapshot_load(argv[1], &loaded);
+    if (r != 0) {
+        if (r == -4) print_error("Not a valid snapshot");
+        else if (r == -2) print_error("Out of memory");
+        else print_error("Failed to open snapshot");
+        return;
     }
+    // The running scheduler, the log and the last run's statistics and output still point at the old DAG
+    stop_scheduler(ps);
+    close_wal(pw, ps);
+    free_stats(pst, ps);
+    free_capture(ps);
+    dag_free(*pd);
+    *pd = loaded;
+    printf("Loaded %zu tasks from '%s'.\n", loaded->n_tasks, argv[1]);
 }
 
-void shell_loop(dag_t *d, scheduler_t **ps) {
+void shell_loop(dag_t **pd, scheduler_t **ps) {
     char *line = NULL;
     size_t cap = 0;
+    wal_t *wal = NULL;
+    sched_stats_t *stats = NULL;
+    char *trace_path = NULL;
+    char *log_dir = NULL;
 
     while (1) {
         if (getline(&line, &cap, stdin) == -1) break;
@@ -195,14 +802,39 @@ void shell_loop(dag_t *d, scheduler_t **ps) {
         int argc = tokenize_line(line, argv);
         if (argc == 0) continue;
 
+        dag_t *d = *pd;
         if (strcmp(argv[0], "add_task") == 0) {
             handle_add_task(argv, argc, d);
         } else if (strcmp(argv[0], "add_dep") == 0) {
             handle_add_dep(argv, argc, d);
+        } else if (strcmp(argv[0], "pool") == 0) {
+            handle_pool(argv, argc, d);
         } else if (strcmp(argv[0], "show") == 0) {
-            handle_show(argv, argc, d);
+            handle_show(argv, argc, d, stats);
         } else if (strcmp(argv[0], "run") == 0) {
-            handle_run(argv, argc, ps, d);
+            handle_run(argv, argc, ps, d, wal, &stats, trace_path, log_dir, false);
+        } else if (strcmp(argv[0], "resume") == 0) {
+            handle_run(argv, argc, ps, d, wal, &stats, trace_path, log_dir, true);
+        } else if (strcmp(argv[0], "rerun") == 0) {
+            handle_rerun(argv, argc, ps, d, wal, &stats, trace_path, log_dir);
+        } else if (strcmp(argv[0], "wal") == 0) {
+            handle_wal(argv, argc, d, &wal, ps);
+        } else if (strcmp(argv[0], "metrics") == 0) {
+            handle_metrics(argv, argc, *ps);
+        } else if (strcmp(argv[0], "trace") == 0) {
+            handle_trace(argv, argc, &trace_path);
+        } else if (strcmp(argv[0], "logs") == 0) {
+            handle_logs(argv, argc, &log_dir);
+        } else if (strcmp(argv[0], "cache") == 0) {
+            handle_cache(argv, argc, ps);
+        } else if (strcmp(argv[0], "fuse") == 0) {
+            handle_fuse(argv, argc);
+        } else if (strcmp(argv[0], "priority") == 0) {
+            handle_priority(argv, argc);
+        } else if (strcmp(argv[0], "save") == 0) {
+            handle_save(argv, argc, d);
+        } else if (strcmp(argv[0], "load") == 0) {
+            handle_load(argv, argc, pd, ps, &wal, &stats);
         } else if (strcmp(argv[0], "help") == 0) {
             print_help();
         } else if (strcmp(argv[0], "exit") == 0) {
@@ -211,5 +843,14 @@ void shell_loop(dag_t *d, scheduler_t **ps) {
             print_error("Unknown command (type 'help')");
         }
     }
+    close_wal(&wal, ps);
+    free_stats(&stats, ps);
+    stop_metrics();
+    // Stopping the last run here, rather than in main, writes its trace
+    stop_scheduler(ps);
+    free_capture(ps);
+    close_cache(ps);
+    free(trace_path);
+    free(log_dir);
     free(line);
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "dag_manager.h"
 #include "scheduler.h"
 
-void shell_loop(dag_t *d, scheduler_t **ps);
+// Reads commands from stdin until exit or EOF
+// load replaces the DAG, so the caller's pointer is updated through pd
+void shell_loop(dag_t **pd, scheduler_t **ps);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,511 @@
+#define _POSIX_C_SOURCE 200809L
+#include "snapshot.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ---- checksum ----
+
+// Four independent multiply-xorshift lanes over 64-bit words, so the CPU can overlap them
+typedef struct {
+    uint64_t lane[4];
+    uint64_t words; // words hashed so far, which decides the lane of the next one
+} snap_hash_t;
+
+static inline uint64_t mix(uint64_t h, uint64_t w) {
+    h ^= w;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+}
+
+static void hash_init(snap_hash_t *h) {
+    h->lane[0] = 0x243f6a8885a308d3ULL;
+    h->lane[1] = 0x13198a2e03707344ULL;
+    h->lane[2] = 0xa4093822299f31d0ULL;
+    h->lane[3] = 0x082efa98ec4e6c89ULL;
+    h->words = 0;
+}
+
+// n must be a multiple of 8
+static void hash_update(snap_hash_t *h, const void *p, size_t n) {
+    const unsigned char *b = p;
+    size_t nw = n / 8, i = 0;
+    uint64_t w;
+    for (; i < nw && ((h->words + i) & 3) != 0; ++i) {
+        memcpy(&w, b + 8 * i, 8);
+        h->lane[(h->words + i) & 3] = mix(h->lane[(h->words + i) & 3], w);
+    }
+    uint64_t l0 = h->lane[0], l1 = h->lane[1], l2 = h->lane[2], l3 = h->lane[3];
+    for (; i + 4 <= nw; i += 4) {
+        uint64_t w4[4];
+        memcpy(w4, b + 8 * i, 32);
+        l0 = mix(l0, w4[0]);
+        l1 = mix(l1, w4[1]);
+        l2 = mix(l2, w4[2]);
+        l3 = mix(l3, w4[3]);
+    }
+    h->lane[0] = l0;
+    h->lane[1] = l1;
+    h->lane[2] = l2;
+    h->lane[3] = l3;
+    for (; i < nw; ++i) {
+        memcpy(&w, b + 8 * i, 8);
+        h->lane[(h->words + i) & 3] = mix(h->lane[(h->words + i) & 3], w);
+    }
+    h->words += nw;
+}
+
+static uint64_t hash_final(const snap_hash_t *h) {
+    return mix(mix(mix(mix(h->lane[0], h->lane[1]), h->lane[2]), h->lane[3]), h->words);
+}
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+// ---- writing ----
+
+#define SNAP_BUF_SIZE (1 << 16)
+
+// Buffered writer that hashes everything it writes after the header
+typedef struct {
+    FILE         *f;
+    unsigned char buf[SNAP_BUF_SIZE];
+    size_t        len;
+    uint64_t      pos; // bytes written so far, header included
+    snap_hash_t   hash;
+    int           err;
+} snap_writer_t;
+
+static void writer_flush(snap_writer_t *w) {
+    if (w->len == 0 || w->err) return;
+    hash_update(&w->hash, w->buf, w->len);
+    if (fwrite(w->buf, 1, w->len, w->f) != w->len) w->err = -1;
+    w->len = 0;
+}
+
+static void writer_put(snap_writer_t *w, const void *p, size_t n) {
+    const unsigned char *b = p;
+    while (n > 0 && !w->err) {
+        size_t k = SNAP_BUF_SIZE - w->len;
+        if (k > n) k = n;
+        memcpy(w->buf + w->len, b, k);
+        w->len += k;
+        w->pos += k;
+        b += k;
+        n -= k;
+        if (w->len == SNAP_BUF_SIZE) writer_flush(w);
+    }
+}
+
+static void writer_u32(snap_writer_t *w, uint32_t x) {
+    writer_put(w, &x, sizeof(x));
+}
+
+// Zero-fills up to the next 8-byte boundary
+static void writer_pad(snap_writer_t *w) {
+    static const unsigned char zeros[8] = { 0 };
+    writer_put(w, zeros, align8(w->pos) - w->pos);
+}
+
+// String pool shared by IDs, commands and input paths; equal commands and paths are stored once
+typedef struct {
+    char     *data;
+    size_t    len, cap;
+    uint32_t *cmd_tab; // open-addressing table of command (or path) offset + 1
+    size_t    cmd_cap;
+} snap_pool_t;
+
+static size_t hash_str(const char *s) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+// Appends s and stores its offset in out; returns 0, -2 on allocation failure, -3 if the pool is too big
+static int pool_append(snap_pool_t *p, const char *s, uint32_t *out) {
+    size_t n = strlen(s) + 1;
+    if (p->len + n > UINT32_MAX) return -3;
+    if (p->len + n > p->cap) {
+        size_t cap = p->cap ? p->cap : 4096;
+        while (cap < p->len + n) cap *= 2;
+        char *data = realloc(p->data, cap);
+        if (!data) return -2;
+        p->data = data;
+        p->cap = cap;
+    }
+    memcpy(p->data + p->len, s, n);
+    *out = (uint32_t)p->len;
+    p->len += n;
+    return 0;
+}
+
+static int pool_command(snap_pool_t *p, const char *cmd, uint32_t *out) {
+    size_t mask = p->cmd_cap - 1;
+    size_t b = hash_str(cmd) & mask;
+    for (; p->cmd_tab[b] != 0; b = (b + 1) & mask) {
+        if (strcmp(p->data + p->cmd_tab[b] - 1, cmd) == 0) {
+            *out = p->cmd_tab[b] - 1;
+            return 0;
+        }
+    }
+    int r = pool_append(p, cmd, out);
+    if (r == 0) p->cmd_tab[b] = *out + 1;
+    return r;
+}
+
+int dag_snapshot_save(const dag_t *d, const char *path) {
+    if (!d || !path) return -1;
+    if (d->bulk || d->n_tasks >= UINT32_MAX) return -3;
+    size_t n = d->n_tasks, m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (d->tasks[i]->kind != TASK_CMD) return -3;
+        m += d->n_deps[i];
+    }
+    size_t n_needs = 0, n_inputs = 0;
+    for (size_t i = 0; i < n; ++i) {
+        n_needs += d->needs[i] ? d->needs[i]->n : 0;
+        n_inputs += d->inputs[i] ? d->inputs[i]->n : 0;
+    }
+    if (m > UINT32_MAX || d->index_cap > UINT32_MAX || n_needs > UINT32_MAX || n_inputs > UINT32_MAX) return -3;
+
+    // IDs and deduplicated commands go into the pool first, so its size is known up front
+    snap_pool_t pool = { 0 };
+    pool.cmd_cap = 16;
+    while (pool.cmd_cap < 2 * (n + n_inputs)) pool.cmd_cap <<= 1;
+    pool.cmd_tab = calloc(pool.cmd_cap, sizeof(uint32_t));
+    uint32_t *id_off = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *cmd_off = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *in_path = malloc((n_inputs ? n_inputs : 1) * sizeof(uint32_t));
+    uint32_t res_name[DAG_MAX_POOLS];
+    snap_writer_t *w = malloc(sizeof(snap_writer_t));
+    int err = 0;
+    if (!pool.cmd_tab || !id_off || !cmd_off || !in_path || !w) err = -2;
+    size_t n_in = 0;
+    for (size_t i = 0; i < n && !err; ++i) {
+        err = pool_append(&pool, d->tasks[i]->id, &id_off[i]);
+        if (!err) err = pool_command(&pool, d->tasks[i]->cmd, &cmd_off[i]);
+        for (uint32_t k = 0; !err && d->inputs[i] && k < d->inputs[i]->n; ++k) {
+            err = pool_command(&pool, d->inputs[i]->path[k], &in_path[n_in++]);
+        }
+    }
+    for (size_t p = 0; p < d->n_pools && !err; ++p) err = pool_append(&pool, d->pool_name[p], &res_name[p]);
+    if (err) goto done;
+
+    snap_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.version     = SNAP_VERSION;
+    h.header_size = sizeof(snap_header_t);
+    h.n_tasks     = n;
+    h.n_edges     = m;
+    h.capacity    = d->capacity;
+    h.index_cap   = d->index_cap;
+    h.pool_size   = pool.len;
+    h.n_res       = d->n_pools;
+    h.n_needs     = n_needs;
+    h.n_inputs    = n_inputs;
+    h.off_time    = align8(sizeof(snap_header_t));
+    h.off_freq    = align8(h.off_time + 8 * n);
+    h.off_cost    = align8(h.off_freq + 4 * n);
+    h.off_id      = align8(h.off_cost + 8 * n);
+    h.off_cmd     = align8(h.off_id + 4 * n);
+    h.off_off     = align8(h.off_cmd + 4 * n);
+    h.off_adj     = align8(h.off_off + 4 * (n + 1));
+    h.off_topo    = align8(h.off_adj + 4 * m);
+    h.off_index   = align8(h.off_topo + 4 * n);
+    h.off_res_cap  = align8(h.off_index + 4 * d->index_cap);
+    h.off_res_name = align8(h.off_res_cap + 8 * h.n_res);
+    h.off_need_off = align8(h.off_res_name + 4 * h.n_res);
+    h.off_need_res = align8(h.off_need_off + 4 * (n + 1));
+    h.off_need_amt = align8(h.off_need_res + 4 * n_needs);
+    h.off_in_off  = align8(h.off_need_amt + 8 * n_needs);
+    h.off_in_path = align8(h.off_in_off + 4 * (n + 1));
+    h.off_pool    = align8(h.off_in_path + 4 * n_inputs);
+    h.file_size   = align8(h.off_pool + pool.len);
+
+    // Written next to the target and renamed over it, so a crash never leaves half a snapshot
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 5);
+    if (!tmp) {
+        err = -2;
+        goto done;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    w->f = fopen(tmp, "wb");
+    if (!w->f) {
+        free(tmp);
+        err = -1;
+        goto done;
+    }
+    w->len = 0;
+    w->pos = 0;
+    w->err = 0;
+
+    // The header is written last, once the checksum is known
+    if (fseek(w->f, (long)h.off_time, SEEK_SET) != 0) w->err = -1;
+    w->pos = h.off_time;
+    hash_init(&w->hash);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t t = (int64_t)d->time[i];
+        writer_put(w, &t, sizeof(t));
+    }
+    for (size_t i = 0; i < n; ++i) {
+        int32_t f = d->freq[i];
+        writer_put(w, &f, sizeof(f));
+    }
+    writer_pad(w);
+    writer_put(w, d->cost, 8 * n);
+    writer_put(w, id_off, 4 * n);
+    writer_pad(w);
+    writer_put(w, cmd_off, 4 * n);
+    writer_pad(w);
+    uint32_t off = 0;
+    for (size_t i = 0; i < n; ++i) {
+        writer_u32(w, off);
+        off += (uint32_t)d->n_deps[i];
+    }
+    writer_u32(w, off);
+    writer_pad(w);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = 0; k < d->n_deps[i]; ++k) writer_u32(w, (uint32_t)d->deps[i][k]);
+    }
+    writer_pad(w);
+    for (size_t i = 0; i < n; ++i) writer_u32(w, (uint32_t)d->topo_pos[i]);
+    writer_pad(w);
+    for (size_t b = 0; b < d->index_cap; ++b) writer_u32(w, (uint32_t)d->index[b]);
+    writer_pad(w);
+    writer_put(w, d->pool_cap, 8 * d->n_pools);
+    writer_put(w, res_name, 4 * d->n_pools);
+    writer_pad(w);
+    off = 0;
+    for (size_t i = 0; i < n; ++i) {
+        writer_u32(w, off);
+        off += d->needs[i] ? d->needs[i]->n : 0;
+    }
+    writer_u32(w, off);
+    writer_pad(w);
+    for (size_t i = 0; i < n; ++i) {
+        for (uint32_t k = 0; d->needs[i] && k < d->needs[i]->n; ++k) writer_u32(w, d->needs[i]->need[k].pool);
+    }
+    writer_pad(w);
+    for (size_t i = 0; i < n; ++i) {
+        for (uint32_t k = 0; d->needs[i] && k < d->needs[i]->n; ++k) writer_put(w, &d->needs[i]->need[k].amount, 8);
+    }
+    off = 0;
+    for (size_t i = 0; i < n; ++i) {
+        writer_u32(w, off);
+        off += d->inputs[i] ? d->inputs[i]->n : 0;
+    }
+    writer_u32(w, off);
+    writer_pad(w);
+    writer_put(w, in_path, 4 * n_inputs);
+    writer_pad(w);
+    writer_put(w, pool.data, pool.len);
+    writer_pad(w);
+    writer_flush(w);
+
+    if (!w->err && w->pos != h.file_size) w->err = -1;
+    h.checksum = hash_final(&w->hash);
+    if (!w->err && (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w->f) != 1)) w->err = -1;
+    if (!w->err && (fflush(w->f) != 0 || fsync(fileno(w->f)) != 0)) w->err = -1;
+    if (fclose(w->f) != 0 && !w->err) w->err = -1;
+    if (!w->err && rename(tmp, path) != 0) w->err = -1;
+    if (w->err) unlink(tmp);
+    err = w->err;
+    free(tmp);
+
+done:
+    free(w);
+    free(id_off);
+    free(cmd_off);
+    free(in_path);
+    free(pool.cmd_tab);
+    free(pool.data);
+    return err;
+}
+
+// ---- loading ----
+
+// Whether a section of count entries of size bytes at off fits in the file
+static int section_ok(const snap_header_t *h, uint64_t off, uint64_t count, uint64_t size) {
+    return off % 8 == 0 && off >= h->header_size && off <= h->file_size &&
+           count <= (h->file_size - off) / size;
+}
+
+static int header_ok(const snap_header_t *h, uint64_t file_size) {
+    if (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) != 0) return 0;
+    if (h->version != SNAP_VERSION || h->header_size != sizeof(snap_header_t)) return 0;
+    if (h->file_size != file_size || h->file_size % 8 != 0) return 0;
+    if (h->n_tasks >= UINT32_MAX || h->n_edges > UINT32_MAX) return 0;
+    if (h->n_res > DAG_MAX_POOLS || h->n_needs > UINT32_MAX || h->n_inputs > UINT32_MAX) return 0;
+    if (h->capacity < h->n_tasks || h->index_cap != 2 * h->capacity) return 0;
+    // Capacities only ever come from doubling DAG_INITIAL_CAPACITY
+    if (h->capacity < DAG_INITIAL_CAPACITY || (h->capacity & (h->capacity - 1)) != 0) return 0;
+    return section_ok(h, h->off_time, h->n_tasks, 8) && section_ok(h, h->off_freq, h->n_tasks, 4) &&
+           section_ok(h, h->off_cost, h->n_tasks, 8) &&
+           section_ok(h, h->off_id, h->n_tasks, 4) && section_ok(h, h->off_cmd, h->n_tasks, 4) &&
+           section_ok(h, h->off_off, h->n_tasks + 1, 4) && section_ok(h, h->off_adj, h->n_edges, 4) &&
+           section_ok(h, h->off_topo, h->n_tasks, 4) && section_ok(h, h->off_index, h->index_cap, 4) &&
+           section_ok(h, h->off_res_cap, h->n_res, 8) && section_ok(h, h->off_res_name, h->n_res, 4) &&
+           section_ok(h, h->off_need_off, h->n_tasks + 1, 4) && section_ok(h, h->off_need_res, h->n_needs, 4) &&
+           section_ok(h, h->off_need_amt, h->n_needs, 8) &&
+           section_ok(h, h->off_in_off, h->n_tasks + 1, 4) && section_ok(h, h->off_in_path, h->n_inputs, 4) &&
+           section_ok(h, h->off_pool, h->pool_size, 1) &&
+           (h->pool_size == 0 || h->n_tasks > 0 || h->n_res > 0);
+}
+
+int dag_snapshot_load(const char *path, dag_t **out) {
+    if (!path || !out) return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len < sizeof(snap_header_t)) {
+        close(fd);
+        return -4;
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const unsigned char *base = map;
+    const snap_header_t *h = map;
+    int err = -4;
+    if (!header_ok(h, len)) goto fail_map;
+    // The whole file is read once for the checksum, which also pages it in
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+    snap_hash_t sum;
+    hash_init(&sum);
+    hash_update(&sum, base + h->header_size, len - h->header_size);
+    if (hash_final(&sum) != h->checksum) goto fail_map;
+    if (h->pool_size > 0 && base[h->off_pool + h->pool_size - 1] != '\0') goto fail_map;
+    if (((const uint32_t *)(base + h->off_off))[h->n_tasks] != h->n_edges) goto fail_map;
+    if (((const uint32_t *)(base + h->off_need_off))[h->n_tasks] != h->n_needs) goto fail_map;
+    if (((const uint32_t *)(base + h->off_in_off))[h->n_tasks] != h->n_inputs) goto fail_map;
+
+    size_t n = h->n_tasks, m = h->n_edges;
+    const int64_t  *time  = (const int64_t *)(base + h->off_time);
+    const int32_t  *freq  = (const int32_t *)(base + h->off_freq);
+    const double   *cost  = (const double *)(base + h->off_cost);
+    const uint32_t *id    = (const uint32_t *)(base + h->off_id);
+    const uint32_t *cmd   = (const uint32_t *)(base + h->off_cmd);
+    const uint32_t *off   = (const uint32_t *)(base + h->off_off);
+    const uint32_t *adj   = (const uint32_t *)(base + h->off_adj);
+    const uint32_t *topo  = (const uint32_t *)(base + h->off_topo);
+    const uint32_t *index = (const uint32_t *)(base + h->off_index);
+    const uint64_t *res_cap  = (const uint64_t *)(base + h->off_res_cap);
+    const uint32_t *res_name = (const uint32_t *)(base + h->off_res_name);
+    const uint32_t *need_off = (const uint32_t *)(base + h->off_need_off);
+    const uint32_t *need_res = (const uint32_t *)(base + h->off_need_res);
+    const uint64_t *need_amt = (const uint64_t *)(base + h->off_need_amt);
+    const uint32_t *in_off   = (const uint32_t *)(base + h->off_in_off);
+    const uint32_t *in_path  = (const uint32_t *)(base + h->off_in_path);
+    char *pool = (char *)(base + h->off_pool);
+
+    err = -2;
+    dag_t *d = dag_init();
+    if (!d) goto fail_map;
+    // Reserving the saved capacity gives the same index size, so the saved index is reused as is
+    if (dag_reserve(d, h->capacity) != 0) goto fail_dag;
+    if (d->capacity != h->capacity || d->index_cap != h->index_cap) {
+        err = -4;
+        goto fail_dag;
+    }
+    task_t *tasks = n ? arena_alloc(&d->arena, n * sizeof(task_t), _Alignof(task_t)) : NULL;
+    d->deps_block = m ? malloc(m * sizeof(size_t)) : NULL;
+    if ((n && !tasks) || (m && !d->deps_block)) goto fail_dag;
+    d->deps_block_len = m;
+
+    for (size_t i = 0; i < n; ++i) {
+        task_t *t = &tasks[i];
+        t->id       = pool + id[i];
+        t->kind     = TASK_CMD;
+        t->cmd      = pool + cmd[i];
+        t->fn       = NULL;
+        t->arg      = NULL;
+        t->time     = (time_t)time[i];
+        t->freq     = freq[i];
+        t->in_arena = true;
+        d->tasks[i] = t;
+        atomic_init(&d->status[i], (unsigned char)PENDING);
+        d->time[i] = t->time;
+        d->freq[i] = t->freq;
+        // Anything that isn't a sane duration would throw off the scheduler's ranks
+        d->cost[i] = cost[i] >= 0 && cost[i] < 1e12 ? cost[i] : 0;
+        d->needs[i] = NULL;
+        d->inputs[i] = NULL;
+        d->n_deps[i] = off[i + 1] - off[i];
+        d->deps[i] = d->n_deps[i] ? d->deps_block + off[i] : NULL;
+        d->topo_pos[i] = topo[i];
+        d->topo_node[topo[i]] = i;
+    }
+    for (size_t k = 0; k < m; ++k) d->deps_block[k] = adj[k];
+    for (size_t b = 0; b < d->index_cap; ++b) d->index[b] = index[b];
+    d->n_tasks = n;
+    for (size_t p = 0; p < h->n_res; ++p) {
+        if (res_name[p] >= h->pool_size || res_cap[p] == 0) {
+            err = -4;
+            goto fail_dag;
+        }
+        d->pool_name[p] = pool + res_name[p];
+        d->pool_cap[p] = res_cap[p];
+    }
+    d->n_pools = h->n_res;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t k0 = need_off[i], k1 = need_off[i + 1];
+        if (k0 > k1 || k1 > h->n_needs || k1 - k0 > DAG_MAX_POOLS) {
+            err = -4;
+            goto fail_dag;
+        }
+        if (k0 == k1) continue;
+        dag_need_t needs[DAG_MAX_POOLS];
+        for (uint32_t k = k0; k < k1; ++k) needs[k - k0] = (dag_need_t){ need_res[k], need_amt[k] };
+        int r = dag_set_needs(d, i, needs, k1 - k0);
+        if (r != 0) {
+            err = r == -1 ? -4 : -2;
+            goto fail_dag;
+        }
+    }
+    // Input paths point into the mapping, like IDs and commands
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t k0 = in_off[i], k1 = in_off[i + 1];
+        if (k0 > k1 || k1 > h->n_inputs) {
+            err = -4;
+            goto fail_dag;
+        }
+        if (k0 == k1) continue;
+        dag_inputs_t *in = arena_alloc(&d->arena, sizeof(dag_inputs_t) + (k1 - k0) * sizeof(char *), _Alignof(dag_inputs_t));
+        if (!in) goto fail_dag;
+        for (uint32_t k = k0; k < k1; ++k) {
+            if (in_path[k] >= h->pool_size || pool[in_path[k]] == '\0') {
+                err = -4;
+                goto fail_dag;
+            }
+            in->path[k - k0] = pool + in_path[k];
+        }
+        in->n = k1 - k0;
+        d->inputs[i] = in;
+    }
+    d->snapshot = map;
+    d->snapshot_len = len;
+    *out = d;
+    return 0;
+
+fail_dag:
+    dag_free(d);
+fail_map:
+    munmap(map, len);
+    return err;
+}
@@ -0,0 +1,64 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "dag_manager.h"
+
+// Binary DAG snapshot, written by dag_snapshot_save and mapped back by dag_snapshot_load
+//
+// Layout (native byte order, every section starts on an 8-byte boundary):
+//   header     snap_header_t
+//   time       int64_t  [n_tasks]       declared start delays
+//   freq       int32_t  [n_tasks]       declared periods
+//   cost       double   [n_tasks]       expected run times in seconds (0 = unknown)
+//   id         uint32_t [n_tasks]       offsets of IDs in the string pool
+//   cmd        uint32_t [n_tasks]       offsets of commands in the string pool (shared when equal)
+//   off        uint32_t [n_tasks + 1]   CSR row offsets into adj
+//   adj        uint32_t [n_edges]       successors of every task, in the DAG's own order
+//   topo       uint32_t [n_tasks]       position of each task in the DAG's topological order
+//   index      uint32_t [index_cap]     the DAG's ID hash index (slot + 1, 0 = empty)
+//   res_cap    uint64_t [n_res]         capacity of each resource pool
+//   res_name   uint32_t [n_res]         offsets of resource pool names in the string pool
+//   need_off   uint32_t [n_tasks + 1]   row offsets into need_res and need_amt
+//   need_res   uint32_t [n_needs]       resource pool of every need, task by task
+//   need_amt   uint64_t [n_needs]       amount of every need
+//   in_off     uint32_t [n_tasks + 1]   row offsets into in_path
+//   in_path    uint32_t [n_inputs]      offsets of input file paths in the string pool, task by task
+//   pool       char     [pool_size]     NUL-terminated strings
+// checksum covers everything after the header
+
+#define SNAP_MAGIC   "GTSNAP\0\0"
+#define SNAP_VERSION 4
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t checksum;
+    uint64_t n_tasks;
+    uint64_t n_edges;
+    uint64_t capacity; // DAG capacity at save time; the saved index is only reused at the same capacity
+    uint64_t index_cap;
+    uint64_t pool_size;
+    uint64_t n_res; // resource pools, at most DAG_MAX_POOLS
+    uint64_t n_needs; // needs of all tasks together
+    uint64_t n_inputs; // input files of all tasks together
+    uint64_t off_time, off_freq, off_cost, off_id, off_cmd, off_off, off_adj, off_topo, off_index, off_pool;
+    uint64_t off_res_cap, off_res_name, off_need_off, off_need_res, off_need_amt;
+    uint64_t off_in_off, off_in_path;
+} snap_header_t;
+
+// Writes the DAG to path, through a temporary file renamed into place
+// Returns 0 on success, -1 on I/O error, -2 on memory allocation failure,
+// -3 if the DAG can't be saved (bulk build in progress, function tasks, or too large for 32-bit offsets)
+int dag_snapshot_save(const dag_t *d, const char *path);
+
+// Maps the snapshot at path and builds a DAG on top of it without re-validating the graph:
+// only the header and checksum are checked. IDs and commands point straight into the
+// mapping, which stays open until dag_free; all tasks start PENDING
+// Returns 0 and stores the new DAG in out, -1 if the file can't be opened or mapped,
+// -2 on memory allocation failure, -4 if the file is not a valid snapshot
+int dag_snapshot_load(const char *path, dag_t **out);
+
+#endif
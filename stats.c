@@ -0,0 +1,138 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RELAXED memory_order_relaxed
+
+int stats_init(sched_stats_t *st, size_t n_tasks, size_t n_workers) {
+    memset(st, 0, sizeof(*st));
+    st->tasks = calloc(n_tasks ? n_tasks : 1, sizeof(task_stats_t));
+    st->threads = calloc(n_workers + 1, sizeof(stats_thread_t));
+    if (!st->tasks || !st->threads) {
+        stats_free(st);
+        return -2;
+    }
+    st->n_tasks = n_tasks;
+    st->n_threads = n_workers + 1;
+    return 0;
+}
+
+void stats_free(sched_stats_t *st) {
+    if (st->tasks) {
+        for (size_t i = 0; i < st->n_tasks; ++i) free(atomic_load(&st->tasks[i].hist));
+    }
+    free(st->tasks);
+    free(st->threads);
+    memset(st, 0, sizeof(*st));
+}
+
+// Values below HIST_SUB get a bucket each; above that every power of two is split
+// into HIST_SUB equal buckets
+static size_t hist_bucket(uint64_t v) {
+    if (v < HIST_SUB) return (size_t)v;
+    unsigned e = 63 - (unsigned)__builtin_clzll(v);
+    if (e >= HIST_MAX_BITS) return HIST_BUCKETS - 1;
+    return (size_t)(e - HIST_SUB_BITS + 1) * HIST_SUB + (size_t)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// Smallest value that lands in bucket b
+static uint64_t hist_bucket_low(size_t b) {
+    if (b < HIST_SUB) return b;
+    unsigned e = (unsigned)(b / HIST_SUB) + HIST_SUB_BITS - 1;
+    return (uint64_t)(HIST_SUB + b % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+static void max_relaxed(atomic_uint_least64_t *a, uint64_t v) {
+    if (v > atomic_load_explicit(a, RELAXED)) atomic_store_explicit(a, v, RELAXED);
+}
+
+static void add_relaxed(atomic_uint_least64_t *a, uint64_t v) {
+    atomic_store_explicit(a, atomic_load_explicit(a, RELAXED) + v, RELAXED);
+}
+
+// Every histogram has a single writer, so a plain read-modify-write is enough; readers
+// just see it a little late
+void hist_record(hist_t *h, uint64_t v) {
+    add_relaxed(&h->counts[hist_bucket(v)], 1);
+    max_relaxed(&h->max, v);
+}
+
+void hist_view_add(hist_view_t *v, const hist_t *h) {
+    for (size_t b = 0; b < HIST_BUCKETS; ++b) {
+        uint64_t n = atomic_load_explicit(&h->counts[b], RELAXED);
+        if (n == 0) continue;
+        v->counts[b] += n;
+        v->total += n;
+    }
+    uint64_t max = atomic_load_explicit(&h->max, RELAXED);
+    if (max > v->max) v->max = max;
+}
+
+uint64_t hist_view_percentile(const hist_view_t *v, double q) {
+    if (v->total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)v->total + 0.5);
+    if (rank < 1) rank = 1;
+    // The largest value is known exactly
+    if (rank >= v->total) return v->max;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; ++b) {
+        seen += v->counts[b];
+        if (seen < rank) continue;
+        // Middle of the bucket, which is never off by more than half its width
+        uint64_t low = hist_bucket_low(b);
+        uint64_t high = b + 1 < HIST_BUCKETS ? hist_bucket_low(b + 1) - 1 : low;
+        uint64_t mid = low + (high - low) / 2;
+        return mid < v->max ? mid : v->max;
+    }
+    return v->max;
+}
+
+void stats_task_started(sched_stats_t *st, size_t t, size_t idx, uint64_t now, uint64_t wait) {
+    task_stats_t *ts = &st->tasks[idx];
+    hist_record(&st->threads[t].wait, wait);
+    add_relaxed(&ts->wait_ns, wait);
+    // Offset by one so a task started in the run's first nanosecond still shows as started
+    atomic_store_explicit(&ts->last_start, now - st->start_ns + 1, RELAXED);
+}
+
+void stats_task_finished(sched_stats_t *st, size_t t, size_t idx, uint64_t now, uint64_t took, int failed) {
+    task_stats_t *ts = &st->tasks[idx];
+    hist_record(&st->threads[t].run, took);
+    uint64_t runs = atomic_load_explicit(&ts->runs, RELAXED);
+    if (runs == 0) {
+        ts->first_ns = took;
+    } else {
+        // Most tasks run once, so only repeating ones pay for a histogram of their own
+        hist_t *h = atomic_load_explicit(&ts->hist, memory_order_acquire);
+        if (!h && (h = calloc(1, sizeof(hist_t))) != NULL) {
+            hist_record(h, ts->first_ns);
+            atomic_store_explicit(&ts->hist, h, memory_order_release);
+        }
+        if (h) hist_record(h, took);
+    }
+    add_relaxed(&ts->total_ns, took);
+    if (failed) add_relaxed(&ts->failed, 1);
+    atomic_store_explicit(&ts->last_end, now - st->start_ns + 1, RELAXED);
+    atomic_store_explicit(&ts->runs, runs + 1, memory_order_release);
+}
+
+void stats_run_view(const sched_stats_t *st, int wait, hist_view_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t i = 0; i < st->n_threads; ++i) {
+        hist_view_add(out, wait ? &st->threads[i].wait : &st->threads[i].run);
+    }
+}
+
+void stats_task_view(const sched_stats_t *st, size_t idx, hist_view_t *out) {
+    memset(out, 0, sizeof(*out));
+    const task_stats_t *ts = &st->tasks[idx];
+    uint64_t runs = atomic_load_explicit(&ts->runs, memory_order_acquire);
+    hist_t *h = atomic_load_explicit(&ts->hist, memory_order_acquire);
+    if (h) {
+        hist_view_add(out, h);
+    } else if (runs == 1) {
+        out->counts[hist_bucket(ts->first_ns)] = 1;
+        out->total = 1;
+        out->max = ts->first_ns;
+    }
+}
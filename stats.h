@@ -0,0 +1,88 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Run-time statistics kept by the scheduler while a run is in progress
+//
+// Durations and queue waits go into HDR-style histograms: log-linear buckets with
+// HIST_SUB buckets per power of two, so any recorded value is known to within about 6%.
+// Every histogram has a single writer and is read with relaxed loads, so readers never
+// block the scheduler: the run-wide ones are kept per worker and merged on read, and a
+// task's own one is only written by whichever thread finishes the task (a task never
+// runs twice at once)
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1u << HIST_SUB_BITS)
+#define HIST_MAX_BITS 48 // values from 2^48 ns (about 3 days) up share the last bucket
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    atomic_uint_least64_t counts[HIST_BUCKETS];
+    atomic_uint_least64_t max; // exact largest value recorded
+} hist_t;
+
+// Plain copy of one or more histograms, for computing percentiles
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} hist_view_t;
+
+// Everything known about one task, written by the thread running it
+typedef struct {
+    atomic_uint_least64_t runs;
+    atomic_uint_least64_t failed;
+    atomic_uint_least64_t total_ns; // sum of run durations
+    atomic_uint_least64_t wait_ns; // sum of times spent queued before starting
+    atomic_uint_least64_t last_start; // ns after the start of the run, 0 if it never started
+    atomic_uint_least64_t last_end;
+    uint64_t              first_ns; // duration of the first run
+    _Atomic(hist_t *)     hist; // durations, only allocated once the task runs a second time
+} task_stats_t;
+
+// Run-wide histograms of one thread that starts or finishes tasks
+typedef struct {
+    hist_t run; // durations of the tasks this thread finished
+    hist_t wait; // queue waits of the tasks this thread started
+} stats_thread_t;
+
+typedef struct {
+    size_t          n_tasks;
+    task_stats_t   *tasks; // one per DAG slot
+    size_t          n_threads; // the workers, plus one for the reactor
+    stats_thread_t *threads;
+    uint64_t        start_ns; // CLOCK_MONOTONIC ns of sched_start
+} sched_stats_t;
+
+// Sets up empty statistics for a DAG of n_tasks and a scheduler with n_workers
+// Returns 0 on success or -2 on memory allocation failure
+int stats_init(sched_stats_t *st, size_t n_tasks, size_t n_workers);
+
+void stats_free(sched_stats_t *st);
+
+// Adds one value to a histogram; only ever called by the histogram's single writer
+void hist_record(hist_t *h, uint64_t v);
+
+// Adds the current contents of h to v
+void hist_view_add(hist_view_t *v, const hist_t *h);
+
+// Value at quantile q (0..1) of the view, accurate to the bucket width; 0 if it is empty
+uint64_t hist_view_percentile(const hist_view_t *v, double q);
+
+// Called by the scheduler: task idx started at now (CLOCK_MONOTONIC ns) on thread t after
+// waiting in the queue for wait ns
+void stats_task_started(sched_stats_t *st, size_t t, size_t idx, uint64_t now, uint64_t wait);
+
+// Called by the scheduler: task idx finished at now after running for took ns on thread t
+void stats_task_finished(sched_stats_t *st, size_t t, size_t idx, uint64_t now, uint64_t took, int failed);
+
+// Merges the run-wide duration (wait = 0) or queue wait (wait = 1) histograms of every thread
+void stats_run_view(const sched_stats_t *st, int wait, hist_view_t *out);
+
+// Duration histogram of one task; a task that ran once or never has no histogram of its own
+void stats_task_view(const sched_stats_t *st, size_t idx, hist_view_t *out);
+
+#endif
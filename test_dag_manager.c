@@ -1,7 +1,13 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
 #include "dag_manager.h"
+#include "snapshot.h"
+#include "graph_loader.h"
 
 static char *my_strdup(const char *s) {
     size_t n = strlen(s) + 1;
@@ -10,14 +16,18 @@ static char *my_strdup(const char *s) {
     return p;
 }
 
+static int noop_fn(void *arg) {
+    (void)arg;
+    return 0;
+}
+
 static task_t* make_task(const char *id) {
-    task_t *t = malloc(sizeof(task_t));
+    task_t *t = calloc(1, sizeof(task_t));
     if (!t) return NULL;
     t->id     = my_strdup(id);
     t->cmd    = my_strdup("");
     t->time   = 0;
     t->freq   = 0;
-    t->status = PENDING;
     if (!t->id || !t->cmd) {
         free(t->id);
         free(t->cmd);
@@ -39,6 +49,601 @@ static void die(const char *msg) {
     exit(1);
 }
 
+// Brute-force reachability used to cross-check the incremental cycle check
+static bool reaches(dag_t *d, size_t src, size_t dst, bool *seen) {
+    if (src == dst) return true;
+    if (seen[src]) return false;
+    seen[src] = true;
+    for (size_t k = 0; k < d->n_deps[src]; ++k) {
+        if (reaches(d, d->deps[src][k], dst, seen)) return true;
+    }
+    return false;
+}
+
+// Random edge insertions must be accepted exactly when they keep the graph acyclic,
+// and the maintained order must stay topological after each one
+static void check_incremental_cycles(void) {
+    enum { N = 120, TRIES = 3000 };
+    dag_t *d = dag_init();
+    if (!d) die("dag_init() returned NULL");
+    char name[32], other[32];
+    for (size_t i = 0; i < N; ++i) {
+        snprintf(name, sizeof(name), "R%zu", i);
+        task_t *t = make_task(name);
+        if (!t || dag_add_task(d, t) != 0) die("Failed to add task for cycle test");
+    }
+    bool *seen = malloc(N * sizeof(bool));
+    if (!seen) die("malloc failed");
+    unsigned long long rng = 7;
+    for (size_t n = 0; n < TRIES; ++n) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t a = (size_t)((rng >> 33) % N);
+        size_t b = (size_t)((rng >> 13) % N);
+        bool exists = false;
+        for (size_t k = 0; k < d->n_deps[a]; ++k) exists |= d->deps[a][k] == b;
+        memset(seen, 0, N * sizeof(bool));
+        bool cycle = reaches(d, b, a, seen);
+        size_t before = d->n_deps[a];
+
+        snprintf(name, sizeof(name), "R%zu", a);
+        snprintf(other, sizeof(other), "R%zu", b);
+        int r = dag_add_dep(d, name, other);
+        int expected = exists ? -2 : (cycle ? -3 : 0);
+        if (r != expected) die("Incremental cycle check disagrees with brute force");
+        if (r != 0 && d->n_deps[a] != before) die("Rejected dependency changed the graph");
+
+        for (size_t u = 0; u < N; ++u) {
+            for (size_t k = 0; k < d->n_deps[u]; ++k) {
+                if (d->topo_pos[u] >= d->topo_pos[d->deps[u][k]]) die("Maintained order is not topological");
+            }
+        }
+    }
+    free(seen);
+    if (dag_detect_cycle(d)) die("Cycle slipped through incremental check");
+    dag_free(d);
+}
+
+// Bulk builds must dedup edges, reject bad input at commit and roll back cleanly
+static void check_bulk_build(void) {
+    dag_t *d = dag_init();
+    if (!d) die("dag_init() returned NULL");
+    if (dag_add_task(d, make_task("P")) != 0) die("Failed to add task P");
+
+    // A valid bulk build on top of an existing task, with a repeated edge
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_begin(d) != -1) die("Nested dag_bulk_begin not rejected");
+    char name[32];
+    for (int i = 0; i < 40; ++i) {
+        snprintf(name, sizeof(name), "Q%d", i);
+        if (dag_bulk_add_task(d, make_task(name)) != 0) die("dag_bulk_add_task failed");
+    }
+    if (dag_find_index(d, "Q0") != -1) die("Bulk task visible before commit");
+    for (int i = 39; i > 0; --i) {
+        char prev[32];
+        snprintf(name, sizeof(name), "Q%d", i);
+        snprintf(prev, sizeof(prev), "Q%d", i - 1);
+        if (dag_bulk_add_dep(d, prev, name) != 0) die("dag_bulk_add_dep failed");
+    }
+    if (dag_bulk_add_dep(d, "P", "Q0") != 0 || dag_bulk_add_dep(d, "P", "Q0") != 0) {
+        die("dag_bulk_add_dep failed");
+    }
+    if (dag_bulk_commit(d) != 0) die("Valid bulk build was rejected");
+    if (d->n_tasks != 41) die("Bulk build has wrong task count");
+    int p = dag_find_index(d, "P");
+    if (p < 0 || d->n_deps[p] != 1) die("Repeated bulk edge was not deduplicated");
+    for (size_t u = 0; u < d->n_tasks; ++u) {
+        for (size_t k = 0; k < d->n_deps[u]; ++k) {
+            if (d->topo_pos[u] >= d->topo_pos[d->deps[u][k]]) die("Order after bulk commit is not topological");
+        }
+    }
+    // Incremental inserts keep working on top of a committed bulk build
+    if (dag_add_dep(d, "Q39", "P") != -3) die("Cycle through bulk edges not detected");
+
+    // A cycle among new edges rolls everything back
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_task(d, make_task("X")) != 0) die("dag_bulk_add_task failed");
+    if (dag_bulk_add_dep(d, "Q39", "X") != 0 || dag_bulk_add_dep(d, "X", "P") != 0) {
+        die("dag_bulk_add_dep failed");
+    }
+    if (dag_bulk_commit(d) != -3) die("Bulk cycle not detected");
+    int q39 = dag_find_index(d, "Q39");
+    if (d->n_tasks != 41 || dag_find_index(d, "X") != -1 || q39 < 0 || d->n_deps[q39] != 0) {
+        die("Failed bulk build was not rolled back");
+    }
+
+    // Unknown IDs and duplicate IDs are reported at commit
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_dep(d, "P", "NOPE") != 0) die("dag_bulk_add_dep failed");
+    if (dag_bulk_commit(d) != -1) die("Unknown bulk ID not detected");
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_task(d, make_task("Y")) != 0 || dag_bulk_add_task(d, make_task("Y")) != 0) {
+        die("dag_bulk_add_task failed");
+    }
+    if (dag_bulk_commit(d) != -4) die("Duplicate bulk ID not detected");
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_task(d, make_task("P")) != 0) die("dag_bulk_add_task failed");
+    if (dag_bulk_commit(d) != -4) die("Bulk ID clashing with existing task not detected");
+    if (d->n_tasks != 41 || dag_find_index(d, "P") != p) die("Existing task lost after rollback");
+
+    // Aborting leaves nothing behind; dag_free also cleans up a pending build
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_task(d, make_task("Z")) != 0) die("dag_bulk_add_task failed");
+    dag_bulk_abort(d);
+    if (d->n_tasks != 41 || d->bulk) die("dag_bulk_abort did not roll back");
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_task(d, make_task("Z")) != 0) die("dag_bulk_add_task failed");
+    dag_free(d);
+}
+
+// The CSR form must hold the same successors and predecessors as the DAG
+static void check_csr(void) {
+    dag_t *d = dag_init();
+    if (!d) die("dag_init() returned NULL");
+    const char *ids[] = { "A", "B", "C", "D" };
+    for (int i = 0; i < 4; ++i) {
+        if (dag_add_task(d, make_task(ids[i])) != 0) die("Failed to add task for CSR test");
+    }
+    // D -> A, D -> C, A -> B, C -> B
+    if (dag_add_dep(d, "D", "A") != 0 || dag_add_dep(d, "D", "C") != 0 ||
+        dag_add_dep(d, "A", "B") != 0 || dag_add_dep(d, "C", "B") != 0) {
+        die("Failed to add dependency for CSR test");
+    }
+
+    dag_csr_t c;
+    if (dag_csr_build(d, &c) != 0) die("dag_csr_build failed");
+    if (c.n != 4 || c.n_edges != 4) die("CSR has wrong size");
+    for (uint32_t u = 0; u < c.n; ++u) {
+        if (c.off[u + 1] - c.off[u] != d->n_deps[u]) die("CSR out-degree mismatch");
+        for (uint32_t k = c.off[u]; k < c.off[u + 1]; ++k) {
+            if (c.adj[k] != d->deps[u][k - c.off[u]]) die("CSR successor mismatch");
+        }
+    }
+    // B has predecessors A and C, D has none
+    if (c.roff[2] - c.roff[1] != 2 || c.radj[c.roff[1]] != 0 || c.radj[c.roff[1] + 1] != 2) {
+        die("CSR predecessors of B wrong");
+    }
+    if (c.roff[4] - c.roff[3] != 0) die("CSR predecessors of D wrong");
+
+    size_t *order = NULL, n_order = 0;
+    if (dag_csr_toposort(&c, &order, &n_order) != 0 || n_order != 4) die("dag_csr_toposort failed");
+    size_t pos[4];
+    for (size_t i = 0; i < n_order; ++i) pos[order[i]] = i;
+    if (!(pos[3] < pos[0] && pos[3] < pos[2] && pos[0] < pos[1] && pos[2] < pos[1])) {
+        die("dag_csr_toposort order incorrect");
+    }
+    free(order);
+    dag_csr_free(&c);
+    dag_free(d);
+}
+
+static void check_arena_tasks(void) {
+    arena_t a;
+    arena_init(&a);
+    for (size_t i = 1; i < 5000; ++i) {
+        size_t align = (size_t)1 << (i % 5);
+        char *p = arena_alloc(&a, i % 97 + 1, align);
+        if (!p || ((uintptr_t)p & (align - 1)) != 0) die("arena_alloc misaligned");
+        memset(p, 0xab, i % 97 + 1);
+    }
+    if (!arena_alloc(&a, ARENA_CHUNK_SIZE * 2, 8)) die("arena_alloc failed for an oversized block");
+    arena_free(&a);
+
+    dag_t *d = dag_init();
+    if (!d) die("dag_init failed");
+    task_t *a1 = dag_new_task(d, "A1", "make all", 5, 2);
+    task_t *a2 = dag_new_task(d, "A2", "make all", 0, 0);
+    task_t *a3 = dag_new_task(d, "A3", "make test", 0, 0);
+    if (!a1 || !a2 || !a3) die("dag_new_task failed");
+    if (a1->cmd != a2->cmd || a1->cmd == a3->cmd) die("commands were not interned");
+    if (strcmp(a1->id, "A1") != 0 || a1->time != 5 || a1->freq != 2 || a1->kind != TASK_CMD ||
+        !a1->in_arena) {
+        die("dag_new_task fields wrong");
+    }
+    if (dag_add_task(d, a1) != 0 || dag_add_task(d, a2) != 0) die("Failed to add arena tasks");
+    if (d->time[0] != 5 || d->freq[0] != 2 || dag_status(d, 0) != PENDING) die("hot state not copied in");
+    // A rejected arena task is just dropped
+    if (dag_add_task(d, dag_new_task(d, "A1", "other", 0, 0)) != -1) die("duplicate arena task not detected");
+    if (dag_add_task(d, make_task("H")) != 0) die("Failed to add heap task next to arena tasks");
+
+    // Rolled-back bulk builds leave arena tasks to the arena
+    if (dag_bulk_begin(d) != 0) die("dag_bulk_begin failed");
+    if (dag_bulk_add_task(d, a3) != 0 || dag_bulk_add_task(d, make_task("H2")) != 0) die("dag_bulk_add_task failed");
+    if (dag_bulk_add_dep(d, "A3", "nope") != 0) die("dag_bulk_add_dep failed");
+    if (dag_bulk_commit(d) != -1) die("bulk commit with unknown endpoint should fail");
+    if (d->n_tasks != 3 || dag_find_index(d, "A3") != -1) die("bulk rollback left tasks behind");
+    if (dag_add_dep(d, "A1", "A2") != 0) die("dependency between arena tasks failed");
+    dag_free(d);
+}
+
+static void check_snapshot(void) {
+    char path[64], name[32], cmd[32];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_snap_%d", (int)getpid());
+    enum { N = 300 };
+
+    dag_t *d = dag_init();
+    if (!d) die("dag_init failed");
+    for (size_t i = 0; i < N; ++i) {
+        snprintf(name, sizeof(name), "S%zu", i);
+        snprintf(cmd, sizeof(cmd), "echo %zu", i % 10);
+        task_t *t = i % 2 ? dag_new_task(d, name, cmd, (time_t)i, (int)(i % 4)) : make_task(name);
+        if (!t || dag_add_task(d, t) != 0) die("Failed to add snapshot task");
+        d->cost[i] = (double)(i % 5) * 0.5;
+    }
+    unsigned long long rng = 7;
+    for (size_t k = 0; k < 2 * N; ++k) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t a = (size_t)(rng >> 33) % N, b = (size_t)(rng >> 13) % N;
+        char from[32], to[32];
+        snprintf(from, sizeof(from), "S%zu", a < b ? a : b);
+        snprintf(to, sizeof(to), "S%zu", a < b ? b : a);
+        dag_add_dep(d, from, to);
+    }
+    if (dag_snapshot_save(d, path) != 0) die("dag_snapshot_save failed");
+
+    dag_t *l;
+    if (dag_snapshot_load(path, &l) != 0) die("dag_snapshot_load failed");
+    if (l->n_tasks != d->n_tasks || l->capacity != d->capacity) die("snapshot size mismatch");
+    for (size_t i = 0; i < N; ++i) {
+        if (strcmp(l->tasks[i]->id, d->tasks[i]->id) != 0 || strcmp(l->tasks[i]->cmd, d->tasks[i]->cmd) != 0 ||
+            l->time[i] != d->time[i] || l->freq[i] != d->freq[i] || l->cost[i] != d->cost[i] ||
+            dag_status(l, i) != PENDING) {
+            die("snapshot task mismatch");
+        }
+        if (dag_find_index(l, d->tasks[i]->id) != (int)i) die("snapshot index mismatch");
+        if (l->n_deps[i] != d->n_deps[i] || l->topo_pos[i] != d->topo_pos[i]) die("snapshot edges mismatch");
+        for (size_t k = 0; k < d->n_deps[i]; ++k) {
+            if (l->deps[i][k] != d->deps[i][k]) die("snapshot edges mismatch");
+        }
+    }
+    if (l->tasks[1]->cmd != l->tasks[11]->cmd) die("snapshot did not share equal commands");
+
+    // The loaded DAG keeps working: rows leave the shared block as they grow, cycles are still caught
+    for (size_t i = 0; i + 1 < N; i += 3) {
+        char from[32], to[32];
+        snprintf(from, sizeof(from), "S%zu", i);
+        snprintf(to, sizeof(to), "S%zu", (size_t)N - 1);
+        int r = dag_add_dep(l, from, to);
+        if (r != 0 && r != -2) die("dag_add_dep failed on a loaded DAG");
+    }
+    if (dag_add_dep(l, "S299", "S0") != -3) die("cycle not detected on a loaded DAG");
+    for (size_t i = N; i < 2 * N; ++i) {
+        snprintf(name, sizeof(name), "S%zu", i);
+        if (dag_add_task(l, make_task(name)) != 0) die("Failed to grow a loaded DAG");
+    }
+    if (dag_find_index(l, "S5") != 5 || dag_detect_cycle(l)) die("loaded DAG broken after growth");
+    dag_free(l);
+
+    // Flipping one byte past the header, or cutting the file short, is caught
+    FILE *f = fopen(path, "r+b");
+    if (!f) die("reopen snapshot failed");
+    fseek(f, (long)sizeof(snap_header_t) + 40, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, (long)sizeof(snap_header_t) + 40, SEEK_SET);
+    fputc(c ^ 1, f);
+    fclose(f);
+    if (dag_snapshot_load(path, &l) != -4) die("corrupt snapshot accepted");
+    if (truncate(path, sizeof(snap_header_t) / 2) != 0) die("truncate failed");
+    if (dag_snapshot_load(path, &l) != -4) die("truncated snapshot accepted");
+    unlink(path);
+    if (dag_snapshot_load(path, &l) != -1) die("missing snapshot not reported");
+
+    // Function tasks have nothing that could be saved
+    if (dag_add_fn_task(d, "FN", noop_fn, NULL) != 0) die("dag_add_fn_task failed");
+    if (dag_snapshot_save(d, path) != -3) die("DAG with function tasks saved");
+    dag_free(d);
+}
+
+static void write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f || fputs(text, f) < 0 || fclose(f) != 0) die("writing graph file failed");
+}
+
+static void check_graph_loader(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_graph_%d", (int)getpid());
+    graph_load_result_t res;
+
+    // Comments, blank lines, quoted commands, deps before their tasks, no final newline
+    write_file(path,
+        "# build\n"
+        "\n"
+        "add_dep A B\n"
+        "  add_task A \"echo A\" 0 0\r\n"
+        "add_task B \"echo  B\" 5 2\n"
+        "add_task C true 0 0 2.5\n"
+        "add_dep B C");
+    dag_t *d = dag_init();
+    if (!d) die("dag_init failed");
+    if (graph_load_file(d, path, 1, &res) != 0) die("graph_load_file failed");
+    if (res.n_tasks != 3 || res.n_deps != 2 || d->n_tasks != 3) die("graph_load_file counts wrong");
+    int b = dag_find_index(d, "B");
+    if (b < 0 || strcmp(d->tasks[b]->cmd, "echo  B") != 0 || d->time[b] != 5 || d->freq[b] != 2) {
+        die("loaded task fields wrong");
+    }
+    if (strcmp(d->tasks[dag_find_index(d, "C")]->cmd, "true") != 0) die("unquoted command wrong");
+    if (d->cost[dag_find_index(d, "C")] != 2.5 || d->cost[b] != 0) die("loaded estimates wrong");
+    if (dag_add_dep(d, "A", "C") != 0 || dag_add_dep(d, "C", "A") != -3) die("loaded edges wrong");
+
+    // Errors leave the DAG as it was; syntax errors say where
+    write_file(path, "add_task D x 0 0\nadd_task E x 0 -1\n");
+    if (graph_load_file(d, path, 1, &res) != -3 || res.line != 2) die("syntax error not located");
+    write_file(path, "add_task D x 0 0\nadd_dep C D\nadd_dep D A\n");
+    if (graph_load_file(d, path, 1, &res) != -4) die("cycle in graph file not detected");
+    write_file(path, "add_task A x 0 0\n");
+    if (graph_load_file(d, path, 1, &res) != -4) die("duplicate ID in graph file not detected");
+    write_file(path, "run 4\n");
+    if (graph_load_file(d, path, 1, &res) != -3 || res.line != 1) die("unknown command accepted");
+    if (d->n_tasks != 3 || dag_find_index(d, "D") != -1) die("failed load changed the DAG");
+    dag_free(d);
+
+    // A file big enough to split: every thread count builds the same DAG,
+    // and an error deep in a later range still gets its absolute line number
+    enum { N = 60000 };
+    FILE *f = fopen(path, "w");
+    if (!f) die("writing graph file failed");
+    for (size_t i = 0; i < N; ++i) {
+        fprintf(f, "add_task node_%zu \"echo padding padding padding %zu\" 0 0\n", i, i % 7);
+        if (i > 0) fprintf(f, "add_dep node_%zu node_%zu\n", (i - 1) / 2, i);
+    }
+    fclose(f);
+    dag_t *ref = dag_init();
+    if (!ref || graph_load_file(ref, path, 1, &res) != 0 || ref->n_tasks != N) die("large graph load failed");
+    for (size_t threads = 2; threads <= 8; threads *= 2) {
+        d = dag_init();
+        if (!d || graph_load_file(d, path, threads, &res) != 0) die("parallel graph load failed");
+        if (res.n_tasks != N || res.n_deps != N - 1) die("parallel graph load counts wrong");
+        for (size_t i = 0; i < N; ++i) {
+            if (strcmp(d->tasks[i]->id, ref->tasks[i]->id) != 0 || d->n_deps[i] != ref->n_deps[i]) {
+                die("parallel graph load differs");
+            }
+        }
+        dag_free(d);
+    }
+    f = fopen(path, "a");
+    if (!f) die("appending to graph file failed");
+    fputs("add_dep node_1\n", f);
+    fclose(f);
+    d = dag_init();
+    if (graph_load_file(d, path, 4, &res) != -3 || res.line != 2 * N) die("late syntax error not located");
+    dag_free(d);
+    dag_free(ref);
+
+    unlink(path);
+    d = dag_init();
+    if (graph_load_file(d, path, 1, &res) != -1) die("missing graph file not reported");
+    dag_free(d);
+}
+
+static void check_pools(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_pools_%d", (int)getpid());
+    uint64_t v;
+    if (!dag_parse_amount("4G", &v) || v != 4ULL << 30 || !dag_parse_amount("3", &v) || v != 3) die("amount parsing wrong");
+    if (dag_parse_amount("0", &v) || dag_parse_amount("4GB", &v) || dag_parse_amount("G", &v) ||
+        dag_parse_amount("99999999999999999999", &v)) {
+        die("bad amount accepted");
+    }
+
+    dag_t *d = dag_init();
+    if (!d) die("dag_init failed");
+    if (dag_set_pool(d, "db", 3) != 0 || dag_set_pool(d, "gpu", 1) != 1 || dag_set_pool(d, "db", 2) != 0) die("dag_set_pool failed");
+    if (d->n_pools != 2 || d->pool_cap[0] != 2 || dag_find_pool(d, "gpu") != 1 || dag_find_pool(d, "x") != -1) die("pools wrong");
+    dag_need_t need[3];
+    if (dag_parse_need(d, "db=1", &need[0]) != 0 || need[0].pool != 0 || need[0].amount != 1) die("need parsing wrong");
+    if (dag_parse_need(d, "nope=1", &need[1]) != -3 || dag_parse_need(d, "db=x", &need[1]) != -1 ||
+        dag_parse_need(d, "=1", &need[1]) != -1) {
+        die("bad need accepted");
+    }
+    // cpu and mem default to this machine's
+    if (dag_parse_need(d, "mem=1M", &need[1]) != 0 || dag_find_pool(d, "mem") != 2 || d->pool_cap[2] < (1u << 20)) die("mem pool not defaulted");
+    if (dag_add_task(d, make_task("A")) != 0 || dag_add_task(d, make_task("B")) != 0) die("Failed to add tasks");
+    if (dag_set_needs(d, 0, need, 2) != 0 || !d->needs[0] || d->needs[0]->n != 2 || d->needs[1]) die("dag_set_needs failed");
+    need[2] = need[0];
+    if (dag_set_needs(d, 1, need, 3) != -1 || d->needs[1]) die("repeated pool accepted");
+    for (int i = 0; i < DAG_MAX_POOLS; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "p%d", i);
+        int r = dag_set_pool(d, name, 1);
+        if ((i + 3 < DAG_MAX_POOLS) != (r >= 0) || (r < 0 && r != -3)) die("pool limit not enforced");
+    }
+
+    // Pools and needs survive a snapshot
+    if (dag_snapshot_save(d, path) != 0) die("dag_snapshot_save failed");
+    dag_t *l;
+    if (dag_snapshot_load(path, &l) != 0) die("dag_snapshot_load failed");
+    if (l->n_pools != d->n_pools || strcmp(l->pool_name[2], "mem") != 0 || l->pool_cap[1] != 1) die("snapshot pools mismatch");
+    if (!l->needs[0] || l->needs[0]->n != 2 || l->needs[0]->need[1].pool != 2 || l->needs[0]->need[1].amount != 1u << 20 ||
+        l->needs[1]) {
+        die("snapshot needs mismatch");
+    }
+    dag_free(l);
+    dag_free(d);
+
+    // Graph files may define pools after the tasks that need them; a need from an
+    // unknown pool rejects the whole file
+    graph_load_result_t res;
+    write_file(path,
+        "add_task A x 0 0 db=2\n"
+        "add_task B x 0 0 1.5 db=1 cpu=1\n"
+        "pool db 4\n");
+    d = dag_init();
+    if (!d || graph_load_file(d, path, 1, &res) != 0) die("graph file with pools failed");
+    int db = dag_find_pool(d, "db");
+    if (db < 0 || d->pool_cap[db] != 4 || dag_find_pool(d, "cpu") < 0) die("graph file pools wrong");
+    if (d->needs[0]->n != 1 || d->needs[0]->need[0].amount != 2 || d->needs[1]->n != 2 || d->cost[1] != 1.5) {
+        die("graph file needs wrong");
+    }
+    write_file(path, "add_task C x 0 0 gpu=1\npool fpga 1\n");
+    if (graph_load_file(d, path, 1, &res) != -4 || d->n_tasks != 2 || dag_find_pool(d, "fpga") != -1) {
+        die("unknown pool in graph file not rejected");
+    }
+    write_file(path, "add_task C x 0 0 db=0\n");
+    if (graph_load_file(d, path, 1, &res) != -3 || res.line != 1) die("bad need in graph file accepted");
+    // More needs on one line than there can be pools
+    char line[256] = "pool db 100\nadd_task C x 0 0";
+    for (int i = 0; i < 30; ++i) strcat(line, " db=1");
+    strcat(line, "\n");
+    write_file(path, line);
+    if (graph_load_file(d, path, 1, &res) != -3 || res.line != 2 || d->n_tasks != 2) die("too many needs in graph file accepted");
+    dag_free(d);
+    unlink(path);
+}
+
+static void check_inputs(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_inputs_%d", (int)getpid());
+    dag_t *d = dag_init();
+    if (!d) die("dag_init failed");
+    if (dag_add_task(d, make_task("A")) != 0 || dag_add_task(d, make_task("B")) != 0) die("Failed to add tasks");
+    const char *in[] = { "src/a.c", "include/common.h" };
+    if (dag_set_inputs(d, 0, in, 2) != 0 || !d->inputs[0] || d->inputs[0]->n != 2 || d->inputs[1]) die("dag_set_inputs failed");
+    // Paths read by many tasks are stored once
+    if (dag_set_inputs(d, 1, in + 1, 1) != 0 || d->inputs[1]->path[0] != d->inputs[0]->path[1]) die("input paths not interned");
+    const char *bad[] = { "" };
+    if (dag_set_inputs(d, 1, bad, 1) != -1 || dag_set_inputs(d, 2, in, 1) != -1) die("bad input accepted");
+    if (dag_set_inputs(d, 1, NULL, 0) != 0 || d->inputs[1]) die("inputs not cleared");
+
+    // Inputs survive a snapshot
+    if (dag_snapshot_save(d, path) != 0) die("dag_snapshot_save failed");
+    dag_t *l;
+    if (dag_snapshot_load(path, &l) != 0) die("dag_snapshot_load failed");
+    if (!l->inputs[0] || l->inputs[0]->n != 2 || strcmp(l->inputs[0]->path[0], "src/a.c") != 0 ||
+        strcmp(l->inputs[0]->path[1], "include/common.h") != 0 || l->inputs[1]) {
+        die("snapshot inputs mismatch");
+    }
+    dag_free(l);
+    dag_free(d);
+
+    // Graph files declare inputs with in=path fields, mixed with needs
+    graph_load_result_t res;
+    write_file(path,
+        "add_task A x 0 0 in=a.c in=a.h\n"
+        "add_task B x 0 0 2 db=1 in=b.c\n"
+        "pool db 1\n");
+    d = dag_init();
+    if (!d || graph_load_file(d, path, 1, &res) != 0) die("graph file with inputs failed");
+    if (d->inputs[0]->n != 2 || strcmp(d->inputs[0]->path[1], "a.h") != 0 || d->inputs[1]->n != 1 || d->needs[1]->n != 1) {
+        die("graph file inputs wrong");
+    }
+    write_file(path, "add_task C x 0 0 in=\n");
+    if (graph_load_file(d, path, 1, &res) != -3 || res.line != 1) die("empty input in graph file accepted");
+    write_file(path, "pool in 2\n");
+    if (graph_load_file(d, path, 1, &res) != -3) die("pool named in accepted");
+    dag_free(d);
+    unlink(path);
+}
+
+// CSR over n tasks where each task past the first 10000 depends on 3 earlier ones picked at random,
+// plus an edge back from the last task to the first if cyclic
+static void build_random_csr(dag_csr_t *c, uint32_t n, bool cyclic) {
+    uint32_t (*edge)[2] = malloc((size_t)n * 4 * sizeof(*edge));
+    if (!edge) die("Out of memory");
+    size_t m = 0;
+    unsigned long long rng = 7;
+    for (uint32_t v = 10000; v < n; ++v) {
+        for (int e = 0; e < 3; ++e) {
+            rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+            // 5000 to 15000 tasks back, so levels come out wide enough to split but vary
+            uint32_t back = 5000 + (uint32_t)((rng >> 33) % 10000);
+            if (back > v) back = v;
+            edge[m][0] = v - back;
+            edge[m++][1] = v;
+        }
+    }
+    if (cyclic) {
+        edge[m][0] = n - 1;
+        edge[m++][1] = 0;
+    }
+    uint32_t *mem = calloc(2 * (n + 1) + 2 * m, sizeof(uint32_t));
+    if (!mem) die("Out of memory");
+    c->n = n;
+    c->n_edges = (uint32_t)m;
+    c->off = mem;
+    c->roff = mem + (n + 1);
+    c->adj = mem + 2 * (n + 1);
+    c->radj = mem + 2 * (n + 1) + m;
+    for (size_t k = 0; k < m; ++k) {
+        c->off[edge[k][0] + 1]++;
+        c->roff[edge[k][1] + 1]++;
+    }
+    for (uint32_t v = 0; v < n; ++v) {
+        c->off[v + 1] += c->off[v];
+        c->roff[v + 1] += c->roff[v];
+    }
+    uint32_t *fill = calloc(2 * (size_t)n, sizeof(uint32_t));
+    if (!fill) die("Out of memory");
+    for (size_t k = 0; k < m; ++k) {
+        uint32_t u = edge[k][0], v = edge[k][1];
+        c->adj[c->off[u] + fill[u]++] = v;
+        c->radj[c->roff[v] + fill[n + v]++] = u;
+    }
+    free(fill);
+    free(edge);
+}
+
+static void check_levels(void) {
+    // D -> A, D -> C, A -> B, C -> B, E on its own
+    dag_t *d = dag_init();
+    if (!d) die("dag_init() returned NULL");
+    const char *ids[] = { "A", "B", "C", "D", "E" };
+    for (int i = 0; i < 5; ++i) {
+        if (dag_add_task(d, make_task(ids[i])) != 0) die("Failed to add task for levels test");
+    }
+    if (dag_add_dep(d, "D", "A") != 0 || dag_add_dep(d, "D", "C") != 0 ||
+        dag_add_dep(d, "A", "B") != 0 || dag_add_dep(d, "C", "B") != 0) {
+        die("Failed to add dependency for levels test");
+    }
+    dag_csr_t c;
+    dag_levels_t l;
+    if (dag_csr_build(d, &c) != 0) die("dag_csr_build failed");
+    if (dag_csr_levels(&c, 4, &l) != 0 || l.n_levels != 3) die("dag_csr_levels failed on a small DAG");
+    if (l.start[1] != 2 || l.start[2] != 4 || l.start[3] != 5) die("level widths wrong");
+    if (l.level[3] != 0 || l.level[4] != 0 || l.level[0] != 1 || l.level[2] != 1 || l.level[1] != 2) {
+        die("task levels wrong");
+    }
+    dag_levels_free(&l);
+    dag_csr_free(&c);
+    dag_free(d);
+
+    // Big enough to be split: every thread count gives the same levels, each one past the
+    // deepest predecessor, with the order grouped by level
+    uint32_t n = 100000;
+    build_random_csr(&c, n, false);
+    dag_levels_t one;
+    if (dag_csr_levels(&c, 1, &one) != 0) die("dag_csr_levels failed on one thread");
+    for (uint32_t v = 0; v < n; ++v) {
+        uint32_t want = 0;
+        for (uint32_t k = c.roff[v]; k < c.roff[v + 1]; ++k) {
+            if (one.level[c.radj[k]] + 1 > want) want = one.level[c.radj[k]] + 1;
+        }
+        if (one.level[v] != want) die("task level is not its depth");
+    }
+    size_t threads[] = { 2, 4, 16 };
+    for (size_t t = 0; t < 3; ++t) {
+        if (dag_csr_levels(&c, threads[t], &l) != 0) die("dag_csr_levels failed on several threads");
+        if (l.n_levels != one.n_levels || memcmp(l.level, one.level, n * sizeof(uint32_t)) != 0) {
+            die("levels differ between thread counts");
+        }
+        bool *seen = calloc(n, sizeof(bool));
+        if (!seen) die("Out of memory");
+        for (size_t lv = 0; lv < l.n_levels; ++lv) {
+            if (l.start[lv + 1] - l.start[lv] != one.start[lv + 1] - one.start[lv]) die("level width differs");
+            for (size_t p = l.start[lv]; p < l.start[lv + 1]; ++p) {
+                if (l.level[l.order[p]] != lv || seen[l.order[p]]) die("order not grouped by level");
+                seen[l.order[p]] = true;
+            }
+        }
+        free(seen);
+        dag_levels_free(&l);
+    }
+    dag_levels_free(&one);
+    dag_csr_free(&c);
+
+    build_random_csr(&c, n, true);
+    if (dag_csr_levels(&c, 4, &l) != -1 || l.order) die("cycle not detected by dag_csr_levels");
+    dag_csr_free(&c);
+}
+
 int main(void) {
     dag_t *d = dag_init();
     if (!d) die("dag_init() returned NULL");
@@ -99,12 +704,86 @@ int main(void) {
     }
     if (d->capacity <= initial_cap) die("ensure_capacity did not grow capacity");
 
+    // 11b) Every task must still be found at its slot after the index was rebuilt
+    for (size_t i = 0; i < initial_cap; ++i) {
+        snprintf(name, sizeof(name), "T%zu", i);
+        if (dag_find_index(d, name) != (int)(i + 2)) die("dag_find_index wrong after resize");
+    }
+    if (dag_find_index(d, "A") != idxA || dag_find_index(d, "B") != idxB) {
+        die("dag_find_index lost original tasks after resize");
+    }
+    if (dag_find_index(d, "T999") != -1) die("dag_find_index found a missing task");
+
     // 12) Finally, confirm no accidental cycles introduced
     if (dag_detect_cycle(d)) die("Unexpected cycle after bulk-add");
 
     // Clean up
     dag_free(d);
 
+    // 13) Incremental cycle check against a brute-force reachability search
+    check_incremental_cycles();
+
+    // 14) Bulk construction with deferred validation
+    check_bulk_build();
+
+    // 15) Frozen CSR adjacency
+    check_csr();
+
+    // 16) Function tasks share the ID space and ownership rules of command tasks
+    d = dag_init();
+    if (!d) die("dag_init failed");
+    if (dag_add_fn_task(d, "F", noop_fn, NULL) != 0) die("dag_add_fn_task failed");
+    if (dag_add_fn_task(d, "F", noop_fn, NULL) != -1) die("duplicate function task not detected");
+    if (dag_add_task(d, make_task("C")) != 0) die("Failed to add task C");
+    task_t *ft = d->tasks[dag_find_index(d, "F")];
+    if (ft->kind != TASK_FN || ft->fn != noop_fn || ft->cmd) {
+        die("function task fields wrong");
+    }
+    if (d->tasks[dag_find_index(d, "C")]->kind != TASK_CMD) die("command task kind wrong");
+    if (dag_add_dep(d, "F", "C") != 0) die("dependency on a function task failed");
+    dag_free(d);
+
+    // 17) Arena-backed tasks share interned commands and are released with the DAG
+    check_arena_tasks();
+
+    // 18) Binary snapshots round-trip and reject damaged files
+    check_snapshot();
+
+    // 19) Graph definition files load through one bulk build, with one or more parser threads
+    check_graph_loader();
+
+    // 20) Resource pools and what tasks need from them
+    check_pools();
+
+    // 21) Input files tasks declare for the result cache
+    check_inputs();
+
+    // 22) Everything below a task, for rerunning it
+    d = dag_init();
+    if (!d) die("dag_init failed");
+    const char *ids[] = { "A", "B", "C", "D", "E" };
+    for (int i = 0; i < 5; ++i) {
+        if (dag_add_task(d, make_task(ids[i])) != 0) die("Failed to add task");
+    }
+    // A -> B -> D, A -> C -> D, E on its own
+    if (dag_add_dep(d, "A", "B") || dag_add_dep(d, "A", "C") || dag_add_dep(d, "B", "D") || dag_add_dep(d, "C", "D")) {
+        die("Failed to add deps");
+    }
+    bool mark[5] = { false };
+    size_t n_marked;
+    if (dag_mark_downstream(d, 1, mark, &n_marked) != 0 || n_marked != 2 || !mark[1] || !mark[3] || mark[0] || mark[2]) {
+        die("downstream of B wrong");
+    }
+    // Marks add up: only A and C are new
+    if (dag_mark_downstream(d, 0, mark, &n_marked) != 0 || n_marked != 2 || !mark[0] || !mark[2] || mark[4]) {
+        die("downstream of A wrong");
+    }
+    if (dag_mark_downstream(d, 5, mark, NULL) != -1) die("out of range task accepted");
+    dag_free(d);
+
+    // 23) Levels, sorted on one thread and on several
+    check_levels();
+
     printf("✅ All dag_manager tests passed!\n");
     return 0;
 }
@@ -1,10 +1,21 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "dag_manager.h"
 #include "scheduler.h"
+#include "timer_wheel.h"
+#include "work_deque.h"
+#include "launcher.h"
+#include "wal.h"
+#include "metrics.h"
 
 static char *my_strdup(const char *s) {
     size_t n = strlen(s) + 1;
@@ -14,17 +25,21 @@ static char *my_strdup(const char *s) {
 }
 
 static task_t* make_task(const char *id, const char *cmd, int freq) {
-    task_t *t = malloc(sizeof(task_t));
+    task_t *t = calloc(1, sizeof(task_t));
     assert(t != NULL);
     t->id     = my_strdup(id);
     t->cmd    = my_strdup(cmd);
     t->time   = 0;
     t->freq   = freq;
-    t->status = PENDING;
     assert(t->id && t->cmd);
     return t;
 }
 
+// Status of a task the test still holds a pointer to
+static task_status_t status_of(dag_t *d, const task_t *t) {
+    return dag_status(d, (size_t)dag_find_index(d, t->id));
+}
+
 // Test invalid initialization inputs
 static void test_init_invalid(void) {
     assert(sched_init(NULL, 1) == NULL);
@@ -58,14 +73,14 @@ static void test_single_worker(void) {
 
     // Wait (up to approx 2s) for the task to complete
     int waited = 0;
-    while (t->status == PENDING && waited < 200) {
+    while (status_of(d, t) == PENDING && waited < 200) {
         usleep(10000);
         waited++;
     }
     sched_stop(s);
     free(s);
 
-    assert(t->status == COMPLETED);
+    assert(status_of(d, t) == COMPLETED);
     dag_free(d);
 }
 
@@ -83,16 +98,1223 @@ static void test_multi_worker_status(void) {
 
     // Wait (up to approx 2s) for both tasks
     int waited = 0;
-    while ((t0->status == PENDING || t1->status == PENDING) && waited < 200) {
+    while ((status_of(d, t0) == PENDING || status_of(d, t1) == PENDING) && waited < 200) {
         usleep(10000);
         waited++;
     }
     sched_stop(s);
     free(s);
 
-    assert(t0->status == COMPLETED);
-    assert(t1->status == FAILED);
+    assert(status_of(d, t0) == COMPLETED);
+    assert(status_of(d, t1) == FAILED);
+    dag_free(d);
+}
+
+// Test that successors only start once their predecessor has completed,
+// even when there are enough workers to run everything at once
+static void test_dependency_order(void) {
+    char path[64], cmd[128];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_dep_%d", (int)getpid());
+    unlink(path);
+
+    dag_t *d = dag_init();
+    snprintf(cmd, sizeof(cmd), "sleep 0.2 && touch %s", path);
+    task_t *a = make_task("A", cmd, 0);
+    snprintf(cmd, sizeof(cmd), "test -f %s", path);
+    task_t *b = make_task("B", cmd, 0);
+    task_t *c = make_task("C", cmd, 0);
+    assert(dag_add_task(d, a) == 0);
+    assert(dag_add_task(d, b) == 0);
+    assert(dag_add_task(d, c) == 0);
+    assert(dag_add_dep(d, "A", "B") == 0);
+    assert(dag_add_dep(d, "A", "C") == 0);
+
+    scheduler_t *s = sched_init(d, 4);
+    assert(s);
+    assert(sched_start(s) == 0);
+    // sched_stop drains the queue, including tasks released along the way
+    sched_stop(s);
+    free(s);
+
+    assert(status_of(d, a) == COMPLETED);
+    assert(status_of(d, b) == COMPLETED);
+    assert(status_of(d, c) == COMPLETED);
+    unlink(path);
+    dag_free(d);
+}
+
+// Test that a failed task does not release its successors
+static void test_failure_blocks_successors(void) {
+    dag_t *d = dag_init();
+    task_t *f = make_task("F", "false", 0);
+    task_t *g = make_task("G", "true", 0);
+    task_t *h = make_task("H", "true", 0);
+    assert(dag_add_task(d, f) == 0);
+    assert(dag_add_task(d, g) == 0);
+    assert(dag_add_task(d, h) == 0);
+    assert(dag_add_dep(d, "F", "G") == 0);
+
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+
+    assert(status_of(d, f) == FAILED);
+    assert(status_of(d, g) == PENDING);
+    assert(status_of(d, h) == COMPLETED);
+    dag_free(d);
+}
+
+typedef struct {
+    timer_wheel_t *tw;
+    uint64_t      *expires;
+    size_t         fired;
+} wheel_check_t;
+
+static void check_expiry(void *ctx, size_t id) {
+    wheel_check_t *w = ctx;
+    // tw->now has already moved past the tick being processed
+    assert(w->tw->now - 1 == w->expires[id]);
+    w->expires[id] = UINT64_MAX;
+    w->fired++;
+}
+
+// Test that timers on every level of the wheel fire exactly at their tick
+static void test_timer_wheel(void) {
+    enum { N = 2000 };
+    timer_wheel_t tw;
+    assert(tw_init(&tw, N, 5) == 0);
+    uint64_t expires[N];
+    unsigned long long rng = 1;
+    size_t armed = 0;
+    for (size_t i = 0; i < N; ++i) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        // Mostly near timers, some far ones including past the top level's span
+        uint64_t span = (i % 4 == 0) ? 20000000ULL : 5000ULL;
+        expires[i] = 6 + (rng >> 20) % span;
+        tw_schedule(&tw, i, expires[i]);
+        armed++;
+    }
+    // Cancelled timers never fire
+    for (size_t i = 1; i < N; i += 50) {
+        tw_cancel(&tw, i);
+        expires[i] = UINT64_MAX;
+        armed--;
+    }
+    assert(tw.n_armed == armed);
+
+    wheel_check_t w = { &tw, expires, 0 };
+    uint64_t now = 5;
+    while (tw.n_armed > 0) {
+        uint64_t next = tw_next_tick(&tw);
+        assert(next >= tw.now);
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        now += 1 + (rng >> 40) % 3000;
+        // Nothing may be due before the tick tw_next_tick reported
+        if (now < next) now = next;
+        tw_advance(&tw, now, check_expiry, &w);
+    }
+    assert(w.fired == armed);
+    assert(tw_next_tick(&tw) == UINT64_MAX);
+    tw_free(&tw);
+}
+
+// Test that a task is held back until its time has come
+static void test_delayed_start(void) {
+    dag_t *d = dag_init();
+    task_t *t = make_task("LATER", "true", 0);
+    t->time = 1;
+    assert(dag_add_task(d, t) == 0);
+
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    assert(sched_start(s) == 0);
+    usleep(300000);
+    assert(status_of(d, t) == PENDING);
+
+    int waited = 0;
+    while (status_of(d, t) != COMPLETED && waited < 300) {
+        usleep(10000);
+        waited++;
+    }
+    sched_stop(s);
+    free(s);
+    assert(status_of(d, t) == COMPLETED);
+    dag_free(d);
+}
+
+// Test that a periodic task runs once per period instead of back to back
+static void test_periodic_rate(void) {
+    char path[64], cmd[128];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_freq_%d", (int)getpid());
+    unlink(path);
+    snprintf(cmd, sizeof(cmd), "echo run >> %s", path);
+
+    dag_t *d = dag_init();
+    assert(dag_add_task(d, make_task("TICK", cmd, 1)) == 0);
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    assert(sched_start(s) == 0);
+    usleep(2500000);
+    sched_stop(s);
+    free(s);
+
+    // Runs at 0s, 1s and 2s, give or take one for timing jitter
+    FILE *f = fopen(path, "r");
+    assert(f);
+    int runs = 0, ch;
+    while ((ch = fgetc(f)) != EOF) runs += ch == '\n';
+    fclose(f);
+    unlink(path);
+    assert(runs >= 2 && runs <= 4);
+    dag_free(d);
+}
+
+static atomic_bool gate_q_done;
+static atomic_int  gate_r_runs, gate_r_early;
+
+static int gate_p_fn(void *arg) {
+    (void)arg;
+    return 0;
+}
+
+static int gate_q_fn(void *arg) {
+    (void)arg;
+    usleep(1600000);
+    atomic_store(&gate_q_done, true);
+    return 0;
+}
+
+static int gate_r_fn(void *arg) {
+    (void)arg;
+    if (!atomic_load(&gate_q_done)) atomic_fetch_add(&gate_r_early, 1);
+    atomic_fetch_add(&gate_r_runs, 1);
+    return 0;
+}
+
+// Test that a periodic predecessor releases its successor only once: P -> R runs every
+// second, Q -> R takes 1.6s, so P's second run must not start R before Q is done
+static void test_periodic_release(void) {
+    dag_t *d = dag_init();
+    assert(d);
+    assert(dag_add_fn_task(d, "P", gate_p_fn, NULL) == 0);
+    assert(dag_add_fn_task(d, "Q", gate_q_fn, NULL) == 0);
+    assert(dag_add_fn_task(d, "R", gate_r_fn, NULL) == 0);
+    d->freq[0] = 1;
+    assert(dag_add_dep(d, "P", "R") == 0);
+    assert(dag_add_dep(d, "Q", "R") == 0);
+
+    scheduler_t *s = sched_init(d, 3);
+    assert(s);
+    assert(sched_start(s) == 0);
+    // Long enough for P to run at 0s, 1s, 2s and 3s
+    usleep(3300000);
+    sched_stop(s);
+    free(s);
+    assert(atomic_load(&gate_r_early) == 0);
+    assert(atomic_load(&gate_r_runs) == 1);
+    assert(dag_status(d, 2) == COMPLETED);
+    dag_free(d);
+}
+
+enum { DEQUE_ITEMS = 200000, DEQUE_THIEVES = 3 };
+
+typedef struct {
+    work_deque_t  *q;
+    atomic_int    *taken;
+    atomic_bool   *done;
+} thief_arg_t;
+
+static void *thief(void *arg) {
+    thief_arg_t *a = arg;
+    size_t x;
+    while (!atomic_load(a->done)) {
+        if (wd_steal(a->q, &x) == 1) atomic_fetch_add(&a->taken[x], 1);
+    }
+    int r;
+    while ((r = wd_steal(a->q, &x)) != 0) {
+        if (r == 1) atomic_fetch_add(&a->taken[x], 1);
+    }
+    return NULL;
+}
+
+// Test that every pushed entry is taken exactly once while thieves race the owner
+static void test_work_deque(void) {
+    work_deque_t q;
+    assert(wd_init(&q, 4) == 0);
+    atomic_int *taken = calloc(DEQUE_ITEMS, sizeof(atomic_int));
+    assert(taken);
+    atomic_bool done;
+    atomic_init(&done, false);
+    thief_arg_t a = { &q, taken, &done };
+    pthread_t th[DEQUE_THIEVES];
+    for (int i = 0; i < DEQUE_THIEVES; ++i) assert(pthread_create(&th[i], NULL, thief, &a) == 0);
+
+    // Bursts of pushes (forcing the buffer to grow) mixed with owner pops
+    size_t x;
+    for (size_t i = 0; i < DEQUE_ITEMS; ++i) {
+        assert(wd_push(&q, i) == 0);
+        if (i % 3 == 0 && wd_pop(&q, &x)) atomic_fetch_add(&taken[x], 1);
+    }
+    while (wd_pop(&q, &x)) atomic_fetch_add(&taken[x], 1);
+    atomic_store(&done, true);
+    for (int i = 0; i < DEQUE_THIEVES; ++i) pthread_join(th[i], NULL);
+
+    for (size_t i = 0; i < DEQUE_ITEMS; ++i) assert(atomic_load(&taken[i]) == 1);
+    free(taken);
+    wd_free(&q);
+}
+
+// Test a wide fan-out where released tasks are spread over workers by stealing
+static void test_wide_fanout(void) {
+    enum { FAN = 200 };
+    dag_t *d = dag_init();
+    assert(dag_add_task(d, make_task("ROOT", "true", 0)) == 0);
+    assert(dag_add_task(d, make_task("SINK", "true", 0)) == 0);
+    char name[32];
+    for (int i = 0; i < FAN; ++i) {
+        snprintf(name, sizeof(name), "LEAF%d", i);
+        assert(dag_add_task(d, make_task(name, "true", 0)) == 0);
+        assert(dag_add_dep(d, "ROOT", name) == 0);
+        assert(dag_add_dep(d, name, "SINK") == 0);
+    }
+
+    scheduler_t *s = sched_init(d, 4);
+    assert(s);
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+
+    for (size_t i = 0; i < d->n_tasks; ++i) assert(dag_status(d, i) == COMPLETED);
+    dag_free(d);
+}
+
+// Commands split into argv only when no shell syntax is involved
+static void test_split_argv(void) {
+    char buf[256];
+    char *argv[8];
+    assert(launcher_split_argv("echo  hello\tworld", buf, sizeof(buf), argv, 7));
+    assert(strcmp(argv[0], "echo") == 0 && strcmp(argv[1], "hello") == 0);
+    assert(strcmp(argv[2], "world") == 0 && argv[3] == NULL);
+    assert(launcher_split_argv("make -j4 CFLAGS=-O2", buf, sizeof(buf), argv, 7));
+
+    assert(!launcher_split_argv("echo hi > out", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("echo $HOME", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("echo 'a b'", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("ls *.c", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("true && false", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("cat ~/notes", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("X=1 env", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("cd /tmp", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("exit 3", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("   ", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("a b c d e f g h", buf, sizeof(buf), argv, 7));
+    assert(!launcher_split_argv("echo hello", buf, 8, argv, 7));
+}
+
+// Every launcher backend reports the same exit codes
+static void test_launch_modes(void) {
+    const char *cmds[] = { "true", "false", "exit 3", "sh -c 'exit 5'", "no_such_program_xyz", "echo hi > /dev/null" };
+    int expect[] = { 0, 1, 3, 5, 127, 0 };
+    launch_mode_t modes[] = { LAUNCH_SPAWN, LAUNCH_SPAWN, LAUNCH_FORK };
+    bool direct[] = { true, false, false };
+    for (size_t m = 0; m < 3; ++m) {
+        launcher_t l;
+        assert(launcher_init(&l, modes[m], direct[m]) == 0);
+        for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
+            pid_t pid;
+            int r = launcher_spawn(&l, cmds[i], &pid);
+            if (r == 0) r = launcher_wait(pid);
+            assert(r == expect[i]);
+        }
+        launcher_destroy(&l);
+    }
+
+    // Schedulers default to posix_spawn with direct exec
+    dag_t *d = dag_init();
+    scheduler_t *s = sched_init(d, 1);
+    assert(s);
+    assert(s->launcher.mode == LAUNCH_SPAWN && s->launcher.direct_exec);
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+    dag_free(d);
+}
+
+static double elapsed_sec(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec) + (double)(t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// Test that in async mode one worker keeps many children running at once,
+// bounded by max_running, with the same gating as sync mode
+static void test_async_mode(void) {
+    enum { N_SLEEPERS = 8 };
+    dag_t *d = dag_init();
+    task_t *sleepers[N_SLEEPERS];
+    char id[16];
+    for (size_t i = 0; i < N_SLEEPERS; ++i) {
+        snprintf(id, sizeof(id), "S%zu", i);
+        sleepers[i] = make_task(id, "sleep 0.4", 0);
+        assert(dag_add_task(d, sleepers[i]) == 0);
+    }
+    task_t *f = make_task("F", "false", 0);
+    task_t *g = make_task("G", "true", 0);
+    task_t *after = make_task("AFTER", "true", 0);
+    assert(dag_add_task(d, f) == 0);
+    assert(dag_add_task(d, g) == 0);
+    assert(dag_add_task(d, after) == 0);
+    assert(dag_add_dep(d, "F", "G") == 0);
+    assert(dag_add_dep(d, "S0", "AFTER") == 0);
+
+    // All eight sleepers overlap: well under the 3.2 s they would take back to back
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    scheduler_t *s = sched_init(d, 1);
+    assert(s);
+    s->async = true;
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+    assert(elapsed_sec(&t0) < 2.0);
+    for (size_t i = 0; i < N_SLEEPERS; ++i) assert(status_of(d, sleepers[i]) == COMPLETED);
+    assert(status_of(d, after) == COMPLETED);
+    assert(status_of(d, f) == FAILED);
+    assert(status_of(d, g) == PENDING);
+
+    // Two at a time: at least four rounds of 0.4 s
+    for (size_t i = 0; i < d->n_tasks; ++i) dag_set_status(d, i, PENDING);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    s = sched_init(d, 4);
+    assert(s);
+    s->async = true;
+    s->max_running = 2;
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+    assert(elapsed_sec(&t0) >= 1.5);
+    for (size_t i = 0; i < N_SLEEPERS; ++i) assert(status_of(d, sleepers[i]) == COMPLETED);
+    assert(status_of(d, after) == COMPLETED);
+    dag_free(d);
+}
+
+enum { FN_TASKS = 100000 };
+
+static atomic_int *fn_done; // per tree task, set once its function has run
+static atomic_int  fn_runs, fn_order_errors;
+static size_t      fn_idx[FN_TASKS];
+
+// Task i of a binary tree: checks that its parent (i-1)/2 already ran
+static int tree_fn(void *arg) {
+    size_t i = *(size_t *)arg;
+    if (i > 0 && !atomic_load(&fn_done[(i - 1) / 2])) atomic_fetch_add(&fn_order_errors, 1);
+    atomic_store(&fn_done[i], 1);
+    atomic_fetch_add(&fn_runs, 1);
+    return 0;
+}
+
+static int failing_fn(void *arg) {
+    (void)arg;
+    return 3;
+}
+
+// Test that 100k in-process tasks run in dependency order, mixed with commands,
+// and that a failing function blocks its successors like a failing command
+static void test_fn_tasks(void) {
+    fn_done = calloc(FN_TASKS, sizeof(atomic_int));
+    assert(fn_done);
+    atomic_init(&fn_order_errors, 0);
+
+    dag_t *d = dag_init();
+    char id[24], from[24];
+    assert(dag_bulk_begin(d) == 0);
+    for (size_t i = 0; i < FN_TASKS; ++i) {
+        fn_idx[i] = i;
+        snprintf(id, sizeof(id), "N%zu", i);
+        task_t *t = dag_new_fn_task(id, tree_fn, &fn_idx[i]);
+        assert(t && dag_bulk_add_task(d, t) == 0);
+        if (i > 0) {
+            snprintf(from, sizeof(from), "N%zu", (i - 1) / 2);
+            assert(dag_bulk_add_dep(d, from, id) == 0);
+        }
+    }
+    assert(dag_bulk_commit(d) == 0);
+    assert(dag_add_fn_task(d, "BAD", failing_fn, NULL) == 0);
+    task_t *after_bad = make_task("AFTER_BAD", "true", 0);
+    task_t *after_root = make_task("AFTER_ROOT", "true", 0);
+    assert(dag_add_task(d, after_bad) == 0);
+    assert(dag_add_task(d, after_root) == 0);
+    assert(dag_add_dep(d, "BAD", "AFTER_BAD") == 0);
+    assert(dag_add_dep(d, "N0", "AFTER_ROOT") == 0);
+
+    // Async mode only hands commands to the reactor; functions still run on workers
+    for (int async = 0; async <= 1; ++async) {
+        for (size_t i = 0; i < d->n_tasks; ++i) dag_set_status(d, i, PENDING);
+        memset(fn_done, 0, FN_TASKS * sizeof(atomic_int));
+        atomic_store(&fn_runs, 0);
+
+        scheduler_t *s = sched_init(d, 4);
+        assert(s);
+        s->async = async;
+        assert(sched_start(s) == 0);
+        sched_stop(s);
+        free(s);
+
+        assert(atomic_load(&fn_runs) == FN_TASKS);
+        assert(atomic_load(&fn_order_errors) == 0);
+        for (size_t i = 0; i < FN_TASKS; ++i) assert(dag_status(d, i) == COMPLETED);
+        assert(dag_status(d, (size_t)dag_find_index(d, "BAD")) == FAILED);
+        assert(status_of(d, after_bad) == PENDING);
+        assert(status_of(d, after_root) == COMPLETED);
+    }
+    dag_free(d);
+    free(fn_done);
+}
+
+#define RES_TASKS 40
+
+static atomic_int res_db, res_gpu; // tokens in use right now
+static atomic_int res_over; // times a pool was found over its capacity
+static atomic_int res_max_db;
+static atomic_int res_runs;
+static int        res_amount[RES_TASKS][2]; // db and gpu each task holds
+
+static int res_fn(void *arg) {
+    const int *need = arg;
+    int db = atomic_fetch_add(&res_db, need[0]) + need[0];
+    int gpu = atomic_fetch_add(&res_gpu, need[1]) + need[1];
+    if (db > 3 || gpu > 1) atomic_fetch_add(&res_over, 1);
+    int seen = atomic_load(&res_max_db);
+    while (db > seen && !atomic_compare_exchange_weak(&res_max_db, &seen, db)) {}
+    usleep(2000);
+    atomic_fetch_sub(&res_db, need[0]);
+    atomic_fetch_sub(&res_gpu, need[1]);
+    atomic_fetch_add(&res_runs, 1);
+    return 0;
+}
+
+// Test that tasks never hold more of a pool than it has, that every task still runs
+// (including one asking for more than the whole pool), and that pools don't break
+// dependency order or priority mode
+static void test_resources(void) {
+    dag_t *d = dag_init();
+    assert(d);
+    assert(dag_set_pool(d, "db", 3) == 0);
+    assert(dag_set_pool(d, "gpu", 1) == 1);
+    char id[16], from[16];
+    for (size_t i = 0; i < RES_TASKS; ++i) {
+        snprintf(id, sizeof(id), "R%zu", i);
+        res_amount[i][0] = i == 7 ? 3 : (int)(i % 3);
+        res_amount[i][1] = i % 5 == 0;
+        assert(dag_add_fn_task(d, id, res_fn, res_amount[i]) == 0);
+        dag_need_t need[2];
+        size_t n = 0;
+        // Task 7 asks for more than the pool has and gets all of it
+        if (res_amount[i][0]) need[n++] = (dag_need_t){ 0, i == 7 ? 10 : (uint64_t)res_amount[i][0] };
+        if (res_amount[i][1]) need[n++] = (dag_need_t){ 1, 1 };
+        assert(dag_set_needs(d, i, need, n) == 0);
+        if (i >= 30) {
+            snprintf(from, sizeof(from), "R%zu", i - 10);
+            assert(dag_add_dep(d, from, id) == 0);
+        }
+    }
+
+    for (int prio = 0; prio <= 1; ++prio) {
+        for (size_t i = 0; i < d->n_tasks; ++i) dag_set_status(d, i, PENDING);
+        atomic_store(&res_runs, 0);
+        atomic_store(&res_over, 0);
+        atomic_store(&res_max_db, 0);
+        scheduler_t *s = sched_init(d, 4);
+        assert(s);
+        s->priority = prio;
+        assert(sched_start(s) == 0);
+        sched_stop(s);
+        free(s);
+
+        assert(atomic_load(&res_runs) == RES_TASKS);
+        assert(atomic_load(&res_over) == 0);
+        assert(atomic_load(&res_max_db) <= 3);
+        for (size_t i = 0; i < RES_TASKS; ++i) assert(dag_status(d, i) == COMPLETED);
+    }
+    dag_free(d);
+}
+
+static size_t    prio_log[16];
+static atomic_int prio_n;
+static size_t    prio_idx[16];
+
+static int prio_fn(void *arg) {
+    prio_log[atomic_fetch_add(&prio_n, 1)] = *(size_t *)arg;
+    return 0;
+}
+
+// Test that priority mode starts the expensive chain before cheap tasks queued ahead of it,
+// and that run times feed back into the DAG's cost estimates
+static void test_priority(void) {
+    dag_t *d = dag_init();
+    assert(d);
+    char id[16];
+    // S0..S9 are cheap roots; C0 -> C1 -> C2 is the critical path
+    for (size_t i = 0; i < 13; ++i) {
+        prio_idx[i] = i;
+        if (i < 10) snprintf(id, sizeof(id), "S%zu", i);
+        else snprintf(id, sizeof(id), "C%zu", i - 10);
+        assert(dag_add_fn_task(d, id, prio_fn, &prio_idx[i]) == 0);
+        d->cost[i] = i < 10 ? 0.01 : 1.0;
+    }
+    d->cost[9] = 0; // unknown: weighs the mean of the others
+    assert(dag_add_dep(d, "C0", "C1") == 0);
+    assert(dag_add_dep(d, "C1", "C2") == 0);
+
+    // FIFO runs the roots in slot order
+    for (int priority = 0; priority <= 1; ++priority) {
+        dag_reset_status(d);
+        atomic_store(&prio_n, 0);
+        scheduler_t *s = sched_init(d, 1);
+        assert(s);
+        s->priority = priority;
+        assert(sched_start(s) == 0);
+        sched_stop(s);
+        free(s);
+        assert(atomic_load(&prio_n) == 13);
+        if (priority) {
+            assert(prio_log[0] == 10 && prio_log[1] == 11 && prio_log[2] == 12);
+        } else {
+            assert(prio_log[0] == 0);
+        }
+    }
+
+    // Two quick successful runs pull the declared second down toward what was observed
+    assert(d->cost[10] > 0 && d->cost[10] < 0.6);
+    assert(d->cost[9] > 0);
+    dag_free(d);
+}
+
+static atomic_int wal_runs[4];
+static atomic_int wal_b_ok;
+static size_t     wal_idx[4] = { 0, 1, 2, 3 };
+
+// Task B fails until wal_b_ok is set
+static int wal_fn(void *arg) {
+    size_t i = *(size_t *)arg;
+    atomic_fetch_add(&wal_runs[i], 1);
+    return i == 1 && !atomic_load(&wal_b_ok) ? 1 : 0;
+}
+
+// A -> B -> C, plus an independent D
+static dag_t *build_wal_dag(const char *first_id) {
+    dag_t *d = dag_init();
+    assert(d);
+    const char *ids[4] = { first_id, "B", "C", "D" };
+    for (size_t i = 0; i < 4; ++i) assert(dag_add_fn_task(d, ids[i], wal_fn, &wal_idx[i]) == 0);
+    assert(dag_add_dep(d, first_id, "B") == 0);
+    assert(dag_add_dep(d, "B", "C") == 0);
+    return d;
+}
+
+static void run_with_wal(dag_t *d, wal_t *w) {
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    s->wal = w;
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+}
+
+// Test that replaying the log after an interrupted run leaves only unfinished tasks to run,
+// that a torn record at the end is dropped and that a log only opens for its own DAG
+static void test_wal_resume(void) {
+    char path[] = "/tmp/graphtasker_wal.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    // First run: B fails, so C never runs
+    dag_t *d = build_wal_dag("A");
+    wal_t w;
+    assert(wal_open(&w, path, d) == 0);
+    wal_mark_run(&w);
+    run_with_wal(d, &w);
+    assert(dag_status(d, 0) == COMPLETED && dag_status(d, 1) == FAILED);
+    assert(dag_status(d, 2) == PENDING && dag_status(d, 3) == COMPLETED);
+    assert(wal_close(&w) == 0);
+    dag_free(d);
+
+    // A crash in the middle of a write leaves part of a record behind
+    fd = open(path, O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    assert(write(fd, "torn!", 5) == 5);
+    close(fd);
+
+    // Restart on a fresh copy of the DAG: A and D are done, B and C still have to run
+    d = build_wal_dag("A");
+    assert(wal_open(&w, path, d) == 0);
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    assert(((size_t)st.st_size - sizeof(wal_header_t)) % sizeof(wal_record_t) == 0);
+    size_t done;
+    assert(wal_replay(&w, d, &done) == 0);
+    assert(done == 2);
+    assert(dag_status(d, 0) == COMPLETED && dag_status(d, 3) == COMPLETED);
+    assert(dag_status(d, 1) == PENDING && dag_status(d, 2) == PENDING);
+
+    atomic_store(&wal_b_ok, 1);
+    run_with_wal(d, &w);
+    assert(atomic_load(&wal_runs[0]) == 1 && atomic_load(&wal_runs[3]) == 1);
+    assert(atomic_load(&wal_runs[1]) == 2 && atomic_load(&wal_runs[2]) == 1);
+    for (size_t i = 0; i < 4; ++i) assert(dag_status(d, i) == COMPLETED);
+
+    // Everything is done now, until a fresh run starts over
+    assert(wal_replay(&w, d, &done) == 0 && done == 4);
+    wal_mark_run(&w);
+    assert(wal_replay(&w, d, &done) == 0 && done == 0);
+    for (size_t i = 0; i < 4; ++i) assert(dag_status(d, i) == PENDING);
+    assert(wal_close(&w) == 0);
+    dag_free(d);
+
+    // Different IDs: the log belongs to another DAG
+    d = build_wal_dag("X");
+    assert(wal_open(&w, path, d) == -4);
+    dag_free(d);
+    unlink(path);
+}
+
+// Sleeps for the number of milliseconds it is given, failing on 0
+static int stats_fn(void *arg) {
+    long ms = *(long *)arg;
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+    return ms == 0;
+}
+
+static void test_stats(void) {
+    // Percentiles stay within a bucket's width of the exact ones
+    hist_t *h = calloc(1, sizeof(hist_t));
+    hist_view_t *v = calloc(1, sizeof(hist_view_t));
+    assert(h && v);
+    for (uint64_t i = 1; i <= 100000; ++i) hist_record(h, i * 1000);
+    hist_view_add(v, h);
+    assert(v->total == 100000 && v->max == 100000000);
+    uint64_t p50 = hist_view_percentile(v, 0.5), p99 = hist_view_percentile(v, 0.99);
+    assert(p50 > 50000000 * 0.94 && p50 < 50000000 * 1.06);
+    assert(p99 > 99000000 * 0.94 && p99 <= 100000000);
+    assert(hist_view_percentile(v, 1.0) == 100000000);
+    free(h);
+
+    // A -> B takes at least 2 ms each, C fails right away
+    static long ms[3] = { 2, 2, 0 };
+    dag_t *d = dag_init();
+    assert(d);
+    assert(dag_add_fn_task(d, "A", stats_fn, &ms[0]) == 0);
+    assert(dag_add_fn_task(d, "B", stats_fn, &ms[1]) == 0);
+    assert(dag_add_fn_task(d, "C", stats_fn, &ms[2]) == 0);
+    assert(dag_add_dep(d, "A", "B") == 0);
+
+    sched_stats_t st;
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    s->stats = &st;
+    assert(stats_init(&st, 1, 2) == 0);
+    assert(sched_start(s) == -1); // too small for the DAG
+    stats_free(&st);
+    assert(stats_init(&st, d->n_tasks, 2) == 0);
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+
+    stats_run_view(&st, 0, v);
+    assert(v->total == 3);
+    assert(v->max >= 2000000);
+    stats_run_view(&st, 1, v);
+    assert(v->total == 3);
+    for (size_t i = 0; i < 3; ++i) {
+        task_stats_t *ts = &st.tasks[i];
+        assert(atomic_load(&ts->runs) == 1);
+        assert(atomic_load(&ts->failed) == (i == 2));
+        assert(atomic_load(&ts->last_start) > 0 && atomic_load(&ts->last_start) <= atomic_load(&ts->last_end));
+        stats_task_view(&st, i, v);
+        assert(v->total == 1 && v->max == atomic_load(&ts->total_ns));
+        if (i < 2) assert(v->max >= 2000000);
+    }
+    // B could only start once A had ended
+    assert(atomic_load(&st.tasks[1].last_start) >= atomic_load(&st.tasks[0].last_end));
+    assert(atomic_load(&st.tasks[0].hist) == NULL);
+
+    // A second run of a task gives it a histogram holding both
+    stats_task_finished(&st, 0, 0, st.start_ns + 10, 8000000, 0);
+    assert(atomic_load(&st.tasks[0].runs) == 2 && atomic_load(&st.tasks[0].hist) != NULL);
+    stats_task_view(&st, 0, v);
+    assert(v->total == 2 && v->max == 8000000);
+    assert(hist_view_percentile(v, 0.5) < 4000000);
+
+    stats_free(&st);
+    free(v);
+    dag_free(d);
+}
+
+// Connects to the metrics socket, sends req and returns everything sent back
+static char *scrape(const char *path, const char *req) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    if (*req) assert(write(fd, req, strlen(req)) == (ssize_t)strlen(req));
+    size_t cap = 1 << 16, len = 0;
+    char *buf = malloc(cap);
+    assert(buf);
+    ssize_t n;
+    while ((n = read(fd, buf + len, cap - 1 - len)) > 0) len += (size_t)n;
+    buf[len] = '\0';
+    close(fd);
+    return buf;
+}
+
+static void test_metrics(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_metrics.%d", (int)getpid());
+    metrics_server_t m;
+    assert(metrics_start(&m, path) == 0);
+
+    // Nothing attached yet
+    char *out = scrape(path, "");
+    assert(strstr(out, "graphtasker_scheduler_up 0\n"));
+    assert(strstr(out, "graphtasker_scrapes_total 1\n"));
+    free(out);
+
+    // A -> B succeed, C fails
+    static long ms[3] = { 1, 1, 0 };
+    dag_t *d = dag_init();
+    assert(d);
+    assert(dag_add_fn_task(d, "A", stats_fn, &ms[0]) == 0);
+    assert(dag_add_fn_task(d, "B", stats_fn, &ms[1]) == 0);
+    assert(dag_add_fn_task(d, "C", stats_fn, &ms[2]) == 0);
+    assert(dag_add_dep(d, "A", "B") == 0);
+    assert(dag_add_task(d, make_task("D", "true", 0)) == 0);
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    assert(sched_start(s) == 0);
+    metrics_attach(&m, s);
+    while (status_of(d, d->tasks[1]) != COMPLETED || status_of(d, d->tasks[2]) != FAILED ||
+           status_of(d, d->tasks[3]) != COMPLETED) {
+        usleep(1000);
+    }
+
+    out = scrape(path, "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+    assert(strncmp(out, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    assert(strstr(out, "graphtasker_scheduler_up 1\n"));
+    assert(strstr(out, "graphtasker_tasks 4\n"));
+    assert(strstr(out, "graphtasker_tasks_started_total 4\n"));
+    assert(strstr(out, "graphtasker_tasks_completed_total 3\n"));
+    assert(strstr(out, "graphtasker_tasks_failed_total 1\n"));
+    assert(strstr(out, "graphtasker_queue_depth 0\n"));
+    assert(strstr(out, "graphtasker_workers 2\n"));
+    assert(strstr(out, "graphtasker_worker_busy_seconds_total{worker=\"1\"} "));
+    assert(strstr(out, "graphtasker_spawn_seconds_count 1\n"));
+    assert(strstr(out, "# TYPE graphtasker_tasks_completed_total counter\n"));
+    free(out);
+
+    metrics_attach(&m, NULL);
+    sched_stop(s);
+    free(s);
+    metrics_stop(&m);
+    struct stat st;
+    assert(stat(path, &st) != 0); // the socket file is gone
+    dag_free(d);
+}
+
+static size_t count_substr(const char *s, const char *sub) {
+    size_t n = 0;
+    for (const char *p = strstr(s, sub); p; p = strstr(p + 1, sub)) n++;
+    return n;
+}
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    assert(f);
+    size_t cap = 1 << 20;
+    char *buf = malloc(cap);
+    assert(buf);
+    size_t len = fread(buf, 1, cap - 1, f);
+    buf[len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+// Runs A -> B and a failing C (function tasks), plus a command D, and returns the trace
+static char *traced_run(const char *path, bool async, size_t ring_events) {
+    static long ms[3] = { 1, 1, 0 };
+    dag_t *d = dag_init();
+    assert(d);
+    assert(dag_add_fn_task(d, "A", stats_fn, &ms[0]) == 0);
+    assert(dag_add_fn_task(d, "B", stats_fn, &ms[1]) == 0);
+    assert(dag_add_fn_task(d, "C\"", stats_fn, &ms[2]) == 0);
+    assert(dag_add_dep(d, "A", "B") == 0);
+    assert(dag_add_task(d, make_task("D", "true", 0)) == 0);
+
+    sched_trace_t t;
+    assert(trace_init(&t, path, 2, ring_events) == 0);
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    s->async = async;
+    s->trace = &t;
+    assert(sched_start(s) == 0);
+    while (status_of(d, d->tasks[1]) != COMPLETED || status_of(d, d->tasks[3]) != COMPLETED) usleep(1000);
+    sched_stop(s);
+    free(s);
+    assert(t.err == 0);
+    trace_free(&t);
+    dag_free(d);
+    return read_file(path);
+}
+
+static void test_trace(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/graphtasker_trace.%d", (int)getpid());
+
+    char *out = traced_run(path, false, 0);
+    assert(strncmp(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39) == 0);
+    assert(count_substr(out, "\"ph\":\"X\"") == 4);
+    assert(strstr(out, "{\"name\":\"A\",\"cat\":\"task\",\"ph\":\"X\""));
+    assert(strstr(out, "{\"name\":\"C\\\"\",\"cat\":\"task\",\"ph\":\"X\""));
+    assert(count_substr(out, "\"code\":1}") == 1);
+    assert(strstr(out, "\"args\":{\"name\":\"worker 1\"}"));
+    assert(strstr(out, "\"args\":{\"name\":\"reactor\"}"));
+    assert(strcmp(out + strlen(out) - 4, "\n]}\n") == 0);
+    free(out);
+
+    // The reactor finishes D, so it becomes an async slice on the worker that launched it
+    out = traced_run(path, true, 0);
+    assert(count_substr(out, "\"ph\":\"X\"") == 3);
+    assert(count_substr(out, "\"ph\":\"b\"") == 1 && count_substr(out, "\"ph\":\"e\"") == 1);
+    assert(strstr(out, "{\"name\":\"D\",\"cat\":\"child\",\"ph\":\"b\""));
+    free(out);
+
+    // Rings of one record keep at most one end per thread, whose begin is gone
+    out = traced_run(path, false, 1);
+    assert(count_substr(out, "\"ph\":\"X\"") <= 1);
+    free(out);
+    unlink(path);
+}
+
+// Test that commands' output lands in per-task logs, in sync and async mode, that the
+// tail is kept in memory, and that a background process holding the pipe doesn't hang stop
+static void test_capture(void) {
+    char dir[64], path[96];
+    snprintf(dir, sizeof(dir), "/tmp/graphtasker_logs.%d", (int)getpid());
+    for (int async = 0; async <= 1; ++async) {
+        dag_t *d = dag_init();
+        assert(d);
+        assert(dag_add_task(d, make_task("A", "echo out; echo err >&2", 0)) == 0);
+        // More than a pipe holds, so the child blocks until the I/O thread drains it
+        assert(dag_add_task(d, make_task("big/one", "head -c 300000 /dev/zero | tr '\\0' x; echo end", 0)) == 0);
+        assert(dag_add_task(d, make_task("quiet", "true", 0)) == 0);
+        assert(dag_add_task(d, make_task("bg", "(sleep 2; echo late) & echo early", 0)) == 0);
+        assert(dag_add_dep(d, "A", "quiet") == 0);
+
+        sched_capture_t c;
+        assert(capture_init(&c, dir, d, d->n_tasks) == 0);
+        scheduler_t *s = sched_init(d, 2);
+        assert(s);
+        s->async = async;
+        s->capture = &c;
+        assert(sched_start(s) == 0);
+        sched_stop(s);
+        free(s);
+        assert(c.err == 0);
+        for (size_t i = 0; i < d->n_tasks; ++i) assert(dag_status(d, i) == COMPLETED);
+
+        snprintf(path, sizeof(path), "%s/A.log", dir);
+        char *out = read_file(path);
+        assert(strcmp(out, "out\nerr\n") == 0);
+        free(out);
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/big_one.log", dir);
+        assert(stat(path, &st) == 0 && st.st_size == 300004);
+        snprintf(path, sizeof(path), "%s/quiet.log", dir);
+        assert(stat(path, &st) == 0 && st.st_size == 0);
+
+        char tail[CAPTURE_TAIL_BYTES];
+        size_t n = capture_tail(&c, 1, tail);
+        assert(n == CAPTURE_TAIL_BYTES && memcmp(tail + n - 5, "xend\n", 5) == 0);
+        assert(capture_tail(&c, 0, tail) == 8 && memcmp(tail, "out\nerr\n", 8) == 0);
+        assert(capture_tail(&c, 2, tail) == 0);
+        assert(capture_tail(&c, 3, tail) == 6 && memcmp(tail, "early\n", 6) == 0);
+        assert(atomic_load(&c.bytes) == 300004 + 8 + 6);
+        capture_free(&c);
+        dag_free(d);
+    }
+    const char *logs[] = { "A.log", "big_one.log", "quiet.log", "bg.log" };
+    for (size_t i = 0; i < 4; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", dir, logs[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+// Test that stop drains every pipe that still holds output, when more of them are ready
+// at once than the I/O thread takes events in one pass
+static void test_capture_drain(void) {
+    enum { N = 300 };
+    char dir[64], path[96], id[16], line[32];
+    snprintf(dir, sizeof(dir), "/tmp/graphtasker_drain.%d", (int)getpid());
+    dag_t *d = dag_init();
+    assert(d);
+    for (int i = 0; i < N; ++i) {
+        snprintf(id, sizeof(id), "t%d", i);
+        assert(dag_add_task(d, make_task(id, "true", 0)) == 0);
+    }
+    sched_capture_t c;
+    assert(capture_init(&c, dir, d, d->n_tasks) == 0);
+    assert(capture_start(&c) == 0);
+    // Told to finish before any stream shows up, the I/O thread makes at most one more pass,
+    // so output and end of file are still waiting in most pipes when stop is called
+    uint64_t one = 1;
+    assert(write(c.evfd, &one, sizeof(one)) == sizeof(one));
+    for (int i = 0; i < N; ++i) {
+        int out;
+        capture_stream_t *st = capture_open(&c, (size_t)i, &out);
+        assert(st);
+        int len = snprintf(line, sizeof(line), "line %d\n", i);
+        assert(write(out, line, (size_t)len) == len);
+        capture_launched(&c, st, out, true);
+    }
+    capture_stop(&c);
+    assert(c.err == 0);
+    assert(atomic_load(&c.bytes) > 0);
+
+    for (int i = 0; i < N; ++i) {
+        snprintf(path, sizeof(path), "%s/t%d.log", dir, i);
+        char *out = read_file(path);
+        snprintf(line, sizeof(line), "line %d\n", i);
+        assert(strcmp(out, line) == 0);
+        free(out);
+        unlink(path);
+    }
+    capture_free(&c);
     dag_free(d);
+    rmdir(dir);
+}
+
+// Runs d once with the result cache at path; returns how many tasks it skipped
+static uint64_t cached_run(dag_t *d, const char *path, bool async) {
+    sched_cache_t c;
+    assert(cache_open(&c, path) == 0);
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    s->async = async;
+    s->cache = &c;
+    dag_reset_status(d);
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+    assert(c.err == 0);
+    uint64_t hits = atomic_load(&c.hits);
+    cache_free(&c);
+    return hits;
+}
+
+static void test_cache(void) {
+    char dir[64], in[96], cache[96], cmd[512];
+    snprintf(dir, sizeof(dir), "/tmp/graphtasker_cache.%d", (int)getpid());
+    snprintf(in, sizeof(in), "%s/in.txt", dir);
+    snprintf(cache, sizeof(cache), "%s/results", dir);
+    assert(mkdir(dir, 0777) == 0);
+    int fd = open(in, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    assert(fd >= 0 && write(fd, "one\n", 4) == 4);
+    close(fd);
+
+    dag_t *d = dag_init();
+    assert(d);
+    snprintf(cmd, sizeof(cmd), "cat %s > %s/gen.out", in, dir);
+    assert(dag_add_task(d, make_task("gen", cmd, 0)) == 0);
+    snprintf(cmd, sizeof(cmd), "cat %s/gen.out >> %s/use.out", dir, dir);
+    assert(dag_add_task(d, make_task("use", cmd, 0)) == 0);
+    // No inputs: always runs
+    snprintf(cmd, sizeof(cmd), "echo x >> %s/always.out", dir);
+    assert(dag_add_task(d, make_task("always", cmd, 0)) == 0);
+    assert(dag_add_task(d, make_task("missing", "true", 0)) == 0);
+    assert(dag_add_task(d, make_task("fails", "false", 0)) == 0);
+    assert(dag_add_dep(d, "gen", "use") == 0);
+    assert(dag_add_dep(d, "use", "always") == 0);
+    char gen_out[96], nope[96];
+    snprintf(gen_out, sizeof(gen_out), "%s/gen.out", dir);
+    snprintf(nope, sizeof(nope), "%s/nope", dir);
+    const char *gen_in[] = { in }, *use_in[] = { gen_out }, *missing_in[] = { nope };
+    assert(dag_set_inputs(d, 0, gen_in, 1) == 0);
+    assert(dag_set_inputs(d, 1, use_in, 1) == 0);
+    assert(dag_set_inputs(d, 3, missing_in, 1) == 0);
+    assert(dag_set_inputs(d, 4, gen_in, 1) == 0);
+
+    // The first run has nothing to go by, the second skips gen and use
+    assert(cached_run(d, cache, false) == 0);
+    assert(cached_run(d, cache, true) == 2);
+    for (size_t i = 0; i < 4; ++i) assert(dag_status(d, i) == COMPLETED);
+    assert(dag_status(d, 4) == FAILED);
+    char *results = read_file(cache);
+    assert(strstr(results, " gen\n") && strstr(results, " use\n") && !strstr(results, "missing") && !strstr(results, "fails"));
+    free(results);
+
+    // A changed input reruns its task and everything below it
+    fd = open(in, O_WRONLY | O_TRUNC);
+    assert(fd >= 0 && write(fd, "two!\n", 5) == 5);
+    close(fd);
+    assert(cached_run(d, cache, false) == 0);
+    assert(cached_run(d, cache, false) == 2);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/use.out", dir);
+    char *use = read_file(path);
+    assert(strcmp(use, "one\ntwo!\n") == 0);
+    free(use);
+    snprintf(path, sizeof(path), "%s/always.out", dir);
+    char *always = read_file(path);
+    assert(strcmp(always, "x\nx\nx\nx\n") == 0);
+    free(always);
+
+    // A file that isn't a cache is refused
+    sched_cache_t c;
+    assert(cache_open(&c, in) == -4);
+    dag_free(d);
+
+    const char *files[] = { "in.txt", "results", "gen.out", "use.out", "always.out" };
+    for (size_t i = 0; i < 5; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+static atomic_int only_runs[4];
+static size_t     only_idx[4] = { 0, 1, 2, 3 };
+
+static int only_fn(void *arg) {
+    atomic_fetch_add(&only_runs[*(size_t *)arg], 1);
+    return 0;
+}
+
+// Test that only the selected tasks run, in dependency order, and that the others keep
+// their status even when a predecessor of theirs reruns
+static void test_only(void) {
+    // A -> B -> C -> D
+    dag_t *d = dag_init();
+    assert(d);
+    const char *ids[4] = { "A", "B", "C", "D" };
+    for (size_t i = 0; i < 4; ++i) assert(dag_add_fn_task(d, ids[i], only_fn, &only_idx[i]) == 0);
+    for (size_t i = 0; i + 1 < 4; ++i) assert(dag_add_dep(d, ids[i], ids[i + 1]) == 0);
+
+    for (int async = 0; async <= 1; ++async) {
+        dag_reset_status(d);
+        for (size_t i = 0; i < 4; ++i) {
+            d->status[i] = COMPLETED;
+            atomic_store(&only_runs[i], 0);
+        }
+        d->status[1] = d->status[2] = PENDING;
+        bool only[4] = { false, true, true, false };
+        scheduler_t *s = sched_init(d, 2);
+        assert(s);
+        s->async = async;
+        s->only = only;
+        assert(sched_start(s) == 0);
+        sched_stop(s);
+        free(s);
+        assert(atomic_load(&only_runs[0]) == 0 && atomic_load(&only_runs[3]) == 0);
+        assert(atomic_load(&only_runs[1]) == 1 && atomic_load(&only_runs[2]) == 1);
+        for (size_t i = 0; i < 4; ++i) assert(dag_status(d, i) == COMPLETED);
+    }
+
+    // A pending task left out never runs, and neither does anything after it
+    dag_reset_status(d);
+    for (size_t i = 0; i < 4; ++i) atomic_store(&only_runs[i], 0);
+    bool only[4] = { true, false, true, true };
+    scheduler_t *s = sched_init(d, 2);
+    assert(s);
+    s->only = only;
+    assert(sched_start(s) == 0);
+    sched_stop(s);
+    free(s);
+    assert(atomic_load(&only_runs[0]) == 1);
+    for (size_t i = 1; i < 4; ++i) assert(atomic_load(&only_runs[i]) == 0 && dag_status(d, i) == PENDING);
+    dag_free(d);
+}
+
+// Test that linear chains of commands run in one shell each, with statuses and exit codes
+// still per task, and that the tasks around them run as usual
+static void test_fuse(void) {
+    // Each command gets a subshell: the cd doesn't carry over to the next one
+    const char *cmds[] = { "cd /", "test \"$(pwd)\" != /", "exit 4", "true" };
+    launch_mode_t modes[] = { LAUNCH_SPAWN, LAUNCH_FORK };
+    for (size_t m = 0; m < 2; ++m) {
+        launcher_t l;
+        assert(launcher_init(&l, modes[m], true) == 0);
+        pid_t pid;
+        int fd;
+        assert(launcher_spawn_chain(&l, cmds, 4, &pid, &fd) == 0);
+        char buf[64] = { 0 }, *p = buf;
+        ssize_t got;
+        while ((got = read(fd, p, sizeof(buf) - 1 - (size_t)(p - buf))) > 0) p += got;
+        close(fd);
+        assert(strcmp(buf, "0\n0\n4\n") == 0);
+        assert(launcher_wait(pid) == 4);
+        launcher_destroy(&l);
+    }
+
+    char path[] = "/tmp/graphtasker_fuse.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    char cmd[128];
+    // H -> A -> B -> C -> D -> E, D -> F, H -> Z; P -> Q -> R -> T where Q fails;
+    // the 70 L tasks make a chain too long for one shell
+    const char *ids[] = { "H", "A", "B", "C", "D", "E", "F", "Z", "P", "Q", "R", "T" };
+    for (int async = 0; async <= 1; ++async) {
+        dag_t *d = dag_init();
+        assert(d);
+        for (size_t i = 0; i < 12; ++i) {
+            // C also checks it sees none of the chain's arguments or loop variables, as under sh -c
+            if (ids[i][0] == 'C') snprintf(cmd, sizeof(cmd), "[ $# -eq 0 ] && [ -z \"${c+x}${s+x}\" ] && echo C >> %s", path);
+            else if (strchr("ABDEF", ids[i][0])) snprintf(cmd, sizeof(cmd), "echo %s >> %s", ids[i], path);
+            else snprintf(cmd, sizeof(cmd), "%s", ids[i][0] == 'Q' ? "exit 3" : "true");
+            assert(dag_add_task(d, make_task(ids[i], cmd, 0)) == 0);
+        }
+        const char *deps[][2] = { { "H", "A" }, { "A", "B" }, { "B", "C" }, { "C", "D" }, { "D", "E" },
+                                  { "D", "F" }, { "H", "Z" }, { "P", "Q" }, { "Q", "R" }, { "R", "T" } };
+        for (size_t i = 0; i < 10; ++i) assert(dag_add_dep(d, deps[i][0], deps[i][1]) == 0);
+        char id[16], prev[16];
+        for (size_t i = 0; i < 70; ++i) {
+            snprintf(id, sizeof(id), "L%zu", i);
+            assert(dag_add_task(d, make_task(id, "true", 0)) == 0);
+            if (i > 0) assert(dag_add_dep(d, prev, id) == 0);
+            memcpy(prev, id, sizeof(id));
+        }
+        assert(truncate(path, 0) == 0);
+
+        scheduler_t *s = sched_init(d, 2);
+        assert(s);
+        s->fuse = true;
+        s->async = async;
+        s->max_running = 2;
+        assert(sched_start(s) == 0);
+        sched_stop(s);
+        // A..D, P..T, and L0..L63 then L64..L69; H, Z, E and F run on their own
+        assert(s->n_chains == 4 && s->n_chained == 78);
+        assert(atomic_load(&s->n_spawns) == 8);
+        free(s);
+
+        for (size_t i = 0; i < 12; ++i) {
+            task_status_t want = COMPLETED;
+            if (ids[i][0] == 'Q') want = FAILED;
+            else if (ids[i][0] == 'R' || ids[i][0] == 'T') want = PENDING;
+            assert(dag_status(d, (size_t)dag_find_index(d, ids[i])) == want);
+        }
+        for (size_t i = 12; i < d->n_tasks; ++i) assert(dag_status(d, i) == COMPLETED);
+        char *out = read_file(path);
+        assert(out && strncmp(out, "A\nB\nC\nD\n", 8) == 0 && strlen(out) == 12);
+        free(out);
+        dag_free(d);
+    }
+    unlink(path);
 }
 
 int main(void) {
@@ -100,6 +1322,29 @@ int main(void) {
     test_empty_dag();
     test_single_worker();
     test_multi_worker_status();
+    test_dependency_order();
+    test_failure_blocks_successors();
+    test_timer_wheel();
+    test_delayed_start();
+    test_periodic_rate();
+    test_periodic_release();
+    test_work_deque();
+    test_wide_fanout();
+    test_split_argv();
+    test_launch_modes();
+    test_async_mode();
+    test_fn_tasks();
+    test_wal_resume();
+    test_priority();
+    test_stats();
+    test_metrics();
+    test_trace();
+    test_resources();
+    test_capture();
+    test_capture_drain();
+    test_cache();
+    test_only();
+    test_fuse();
 
     printf("✅ All scheduler tests passed!\n");
     return 0;
@@ -7,6 +7,15 @@ if [[ ! -x ./task_scheduler ]]; then
   exit 1
 fi
 
+snap=$(mktemp /tmp/graphtasker_shell.XXXXXX)
+sock=/tmp/graphtasker_metrics_shell.$$
+tracef=$(mktemp /tmp/graphtasker_trace.XXXXXX)
+wal=$(mktemp /tmp/graphtasker_wal.XXXXXX)
+graph=$(mktemp /tmp/graphtasker_graph.XXXXXX)
+logdir=$(mktemp -d /tmp/graphtasker_logs.XXXXXX)
+cachef=$(mktemp /tmp/graphtasker_cache.XXXXXX)
+trap 'rm -f "$snap" "$wal" "$graph" "$sock" "$tracef" "$cachef"; rm -rf "$logdir"' EXIT
+
 # Run a sequence of commands through the shell and capture output (including stderr)
 output=$(printf "%s\n" \
   'add_task A "echo A" 0 0' \
@@ -17,6 +26,15 @@ output=$(printf "%s\n" \
   'show tasks' \
   'show deps' \
   'run 1' \
+  'run 2 8' \
+  "save $snap" \
+  "load $snap" \
+  'show deps' \
+  "wal $wal" \
+  "metrics $sock" \
+  "trace $tracef" \
+  'run 1' \
+  'resume 1' \
   'exit' \
 | ./task_scheduler 2>&1)
 
@@ -34,5 +52,134 @@ grep -q "^\[0\] A: time=0 freq=0 status="  <<<"$output" || { echo "❌ show task
 grep -q "^\[1\] B: time=0 freq=0 status="  <<<"$output" || { echo "❌ show tasks missing B"; exit 1; }
 grep -q "^A -> B *$"                       <<<"$output" || { echo "❌ show deps missing A -> B"; exit 1; }
 grep -q "Scheduler started with 1 workers\." <<<"$output" || { echo "❌ scheduler did not start"; exit 1; }
+grep -q "Scheduler started with 2 workers, up to 8 tasks running\." <<<"$output" || { echo "❌ async scheduler did not start"; exit 1; }
+grep -q "Saved 2 tasks to"                 <<<"$output" || { echo "❌ save failed"; exit 1; }
+grep -q "Loaded 2 tasks from"              <<<"$output" || { echo "❌ load failed"; exit 1; }
+grep -q "Logging task status to"          <<<"$output" || { echo "❌ wal failed"; exit 1; }
+grep -q "Serving metrics on"              <<<"$output" || { echo "❌ metrics failed"; exit 1; }
+[[ ! -e "$sock" ]]                                     || { echo "❌ metrics socket left behind"; exit 1; }
+grep -q "Tracing runs to"                 <<<"$output" || { echo "❌ trace failed"; exit 1; }
+[[ $(grep -c "Wrote trace of the last run" <<<"$output") -eq 2 ]] || { echo "❌ traces not written"; exit 1; }
+grep -q '"traceEvents"' "$tracef"                      || { echo "❌ trace file not written"; exit 1; }
+grep -q "Resuming: 2 of 2 tasks already completed\." <<<"$output" || { echo "❌ resume did not replay the log"; exit 1; }
+[[ $(grep -c "^A -> B *$" <<<"$output") -eq 2 ]] || { echo "❌ loaded DAG lost A -> B"; exit 1; }
+
+# Batch mode: the graph comes from a file, commands from stdin
+printf '%s\n' \
+  '# three steps' \
+  'add_task X "echo X" 0 0' \
+  'add_task Y "echo Y" 0 0' \
+  'add_task Z "echo Z" 0 0' \
+  'add_dep X Y' \
+  'add_dep Y Z' >"$graph"
+batch=$(printf "%s\n" 'show deps' 'exit' | ./task_scheduler -f "$graph" -j 2 2>&1)
+echo "$batch"
+grep -q "Loaded 3 tasks and 2 dependencies from" <<<"$batch" || { echo "❌ batch load failed"; exit 1; }
+grep -q "^X -> Y *$"                            <<<"$batch" || { echo "❌ batch graph missing X -> Y"; exit 1; }
+
+# Statistics of the last run, read once the three echo commands are done
+stats=$( (printf "%s\n" 'show stats' 'run 2'; sleep 1; printf "%s\n" 'show stats' 'exit') | ./task_scheduler -f "$graph" 2>&1)
+echo "$stats"
+grep -q "^No run yet\.$"                                        <<<"$stats" || { echo "❌ show stats before a run"; exit 1; }
+grep -q "^Run: 3 task runs finished (0 failed) within "          <<<"$stats" || { echo "❌ show stats run totals"; exit 1; }
+grep -q "^  run time:   p50=.* p99=.* max="                      <<<"$stats" || { echo "❌ show stats run percentiles"; exit 1; }
+grep -q "^  queue wait: p50="                                    <<<"$stats" || { echo "❌ show stats queue wait"; exit 1; }
+grep -q "^\[2\] Z: runs=1 failed=0 p50=.* start=.* end=.* est=" <<<"$stats" || { echo "❌ show stats missing Z"; exit 1; }
+# Resource pools: needs are checked against defined pools and survive a snapshot
+pools=$(printf "%s\n" \
+  'pool db 1' \
+  'add_task P1 "true" 0 0 db=1' \
+  'add_task P2 "true" 0 0 0.5 db=1 cpu=1' \
+  'add_task P3 "true" 0 0 gpu=1' \
+  'add_task P4 "true" 0 0 db=x' \
+  "save $snap" \
+  "load $snap" \
+  'show pools' \
+  'run 2' \
+  'exit' \
+| ./task_scheduler 2>&1)
+echo "$pools"
+grep -q "^Pool 'db' holds 1\.$"                  <<<"$pools" || { echo "❌ pool not defined"; exit 1; }
+grep -q "Unknown resource pool in 'gpu=1'"        <<<"$pools" || { echo "❌ unknown pool not reported"; exit 1; }
+grep -q "Invalid need, expected pool=amount"      <<<"$pools" || { echo "❌ bad need accepted"; exit 1; }
+grep -q "^db: capacity=1$"                         <<<"$pools" || { echo "❌ show pools missing db"; exit 1; }
+grep -q "^  P2: 1$"                                <<<"$pools" || { echo "❌ show pools missing P2"; exit 1; }
+grep -q "^cpu: capacity="                          <<<"$pools" || { echo "❌ cpu pool not defaulted"; exit 1; }
+
+# Captured output goes to the task's log instead of the terminal, and its end can be shown
+logs=$( (printf "%s\n" 'add_task L "echo captured; echo oops >&2" 0 0' 'show tail L' "logs $logdir" 'run 1'; sleep 1; \
+  printf "%s\n" 'show tail L' 'logs' 'exit') | ./task_scheduler 2>&1)
+echo "$logs"
+grep -q "No output captured"                      <<<"$logs" || { echo "❌ show tail before capture"; exit 1; }
+grep -q "^Capturing task output in '$logdir'\.$"   <<<"$logs" || { echo "❌ logs command failed"; exit 1; }
+grep -q "^Output capture off\.$"                   <<<"$logs" || { echo "❌ logs off failed"; exit 1; }
+[[ $(grep -c "^captured$" <<<"$logs") -eq 1 ]]              || { echo "❌ output not shown once by show tail"; exit 1; }
+grep -q "^oops$"                                  <<<"$logs" || { echo "❌ stderr missing from tail"; exit 1; }
+[[ $(cat "$logdir/L.log") == $'captured\noops' ]]            || { echo "❌ log file wrong"; exit 1; }
+
+echo data >"$logdir/in.txt"
+cached=$( (printf "%s\n" "cache $cachef" "add_task G \"echo ran >> $logdir/g.out\" 0 0 in=$logdir/in.txt" \
+  'add_task H "true" 0 0 in=' 'pool in 1' 'run 1'; sleep 1; printf "%s\n" 'run 1'; sleep 1; printf "%s\n" 'cache' 'exit') \
+  | ./task_scheduler 2>&1)
+echo "$cached"
+grep -q "^Caching task results in '$cachef' (0 known)\.$" <<<"$cached" || { echo "❌ cache command failed"; exit 1; }
+grep -q "Invalid input"                                  <<<"$cached" || { echo "❌ empty input accepted"; exit 1; }
+grep -q "Invalid pool"                                   <<<"$cached" || { echo "❌ pool named in accepted"; exit 1; }
+grep -q "^Result cache: 0 of 1 tasks were up to date\.$" <<<"$cached" || { echo "❌ first cached run wrong"; exit 1; }
+grep -q "^Result cache: 1 of 1 tasks were up to date\.$" <<<"$cached" || { echo "❌ up-to-date task not skipped"; exit 1; }
+grep -q "^Result cache off\.$"                          <<<"$cached" || { echo "❌ cache off failed"; exit 1; }
+[[ $(cat "$logdir/g.out") == "ran" ]]                          || { echo "❌ cached task ran again"; exit 1; }
+printf "%s\n" "cache $cachef" 'exit' | ./task_scheduler | grep -q "(1 known)" || { echo "❌ cache file not reloaded"; exit 1; }
+
+# Rerunning a failed task runs what it blocked and nothing else, unless asked for everything below it
+rerun=$( (printf "%s\n" 'add_task R1 "true" 0 0' "add_task R2 \"test -e $logdir/flag\" 0 0" \
+  "add_task R3 \"echo ran >> $logdir/r3.out\" 0 0" "add_task R4 \"echo ran >> $logdir/r4.out\" 0 0" \
+  'add_dep R1 R2' 'add_dep R2 R3' 'rerun nope' 'run 1'; sleep 1; touch "$logdir/flag"; \
+  printf "%s\n" 'rerun R2 1'; sleep 1; printf "%s\n" 'rerun R1 --downstream'; sleep 1; printf "%s\n" 'exit') \
+  | ./task_scheduler 2>&1)
+echo "$rerun"
+grep -q "Unknown task ID"                   <<<"$rerun" || { echo "❌ rerun of unknown task accepted"; exit 1; }
+grep -q "^Rerunning 2 of 4 tasks\.$"        <<<"$rerun" || { echo "❌ rerun picked the wrong tasks"; exit 1; }
+grep -q "^Rerunning 3 of 4 tasks\.$"        <<<"$rerun" || { echo "❌ rerun --downstream picked the wrong tasks"; exit 1; }
+[[ $(wc -l <"$logdir/r3.out") -eq 2 ]]                   || { echo "❌ blocked task not rerun"; exit 1; }
+[[ $(wc -l <"$logdir/r4.out") -eq 1 ]]                   || { echo "❌ unrelated task rerun"; exit 1; }
+
+levels=$(printf "%s\n" 'add_task A "true" 0 0' 'add_task B "true" 0 0' 'add_task C "true" 0 0' \
+  'add_dep A C' 'add_dep B C' 'show levels' 'exit' | ./task_scheduler 2>&1)
+echo "$levels"
+grep -q "^Level 0: 2 tasks$"                                <<<"$levels" || { echo "❌ show levels level 0"; exit 1; }
+grep -q "^Level 1: 1 task$"                                 <<<"$levels" || { echo "❌ show levels level 1"; exit 1; }
+grep -q "^2 levels, the widest is level 0 with 2 tasks\.$"  <<<"$levels" || { echo "❌ show levels summary"; exit 1; }
+
+# A fused chain still fails at the right task and leaves the ones after it pending
+fused=$( (printf "%s\n" 'fuse on' "add_task F1 \"echo f1 >> $logdir/f.out\" 0 0" 'add_task F2 "exit 7" 0 0' \
+  "add_task F3 \"echo f3 >> $logdir/f.out\" 0 0" 'add_task F0 "true" 0 0' 'add_dep F0 F1' 'add_dep F1 F2' 'add_dep F2 F3' \
+  'fuse' 'run 1'; sleep 1; printf "%s\n" 'show tasks' 'exit') | ./task_scheduler 2>&1)
+echo "$fused"
+grep -q "^Fusing linear chains of commands\.$"  <<<"$fused" || { echo "❌ fuse on failed"; exit 1; }
+grep -q "Usage: fuse on|off"                   <<<"$fused" || { echo "❌ fuse without argument accepted"; exit 1; }
+grep -q "^Fused 4 tasks into 1 chain\.$"        <<<"$fused" || { echo "❌ chain not fused"; exit 1; }
+grep -q "F1: .*status=COMPLETED"               <<<"$fused" || { echo "❌ F1 not completed"; exit 1; }
+grep -q "F2: .*status=FAILED"                  <<<"$fused" || { echo "❌ F2 not failed"; exit 1; }
+grep -q "F3: .*status=PENDING"                 <<<"$fused" || { echo "❌ F3 ran after a failure"; exit 1; }
+[[ $(cat "$logdir/f.out") == "f1" ]]                     || { echo "❌ fused chain output wrong"; exit 1; }
+
+# Ready tasks go in FIFO order unless priority is on, which starts the longer path first
+for mode in off on; do
+  prio=$( (printf "%s\n" "priority $mode" "add_task S \"echo S >> $logdir/p_$mode.out\" 0 0 1" \
+    "add_task L \"echo L >> $logdir/p_$mode.out\" 0 0 5" 'add_task L2 "true" 0 0 5' 'add_dep L L2' 'priority' 'run 1'; \
+    sleep 1; printf "%s\n" 'exit') | ./task_scheduler 2>&1)
+  echo "$prio"
+  grep -q "Usage: priority on|off" <<<"$prio" || { echo "❌ priority without argument accepted"; exit 1; }
+done
+grep -q "^Dispatching ready tasks by upward rank\.$" <<<"$prio"   || { echo "❌ priority on failed"; exit 1; }
+[[ $(head -n1 "$logdir/p_off.out") == "S" ]]                     || { echo "❌ default run not FIFO"; exit 1; }
+[[ $(head -n1 "$logdir/p_on.out") == "L" ]]                      || { echo "❌ priority run did not start the long path first"; exit 1; }
+
+echo 'add_dep Z X' >>"$graph"
+if bad=$(./task_scheduler -f "$graph" </dev/null 2>&1); then
+  echo "❌ cyclic graph file accepted"; exit 1
+fi
+grep -q "would create a cycle" <<<"$bad" || { echo "❌ cyclic graph file not reported"; exit 1; }
 
 echo "✅ All shell‐interface tests passed!"
\ No newline at end of file
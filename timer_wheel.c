@@ -0,0 +1,133 @@
+#include "timer_wheel.h"
+#include <stdlib.h>
+
+#define TW_MASK  (TW_SLOTS - 1)
+#define TW_HEADS (TW_LEVELS * TW_SLOTS)
+
+// List head of a bucket, stored after the n timer entries
+static size_t bucket(const timer_wheel_t *tw, unsigned level, uint64_t slot) {
+    return tw->n + level * TW_SLOTS + (size_t)(slot & TW_MASK);
+}
+
+static void list_unlink(timer_wheel_t *tw, size_t id) {
+    tw->next[tw->prev[id]] = tw->next[id];
+    tw->prev[tw->next[id]] = tw->prev[id];
+    tw->next[id] = tw->prev[id] = TW_NONE;
+}
+
+static void list_append(timer_wheel_t *tw, size_t head, size_t id) {
+    size_t last = tw->prev[head];
+    tw->next[last] = id;
+    tw->prev[id] = last;
+    tw->next[id] = head;
+    tw->prev[head] = id;
+}
+
+// Picking the level whose span covers the distance to expiry, like the classic kernel wheel
+static void place(timer_wheel_t *tw, size_t id) {
+    uint64_t e = tw->expires[id];
+    if (e < tw->now) e = tw->now;
+    uint64_t delta = e - tw->now;
+    unsigned level = 0;
+    while (level < TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_BITS * (level + 1)))) level++;
+    if (level == TW_LEVELS - 1) {
+        // Timers beyond the top level's span wait in its furthest bucket and get re-placed there
+        uint64_t span = (uint64_t)1 << (TW_BITS * TW_LEVELS);
+        if (delta >= span) e = tw->now + span - 1;
+    }
+    list_append(tw, bucket(tw, level, e >> (TW_BITS * level)), id);
+}
+
+int tw_init(timer_wheel_t *tw, size_t n, uint64_t now) {
+    tw->now = now;
+    tw->n = n;
+    tw->n_armed = 0;
+    tw->next = malloc((n + TW_HEADS) * sizeof(size_t));
+    tw->prev = malloc((n + TW_HEADS) * sizeof(size_t));
+    tw->expires = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    if (!tw->next || !tw->prev || !tw->expires) {
+        tw_free(tw);
+        return -2;
+    }
+    for (size_t i = 0; i < n; ++i) tw->next[i] = tw->prev[i] = TW_NONE;
+    for (size_t h = n; h < n + TW_HEADS; ++h) tw->next[h] = tw->prev[h] = h;
+    return 0;
+}
+
+void tw_free(timer_wheel_t *tw) {
+    free(tw->next);
+    free(tw->prev);
+    free(tw->expires);
+    tw->next = tw->prev = NULL;
+    tw->expires = NULL;
+    tw->n = tw->n_armed = 0;
+}
+
+void tw_schedule(timer_wheel_t *tw, size_t id, uint64_t expires) {
+    if (id >= tw->n) return;
+    if (tw->next[id] != TW_NONE) list_unlink(tw, id);
+    else tw->n_armed++;
+    tw->expires[id] = expires;
+    place(tw, id);
+}
+
+void tw_cancel(timer_wheel_t *tw, size_t id) {
+    if (id >= tw->n || tw->next[id] == TW_NONE) return;
+    list_unlink(tw, id);
+    tw->n_armed--;
+}
+
+// Moving every timer of a higher-level bucket down to where it now belongs
+// Returns the slot so the caller knows whether the next level has to cascade as well
+static uint64_t cascade(timer_wheel_t *tw, unsigned level) {
+    uint64_t slot = (tw->now >> (TW_BITS * level)) & TW_MASK;
+    size_t head = bucket(tw, level, slot);
+    size_t id = tw->next[head];
+    tw->next[head] = tw->prev[head] = head;
+    while (id != head) {
+        size_t nxt = tw->next[id];
+        place(tw, id);
+        id = nxt;
+    }
+    return slot;
+}
+
+size_t tw_advance(timer_wheel_t *tw, uint64_t now, tw_expire_fn fn, void *ctx) {
+    size_t fired = 0;
+    while (tw->now <= now) {
+        if (tw->n_armed == 0) {
+            tw->now = now + 1;
+            break;
+        }
+        uint64_t idx = tw->now & TW_MASK;
+        for (unsigned level = 1; idx == 0 && level < TW_LEVELS; ++level) {
+            idx = cascade(tw, level);
+        }
+
+        // Detaching the bucket first, so callbacks can re-arm timers safely
+        size_t head = bucket(tw, 0, tw->now);
+        size_t id = tw->next[head];
+        tw->next[head] = tw->prev[head] = head;
+        tw->now++;
+        while (id != head) {
+            size_t nxt = tw->next[id];
+            tw->next[id] = tw->prev[id] = TW_NONE;
+            tw->n_armed--;
+            fired++;
+            fn(ctx, id);
+            id = nxt;
+        }
+    }
+    return fired;
+}
+
+uint64_t tw_next_tick(const timer_wheel_t *tw) {
+    if (tw->n_armed == 0) return UINT64_MAX;
+    // Level 0 buckets hold timers due within the next 64 ticks
+    for (uint64_t t = tw->now; t < tw->now + TW_SLOTS; ++t) {
+        if ((t & TW_MASK) == 0 && t != tw->now) return t; // a cascade comes first
+        size_t head = bucket(tw, 0, t);
+        if (tw->next[head] != head) return t;
+    }
+    return (tw->now | TW_MASK) + 1;
+}
@@ -0,0 +1,52 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel: 4 levels of 64 slots, each level covering 64 times the
+// span of the one below, so 64^4 ticks ahead can be tracked exactly
+// Timers are identified by a slot number in [0, n) (the scheduler uses task indices)
+// and are kept in intrusive lists, so arming, cancelling and expiring are O(1) amortized
+// The wheel does no locking of its own
+
+#define TW_BITS   6
+#define TW_SLOTS  (1u << TW_BITS)
+#define TW_LEVELS 4
+#define TW_NONE   ((size_t)-1)
+
+typedef struct {
+    uint64_t  now; // next tick that has not been processed yet
+    size_t    n; // number of timer slots
+    size_t   *next; // list links; entries n .. n + TW_LEVELS*TW_SLOTS - 1 are the bucket heads
+    size_t   *prev;
+    uint64_t *expires; // tick each armed timer is due at
+    size_t    n_armed;
+} timer_wheel_t;
+
+// Callback run for each expired timer; it may re-arm the timer it is given
+typedef void (*tw_expire_fn)(void *ctx, size_t id);
+
+// Sets up a wheel for n timers with its clock at tick now
+// Returns 0 on success or -2 on memory allocation failure
+int tw_init(timer_wheel_t *tw, size_t n, uint64_t now);
+
+// Frees the wheel's arrays
+void tw_free(timer_wheel_t *tw);
+
+// Arms (or re-arms) timer id to fire at tick expires; ticks in the past fire on the next advance
+void tw_schedule(timer_wheel_t *tw, size_t id, uint64_t expires);
+
+// Disarms timer id if it is armed
+void tw_cancel(timer_wheel_t *tw, size_t id);
+
+// Processes every tick up to and including now, calling fn for each timer that expires
+// Returns the number of timers that expired
+size_t tw_advance(timer_wheel_t *tw, uint64_t now, tw_expire_fn fn, void *ctx);
+
+// Earliest tick at which tw_advance may have something to do: the exact expiry when
+// one is due within the next 64 ticks, otherwise the next tick where a higher level
+// cascades down; UINT64_MAX if no timer is armed
+uint64_t tw_next_tick(const timer_wheel_t *tw);
+
+#endif
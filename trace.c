@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trace_init(sched_trace_t *t, const char *path, size_t n_workers, size_t events_per_thread) {
+    memset(t, 0, sizeof(*t));
+    size_t cap = 1;
+    while (cap < (events_per_thread ? events_per_thread : TRACE_RING_EVENTS)) cap <<= 1;
+    t->cap = cap;
+    t->n_rings = n_workers + 1;
+    t->path = strdup(path);
+    t->rings = calloc(t->n_rings, sizeof(trace_ring_t));
+    if (!t->path || !t->rings) goto fail;
+    for (size_t i = 0; i < t->n_rings; ++i) {
+        t->rings[i].ev = malloc(cap * sizeof(trace_event_t));
+        if (!t->rings[i].ev) goto fail;
+    }
+    return 0;
+
+fail:
+    trace_free(t);
+    return -2;
+}
+
+void trace_free(sched_trace_t *t) {
+    if (t->rings) {
+        for (size_t i = 0; i < t->n_rings; ++i) free(t->rings[i].ev);
+    }
+    free(t->rings);
+    free(t->path);
+    memset(t, 0, sizeof(*t));
+}
+
+// A record and the ring it came from
+typedef struct {
+    trace_event_t ev;
+    size_t        ring;
+} trace_item_t;
+
+// By task, then time; a begin sorts before an end stamped the same nanosecond
+static int cmp_item(const void *a, const void *b) {
+    const trace_event_t *x = &((const trace_item_t *)a)->ev, *y = &((const trace_item_t *)b)->ev;
+    if (x->task != y->task) return x->task < y->task ? -1 : 1;
+    if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+    return (x->kind > y->kind) - (x->kind < y->kind);
+}
+
+static void put_json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static double us_since(const sched_trace_t *t, uint64_t ts) {
+    return ts > t->start_ns ? (double)(ts - t->start_ns) / 1e3 : 0;
+}
+
+int trace_write(const sched_trace_t *t, const dag_t *d) {
+    size_t n = 0;
+    for (size_t r = 0; r < t->n_rings; ++r) n += t->rings[r].head < t->cap ? t->rings[r].head : t->cap;
+    trace_item_t *items = malloc((n ? n : 1) * sizeof(trace_item_t));
+    if (!items) return -2;
+    size_t k = 0;
+    for (size_t r = 0; r < t->n_rings; ++r) {
+        const trace_ring_t *ring = &t->rings[r];
+        uint64_t first = ring->head > t->cap ? ring->head - t->cap : 0;
+        for (uint64_t i = first; i < ring->head; ++i) items[k++] = (trace_item_t){ ring->ev[i & (t->cap - 1)], r };
+    }
+    qsort(items, n, sizeof(trace_item_t), cmp_item);
+
+    FILE *f = fopen(t->path, "w");
+    if (!f) {
+        free(items);
+        return -1;
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"graphtasker\"}}");
+    for (size_t r = 0; r < t->n_rings; ++r) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":", r);
+        if (r + 1 < t->n_rings) fprintf(f, "\"worker %zu\"}}", r);
+        else fprintf(f, "\"reactor\"}}");
+    }
+
+    // A task's runs never overlap, so after sorting each begin is followed by its end;
+    // an end whose begin was overwritten is dropped
+    const trace_item_t *open = NULL;
+    uint64_t async_id = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const trace_item_t *it = &items[i];
+        if (it->ev.kind == TRACE_BEGIN) {
+            open = it;
+            continue;
+        }
+        if (!open || open->ev.task != it->ev.task) continue;
+        const trace_event_t *b = &open->ev, *e = &it->ev;
+        const char *id = b->task < d->n_tasks ? d->tasks[b->task]->id : "?";
+        double ts = us_since(t, b->ts), end = us_since(t, e->ts);
+        if (open->ring == it->ring) {
+            fprintf(f, ",\n{\"name\":");
+            put_json_str(f, id);
+            fprintf(f, ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"args\":{\"wait_us\":%.3f,\"code\":%d}}",
+                    open->ring, ts, end - ts, (double)b->arg / 1e3, (int)e->arg);
+        } else {
+            // Launched by a worker and reaped by the reactor, possibly overlapping other
+            // children the same worker launched
+            async_id++;
+            fprintf(f, ",\n{\"name\":");
+            put_json_str(f, id);
+            fprintf(f, ",\"cat\":\"child\",\"ph\":\"b\",\"id\":%llu,\"pid\":1,\"tid\":%zu,\"ts\":%.3f,"
+                       "\"args\":{\"wait_us\":%.3f}}",
+                    (unsigned long long)async_id, open->ring, ts, (double)b->arg / 1e3);
+            fprintf(f, ",\n{\"name\":");
+            put_json_str(f, id);
+            fprintf(f, ",\"cat\":\"child\",\"ph\":\"e\",\"id\":%llu,\"pid\":1,\"tid\":%zu,\"ts\":%.3f,"
+                       "\"args\":{\"code\":%d}}",
+                    (unsigned long long)async_id, open->ring, end, (int)e->arg);
+        }
+        open = NULL;
+    }
+    fprintf(f, "\n]}\n");
+    free(items);
+    bool bad = ferror(f) != 0;
+    if (fclose(f) != 0 || bad) return -1;
+    return 0;
+}
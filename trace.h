@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dag_manager.h"
+
+// Timeline of a run in the Chrome trace event format, for chrome://tracing or Perfetto
+//
+// Every worker (and the async reactor) appends begin/end records to a ring buffer of its
+// own, so recording is a couple of plain stores with no lock and no shared cache line.
+// A full ring overwrites its oldest records, which only loses the start of a long run.
+// The rings are only read after every thread has stopped, when the records are paired up
+// per task and written out: a task run started and finished by the same worker becomes
+// one slice on that worker's track, one the reactor finished (async mode) becomes an
+// async slice started from the worker that launched it
+
+#define TRACE_RING_EVENTS (1u << 16) // default records per thread, must be a power of two
+
+enum { TRACE_BEGIN, TRACE_END };
+
+typedef struct {
+    uint64_t ts; // CLOCK_MONOTONIC ns
+    uint64_t arg; // queue wait in ns for TRACE_BEGIN, exit code for TRACE_END
+    uint32_t task; // slot in the DAG
+    uint32_t kind;
+} trace_event_t;
+
+typedef struct {
+    trace_event_t *ev;
+    uint64_t       head; // records ever written; the ring holds the last cap of them
+} trace_ring_t;
+
+typedef struct {
+    char         *path; // file the trace is written to
+    size_t        n_rings; // the workers, plus one for the reactor
+    size_t        cap; // records per ring
+    trace_ring_t *rings;
+    uint64_t      start_ns; // CLOCK_MONOTONIC ns of sched_start, time 0 in the trace
+    int           err; // result of writing the file, set by sched_stop
+} sched_trace_t;
+
+// Sets up empty rings of events_per_thread records (rounded up to a power of two, 0 for
+// TRACE_RING_EVENTS) for n_workers and the reactor, to be written to path
+// Returns 0 on success or -2 on memory allocation failure
+int trace_init(sched_trace_t *t, const char *path, size_t n_workers, size_t events_per_thread);
+
+void trace_free(sched_trace_t *t);
+
+// Appends a record to ring r of t; only ever called by the thread that owns r
+static inline void trace_record(sched_trace_t *t, size_t r, uint32_t kind, size_t task, uint64_t ts, uint64_t arg) {
+    trace_ring_t *ring = &t->rings[r];
+    ring->ev[ring->head++ & (t->cap - 1)] = (trace_event_t){ ts, arg, (uint32_t)task, kind };
+}
+
+// Writes everything the rings hold to t->path as Chrome trace JSON, naming tasks from d
+// Call only once no thread is recording anymore
+// Returns 0 on success, -1 if the file can't be written, -2 on memory allocation failure
+int trace_write(const sched_trace_t *t, const dag_t *d);
+
+#endif
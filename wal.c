@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L
+#include "wal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Records read per pread while scanning the log
+#define WAL_SCAN_RECORDS 4096
+
+// FNV-1a over every ID, NUL included so "ab","c" and "a","bc" differ
+static uint64_t dag_fingerprint(const dag_t *d) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < d->n_tasks; ++i) {
+        const unsigned char *p = (const unsigned char *)d->tasks[i]->id;
+        do {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        } while (*p++);
+    }
+    return h;
+}
+
+// Seeded so an all-zero record (a hole left by a crash) never checks out
+static uint16_t record_check(const wal_record_t *r) {
+    uint64_t h = 0x2545f4914f6cdd1dULL ^ r->time_ns;
+    h = (h ^ ((uint64_t)r->task << 8 | r->kind)) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return (uint16_t)(h ^ h >> 16);
+}
+
+static int write_all(int fd, const void *p, size_t n) {
+    const char *c = p;
+    while (n > 0) {
+        ssize_t k = write(fd, c, n);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+// Calls fn on every intact record from the start of the log, stopping at the first torn one
+// Returns the number of intact records, or -1 on I/O error
+typedef void (*record_fn)(void *ctx, const wal_record_t *r);
+
+static long long scan_records(int fd, record_fn fn, void *ctx) {
+    wal_record_t *chunk = malloc(WAL_SCAN_RECORDS * sizeof(wal_record_t));
+    if (!chunk) return -1;
+    long long n = 0;
+    off_t pos = sizeof(wal_header_t);
+    while (1) {
+        ssize_t k = pread(fd, chunk, WAL_SCAN_RECORDS * sizeof(wal_record_t), pos);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            n = -1;
+            break;
+        }
+        size_t got = (size_t)k / sizeof(wal_record_t);
+        size_t i = 0;
+        for (; i < got && chunk[i].check == record_check(&chunk[i]); ++i) {
+            if (fn) fn(ctx, &chunk[i]);
+        }
+        n += (long long)i;
+        if (i < got || got < WAL_SCAN_RECORDS) break;
+        pos += (off_t)(got * sizeof(wal_record_t));
+    }
+    free(chunk);
+    return n;
+}
+
+// Writes a header to an empty file, or checks that an existing one belongs to this DAG
+static int header_setup(wal_t *w, const struct stat *st) {
+    wal_header_t h;
+    if (st->st_size == 0) {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, WAL_MAGIC, sizeof(h.magic));
+        h.version = WAL_VERSION;
+        h.n_tasks = w->n_tasks;
+        h.fingerprint = w->fingerprint;
+        if (write_all(w->fd, &h, sizeof(h)) != 0 || fdatasync(w->fd) != 0) return -1;
+        return 0;
+    }
+    if ((size_t)st->st_size < sizeof(h)) return -4;
+    if (pread(w->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) return -1;
+    if (memcmp(h.magic, WAL_MAGIC, sizeof(h.magic)) != 0 || h.version != WAL_VERSION) return -4;
+    if (h.n_tasks != w->n_tasks || h.fingerprint != w->fingerprint) return -4;
+
+    // New records go right after the last intact one
+    long long n = scan_records(w->fd, NULL, NULL);
+    if (n < 0) return -1;
+    off_t end = (off_t)(sizeof(h) + (size_t)n * sizeof(wal_record_t));
+    if (end != st->st_size && ftruncate(w->fd, end) != 0) return -1;
+    if (lseek(w->fd, end, SEEK_SET) < 0) return -1;
+    return 0;
+}
+
+static bool flush_wanted(const wal_t *w) {
+    return w->durable < w->flush_target;
+}
+
+// Writer thread: takes whatever has piled up, writes it in one go and syncs once
+static void *writer_loop(void *arg) {
+    wal_t *w = arg;
+    pthread_mutex_lock(&w->mu);
+    while (1) {
+        while (w->len == 0 && !w->stop) pthread_cond_wait(&w->cv_writer, &w->mu);
+        if (w->len == 0) break;
+
+        // Give a burst WAL_COMMIT_MS to grow so it shares one sync, unless someone is
+        // waiting on it or the buffer is filling up
+        if (!w->stop && !flush_wanted(w) && w->len < WAL_BUF_RECORDS / 2) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WAL_COMMIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (!w->stop && !flush_wanted(w) && w->len < WAL_BUF_RECORDS / 2) {
+                if (pthread_cond_timedwait(&w->cv_writer, &w->mu, &deadline) == ETIMEDOUT) break;
+            }
+        }
+
+        wal_record_t *batch = w->buf;
+        size_t n = w->len;
+        uint64_t upto = w->appended;
+        w->buf = w->spare;
+        w->spare = batch;
+        w->len = 0;
+        pthread_cond_broadcast(&w->cv_done); // loggers blocked on a full buffer can go on
+        pthread_mutex_unlock(&w->mu);
+
+        int r = 0;
+        if (w->err == 0) {
+            r = write_all(w->fd, batch, n * sizeof(wal_record_t));
+            if (r == 0 && fdatasync(w->fd) != 0) r = -1;
+        }
+
+        pthread_mutex_lock(&w->mu);
+        if (r != 0) w->err = -1;
+        w->durable = upto;
+        w->n_syncs++;
+        pthread_cond_broadcast(&w->cv_done);
+    }
+    pthread_mutex_unlock(&w->mu);
+    return NULL;
+}
+
+int wal_open(wal_t *w, const char *path, const dag_t *d) {
+    memset(w, 0, sizeof(*w));
+    w->n_tasks = d->n_tasks;
+    w->fingerprint = dag_fingerprint(d);
+    w->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (w->fd < 0) return -1;
+
+    struct stat st;
+    int r = fstat(w->fd, &st) == 0 ? header_setup(w, &st) : -1;
+    if (r != 0) goto fail_fd;
+
+    r = -2;
+    w->buf = malloc(WAL_BUF_RECORDS * sizeof(wal_record_t));
+    w->spare = malloc(WAL_BUF_RECORDS * sizeof(wal_record_t));
+    if (!w->buf || !w->spare) goto fail_bufs;
+    if (pthread_mutex_init(&w->mu, NULL) != 0) goto fail_bufs;
+    if (pthread_cond_init(&w->cv_writer, NULL) != 0) goto fail_mu;
+    if (pthread_cond_init(&w->cv_done, NULL) != 0) goto fail_cv_writer;
+    if (pthread_create(&w->writer, NULL, writer_loop, w) != 0) goto fail_cv_done;
+    return 0;
+
+fail_cv_done:
+    pthread_cond_destroy(&w->cv_done);
+fail_cv_writer:
+    pthread_cond_destroy(&w->cv_writer);
+fail_mu:
+    pthread_mutex_destroy(&w->mu);
+fail_bufs:
+    free(w->buf);
+    free(w->spare);
+fail_fd:
+    close(w->fd);
+    w->fd = -1;
+    return r;
+}
+
+static void append(wal_t *w, uint32_t task, uint8_t kind) {
+    wal_record_t r;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r.time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    r.task = task;
+    r.kind = kind;
+    r.pad = 0;
+    r.check = record_check(&r);
+
+    pthread_mutex_lock(&w->mu);
+    while (w->len == WAL_BUF_RECORDS) pthread_cond_wait(&w->cv_done, &w->mu);
+    w->buf[w->len++] = r;
+    w->appended++;
+    // The writer only needs a nudge when a batch starts and when it is worth cutting the wait short
+    if (w->len == 1 || w->len == WAL_BUF_RECORDS / 2) pthread_cond_signal(&w->cv_writer);
+    pthread_mutex_unlock(&w->mu);
+}
+
+void wal_log(wal_t *w, size_t task, task_status_t st) {
+    append(w, (uint32_t)task, (uint8_t)st);
+}
+
+void wal_mark_run(wal_t *w) {
+    append(w, UINT32_MAX, WAL_RUN_START);
+}
+
+int wal_flush(wal_t *w) {
+    pthread_mutex_lock(&w->mu);
+    uint64_t target = w->appended;
+    if (target > w->flush_target) w->flush_target = target;
+    pthread_cond_signal(&w->cv_writer);
+    while (w->durable < target) pthread_cond_wait(&w->cv_done, &w->mu);
+    int err = w->err;
+    pthread_mutex_unlock(&w->mu);
+    return err;
+}
+
+typedef struct {
+    unsigned char *last; // last kind logged per task since the latest run marker
+    size_t         n;
+} replay_t;
+
+static void replay_record(void *ctx, const wal_record_t *r) {
+    replay_t *rp = ctx;
+    if (r->kind == WAL_RUN_START) memset(rp->last, PENDING, rp->n);
+    else if (r->task < rp->n && r->kind <= FAILED) rp->last[r->task] = r->kind;
+}
+
+int wal_replay(wal_t *w, dag_t *d, size_t *n_completed) {
+    if (d->n_tasks != w->n_tasks) return -4;
+    int r = wal_flush(w);
+    if (r != 0) return r;
+
+    replay_t rp = { malloc(d->n_tasks ? d->n_tasks : 1), d->n_tasks };
+    if (!rp.last) return -2;
+    memset(rp.last, PENDING, rp.n);
+    if (scan_records(w->fd, replay_record, &rp) < 0) {
+        free(rp.last);
+        return -1;
+    }
+
+    size_t done = 0;
+    for (size_t i = 0; i < d->n_tasks; ++i) {
+        bool completed = rp.last[i] == COMPLETED;
+        dag_set_status(d, i, completed ? COMPLETED : PENDING);
+        done += completed;
+    }
+    free(rp.last);
+    if (n_completed) *n_completed = done;
+    return 0;
+}
+
+int wal_close(wal_t *w) {
+    pthread_mutex_lock(&w->mu);
+    w->stop = true;
+    pthread_cond_signal(&w->cv_writer);
+    pthread_mutex_unlock(&w->mu);
+    // The writer drains the buffer before it exits
+    pthread_join(w->writer, NULL);
+
+    int err = w->err;
+    if (close(w->fd) != 0 && err == 0) err = -1;
+    w->fd = -1;
+    pthread_cond_destroy(&w->cv_done);
+    pthread_cond_destroy(&w->cv_writer);
+    pthread_mutex_destroy(&w->mu);
+    free(w->buf);
+    free(w->spare);
+    w->buf = w->spare = NULL;
+    return err;
+}
@@ -0,0 +1,87 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "dag_manager.h"
+
+// Append-only write-ahead log of task status transitions
+// Workers only copy a record into a buffer; a writer thread writes whatever has piled up
+// and makes it durable with one fdatasync per batch (group commit), so a completion is
+// on disk at most about WAL_COMMIT_MS after it happened. A crash may lose that last window,
+// in which case those tasks simply run again on resume
+//
+// File layout: a wal_header_t, then wal_record_t entries. The header ties the log to one
+// DAG (same IDs in the same slots), so it can only be replayed onto that DAG
+
+#define WAL_MAGIC       "GTWAL\0\0\0"
+#define WAL_VERSION     1
+#define WAL_COMMIT_MS   5
+#define WAL_BUF_RECORDS 4096
+
+// Record kinds besides task statuses
+#define WAL_RUN_START 0xff // a fresh run began: everything logged before it is stale
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t n_tasks;
+    uint64_t fingerprint; // hash of every task ID in slot order
+} wal_header_t;
+
+typedef struct {
+    uint64_t time_ns; // CLOCK_REALTIME when the transition happened
+    uint32_t task; // slot of the task in the DAG
+    uint8_t  kind; // task_status_t, or WAL_RUN_START
+    uint8_t  pad;
+    uint16_t check; // catches a torn or garbage record at the end of the file
+} wal_record_t;
+
+typedef struct {
+    int              fd;
+    uint64_t         fingerprint;
+    size_t           n_tasks;
+    wal_record_t    *buf; // records waiting for the writer thread
+    size_t           len;
+    wal_record_t    *spare; // the writer's buffer, swapped with buf on every batch
+    pthread_mutex_t  mu;
+    pthread_cond_t   cv_writer; // wakes the writer when records arrive, on flush and on close
+    pthread_cond_t   cv_done; // wakes loggers waiting for room and wal_flush callers
+    pthread_t        writer;
+    bool             stop;
+    uint64_t         appended; // records handed to wal_log so far
+    uint64_t         durable; // records written and synced so far
+    uint64_t         flush_target; // wal_flush callers want records up to here synced without delay
+    uint64_t         n_syncs;
+    int              err; // first write or sync error, sticky
+} wal_t;
+
+// Opens or creates the log at path for DAG d and starts the writer thread
+// An existing log is appended to after dropping any torn record at its end
+// Returns 0 on success, -1 on I/O error, -2 on memory allocation failure,
+// -4 if the file is not a log or belongs to a different DAG
+int wal_open(wal_t *w, const char *path, const dag_t *d);
+
+// Queues a status transition of the task at slot task; blocks only if the buffer is full
+void wal_log(wal_t *w, size_t task, task_status_t st);
+
+// Queues a marker that a fresh run starts, so statuses logged before it are ignored by replay
+void wal_mark_run(wal_t *w);
+
+// Waits until everything queued so far is on disk; returns 0 or the log's I/O error
+int wal_flush(wal_t *w);
+
+// Applies the log to d: a task whose last status since the latest run marker is COMPLETED
+// becomes COMPLETED, every other task becomes PENDING
+// Stores the number of COMPLETED tasks in n_completed if it is not NULL
+// Returns 0 on success, -1 on I/O error, -2 on memory allocation failure,
+// -4 if tasks were added to d since the log was opened
+int wal_replay(wal_t *w, dag_t *d, size_t *n_completed);
+
+// Flushes, stops the writer thread and closes the file; returns 0 or the log's I/O error
+int wal_close(wal_t *w);
+
+#endif
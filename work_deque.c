@@ -0,0 +1,97 @@
+#include "work_deque.h"
+#include <stdlib.h>
+
+static wd_array_t *array_new(size_t cap) {
+    wd_array_t *a = malloc(sizeof(wd_array_t) + cap * sizeof(atomic_size_t));
+    if (!a) return NULL;
+    a->cap = cap;
+    a->retired = NULL;
+    return a;
+}
+
+int wd_init(work_deque_t *q, size_t cap) {
+    size_t c = 16;
+    while (c < cap) c <<= 1;
+    wd_array_t *a = array_new(c);
+    if (!a) return -2;
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, a);
+    return 0;
+}
+
+void wd_free(work_deque_t *q) {
+    wd_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    while (a) {
+        wd_array_t *old = a->retired;
+        free(a);
+        a = old;
+    }
+    atomic_store_explicit(&q->array, NULL, memory_order_relaxed);
+}
+
+// Copying the live range [t, b) into a buffer twice the size
+static wd_array_t *grow(work_deque_t *q, wd_array_t *a, long long t, long long b) {
+    wd_array_t *na = array_new(a->cap * 2);
+    if (!na) return NULL;
+    for (long long i = t; i < b; ++i) {
+        size_t x = atomic_load_explicit(&a->buf[(size_t)i & (a->cap - 1)], memory_order_relaxed);
+        atomic_store_explicit(&na->buf[(size_t)i & (na->cap - 1)], x, memory_order_relaxed);
+    }
+    na->retired = a;
+    atomic_store_explicit(&q->array, na, memory_order_release);
+    return na;
+}
+
+int wd_push(work_deque_t *q, size_t x) {
+    long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    wd_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    if (b - t > (long long)a->cap - 1) {
+        a = grow(q, a, t, b);
+        if (!a) return -2;
+    }
+    atomic_store_explicit(&a->buf[(size_t)b & (a->cap - 1)], x, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+bool wd_pop(work_deque_t *q, size_t *out) {
+    long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    wd_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if (t > b) {
+        // Empty: put bottom back
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+    *out = atomic_load_explicit(&a->buf[(size_t)b & (a->cap - 1)], memory_order_relaxed);
+    if (t == b) {
+        // Last entry: race any thief for it
+        bool won = atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                           memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+int wd_steal(work_deque_t *q, size_t *out) {
+    long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b) return 0;
+
+    wd_array_t *a = atomic_load_explicit(&q->array, memory_order_acquire);
+    size_t x = atomic_load_explicit(&a->buf[(size_t)t & (a->cap - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+    *out = x;
+    return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef WORK_DEQUE_H
+#define WORK_DEQUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Chase-Lev work-stealing deque of task indices (C11 atomics version of Le et al., PPoPP 2013)
+// The owning worker pushes and pops at the bottom without locks, any other thread may
+// steal from the top. The buffer doubles when full; replaced buffers are kept until
+// wd_free because a thief may still be reading from them
+
+typedef struct wd_array {
+    size_t           cap; // always a power of two
+    struct wd_array *retired; // buffer this one replaced
+    atomic_size_t    buf[];
+} wd_array_t;
+
+typedef struct {
+    atomic_llong top; // next index thieves take from
+    char         pad[64 - sizeof(atomic_llong)]; // keeps top and bottom on separate cache lines
+    atomic_llong bottom; // next index the owner pushes to
+    _Atomic(wd_array_t *) array;
+} work_deque_t;
+
+// Sets up an empty deque with room for cap entries (rounded up to a power of two)
+// Returns 0 on success or -2 on memory allocation failure
+int wd_init(work_deque_t *q, size_t cap);
+
+// Frees the deque and every buffer it has used; no other thread may touch it anymore
+void wd_free(work_deque_t *q);
+
+// Owner only: adds x at the bottom
+// Returns 0 on success or -2 if the buffer had to grow and memory allocation failed
+int wd_push(work_deque_t *q, size_t x);
+
+// Owner only: takes the most recently pushed entry
+// Returns true and stores it in out, or false if the deque is empty
+bool wd_pop(work_deque_t *q, size_t *out);
+
+// Any thread: takes the oldest entry
+// Returns 1 and stores it in out, 0 if the deque is empty, -1 if another thread won the race
+int wd_steal(work_deque_t *q, size_t *out);
+
+#endif